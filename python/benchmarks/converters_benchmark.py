@@ -0,0 +1,94 @@
+# Copyright 2016 Cloudera Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Times the pandas converters in isolation from fetching. Start the mock server
+# first with
+#
+#   hs2client-benchmark --serve --rows=1000000 --port=21060
+#
+# then run
+#
+#   python converters_benchmark.py --port 21060
+
+import argparse
+import time
+
+import hs2client as hs2
+
+
+def _time(func, repeat):
+    best = None
+    for _ in range(repeat):
+        start = time.time()
+        result = func()
+        elapsed = time.time() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best, result
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--host', default='localhost')
+    parser.add_argument('--port', type=int, default=21060)
+    parser.add_argument('--batchsize', type=int, default=2 ** 16)
+    parser.add_argument('--repeat', type=int, default=5)
+    parser.add_argument('--nthreads', type=int, default=None,
+                        help='Conversion threads, defaults to the CPU count')
+    args = parser.parse_args()
+
+    service = hs2.connect(args.host, port=args.port)
+    session = service.open_session()
+
+    op = session.execute('select * from mock')
+    start = time.time()
+    batches = op.fetchall_batches(batchsize=args.batchsize)
+    fetch_time = time.time() - start
+
+    elapsed, df = _time(
+        lambda: op.batches_to_pandas(batches, nthreads=args.nthreads),
+        args.repeat)
+    nrows = len(df)
+    print('fetch:   {0:.3f}s ({1:.0f} rows/s)'.format(fetch_time,
+                                                     nrows / fetch_time))
+    print('convert: {0:.3f}s ({1:.0f} rows/s)'.format(elapsed,
+                                                     nrows / elapsed))
+
+    elapsed, _ = _time(lambda: op.batches_to_pandas(batches, nthreads=1),
+                       args.repeat)
+    print('convert, 1 thread: {0:.3f}s ({1:.0f} rows/s)'
+          .format(elapsed, nrows / elapsed))
+
+    elapsed, _ = _time(
+        lambda: op.batches_to_pandas(batches, nthreads=args.nthreads,
+                                     strings_as_categorical=True),
+        args.repeat)
+    print('convert, categorical strings: {0:.3f}s ({1:.0f} rows/s)'
+          .format(elapsed, nrows / elapsed))
+
+    # Per-column times, converting only one column at a time
+    schema = op.schema
+    for i in range(schema.ncolumns):
+        col = schema.column(i)
+        elapsed, _ = _time(lambda: op.column_to_pandas(batches, i),
+                           args.repeat)
+        print('  {0:<12} {1:.3f}s ({2:.0f} rows/s)'
+              .format(col.type.name, elapsed, nrows / elapsed))
+
+    op.close()
+    session.close()
+    service.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -20,16 +20,28 @@
 
 #include <Python.h>
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <numpy/arrayobject.h>
 
 #include "hs2client/api.h"
+#include "hs2client/parse-util.h"
+#include "hs2client/string-dictionary.h"
 
 namespace hs2client {
 
@@ -45,6 +57,22 @@ static inline bool GetBit(const uint8_t* bits, int i) {
   return static_cast<bool>(bits[i / 8] & BITMASK[i % 8]);
 }
 
+// Returns true if none of the values of 'col' are null. The null bitmap may be shorter
+// than the column, eg. when the server trims trailing zero bytes.
+static inline bool NoNulls(const Column& col) {
+  int64_t size = std::min<int64_t>(col.nulls_size(), (col.length() + 7) / 8);
+  const uint8_t* nulls = col.nulls();
+  for (int64_t i = 0; i < size; ++i) {
+    if (nulls[i] != 0) return false;
+  }
+  return true;
+}
+
+// Returns true if value i of 'col' is null, allowing for a short null bitmap.
+static inline bool IsNullValue(const Column& col, int i) {
+  return i / 8 < col.nulls_size() && GetBit(col.nulls(), i);
+}
+
 #define RETURN_IF_NULL(_X_)                     \
   do {                                          \
     if (_X_ == nullptr) {                       \
@@ -52,288 +80,678 @@ static inline bool GetBit(const uint8_t* bits, int i) {
     }                                           \
   } while (0)
 
-#define TRY_NPY_ALLOC(VARNAME, NPY_TYPE, LENGTH)        \
-  do {                                                  \
-    npy_intp dims[1] = {static_cast<npy_intp>(LENGTH)}; \
-    VARNAME = PyArray_SimpleNew(1, dims, NPY_TYPE);     \
-    RETURN_IF_NULL(VARNAME);                            \
-  } while (0)
+// How DECIMAL columns are converted.
+enum DecimalConversion {
+  // To decimal.Decimal objects. The converter returns the codes and distinct strings of
+  // the values, so that each distinct value is only converted once.
+  DECIMAL_AS_OBJECT = 0,
+
+  // To NPY_DOUBLE, with NaN for nulls.
+  DECIMAL_AS_DOUBLE = 1,
+
+  // To the NPY_INT64 unscaled values, with a mask, or an OverflowError if any don't fit.
+  DECIMAL_AS_INT64 = 2
+};
+
+struct PandasOptions {
+  PandasOptions() : strings_as_categorical(false), decimals(DECIMAL_AS_OBJECT) {}
+
+  // Convert STRING, VARCHAR and CHAR columns to the codes and categories of a
+  // pandas.Categorical.
+  bool strings_as_categorical;
+
+  DecimalConversion decimals;
+};
+
+// Worker threads that run submitted tasks in order. Workers are started by Reserve and
+// then run until the process exits, so that they are reused by every conversion.
+class ThreadPool {
+ public:
+  // Starts workers until there are at least 'num_workers'.
+  void Reserve(int num_workers) {
+    std::lock_guard<std::mutex> l(lock_);
+    while (static_cast<int>(workers_.size()) < num_workers) {
+      workers_.emplace_back(&ThreadPool::RunWorker, this);
+    }
+  }
 
-// Returns the total length of the columns
-template <typename T>
-static int64_t GetColumns(const std::vector<ColumnarRowSet*>& batches,
-    int col_index, vector<unique_ptr<T>>* columns) {
-  int64_t total_length = 0;
-  for (size_t i = 0; i < batches.size(); ++i) {
-    auto col = batches[i]->GetCol<T>(col_index);
-    total_length += col->length();
-    columns->push_back(std::move(col));
-  }
-  return total_length;
-}
+  void Submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+  }
 
-template <int NPY_TYPE, typename CType, typename T>
-static PyObject* ConvertInteger(const std::vector<ColumnarRowSet*>& batches,
-    int col_index) {
-  vector<unique_ptr<CType>> columns;
-  int64_t total_length = GetColumns(batches, col_index, &columns);
-
-  // Optimistically we'll try to write into integer until a null is encountered
-  PyObject* out;
-  TRY_NPY_ALLOC(out, NPY_TYPE, total_length);
-
-  T* out_values = reinterpret_cast<T*>(PyArray_DATA(out));
-
-  const CType* col;
-  const T* col_data;
-  const uint8_t* nulls;
-
-  int64_t i = 0;
-  bool have_null = false;
-  for (size_t chunk = 0; chunk < columns.size(); ++chunk) {
-    col = columns[chunk].get();
-    col_data = col->data().data();
-    nulls = col->nulls();
-    for (int j = 0; j < col->length(); ++j) {
-      if (GetBit(nulls, j)) {
-        have_null = true;
-        break;
+ private:
+  void RunWorker() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> l(lock_);
+        cv_.wait(l, [this]() { return !tasks_.empty(); });
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
       }
-      out_values[i++] = col_data[j];
+      task();
     }
+  }
 
-    if (have_null) break;
+  std::mutex lock_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  vector<std::thread> workers_;
+};
+
+// Returns the pool shared by all conversions in this process. It grows to the largest
+// number of threads requested, and is never destroyed, as its workers are still waiting
+// for tasks when the interpreter exits. The workers of a forked parent don't exist in
+// the child, so the child starts a new pool.
+static ThreadPool* GetThreadPool() {
+  static std::mutex lock;
+  static ThreadPool* pool = nullptr;
+  static pid_t pool_pid = 0;
+  std::lock_guard<std::mutex> l(lock);
+  if (pool == nullptr || pool_pid != getpid()) {
+    pool = new ThreadPool();
+    pool_pid = getpid();
   }
+  return pool;
+}
 
-  if (!have_null) {
-    // Successful, no nulls
-    return out;
+// Runs fn(i) for each i in [0, n), on up to 'num_threads' threads including the
+// calling thread. Each i is run exactly once, in no particular order.
+template <typename Fn>
+static void ParallelFor(int n, int num_threads, const Fn& fn) {
+  num_threads = std::max(1, std::min(num_threads, n));
+  std::atomic<int> next(0);
+  auto worker = [&]() {
+    for (int i = next++; i < n; i = next++) fn(i);
+  };
+  if (num_threads == 1) {
+    worker();
+    return;
   }
 
-  // There were nulls, delete the array and instead write to NPY_DOUBLE
-  Py_DECREF(out);
+  ThreadPool* pool = GetThreadPool();
+  pool->Reserve(num_threads - 1);
+  std::mutex lock;
+  std::condition_variable done;
+  int num_running = num_threads - 1;
+  for (int t = 1; t < num_threads; ++t) {
+    pool->Submit([&]() {
+      worker();
+      std::lock_guard<std::mutex> l(lock);
+      if (--num_running == 0) done.notify_one();
+    });
+  }
+  worker();
+  std::unique_lock<std::mutex> l(lock);
+  done.wait(l, [&]() { return num_running == 0; });
+}
 
-  TRY_NPY_ALLOC(out, NPY_DOUBLE, total_length);
+// Converts one column of a sequence of batches to a numpy array. Each group of batches
+// passed to Prepare is appended to the values already converted. The conversion of a
+// group is split into phases, so that only the steps that touch Python objects need
+// the GIL:
+// 1. Prepare, without the GIL: gets the column from each batch and checks for nulls.
+// 2. Reserve, with the GIL: allocates the output array, or reallocates it if it is too
+//    small.
+// 3. Fill, without the GIL: copies numeric and boolean values into the array, and sets
+//    the mask for types that return one.
+// 4. FillObjects, with the GIL: creates Python objects, eg. for strings.
+// Prepare and Fill only touch this converter's column, so they may run concurrently
+// with other converters. Advance then releases the group's columns, and Finish returns
+// the array.
+//
+// Converters created with 'masked' also fill a boolean array that is true for nulls, so
+// that values of types without a null representation are converted in a single pass. If
+// any value is null, Finish returns a (values, mask) tuple rather than just the values.
+class ColumnConverter {
+ public:
+  ColumnConverter(int col_index, bool masked)
+    : col_index_(col_index), masked_(masked), length_(0), capacity_(0),
+      batch_length_(0), have_null_(false), out_(nullptr), mask_(nullptr) {}
+
+  virtual ~ColumnConverter() {
+    Py_XDECREF(out_);
+    Py_XDECREF(mask_);
+  }
+
+  virtual void Prepare(const std::vector<ColumnarRowSet*>& batches) = 0;
+
+  // Ensures that the output array has room for at least 'capacity' values, and for all
+  // of the prepared values. Values already converted are moved to the new array if it is
+  // reallocated. Returns false, with a Python exception set, on failure.
+  bool Reserve(int64_t capacity) {
+    capacity = std::max(capacity, length_ + batch_length_);
+    if (out_ != nullptr && capacity <= capacity_) return true;
+
+    capacity = std::max(capacity, capacity_);
+    if (!Grow(OutputType(), capacity, &out_)) return false;
+    if (masked_ && !Grow(NPY_BOOL, capacity, &mask_)) return false;
+    capacity_ = capacity;
+    return true;
+  }
+
+  virtual void Fill() {}
+
+  // Returns false, with a Python exception set, on failure.
+  virtual bool FillObjects() { return true; }
+
+  // Marks the prepared values as converted, and releases the columns of the batches
+  // they came from.
+  void Advance() {
+    length_ += batch_length_;
+    batch_length_ = 0;
+    ReleaseColumns();
+  }
 
-  double* doubles = reinterpret_cast<double*>(PyArray_DATA(out));
-  i = 0;
-  for (size_t chunk = 0; chunk < columns.size(); ++chunk) {
-    col = columns[chunk].get();
-    col_data = col->data().data();
-    nulls = col->nulls();
-    for (int j = 0; j < col->length(); ++j) {
-      doubles[i++] = GetBit(nulls, j) ? NAN : col_data[j];
+  // Returns a new reference to the output array, holding the converted values, and
+  // resets the converter to start a new array. Returns null, with a Python exception
+  // set, on failure.
+  PyObject* Finish() {
+    PyObject* out = TakeArray(OutputType(), &out_);
+    if (out != nullptr) out = FinishValues(out);
+    PyObject* mask = masked_ ? TakeArray(NPY_BOOL, &mask_) : nullptr;
+    bool have_null = have_null_;
+    length_ = 0;
+    capacity_ = 0;
+    have_null_ = false;
+    Reset();
+
+    if (!have_null || out == nullptr || mask == nullptr) {
+      Py_XDECREF(mask);
+      return out;
     }
+    // PyTuple_Pack doesn't steal the references.
+    PyObject* result = PyTuple_Pack(2, out, mask);
+    Py_DECREF(out);
+    Py_DECREF(mask);
+    return result;
   }
 
-  return out;
-}
+ protected:
+  // The numpy type of the output array.
+  virtual int OutputType() const = 0;
 
-static PyObject* ConvertBoolean(const std::vector<ColumnarRowSet*>& batches,
-    int col_index) {
-  vector<unique_ptr<BoolColumn>> columns;
-  int64_t total_length = GetColumns(batches, col_index, &columns);
-
-  PyObject* out;
-  TRY_NPY_ALLOC(out, NPY_BOOL, total_length);
-
-  uint8_t* out_values = reinterpret_cast<uint8_t*>(PyArray_DATA(out));
-
-  const BoolColumn* col;
-  const uint8_t* nulls;
-
-  int64_t i = 0;
-  bool have_null = false;
-  for (size_t chunk = 0; chunk < columns.size(); ++chunk) {
-    col = columns[chunk].get();
-    const std::vector<bool>& col_data = col->data();
-    nulls = col->nulls();
-    for (int j = 0; j < col->length(); ++j) {
-      if (GetBit(nulls, j)) {
-        have_null = true;
-        break;
-      }
-      out_values[i++] = static_cast<uint8_t>(col_data[j]);
+  // Called by Finish with the output array, which it steals. Returns a new reference to
+  // what should be returned in its place, or null with a Python exception set.
+  virtual PyObject* FinishValues(PyObject* values) { return values; }
+
+  virtual void ReleaseColumns() = 0;
+
+  // Releases any state that is kept for the whole output array.
+  virtual void Reset() {}
+
+  template <typename T>
+  T* out_data() const {
+    return reinterpret_cast<T*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(out_)));
+  }
+
+  uint8_t* mask_data() const {
+    return reinterpret_cast<uint8_t*>(
+        PyArray_DATA(reinterpret_cast<PyArrayObject*>(mask_)));
+  }
+
+  // Sets mask[j] for each of the values of 'col' and returns true, or returns false
+  // without touching 'mask' if none of them are null.
+  bool FillMask(const Column& col, uint8_t* mask) {
+    if (NoNulls(col)) return false;
+    have_null_ = true;
+    for (int j = 0; j < col.length(); ++j) mask[j] = IsNullValue(col, j);
+    return true;
+  }
+
+  const int col_index_;
+  const bool masked_;
+
+  // The number of values converted, and the size of 'out_'.
+  int64_t length_;
+  int64_t capacity_;
+
+  // The number of values in the prepared batches.
+  int64_t batch_length_;
+
+  // True if any value converted so far is null. Only set by masked converters.
+  bool have_null_;
+
+  PyObject* out_;
+  PyObject* mask_;
+
+ private:
+  // Replaces '*array' with a new array of 'capacity' values of 'type', holding the
+  // first 'length_' values of the old one.
+  bool Grow(int type, int64_t capacity, PyObject** array) {
+    npy_intp dims[1] = {static_cast<npy_intp>(capacity)};
+    PyObject* grown = PyArray_SimpleNew(1, dims, type);
+    if (grown == nullptr) return false;
+    if (*array != nullptr && length_ > 0) {
+      PyArrayObject* old = reinterpret_cast<PyArrayObject*>(*array);
+      int64_t size = length_ * PyArray_ITEMSIZE(old);
+      memcpy(PyArray_DATA(reinterpret_cast<PyArrayObject*>(grown)), PyArray_DATA(old),
+          size);
+      // The new array now owns the references to any objects.
+      if (type == NPY_OBJECT) memset(PyArray_DATA(old), 0, size);
     }
-    if (have_null) break;
+    Py_XDECREF(*array);
+    *array = grown;
+    return true;
   }
 
-  if (!have_null) {
-    // Successful, no nulls
+  // Returns '*array' truncated to the converted values, or an empty array if nothing was
+  // converted, and resets '*array'.
+  PyObject* TakeArray(int type, PyObject** array) {
+    PyObject* out = *array;
+    *array = nullptr;
+    if (out == nullptr) {
+      npy_intp dims[1] = {0};
+      return PyArray_SimpleNew(1, dims, type);
+    } else if (length_ < capacity_) {
+      // A view of the converted values. The rest of the array is not initialized.
+      PyObject* view = PySequence_GetSlice(out, 0, length_);
+      Py_DECREF(out);
+      return view;
+    }
     return out;
   }
+};
 
-  // There were nulls, delete the array and instead write to NPY_DOUBLE
-  Py_DECREF(out);
-  TRY_NPY_ALLOC(out, NPY_OBJECT, total_length);
-
-  PyObject** objects = reinterpret_cast<PyObject**>(PyArray_DATA(out));
-  i = 0;
-  for (size_t chunk = 0; chunk < columns.size(); ++chunk) {
-    col = columns[chunk].get();
-    const std::vector<bool>& col_data = col->data();
-    nulls = col->nulls();
-    for (int j = 0; j < col->length(); ++j) {
-      if (GetBit(nulls, j)) {
-        Py_INCREF(Py_None);
-        objects[i++] = Py_None;
-      } else if (col_data[j]) {
-        Py_INCREF(Py_True);
-        objects[i++] = Py_True;
-      } else {
-        Py_INCREF(Py_False);
-        objects[i++] = Py_False;
-      }
+// Holds the columns of type T of the prepared batches.
+template <typename T>
+class TypedConverter : public ColumnConverter {
+ public:
+  TypedConverter(int col_index, bool masked) : ColumnConverter(col_index, masked) {}
+
+  void Prepare(const std::vector<ColumnarRowSet*>& batches) override {
+    columns_.clear();
+    batch_length_ = 0;
+    for (ColumnarRowSet* batch : batches) {
+      auto col = batch->GetCol<T>(col_index_);
+      batch_length_ += col->length();
+      columns_.push_back(std::move(col));
     }
   }
 
-  return out;
-}
-
-static inline PyObject* make_pystring(const char* data, int32_t length,
-    PyObject* intern_table) {
-  PyObject* str;
-#if PY_MAJOR_VERSION >= 3
-  str = PyUnicode_FromStringAndSize(data, length);
-#else
-  str = PyString_FromStringAndSize(data, length);
-#endif
+ protected:
+  void ReleaseColumns() override {
+    columns_.clear();
+  }
 
-  // probably out of memory, Python sets exception
-  RETURN_IF_NULL(str);
+  vector<unique_ptr<T>> columns_;
+};
 
-  // TODO: Consider a more performant hash table pass that circumvents Python
-  // object indirection
+// Integers are converted to the numpy type of the same width, with a mask. The values
+// of nulls are left as sent by the server, usually 0.
+template <int NPY_TYPE, typename CType, typename T>
+class IntegerConverter : public TypedConverter<CType> {
+ public:
+  explicit IntegerConverter(int col_index) : TypedConverter<CType>(col_index, true) {}
+
+  void Fill() override {
+    T* out_values = this->template out_data<T>() + this->length_;
+    uint8_t* mask = this->mask_data() + this->length_;
+    for (const unique_ptr<CType>& col : this->columns_) {
+      memcpy(out_values, col->data().data(), col->length() * sizeof(T));
+      if (!this->FillMask(*col, mask)) memset(mask, 0, col->length());
+      out_values += col->length();
+      mask += col->length();
+    }
+  }
 
-  PyObject* interned = PyDict_GetItem(intern_table, str);
-  if (interned == NULL) {
-    // Not in the dict
-    int ret = PyDict_SetItem(intern_table, str, str);
-    if (ret != 0) return nullptr;
+ protected:
+  int OutputType() const override { return NPY_TYPE; }
+};
 
-    // The reference count of str is 1
-    return str;
-  } else {
-    // We maintain a reference to the interned string value
-    Py_DECREF(str);
-    Py_INCREF(interned);
-    return interned;
+template <int NPY_TYPE, typename CType, typename IN_TYPE, typename OUT_TYPE>
+class FloatConverter : public TypedConverter<CType> {
+ public:
+  explicit FloatConverter(int col_index) : TypedConverter<CType>(col_index, false) {}
+
+  void Fill() override {
+    OUT_TYPE* out_values = this->template out_data<OUT_TYPE>() + this->length_;
+    OUT_TYPE null_value = static_cast<OUT_TYPE>(NAN);
+    for (const unique_ptr<CType>& col : this->columns_) {
+      const IN_TYPE* col_data = col->data().data();
+      for (int j = 0; j < col->length(); ++j) {
+        *out_values++ = IsNullValue(*col, j) ? null_value : col_data[j];
+      }
+    }
   }
-}
 
-static PyObject* ConvertString(const std::vector<ColumnarRowSet*>& batches,
-    int col_index) {
-  vector<unique_ptr<StringColumn>> columns;
-  int64_t total_length = GetColumns(batches, col_index, &columns);
+ protected:
+  int OutputType() const override { return NPY_TYPE; }
+};
+
+// Booleans are converted to NPY_BOOL, with a mask.
+class BooleanConverter : public TypedConverter<BoolColumn> {
+ public:
+  explicit BooleanConverter(int col_index) : TypedConverter<BoolColumn>(col_index, true) {}
+
+  void Fill() override {
+    uint8_t* out_values = out_data<uint8_t>() + length_;
+    uint8_t* mask = mask_data() + length_;
+    for (const unique_ptr<BoolColumn>& col : columns_) {
+      const std::vector<bool>& col_data = col->data();
+      if (NoNulls(*col)) {
+        for (int j = 0; j < col->length(); ++j) out_values[j] = col_data[j];
+        memset(mask, 0, col->length());
+      } else {
+        have_null_ = true;
+        for (int j = 0; j < col->length(); ++j) {
+          mask[j] = IsNullValue(*col, j);
+          out_values[j] = col_data[j];
+        }
+      }
+      out_values += col->length();
+      mask += col->length();
+    }
+  }
 
-  PyObject* out;
-  TRY_NPY_ALLOC(out, NPY_OBJECT, total_length);
+ protected:
+  int OutputType() const override { return NPY_BOOL; }
+};
+
+// Decimals are parsed into their unscaled values, and converted as described by
+// DecimalConversion. Values that can't be parsed are null.
+class DecimalConverter : public TypedConverter<StringViewColumn> {
+ public:
+  DecimalConverter(int col_index, int scale, bool as_int64)
+    : TypedConverter<StringViewColumn>(col_index, as_int64), scale_(scale),
+      as_int64_(as_int64), overflow_(false) {}
+
+  void Fill() override {
+    if (as_int64_) {
+      FillInt64();
+    } else {
+      FillDouble();
+    }
+  }
 
-  PyObject** out_values = reinterpret_cast<PyObject**>(PyArray_DATA(out));
+  bool FillObjects() override {
+    if (overflow_) {
+      // Only the values just filled are reported, not those of later appends.
+      overflow_ = false;
+      PyErr_SetString(PyExc_OverflowError, "DECIMAL value does not fit in an int64");
+      return false;
+    }
+    return true;
+  }
 
-  const StringColumn* col;
-  const uint8_t* nulls;
+ protected:
+  int OutputType() const override { return as_int64_ ? NPY_INT64 : NPY_DOUBLE; }
+
+  void Reset() override { overflow_ = false; }
+
+ private:
+  void FillDouble() {
+    // Powers of 10 up to 10^22 are exact in a double.
+    const double divisor = static_cast<double>(PowerOfTen(scale_));
+    double* out_values = out_data<double>() + length_;
+    for (const unique_ptr<StringViewColumn>& col : columns_) {
+      for (int j = 0; j < col->length(); ++j) {
+        StringPiece value = col->GetData(j);
+        int128_t unscaled;
+        if (IsNullValue(*col, j) ||
+            !ParseDecimal(value.data(), value.size(), scale_, &unscaled)) {
+          *out_values++ = NAN;
+        } else {
+          *out_values++ = static_cast<double>(unscaled) / divisor;
+        }
+      }
+    }
+  }
 
-  PyObject* intern_table = PyDict_New();
-  RETURN_IF_NULL(intern_table);
+  void FillInt64() {
+    int64_t* out_values = out_data<int64_t>() + length_;
+    uint8_t* mask = mask_data() + length_;
+    for (const unique_ptr<StringViewColumn>& col : columns_) {
+      for (int j = 0; j < col->length(); ++j) {
+        StringPiece value = col->GetData(j);
+        int128_t unscaled = 0;
+        bool null = IsNullValue(*col, j) ||
+            !ParseDecimal(value.data(), value.size(), scale_, &unscaled);
+        if (unscaled < INT64_MIN || unscaled > INT64_MAX) {
+          overflow_ = true;
+          unscaled = 0;
+        }
+        have_null_ |= null;
+        *mask++ = null;
+        *out_values++ = static_cast<int64_t>(unscaled);
+      }
+    }
+  }
 
-  PyObject* out_string;
+  const int scale_;
+  const bool as_int64_;
+
+  // Set by Fill if a value doesn't fit in an int64, until FillObjects reports it.
+  bool overflow_;
+};
+
+// Dates are parsed into NPY_INT64 days since the Unix epoch, to be viewed as
+// datetime64[D], with NaT for nulls and for values that can't be parsed.
+class DateConverter : public TypedConverter<StringViewColumn> {
+ public:
+  explicit DateConverter(int col_index) : TypedConverter<StringViewColumn>(col_index, false) {}
+
+  void Fill() override {
+    int64_t* out_values = out_data<int64_t>() + length_;
+    for (const unique_ptr<StringViewColumn>& col : columns_) {
+      for (int j = 0; j < col->length(); ++j) {
+        StringPiece value = col->GetData(j);
+        int32_t days;
+        if (IsNullValue(*col, j) || !ParseDate(value.data(), value.size(), &days)) {
+          *out_values++ = NAT;
+        } else {
+          *out_values++ = days;
+        }
+      }
+    }
+  }
 
-  int64_t i = 0;
-  for (size_t chunk = 0; chunk < columns.size(); ++chunk) {
-    col = columns[chunk].get();
-    const std::vector<std::string>& col_data = col->data();
-    nulls = col->nulls();
-    for (int j = 0; j < col->length(); ++j) {
-      if (GetBit(nulls, j)) {
-        Py_INCREF(Py_None);
-        out_values[i++] = Py_None;
-      } else {
-        out_string = make_pystring(col_data[j].c_str(), col_data[j].size(),
-            intern_table);
-        RETURN_IF_NULL(out_string);
-        out_values[i++] = out_string;
+ protected:
+  int OutputType() const override { return NPY_INT64; }
+
+ private:
+  static constexpr int64_t NAT = INT64_MIN;
+};
+
+// Timestamps are parsed into NPY_INT64 nanoseconds since the Unix epoch, to be viewed as
+// datetime64[ns], with NaT for nulls and for values that can't be parsed.
+class TimestampConverter : public TypedConverter<StringViewColumn> {
+ public:
+  explicit TimestampConverter(int col_index)
+    : TypedConverter<StringViewColumn>(col_index, false) {}
+
+  void Fill() override {
+    int64_t* out_values = out_data<int64_t>() + length_;
+    for (const unique_ptr<StringViewColumn>& col : columns_) {
+      for (int j = 0; j < col->length(); ++j) {
+        StringPiece value = col->GetData(j);
+        if (IsNullValue(*col, j) ||
+            !ParseTimestamp(value.data(), value.size(), out_values)) {
+          *out_values = NAT;
+        }
+        ++out_values;
       }
     }
   }
 
-  Py_DECREF(intern_table);
+ protected:
+  int OutputType() const override { return NPY_INT64; }
 
-  return out;
+ private:
+  static constexpr int64_t NAT = INT64_MIN;
+};
+
+static inline PyObject* make_pystring(const StringPiece& value) {
+#if PY_MAJOR_VERSION >= 3
+  return PyUnicode_FromStringAndSize(value.data(), value.size());
+#else
+  return PyString_FromStringAndSize(value.data(), value.size());
+#endif
 }
 
-template <int NPY_TYPE, typename CType, typename IN_TYPE, typename OUT_TYPE>
-static PyObject* ConvertFloat(const std::vector<ColumnarRowSet*>& batches,
-    int col_index) {
-  vector<unique_ptr<CType>> columns;
-  int64_t total_length = GetColumns(batches, col_index, &columns);
+// Strings are dictionary encoded without the GIL, so that a Python string is only
+// created once for each distinct value. They are converted to NPY_OBJECT, with None for
+// nulls and equal values sharing a single string, or if 'categorical', to the NPY_INT32
+// codes of a pandas.Categorical, with -1 for nulls. In that case Finish returns a
+// (codes, categories) tuple. The dictionary is kept until Finish, so that each distinct
+// value is only created once per output array.
+class StringConverter : public TypedConverter<StringViewColumn> {
+ public:
+  StringConverter(int col_index, bool categorical)
+    : TypedConverter<StringViewColumn>(col_index, false), categorical_(categorical) {}
+
+  ~StringConverter() {
+    ReleaseObjects();
+  }
 
-  PyObject* out;
-  TRY_NPY_ALLOC(out, NPY_TYPE, total_length);
+  void Fill() override {
+    int32_t* codes;
+    if (categorical_) {
+      codes = out_data<int32_t>() + length_;
+    } else {
+      codes_.resize(batch_length_);
+      codes = codes_.data();
+    }
+    for (const unique_ptr<StringViewColumn>& col : columns_) {
+      for (int j = 0; j < col->length(); ++j) {
+        *codes++ = IsNullValue(*col, j) ? -1 : dict_.GetOrInsert(col->GetData(j));
+      }
+    }
+  }
 
-  OUT_TYPE* out_values = reinterpret_cast<OUT_TYPE*>(PyArray_DATA(out));
+  bool FillObjects() override {
+    // Create the strings for the values first seen in these batches.
+    for (int32_t code = objects_.size(); code < dict_.size(); ++code) {
+      PyObject* str = make_pystring(dict_.value(code));
+      // probably out of memory, Python sets exception
+      if (str == nullptr) return false;
+      objects_.push_back(str);
+    }
+    if (categorical_) return true;
 
-  const CType* col;
-  const IN_TYPE* col_data;
-  const uint8_t* nulls;
+    PyObject** out_values = out_data<PyObject*>() + length_;
+    for (int32_t code : codes_) {
+      PyObject* value = code < 0 ? Py_None : objects_[code];
+      Py_INCREF(value);
+      *out_values++ = value;
+    }
+    return true;
+  }
 
-  OUT_TYPE null_value = static_cast<OUT_TYPE>(NAN);
+ protected:
+  int OutputType() const override { return categorical_ ? NPY_INT32 : NPY_OBJECT; }
 
-  int64_t i = 0;
-  for (size_t chunk = 0; chunk < columns.size(); ++chunk) {
-    col = columns[chunk].get();
-    col_data = col->data().data();
-    nulls = col->nulls();
-    for (int j = 0; j < col->length(); ++j) {
-      out_values[i++] = GetBit(nulls, j) ? null_value : col_data[j];
+  PyObject* FinishValues(PyObject* values) override {
+    if (!categorical_) return values;
+    npy_intp dims[1] = {static_cast<npy_intp>(objects_.size())};
+    PyObject* categories = PyArray_SimpleNew(1, dims, NPY_OBJECT);
+    if (categories == nullptr) {
+      Py_DECREF(values);
+      return nullptr;
     }
+    PyObject** category_values = reinterpret_cast<PyObject**>(
+        PyArray_DATA(reinterpret_cast<PyArrayObject*>(categories)));
+    for (size_t i = 0; i < objects_.size(); ++i) {
+      Py_INCREF(objects_[i]);
+      category_values[i] = objects_[i];
+    }
+    PyObject* result = PyTuple_Pack(2, values, categories);
+    Py_DECREF(values);
+    Py_DECREF(categories);
+    return result;
+  }
+
+  void ReleaseColumns() override {
+    TypedConverter<StringViewColumn>::ReleaseColumns();
+    codes_.clear();
   }
-  return out;
-}
 
-PyObject* ConvertColumnPandas(const std::vector<ColumnarRowSet*>& batches,
-    int col_index, const ColumnType* type) {
+  void Reset() override {
+    ReleaseObjects();
+    dict_.Clear();
+  }
+
+ private:
+  void ReleaseObjects() {
+    for (PyObject* obj : objects_) Py_DECREF(obj);
+    objects_.clear();
+  }
+
+  const bool categorical_;
+
+  StringDictionary dict_;
+
+  // The Python string for each value in 'dict_', indexed by code.
+  vector<PyObject*> objects_;
+
+  // The codes of the prepared values, when converting to NPY_OBJECT.
+  vector<int32_t> codes_;
+};
+
+// Returns the converter for a column of type 'type', or null with a Python exception
+// set if the type isn't supported.
+static unique_ptr<ColumnConverter> MakeConverter(int col_index, const ColumnType* type,
+    const PandasOptions& options) {
+  ColumnConverter* converter = nullptr;
   switch (type->type_id()) {
     case TypeId::BOOLEAN:
-      return ConvertBoolean(batches, col_index);
+      converter = new BooleanConverter(col_index);
+      break;
     case TypeId::TINYINT:
-      return ConvertInteger<NPY_INT8, ByteColumn, int8_t>(batches, col_index);
+      converter = new IntegerConverter<NPY_INT8, ByteColumn, int8_t>(col_index);
+      break;
     case TypeId::SMALLINT:
-      return ConvertInteger<NPY_INT16, Int16Column, int16_t>(batches, col_index);
+      converter = new IntegerConverter<NPY_INT16, Int16Column, int16_t>(col_index);
+      break;
     case TypeId::INT:
-      return ConvertInteger<NPY_INT32, Int32Column, int32_t>(batches, col_index);
+      converter = new IntegerConverter<NPY_INT32, Int32Column, int32_t>(col_index);
+      break;
     case TypeId::BIGINT:
-      return ConvertInteger<NPY_INT64, Int64Column, int64_t>(batches, col_index);
+      converter = new IntegerConverter<NPY_INT64, Int64Column, int64_t>(col_index);
+      break;
     case TypeId::FLOAT:
       // float32 data is transported in doubles on the wire
-      return ConvertFloat<NPY_FLOAT32, DoubleColumn, double, float>(batches, col_index);
+      converter = new FloatConverter<NPY_FLOAT32, DoubleColumn, double, float>(
+          col_index);
+      break;
     case TypeId::DOUBLE:
-      return ConvertFloat<NPY_DOUBLE, DoubleColumn, double, double>(batches, col_index);
+      converter = new FloatConverter<NPY_DOUBLE, DoubleColumn, double, double>(
+          col_index);
+      break;
     case TypeId::STRING:
+    case TypeId::VARCHAR:
+    case TypeId::CHAR:
       // TODO(wesm): Unicode encodings
-      return ConvertString(batches, col_index);
+      converter = new StringConverter(col_index, options.strings_as_categorical);
+      break;
     case TypeId::TIMESTAMP:
-      // TODO(wesm): HS2 presents timestamps as ISO-8601-ish strings. Will
-      // leave it to pandas to convert
-      return ConvertString(batches, col_index);
+      converter = new TimestampConverter(col_index);
+      break;
     case TypeId::BINARY:
     case TypeId::ARRAY:
     case TypeId::MAP:
     case TypeId::STRUCT:
     case TypeId::UNION:
     case TypeId::USER_DEFINED:
+      converter = new StringConverter(col_index, false);
+      break;
     case TypeId::DECIMAL:
-      return ConvertString(batches, col_index);
-    case TypeId::NULL_TYPE:
-    case TypeId::DATE:
-      {
-        const std::string name = type->ToString();
-        PyErr_SetString(PyExc_NotImplementedError, name.c_str());
+      if (options.decimals == DECIMAL_AS_OBJECT) {
+        converter = new StringConverter(col_index, true);
+      } else {
+        converter = new DecimalConverter(col_index,
+            static_cast<const DecimalType*>(type)->scale(),
+            options.decimals == DECIMAL_AS_INT64);
       }
       break;
-    case TypeId::VARCHAR:
-    case TypeId::CHAR:
-      return ConvertString(batches, col_index);
+    case TypeId::DATE:
+      converter = new DateConverter(col_index);
+      break;
+    case TypeId::NULL_TYPE:
     case TypeId::INVALID:
       {
         const std::string name = type->ToString();
@@ -344,10 +762,150 @@ PyObject* ConvertColumnPandas(const std::vector<ColumnarRowSet*>& batches,
       PyErr_SetString(PyExc_NotImplementedError, "Unknown type");
       break;
   }
+  return unique_ptr<ColumnConverter>(converter);
+}
+
+// Creates a converter for each column. Returns false, with a Python exception set, if
+// any of the types aren't supported.
+static bool MakeConverters(const std::vector<int>& col_indices,
+    const std::vector<const ColumnType*>& types, const PandasOptions& options,
+    vector<unique_ptr<ColumnConverter>>* converters) {
+  for (size_t i = 0; i < col_indices.size(); ++i) {
+    converters->push_back(MakeConverter(col_indices[i], types[i], options));
+    if (!converters->back()) return false;
+  }
+  return true;
+}
+
+// Batches with fewer rows in total than this are converted on the calling thread, as
+// handing their columns to other threads would take longer than converting them.
+static constexpr int64_t MIN_PARALLEL_ROWS = 4096;
+
+// Appends the values of 'batches' to each converter's output, reserving room for at
+// least 'capacity' values. Prepare and Fill are run on up to 'num_threads' threads
+// with the GIL released. Must be called with the GIL held. Returns false, with a Python
+// exception set, on failure.
+static bool AppendBatches(const std::vector<ColumnarRowSet*>& batches,
+    int64_t capacity, int num_threads,
+    const vector<unique_ptr<ColumnConverter>>& converters) {
+  int num_columns = converters.size();
+  int64_t num_rows = 0;
+  for (ColumnarRowSet* batch : batches) num_rows += batch->num_rows();
+  if (num_rows < MIN_PARALLEL_ROWS) num_threads = 1;
+
+  Py_BEGIN_ALLOW_THREADS
+  ParallelFor(num_columns, num_threads, [&](int i) {
+    converters[i]->Prepare(batches);
+  });
+  Py_END_ALLOW_THREADS
+
+  for (const unique_ptr<ColumnConverter>& converter : converters) {
+    if (!converter->Reserve(capacity)) return false;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  ParallelFor(num_columns, num_threads, [&](int i) {
+    converters[i]->Fill();
+  });
+  Py_END_ALLOW_THREADS
+
+  for (const unique_ptr<ColumnConverter>& converter : converters) {
+    if (!converter->FillObjects()) return false;
+    converter->Advance();
+  }
+  return true;
+}
+
+// Returns a list of each converter's output array. Returns null, with a Python
+// exception set, on failure.
+static PyObject* FinishConverters(
+    const vector<unique_ptr<ColumnConverter>>& converters) {
+  PyObject* out = PyList_New(converters.size());
+  RETURN_IF_NULL(out);
+  for (size_t i = 0; i < converters.size(); ++i) {
+    PyObject* array = converters[i]->Finish();
+    if (array == nullptr) {
+      Py_DECREF(out);
+      return nullptr;
+    }
+    // PyList_SET_ITEM steals the reference.
+    PyList_SET_ITEM(out, i, array);
+  }
+  return out;
+}
+
+// Converts columns 'col_indices', of types 'types', to numpy arrays, returned as a list
+// in the same order. The values are converted on up to 'num_threads' threads, with the
+// GIL released. Must be called with the GIL held. Returns null with a Python exception
+// set on failure.
+static PyObject* ConvertColumnsPandas(const std::vector<ColumnarRowSet*>& batches,
+    const std::vector<int>& col_indices, const std::vector<const ColumnType*>& types,
+    int num_threads, const PandasOptions& options) {
+  vector<unique_ptr<ColumnConverter>> converters;
+  if (!MakeConverters(col_indices, types, options, &converters)) return nullptr;
+  if (!AppendBatches(batches, 0, num_threads, converters)) return nullptr;
+  return FinishConverters(converters);
+}
 
-  return nullptr;
+// Converts a single column. Must be called with the GIL held. Returns null with a
+// Python exception set on failure.
+static PyObject* ConvertColumnPandas(const std::vector<ColumnarRowSet*>& batches,
+    int col_index, const ColumnType* type, const PandasOptions& options) {
+  vector<unique_ptr<ColumnConverter>> converters;
+  converters.push_back(MakeConverter(col_index, type, options));
+  RETURN_IF_NULL(converters.back());
+  if (!AppendBatches(batches, 0, 1, converters)) return nullptr;
+  return converters[0]->Finish();
 }
 
+// Converts a stream of batches, eg. as fetched by a ResultStream, into chunks of numpy
+// arrays. Each batch is converted into the current chunk's arrays by Append, so that it
+// can be freed as soon as Append returns, rather than holding every batch until they
+// are all converted. The arrays are allocated with room for 'chunk_size' values, and
+// grow if a chunk has more. Must be used with the GIL held.
+class PandasChunkBuilder {
+ public:
+  PandasChunkBuilder(const std::vector<int>& col_indices,
+      const std::vector<const ColumnType*>& types, int64_t chunk_size, int num_threads,
+      const PandasOptions& options)
+    : col_indices_(col_indices), types_(types), chunk_size_(chunk_size),
+      num_threads_(num_threads), options_(options), chunk_rows_(0) {}
+
+  // Returns -1, with a Python exception set, if any of the types aren't supported.
+  int Init() {
+    return MakeConverters(col_indices_, types_, options_, &converters_) ? 0 : -1;
+  }
+
+  // Appends the values of 'batch' to the current chunk. Returns -1, with a Python
+  // exception set, on failure.
+  int Append(ColumnarRowSet* batch) {
+    std::vector<ColumnarRowSet*> batches(1, batch);
+    if (!AppendBatches(batches, chunk_size_, num_threads_, converters_)) return -1;
+    chunk_rows_ += batch->num_rows();
+    return 0;
+  }
+
+  // Returns the current chunk as a list of arrays, one per column, and starts a new
+  // chunk. Returns null, with a Python exception set, on failure.
+  PyObject* Finish() {
+    chunk_rows_ = 0;
+    return FinishConverters(converters_);
+  }
+
+  // The number of rows appended to the current chunk.
+  int64_t chunk_rows() const { return chunk_rows_; }
+
+ private:
+  const std::vector<int> col_indices_;
+  const std::vector<const ColumnType*> types_;
+  const int64_t chunk_size_;
+  const int num_threads_;
+  const PandasOptions options_;
+
+  vector<unique_ptr<ColumnConverter>> converters_;
+  int64_t chunk_rows_;
+};
+
 }  // namespace py
 
 }  // namespace hs2client
@@ -27,7 +27,8 @@ from hs2client.compat import frombytes, tobytes, Decimal
 cimport numpy as cnp
 cnp.import_array()
 
-import time
+import multiprocessing
+import numpy as np
 
 class HS2Exception(Exception):
     pass
@@ -36,12 +37,53 @@ class NativeException(HS2Exception):
     pass
 
 
-# These functions are responsible for their own GIL acquisition internally if
-# needed.
-cdef extern from "converters.h" namespace "hs2client::py" nogil:
-    object ConvertColumnPandas(const vector[CColumnarRowSet*]& batches,
-                               int i, const CColumnType* type)
+# These functions must be called with the GIL held. They release it internally
+# while converting values that don't need Python objects.
+cdef extern from "converters.h" namespace "hs2client::py":
+    enum DecimalConversion:
+        DECIMAL_AS_OBJECT
+        DECIMAL_AS_DOUBLE
+        DECIMAL_AS_INT64
+
+    cdef cppclass PandasOptions:
+        PandasOptions()
+        c_bool strings_as_categorical
+        DecimalConversion decimals
 
+    object ConvertColumnPandas(const vector[CColumnarRowSet*]& batches,
+                               int i, const CColumnType* type,
+                               const PandasOptions& options)
+    object ConvertColumnsPandas(const vector[CColumnarRowSet*]& batches,
+                                const vector[int]& col_indices,
+                                const vector[const CColumnType*]& types,
+                                int num_threads,
+                                const PandasOptions& options)
+
+    cdef cppclass PandasChunkBuilder:
+        PandasChunkBuilder(const vector[int]& col_indices,
+                           const vector[const CColumnType*]& types,
+                           int64_t chunk_size, int num_threads,
+                           const PandasOptions& options)
+        int Init() except -1
+        int Append(CColumnarRowSet* batch) except -1
+        object Finish()
+        int64_t chunk_rows()
+
+
+
+cdef PandasOptions _pandas_options(strings_as_categorical,
+                                   decimals) except *:
+    cdef PandasOptions options
+    options.strings_as_categorical = strings_as_categorical
+    if decimals == 'decimal':
+        options.decimals = DECIMAL_AS_OBJECT
+    elif decimals == 'float64':
+        options.decimals = DECIMAL_AS_DOUBLE
+    elif decimals == 'int64':
+        options.decimals = DECIMAL_AS_INT64
+    else:
+        raise ValueError('Unknown decimals conversion: {0}'.format(decimals))
+    return options
 
 
 cdef check_status(const Status& status):
@@ -78,23 +120,76 @@ cdef class Service:
         self.user = tobytes(user)
         self.timeout_ms = timeout_ms
 
-        check_status(CService.Connect(self.host, self.port,
-                                      self.timeout_ms,
-                                      self.proto_version,
-                                      &self.service))
+        cdef:
+            Status status
+            string c_host = self.host
+            int c_port = self.port
+            int c_timeout_ms = self.timeout_ms
+            ProtocolVersion c_proto_version = self.proto_version
+            unique_ptr[CService]* c_service = &self.service
+
+        with nogil:
+            status = CService.Connect(c_host, c_port, c_timeout_ms,
+                                      c_proto_version, c_service)
+        check_status(status)
 
     def __dealloc__(self):
         self.close()
 
     def close(self):
         # Idempotent
-        cdef CService* sp = self.service.get()
+        cdef:
+            CService* sp = self.service.get()
+            Status status
         if sp != NULL:
-            check_status(sp.Close())
+            with nogil:
+                status = sp.Close()
+            check_status(status)
 
     def is_connected(self):
         return self.service.get().IsConnected()
 
+    def get_metrics(self):
+        """
+        Return a snapshot of the metrics of this connection
+
+        Returns
+        -------
+        metrics : dict
+            bytes_read, bytes_written and rows_fetched, and under 'rpcs' a
+            dict for each RPC method that has been called, keyed by its
+            HiveServer2 name, with its count, errors, server_errors (replies
+            with an error status, which aren't counted in errors), total
+            latency in microseconds and latency percentiles
+        """
+        cdef:
+            CServiceMetrics metrics = self.service.get().GetMetrics()
+            CRpcMetrics* rpc
+            RpcMethod method
+            int i
+
+        rpcs = {}
+        for i in range(NUM_RPC_METHODS):
+            method = <RpcMethod> i
+            rpc = &metrics.rpcs[i]
+            if rpc.count == 0:
+                continue
+            rpcs[frombytes(RpcMethodToString(method))] = {
+                'count': rpc.count,
+                'errors': rpc.num_errors,
+                'server_errors': rpc.num_server_errors,
+                'latency_us_sum': rpc.latency.sum_us,
+                'latency_us_p50': rpc.latency.Percentile(50),
+                'latency_us_p99': rpc.latency.Percentile(99),
+            }
+
+        return {
+            'bytes_read': metrics.bytes_read,
+            'bytes_written': metrics.bytes_written,
+            'rows_fetched': metrics.rows_fetched,
+            'rpcs': rpcs,
+        }
+
     def open_session(self):
         """
         Start a new HiveServer2 session, which may consist of one or more
@@ -107,11 +202,17 @@ cdef class Service:
         -------
         operation : Operation
         """
-        cdef Session session = Session(self)
-
-        cdef HS2ClientConfig config
-        check_status(self.service.get()
-                     .OpenSession(self.user, config, &session.session))
+        cdef:
+            Session session = Session(self)
+            HS2ClientConfig config
+            Status status
+            CService* sp = self.service.get()
+            string c_user = self.user
+            unique_ptr[CSession]* c_session = &session.session
+
+        with nogil:
+            status = sp.OpenSession(c_user, config, c_session)
+        check_status(status)
         return session
 
 
@@ -134,9 +235,13 @@ cdef class Session:
 
     cdef close_session(self):
         # Idempotent
-        cdef CSession* sp = self.session.get()
+        cdef:
+            CSession* sp = self.session.get()
+            Status status
         if sp != NULL:
-            check_status(sp.Close())
+            with nogil:
+                status = sp.Close()
+            check_status(status)
 
     def close(self):
         """
@@ -153,11 +258,16 @@ cdef class Session:
         -------
         operation : Operation
         """
-        cdef Operation operation = Operation(self)
-        cdef string c_statement = tobytes(statement)
+        cdef:
+            Operation operation = Operation(self)
+            string c_statement = tobytes(statement)
+            Status status
+            CSession* sp = self.session.get()
+            unique_ptr[COperation]* c_op = &operation.op
 
-        check_status(self.session.get()
-                     .ExecuteStatement(c_statement, &operation.op))
+        with nogil:
+            status = sp.ExecuteStatement(c_statement, c_op)
+        check_status(status)
 
         return operation
 
@@ -187,6 +297,7 @@ cdef operation_state_to_string(OperationState state):
 
 
 cdef int DEFAULT_BATCHSIZE = 2 ** 10
+cdef int DEFAULT_CHUNKSIZE = 2 ** 16
 
 
 cdef class Operation:
@@ -212,7 +323,12 @@ cdef class Operation:
         """
         May be called before the operation has been closed.
         """
-        check_status(self.op.get().Cancel())
+        cdef:
+            COperation* optr = self.op.get()
+            Status status
+        with nogil:
+            status = optr.Cancel()
+        check_status(status)
 
     def close(self):
         """
@@ -221,51 +337,152 @@ cdef class Operation:
         """
         self.close_operation()
 
-    def fetchall_pandas(self, batchsize=None):
+    def fetchall_pandas(self, batchsize=None, nthreads=None,
+                        strings_as_categorical=False, decimals='decimal'):
+        """
+        Fetch all remaining results and convert them to a pandas.DataFrame
+
+        Parameters
+        ----------
+        batchsize : int, optional
+        nthreads : int, optional
+        strings_as_categorical : boolean, default False
+        decimals : {'decimal', 'float64', 'int64'}, default 'decimal'
+          See batches_to_pandas
+        """
+        # The extension class retains ownership of the
+        # hs2client::ColumnarRowSet
+        batches = self.fetchall_internal(batchsize=batchsize)
+        return self.batches_to_pandas(
+            batches, nthreads=nthreads,
+            strings_as_categorical=strings_as_categorical, decimals=decimals)
+
+    def fetchall_batches(self, batchsize=None):
+        """
+        Fetch all remaining results without converting them. The batches may
+        be passed to batches_to_pandas, eg. to time the conversion separately
+        from fetching
+
+        Returns
+        -------
+        batches : list of ColumnarRowSet
         """
+        return self.fetchall_internal(batchsize=batchsize)
 
+    def batches_to_pandas(self, batches, nthreads=None,
+                          strings_as_categorical=False, decimals='decimal'):
+        """
+        Convert batches fetched from this operation to a pandas.DataFrame
+
+        Parameters
+        ----------
+        batches : list of ColumnarRowSet
+        nthreads : int, optional
+          Number of threads to convert columns on, with the GIL released.
+          Defaults to the number of CPUs
+        strings_as_categorical : boolean, default False
+          Convert STRING, VARCHAR and CHAR columns to pandas.Categorical,
+          which is much faster and smaller for columns with few distinct
+          values
+        decimals : {'decimal', 'float64', 'int64'}, default 'decimal'
+          Convert DECIMAL columns to decimal.Decimal objects, to float64, or
+          to their unscaled int64 values, eg. 150 for 1.50 in a
+          DECIMAL(5, 2). int64 raises OverflowError if a value doesn't fit
+
+        Returns
+        -------
+        df : pandas.DataFrame
         """
         cdef:
             vector[CColumnarRowSet*] c_row_sets
-            ColumnarRowSet py_row_set
+            vector[int] c_col_indices
+            vector[const CColumnType*] c_types
+            PandasOptions options = _pandas_options(strings_as_categorical,
+                                                    decimals)
             Schema schema
-            const CColumnType* col_type
             int i
 
-        import pandas as pd
+        if nthreads is None:
+            nthreads = multiprocessing.cpu_count()
 
-        # The extension class retains ownership of the
-        # hs2client::ColumnarRowSet
-        batches = self.fetchall_internal(batchsize=batchsize)
         schema = self.schema
+        _get_row_sets(batches, &c_row_sets)
 
-        for py_row_set in batches:
-            c_row_sets.push_back(py_row_set.data.get())
-
-        # TODO(wesm): consider parallelizing deserialization
-        column_names = []
-        converted_columns = {}
         for i in range(schema.ncolumns):
-            col_name = schema.column(i).name
-            col_type = schema.columns[i].type()
+            c_col_indices.push_back(i)
+            c_types.push_back(schema.columns[i].type())
 
-            result = ConvertColumnPandas(c_row_sets, i, col_type)
+        results = ConvertColumnsPandas(c_row_sets, c_col_indices, c_types,
+                                       nthreads, options)
+        return _make_dataframe(results, schema, options)
 
-            if col_type.type_id() == ColumnType_TIMESTAMP:
-                result = pd.to_datetime(result)
-            elif col_type.type_id() == ColumnType_DECIMAL:
-                _convert_decimals(result)
+    def iter_pandas(self, chunksize=DEFAULT_CHUNKSIZE, batchsize=None,
+                    nthreads=None, strings_as_categorical=False,
+                    decimals='decimal'):
+        """
+        Fetch the remaining results as a sequence of pandas.DataFrames of up to
+        chunksize rows each. Each fetched batch is converted and freed before
+        the next one is fetched, so that memory use is bounded by the size of
+        a chunk rather than of the whole result set
+
+        Parameters
+        ----------
+        chunksize : int, default 65536
+        batchsize : int, optional
+          Maximum number of rows to request per fetch
+        nthreads : int, optional
+        strings_as_categorical : boolean, default False
+          See batches_to_pandas. The categories of each chunk are the distinct
+          values in that chunk
+        decimals : {'decimal', 'float64', 'int64'}, default 'decimal'
+          See batches_to_pandas
+
+        Returns
+        -------
+        chunks : iterator of pandas.DataFrame
+        """
+        cdef PandasChunkIterator it
+
+        if chunksize <= 0:
+            raise ValueError('chunksize must be positive')
+        if batchsize is None:
+            batchsize = DEFAULT_BATCHSIZE
+        if nthreads is None:
+            nthreads = multiprocessing.cpu_count()
+
+        it = PandasChunkIterator(self)
+        it.init(chunksize, batchsize, nthreads,
+                _pandas_options(strings_as_categorical, decimals))
+        return it
+
+    def column_to_pandas(self, batches, int i):
+        """
+        Convert a single column of batches fetched from this operation
 
-            column_names.append(col_name)
-            converted_columns[col_name] = result
+        Returns
+        -------
+        values : numpy.ndarray or pandas.Series
+        """
+        cdef vector[CColumnarRowSet*] c_row_sets
+        _get_row_sets(batches, &c_row_sets)
+        return self.convert_column(c_row_sets, i, self.schema)
 
-        return pd.DataFrame(converted_columns, columns=column_names)
+    cdef convert_column(self, const vector[CColumnarRowSet*]& c_row_sets,
+                        int i, Schema schema):
+        cdef:
+            const CColumnType* col_type = schema.columns[i].type()
+            PandasOptions options
+        result = ConvertColumnPandas(c_row_sets, i, col_type, options)
+        return _finish_column(result, col_type, options)
 
     cdef fetchall_internal(self, batchsize=None):
         cdef:
             ColumnarRowSet row_set
             int c_batchsize
             c_bool has_more_rows
+            COperation* optr = self.op.get()
+            unique_ptr[CColumnarRowSet]* c_results
+            Status status
 
         if batchsize is not None:
             c_batchsize = batchsize
@@ -280,9 +497,11 @@ cdef class Operation:
         has_more_rows = True
         while has_more_rows:
             row_set = ColumnarRowSet()
-            check_status(self.op.get()
-                         .Fetch(c_batchsize, FetchOrientation_NEXT,
-                                &row_set.data, &has_more_rows))
+            c_results = &row_set.data
+            with nogil:
+                status = optr.Fetch(c_batchsize, FetchOrientation_NEXT,
+                                    c_results, &has_more_rows)
+            check_status(status)
 
             batches.append(row_set)
 
@@ -290,49 +509,85 @@ cdef class Operation:
 
     cdef close_operation(self):
         # Idempotent
-        cdef COperation* optr = self.op.get()
+        cdef:
+            COperation* optr = self.op.get()
+            Status status
         if optr != NULL:
-            check_status(optr.Close())
+            with nogil:
+                status = optr.Close()
+            check_status(status)
 
     def get_state(self):
-        cdef OperationState state
-        check_status(self.op.get().GetState(&state))
+        cdef:
+            OperationState state
+            COperation* optr = self.op.get()
+            Status status
+        with nogil:
+            status = optr.GetState(&state)
+        check_status(status)
         return operation_state_to_string(state)
 
     def get_log(self):
-        cdef string log
-        check_status(self.op.get().GetLog(&log))
+        cdef:
+            string log
+            COperation* optr = self.op.get()
+            Status status
+        with nogil:
+            status = optr.GetLog(&log)
+        check_status(status)
         return frombytes(log)
 
     def get_profile(self):
-        cdef string profile
-        check_status(self.op.get().GetProfile(&profile))
+        cdef:
+            string profile
+            COperation* optr = self.op.get()
+            Status status
+        with nogil:
+            status = optr.GetProfile(&profile)
+        check_status(status)
         return frombytes(profile)
 
     def wait(self, timeout_seconds=0):
-        if self.is_finished:
-            return
-
-        interval = 0.05
-        time.sleep(interval)
-        total_sleep = interval
-        while not self.is_finished:
-            interval *= 2
-            time.sleep(interval)
-            total_sleep += interval
-            if timeout_seconds > 0 and total_sleep > timeout_seconds:
-                raise Exception('Operation timed out')
+        """
+        Block until the operation has finished. For queries this fetches the
+        first batch of results, which the next fetch returns
+
+        Parameters
+        ----------
+        timeout_seconds : float, default 0
+            Raise if the operation hasn't finished after this long. 0 waits
+            indefinitely
+        """
+        cdef:
+            COperation* optr = self.op.get()
+            int timeout_ms = -1
+            Status status
+
+        if timeout_seconds > 0:
+            timeout_ms = max(int(timeout_seconds * 1000), 1)
+        with nogil:
+            status = optr.WaitForCompletion(timeout_ms)
+        if status.IsStillExecuting():
+            raise Exception('Operation timed out')
+        check_status(status)
 
     property schema:
 
         def __get__(self):
-            cdef Schema metadata
+            cdef:
+                Schema metadata
+                COperation* optr = self.op.get()
+                vector[CColumnDesc]* c_columns
+                Status status
 
             if self.cached_metadata is not None:
                 return self.cached_metadata
 
             metadata = Schema()
-            check_status(self.op.get().GetResultSetMetadata(&metadata.columns))
+            c_columns = &metadata.columns
+            with nogil:
+                status = optr.GetResultSetMetadata(c_columns)
+            check_status(status)
             self.cached_metadata = metadata
             return metadata
 
@@ -343,7 +598,84 @@ cdef class Operation:
         """
 
         def __get__(self):
-            return self.op.get().HasResultSet()
+            cdef:
+                COperation* optr = self.op.get()
+                c_bool result
+            with nogil:
+                result = optr.HasResultSet()
+            return result
+
+
+cdef class PandasChunkIterator:
+    """
+    Returned by Operation.iter_pandas
+    """
+    cdef:
+        Operation op
+        Schema schema
+        unique_ptr[CResultStream] stream
+        unique_ptr[PandasChunkBuilder] builder
+        PandasOptions options
+        c_bool eos
+        int num_chunks
+
+    def __cinit__(self, Operation op):
+        self.op = op
+        self.eos = False
+        self.num_chunks = 0
+
+    cdef init(self, int64_t chunksize, int batchsize, int nthreads,
+              const PandasOptions& options):
+        cdef:
+            vector[int] c_col_indices
+            vector[const CColumnType*] c_types
+            int i
+
+        self.schema = self.op.schema
+        self.options = options
+        for i in range(self.schema.ncolumns):
+            c_col_indices.push_back(i)
+            c_types.push_back(self.schema.columns[i].type())
+
+        self.stream.reset(new CResultStream(self.op.op.get(), chunksize,
+                                            batchsize))
+        self.builder.reset(new PandasChunkBuilder(c_col_indices, c_types,
+                                                  chunksize, nthreads,
+                                                  options))
+        self.builder.get().Init()
+
+    def __iter__(self):
+        return self
+
+    def __next__(self):
+        cdef:
+            unique_ptr[CColumnarRowSet] batch
+            c_bool end_of_chunk = False
+            c_bool eos = False
+            CResultStream* stream = self.stream.get()
+            unique_ptr[CColumnarRowSet]* c_batch = &batch
+            Status status
+
+        if self.eos:
+            raise StopIteration
+
+        while not end_of_chunk and not eos:
+            with nogil:
+                status = stream.Next(c_batch, &end_of_chunk, &eos)
+            check_status(status)
+            self.builder.get().Append(batch.get())
+            batch.reset()
+        self.eos = eos
+
+        # A result set that ends on a chunk boundary is followed by an empty
+        # final batch, which isn't worth a chunk of its own
+        if self.builder.get().chunk_rows() == 0 and self.num_chunks > 0:
+            self.builder.get().Finish()
+            raise StopIteration
+
+        self.num_chunks += 1
+        return _make_dataframe(self.builder.get().Finish(), self.schema,
+                               self.options)
 
 
 cdef class ColumnarRowSet:
@@ -351,6 +683,12 @@ cdef class ColumnarRowSet:
         unique_ptr[CColumnarRowSet] data
 
 
+cdef _get_row_sets(batches, vector[CColumnarRowSet*]* out):
+    cdef ColumnarRowSet py_row_set
+    for py_row_set in batches:
+        out.push_back(py_row_set.data.get())
+
+
 cdef class ColumnType:
     cdef:
         const CColumnType* base
@@ -497,11 +835,58 @@ cdef class Schema:
         return desc
 
 
-cdef _convert_decimals(cnp.ndarray[object] arr):
-    cdef:
-        int i, n = len(arr)
-
-    for i in range(n):
-        if arr[i] is None:
-            continue
-        arr[i] = Decimal(arr[i])
+cdef _make_dataframe(results, Schema schema, const PandasOptions& options):
+    import pandas as pd
+
+    column_names = []
+    converted_columns = {}
+    for i in range(schema.ncolumns):
+        col_name = schema.column(i).name
+        column_names.append(col_name)
+        converted_columns[col_name] = _finish_column(
+            results[i], schema.columns[i].type(), options)
+
+    return pd.DataFrame(converted_columns, columns=column_names)
+
+
+cdef _finish_column(result, const CColumnType* col_type,
+                    const PandasOptions& options):
+    # Conversions that are left to Python, applied to the output of the
+    # C++ converters
+    import pandas as pd
+
+    cdef ColumnTypeId type_id = col_type.type_id()
+
+    if type_id == ColumnType_DECIMAL and options.decimals == DECIMAL_AS_OBJECT:
+        # The codes and distinct strings of the values, so that only one
+        # Decimal is created per distinct value. The code of nulls, -1,
+        # selects the None at the end
+        codes, strings = result
+        values = np.empty(len(strings) + 1, dtype=object)
+        values[:-1] = [Decimal(x) for x in strings]
+        values[-1] = None
+        return values.take(codes)
+
+    if isinstance(result, tuple):
+        if (type_id == ColumnType_STRING or type_id == ColumnType_VARCHAR or
+                type_id == ColumnType_CHAR):
+            # Strings converted with strings_as_categorical come back as codes
+            # and categories
+            codes, categories = result
+            return pd.Categorical.from_codes(codes, categories)
+
+        # Integer, boolean and int64 decimal columns with nulls come back as
+        # values and a mask that is True for nulls
+        values, mask = result
+        if type_id == ColumnType_BOOLEAN:
+            return pd.arrays.BooleanArray(values, mask)
+        return pd.arrays.IntegerArray(values, mask)
+
+    if type_id == ColumnType_TIMESTAMP:
+        # Nanoseconds since the epoch, with NaT for nulls
+        result = result.view('datetime64[ns]')
+    elif type_id == ColumnType_DATE:
+        # Days since the epoch, with NaT for nulls
+        result = result.view('datetime64[D]')
+
+    return result
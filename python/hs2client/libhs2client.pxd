@@ -94,6 +94,9 @@ cdef extern from "hs2client/api.h" namespace "hs2client" nogil:
     cdef cppclass CColumnarRowSet" hs2client::ColumnarRowSet":
         unique_ptr[T] GetCol[T](int i)
 
+        int num_columns()
+        int64_t num_rows()
+
         unique_ptr[BoolColumn] GetBoolCol(int i)
         unique_ptr[ByteColumn] GetByteCol(int i)
         unique_ptr[Int16Column] GetInt16Col(int i)
@@ -175,6 +178,42 @@ cdef extern from "hs2client/api.h" namespace "hs2client" nogil:
         Protocol_V6 " hs2client::ProtocolVersion::HS2CLIENT_PROTOCOL_V6"
         Protocol_V7 " hs2client::ProtocolVersion::HS2CLIENT_PROTOCOL_V7"
 
+    enum RpcMethod" hs2client::RpcMethod":
+        RpcMethod_OpenSession" hs2client::RpcMethod::OPEN_SESSION"
+        RpcMethod_CloseSession" hs2client::RpcMethod::CLOSE_SESSION"
+        RpcMethod_GetInfo" hs2client::RpcMethod::GET_INFO"
+        RpcMethod_ExecuteStatement" hs2client::RpcMethod::EXECUTE_STATEMENT"
+        RpcMethod_GetOperationStatus" hs2client::RpcMethod::GET_OPERATION_STATUS"
+        RpcMethod_GetLog" hs2client::RpcMethod::GET_LOG"
+        RpcMethod_GetRuntimeProfile" hs2client::RpcMethod::GET_RUNTIME_PROFILE"
+        RpcMethod_GetResultSetMetadata" hs2client::RpcMethod::GET_RESULT_SET_METADATA"
+        RpcMethod_FetchResults" hs2client::RpcMethod::FETCH_RESULTS"
+        RpcMethod_CancelOperation" hs2client::RpcMethod::CANCEL_OPERATION"
+        RpcMethod_CloseOperation" hs2client::RpcMethod::CLOSE_OPERATION"
+
+    int NUM_RPC_METHODS
+
+    const char* RpcMethodToString(RpcMethod method)
+
+    cdef cppclass CLatencyHistogram" hs2client::LatencyHistogram":
+        int64_t buckets[32]
+        int64_t count
+        int64_t sum_us
+
+        int64_t Percentile(double percentile)
+
+    cdef cppclass CRpcMetrics" hs2client::RpcMetrics":
+        int64_t count
+        int64_t num_errors
+        int64_t num_server_errors
+        CLatencyHistogram latency
+
+    cdef cppclass CServiceMetrics" hs2client::ServiceMetrics":
+        CRpcMetrics rpcs[11]
+        int64_t bytes_read
+        int64_t bytes_written
+        int64_t rows_fetched
+
     cdef cppclass CService" hs2client::Service":
 
         @staticmethod
@@ -189,6 +228,8 @@ cdef extern from "hs2client/api.h" namespace "hs2client" nogil:
         void SetRecvTimeout(int timeout)
         void SetSendTimeout(int timeout)
 
+        CServiceMetrics GetMetrics()
+
         Status OpenSession(const string& user, const HS2ClientConfig& config,
                            unique_ptr[CSession]* session)
 
@@ -224,6 +265,8 @@ cdef extern from "hs2client/api.h" namespace "hs2client" nogil:
         Status GetProfile(string* out)
         Status GetResultSetMetadata(vector[CColumnDesc]* out)
 
+        Status WaitForCompletion(int timeout_ms)
+
         # Fetches 1024 rows by default currently
         Status Fetch(unique_ptr[CColumnarRowSet]* results,
                      c_bool* has_more_rows)
@@ -241,3 +284,14 @@ cdef extern from "hs2client/api.h" namespace "hs2client" nogil:
         c_bool HasResultSet()
 
         c_bool IsColumnar()
+
+    cdef cppclass CResultStream" hs2client::ResultStream":
+        CResultStream(const COperation* op, int64_t chunk_size,
+                      int max_batch_rows)
+
+        Status Next(unique_ptr[CColumnarRowSet]* batch, c_bool* end_of_chunk,
+                    c_bool* eos)
+
+        int64_t chunk_size()
+        int64_t chunk_rows()
+        int64_t num_rows()
@@ -14,8 +14,9 @@
 
 import getpass
 import os
+import threading
 
-from pandas.util.testing import assert_frame_equal
+from pandas.testing import assert_frame_equal
 import numpy as np
 import pandas as pd
 
@@ -40,6 +41,26 @@ def test_service_session_scope():
     session = None
 
 
+def test_service_metrics():
+    svc = hs2.connect(TEST_HOST, TEST_PORT, TEST_USER)
+    session = svc.open_session()
+    op = session.execute_sync('select 1 as x')
+    op.fetchall_pandas()
+    op.close()
+
+    metrics = svc.get_metrics()
+    assert metrics['rows_fetched'] == 1
+    assert metrics['bytes_read'] > 0
+    assert metrics['bytes_written'] > 0
+    assert metrics['rpcs']['OpenSession']['count'] == 1
+    assert metrics['rpcs']['ExecuteStatement']['count'] == 1
+    assert metrics['rpcs']['FetchResults']['errors'] == 0
+    assert metrics['rpcs']['FetchResults']['server_errors'] == 0
+    assert 'CloseSession' not in metrics['rpcs']
+    session.close()
+    svc.close()
+
+
 @pytest.fixture(scope='module')
 def env1(request):
     env = ExampleEnv(TEST_HOST, TEST_PORT, TEST_USER)
@@ -48,6 +69,30 @@ def env1(request):
     return env
 
 
+def test_concurrent_operations(env1):
+    # The RPC wrappers release the GIL, so operations on one session may run
+    # from several threads at once
+    results = []
+    errors = []
+
+    def run(i):
+        try:
+            op = env1.session.execute_sync('select {0} as x'.format(i))
+            results.append(op.fetchall_pandas()['x'][0])
+            op.close()
+        except Exception as e:
+            errors.append(e)
+
+    threads = [threading.Thread(target=run, args=(i,)) for i in range(8)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    assert errors == []
+    assert sorted(results) == list(range(8))
+
+
 def test_result_metadata(env1):
     # As of Impala 2.5, only supports scalar types in result set
     # metadata. hive can return more types; will need to test this
@@ -154,15 +199,21 @@ def test_pandas_fetch_numeric(env1):
     for name, np_type, data in zip(names, dtypes, data):
         expected[name] = np.array(data, dtype=np_type)
 
-    # Integers with nulls
+    # Integers with nulls become pandas nullable integers
     names = ['i4', 'i5', 'i6', 'i7']
     types = ['tinyint', 'smallint', 'int', 'bigint']
-    dtypes = ['f8'] * 4
+    dtypes = ['Int8', 'Int16', 'Int32', 'Int64']
     data = [[1, 2, None, 4, 5] * K] * 4
 
-    for name, np_type, arr in zip(names, dtypes, data):
-        # leave this conversion to pandas (automatically -> float64)
-        expected[name] = arr
+    for name, dtype, arr in zip(names, dtypes, data):
+        expected[name] = pd.array(arr, dtype=dtype)
+
+    # Values that don't fit in a double keep their precision
+    names.append('i8')
+    types.append('bigint')
+    dtypes.append('Int64')
+    data.append([2 ** 62 + 1, None, -2 ** 62 - 1, 0, 1] * K)
+    expected['i8'] = pd.array(data[-1], dtype='Int64')
 
     push(names, types, dtypes, data)
 
@@ -201,17 +252,17 @@ def test_pandas_fetch_boolean(env1):
     coltypes = ['boolean', 'boolean']
 
     # We can do this in one shot
-    expected = pd.DataFrame({name: np.array(arr)
-                             for name, arr in zip(colnames, data)},
+    expected = pd.DataFrame({'f0': np.array(data[0]),
+                             'f1': pd.array(data[1], dtype='boolean')},
                             columns=colnames)
 
     result = _roundtrip_data(env1, colnames, coltypes, data)
 
     assert_frame_equal(result, expected)
 
-    # Boolean + nulls in pandas becomes numpy object
+    # Boolean + nulls becomes a pandas nullable boolean
     assert result['f0'].dtype == np.bool_
-    assert result['f1'].dtype == np.object_
+    assert result['f1'].dtype == 'boolean'
 
 
 def test_pandas_fetch_string(env1):
@@ -238,7 +289,7 @@ def test_pandas_fetch_timestamp(env1):
     K = 20
     v = '2000-01-01 12:34:56.123456'
     data = [
-        [v, None, '2001-01-01', v] * K
+        [v, None, '2001-01-01', '1969-07-20 20:17:40.000000001', v] * K
     ]
     colnames = ['f0']
     coltypes = ['timestamp']
@@ -250,6 +301,20 @@ def test_pandas_fetch_timestamp(env1):
     assert_frame_equal(result, expected)
 
 
+def test_pandas_fetch_date(env1):
+    K = 20
+    data = [
+        ['2000-01-01', None, '1969-12-31', '2016-02-29'] * K
+    ]
+    colnames = ['f0']
+    coltypes = ['date']
+
+    expected = pd.DataFrame({colnames[0]: pd.to_datetime(data[0])})
+    result = _roundtrip_data(env1, colnames, coltypes, data)
+
+    assert_frame_equal(result, expected, check_dtype=False)
+
+
 def test_pandas_fetch_decimal(env1):
     K = 20
     values = [-1.5, None, 0, 1.5] * K
@@ -266,6 +331,80 @@ def test_pandas_fetch_decimal(env1):
     assert_frame_equal(result, expected)
 
 
+def test_pandas_fetch_decimal_numeric(env1):
+    K = 20
+    data = [
+        [-1.5, None, 0, 1.5] * K,
+        [-1.5, 2.25, 0, 1.5] * K,
+    ]
+    colnames = ['f0', 'f1']
+    coltypes = ['decimal(12,2)', 'decimal(38,2)']
+
+    tname = random_table_name()
+    env1.create_table(tname, zip(colnames, coltypes))
+    insert_tuples(env1.session, tname, zip(*data))
+
+    op = env1.select_all(tname)
+    result = op.fetchall_pandas(batchsize=16, decimals='float64')
+    expected = pd.DataFrame({name: np.array(arr, dtype='f8')
+                             for name, arr in zip(colnames, data)},
+                            columns=colnames)
+    assert_frame_equal(result, expected)
+
+    # Unscaled values, nullable if there are nulls
+    op = env1.select_all(tname)
+    result = op.fetchall_pandas(batchsize=16, decimals='int64')
+    expected = pd.DataFrame({
+        'f0': pd.array([-150, None, 0, 150] * K, dtype='Int64'),
+        'f1': np.array([-150, 225, 0, 150] * K, dtype='i8'),
+    }, columns=colnames)
+    assert_frame_equal(result, expected)
+
+    op = env1.select_all(tname)
+    with pytest.raises(ValueError):
+        op.fetchall_pandas(decimals='float32')
+
+
+def test_pandas_fetch_decimal_overflow(env1):
+    colnames = ['f0']
+    coltypes = ['decimal(38,0)']
+    data = [[10 ** 30, 1]]
+
+    tname = random_table_name()
+    env1.create_table(tname, zip(colnames, coltypes))
+    insert_tuples(env1.session, tname, zip(*data))
+
+    op = env1.select_all(tname)
+    with pytest.raises(OverflowError):
+        op.fetchall_pandas(decimals='int64')
+
+
+def test_pandas_convert_nthreads(env1):
+    K = 20
+    coltypes = ['tinyint', 'smallint', 'int', 'bigint', 'boolean', 'double',
+                'string'] * 2
+    colnames = ['f{0}'.format(i) for i in range(len(coltypes))]
+    data = [
+        [1, 2, None, 4, 5] * K,
+        [1, 2, 3, 4, 5] * K,
+        [1, 2, None, 4, 5] * K,
+        [1, 2, 3, 4, 5] * K,
+        [True, False, None, True, False] * K,
+        [-0.5, 0, None, 0.5, 1] * K,
+        ['foo', None, 'bar', 'foo', 'baz'] * K,
+    ] * 2
+
+    tname = random_table_name()
+    env1.create_table(tname, zip(colnames, coltypes))
+    insert_tuples(env1.session, tname, zip(*data))
+
+    op = env1.select_all(tname)
+    batches = op.fetchall_batches(batchsize=16)
+    expected = op.batches_to_pandas(batches, nthreads=1)
+    result = op.batches_to_pandas(batches, nthreads=4)
+    assert_frame_equal(result, expected)
+
+
 def _roundtrip_data(env, colnames, coltypes, column_data, batchsize=16):
     tname = random_table_name()
     env.create_table(tname, zip(colnames, coltypes))
@@ -273,3 +412,59 @@ def _roundtrip_data(env, colnames, coltypes, column_data, batchsize=16):
 
     op = env.select_all(tname)
     return op.fetchall_pandas(batchsize=16)
+
+
+def test_iter_pandas(env1):
+    K = 20
+    coltypes = ['tinyint', 'bigint', 'boolean', 'double', 'string']
+    colnames = ['f{0}'.format(i) for i in range(len(coltypes))]
+    data = [
+        [1, 2, 3, 4, 5] * K,
+        [1, 2, 3, 4, 5] * K,
+        [True, False, True, True, False] * K,
+        [-0.5, 0, 0.25, 0.5, 1] * K,
+        ['foo', 'bar', 'foo', 'baz', 'qux'] * K,
+    ]
+    # Each chunk has nulls, but only after its first batch, so that the
+    # masks of the integer and boolean columns are first set partway through
+    for column in data:
+        for i in [20, 60, 95]:
+            column[i] = None
+
+    tname = random_table_name()
+    env1.create_table(tname, zip(colnames, coltypes))
+    insert_tuples(env1.session, tname, zip(*data))
+
+    expected = env1.select_all(tname).fetchall_pandas()
+
+    op = env1.select_all(tname)
+    chunks = list(op.iter_pandas(chunksize=35, batchsize=16, nthreads=2))
+    assert [len(chunk) for chunk in chunks] == [35, 35, 30]
+
+    result = pd.concat(chunks, ignore_index=True)
+    assert_frame_equal(result, expected)
+
+
+def test_pandas_fetch_string_categorical(env1):
+    K = 20
+    data = [
+        ['foo', None, 'bar', 'foo', 'baz'] * K,
+        ['a', 'b', 'a', 'a', 'b'] * K,
+    ]
+    colnames = ['f0', 'f1']
+    coltypes = ['string', 'varchar(10)']
+
+    tname = random_table_name()
+    env1.create_table(tname, zip(colnames, coltypes))
+    insert_tuples(env1.session, tname, zip(*data))
+
+    op = env1.select_all(tname)
+    result = op.fetchall_pandas(batchsize=16, strings_as_categorical=True)
+
+    for name, values in zip(colnames, data):
+        assert result[name].dtype == 'category'
+        # Categories are in order of first appearance
+        expected = pd.Categorical(
+            values, categories=pd.unique([v for v in values
+                                          if v is not None]))
+        assert result[name].values.equals(expected)
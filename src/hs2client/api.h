@@ -15,13 +15,26 @@
 #ifndef HS2CLIENT_API_H
 #define HS2CLIENT_API_H
 
+#include "hs2client/arrow-export.h"
+#include "hs2client/capture.h"
 #include "hs2client/columnar-row-set.h"
+#include "hs2client/compute.h"
 #include "hs2client/macros.h"
+#include "hs2client/metrics.h"
 #include "hs2client/operation.h"
+#include "hs2client/pool.h"
+#include "hs2client/result-stream.h"
 #include "hs2client/service.h"
 #include "hs2client/session.h"
 #include "hs2client/status.h"
+#include "hs2client/tracer.h"
 #include "hs2client/types.h"
 #include "hs2client/util.h"
 
+// The asynchronous API is only built on Linux.
+#ifdef __linux__
+#include "hs2client/coro.h"
+#include "hs2client/event-loop.h"
+#endif
+
 #endif  // HS2CLIENT_API_H
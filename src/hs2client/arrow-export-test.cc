@@ -0,0 +1,285 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/arrow-export.h"
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hs2client/mock-server.h"
+#include "hs2client/operation.h"
+#include "hs2client/service.h"
+#include "hs2client/session.h"
+#include "hs2client/test-util.h"
+
+using namespace hs2client;
+using namespace std;
+
+// The expected contents of an exported column. Values are the bytes of each value, eg.
+// the 4 bytes of an int32, and are only compared for rows that aren't null.
+struct ExpectedColumn {
+  vector<bool> nulls;
+  vector<string> values;
+};
+
+template <typename T>
+string ValueBytes(const T& value) {
+  return string(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename ColumnT>
+void AppendValues(const ColumnT& col, ExpectedColumn* expected) {
+  for (int i = 0; i < col.length(); ++i) {
+    expected->nulls.push_back(col.IsNull(i));
+    expected->values.push_back(ValueBytes(col.GetData(i)));
+  }
+}
+
+// Appends the values of 'batch' to 'expected', using the column accessors.
+void AppendExpected(const ColumnarRowSet& batch, const vector<ColumnDesc>& column_descs,
+    vector<ExpectedColumn>* expected) {
+  expected->resize(column_descs.size());
+  for (size_t i = 0; i < column_descs.size(); ++i) {
+    ExpectedColumn* col = &(*expected)[i];
+    switch (column_descs[i].type()->type_id()) {
+      case ColumnType::TypeId::BOOLEAN: {
+        unique_ptr<BoolColumn> bool_col = batch.GetBoolCol(i);
+        for (int j = 0; j < bool_col->length(); ++j) {
+          col->nulls.push_back(bool_col->IsNull(j));
+          col->values.push_back(bool_col->data()[j] ? "1" : "0");
+        }
+        break;
+      }
+      case ColumnType::TypeId::INT:
+        AppendValues(*batch.GetInt32Col(i), col);
+        break;
+      case ColumnType::TypeId::BIGINT:
+        AppendValues(*batch.GetInt64Col(i), col);
+        break;
+      case ColumnType::TypeId::DOUBLE:
+        AppendValues(*batch.GetDoubleCol(i), col);
+        break;
+      case ColumnType::TypeId::TIMESTAMP:
+        AppendValues(*batch.GetTimestampCol(i), col);
+        break;
+      case ColumnType::TypeId::DATE:
+        AppendValues(*batch.GetDateCol(i), col);
+        break;
+      case ColumnType::TypeId::DECIMAL:
+        AppendValues(*batch.GetDecimal128Col(i, *column_descs[i].GetDecimalType()), col);
+        break;
+      default: {
+        unique_ptr<StringViewColumn> string_col = batch.GetStringViewCol(i);
+        for (int j = 0; j < string_col->length(); ++j) {
+          col->nulls.push_back(string_col->IsNull(j));
+          col->values.push_back(string_col->GetData(j).ToString());
+        }
+        break;
+      }
+    }
+  }
+}
+
+// Checks that 'array', with format 'format', has the contents of 'expected'.
+void CheckArray(const ArrowArray& array, const string& format,
+    const ExpectedColumn& expected) {
+  ASSERT_EQ(array.length, expected.nulls.size());
+  EXPECT_EQ(array.offset, 0);
+  EXPECT_EQ(array.n_children, 0);
+  ASSERT_EQ(array.n_buffers, format == "u" ? 3 : 2);
+
+  const uint8_t* validity = static_cast<const uint8_t*>(array.buffers[0]);
+  int64_t null_count = 0;
+  for (int64_t i = 0; i < array.length; ++i) {
+    bool is_null = validity != nullptr && (validity[i / 8] & (1 << (i % 8))) == 0;
+    EXPECT_EQ(is_null, expected.nulls[i]) << i;
+    if (is_null) {
+      ++null_count;
+      continue;
+    }
+
+    string value;
+    if (format == "b") {
+      const uint8_t* bits = static_cast<const uint8_t*>(array.buffers[1]);
+      value = (bits[i / 8] & (1 << (i % 8))) ? "1" : "0";
+    } else if (format == "u") {
+      const int32_t* offsets = static_cast<const int32_t*>(array.buffers[1]);
+      const char* data = static_cast<const char*>(array.buffers[2]);
+      value.assign(data + offsets[i], offsets[i + 1] - offsets[i]);
+    } else {
+      size_t size = expected.values[i].size();
+      value.assign(static_cast<const char*>(array.buffers[1]) + i * size, size);
+    }
+    EXPECT_EQ(value, expected.values[i]) << i;
+  }
+  EXPECT_EQ(array.null_count, null_count);
+}
+
+class ArrowExportTest : public MockSessionTestBase {
+ protected:
+  virtual void SetUp() {
+    spec_.num_rows = 2500;
+    spec_.columns.emplace_back(ColumnType::TypeId::BOOLEAN, 0.1);
+    spec_.columns.emplace_back(ColumnType::TypeId::INT, 0.1);
+    spec_.columns.emplace_back(ColumnType::TypeId::BIGINT);
+    spec_.columns.emplace_back(ColumnType::TypeId::DOUBLE, 0.2);
+    spec_.columns.emplace_back(ColumnType::TypeId::STRING, 0.5, 8);
+    spec_.columns.emplace_back(ColumnType::TypeId::TIMESTAMP, 0.2);
+    spec_.columns.emplace_back(ColumnType::TypeId::DATE, 0.2);
+    spec_.columns.emplace_back(ColumnType::TypeId::DECIMAL, 0.2);
+    spec_.columns.back().precision = 9;
+    spec_.columns.back().scale = 2;
+    formats_ = {"b", "i", "l", "g", "u", "tsn:", "tdD", "d:9,2"};
+
+    ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+    ASSERT_OK(session_->ExecuteStatement("select * from mock", &op_));
+    ASSERT_OK(op_->GetResultSetMetadata(&column_descs_));
+  }
+
+  virtual void TearDown() {
+    if (op_) EXPECT_OK(op_->Close());
+    MockSessionTestBase::TearDown();
+  }
+
+  // Checks that 'array' is a struct array with the contents of 'expected'.
+  void CheckStructArray(const ArrowArray& array, const vector<ExpectedColumn>& expected) {
+    ASSERT_EQ(array.n_children, formats_.size());
+    EXPECT_EQ(array.null_count, 0);
+    for (size_t i = 0; i < formats_.size(); ++i) {
+      SCOPED_TRACE(formats_[i]);
+      EXPECT_EQ(array.length, expected[i].nulls.size());
+      CheckArray(*array.children[i], formats_[i], expected[i]);
+    }
+  }
+
+  vector<string> formats_;
+
+  unique_ptr<Operation> op_;
+  vector<ColumnDesc> column_descs_;
+};
+
+TEST_F(ArrowExportTest, TestExportSchema) {
+  ArrowSchema schema;
+  EXPECT_OK(ExportArrowSchema(column_descs_, &schema));
+  EXPECT_STREQ(schema.format, "+s");
+  ASSERT_EQ(schema.n_children, formats_.size());
+  for (size_t i = 0; i < formats_.size(); ++i) {
+    EXPECT_EQ(schema.children[i]->format, formats_[i]);
+    EXPECT_EQ(schema.children[i]->name, column_descs_[i].column_name());
+    EXPECT_EQ(schema.children[i]->flags, ARROW_FLAG_NULLABLE);
+    EXPECT_EQ(schema.children[i]->n_children, 0);
+  }
+
+  // A child moved out by the consumer outlives its parent.
+  ArrowSchema child = *schema.children[4];
+  schema.children[4]->release = nullptr;
+  schema.release(&schema);
+  EXPECT_TRUE(schema.release == nullptr);
+  EXPECT_STREQ(child.format, "u");
+  child.release(&child);
+  EXPECT_TRUE(child.release == nullptr);
+
+  vector<ColumnDesc> invalid;
+  invalid.emplace_back("invalid", unique_ptr<ColumnType>(
+      new PrimitiveType(ColumnType::TypeId::INVALID)), 0, "");
+  EXPECT_ERROR(ExportArrowSchema(invalid, &schema));
+}
+
+TEST_F(ArrowExportTest, TestExportBatch) {
+  unique_ptr<ColumnarRowSet> batch;
+  bool has_more_rows;
+  EXPECT_OK(op_->Fetch(1000, FetchOrientation::NEXT, &batch, &has_more_rows));
+  vector<ExpectedColumn> expected;
+  AppendExpected(*batch, column_descs_, &expected);
+  const int32_t* int_values = batch->GetInt32Col(1)->data().data();
+  const char* string_data = batch->GetStringViewCol(4)->data();
+
+  ArrowArray array;
+  EXPECT_OK(ExportArrowArray(column_descs_, std::move(batch), &array));
+  EXPECT_EQ(array.length, 1000);
+  CheckStructArray(array, expected);
+
+  // The buffers of a single batch are shared.
+  EXPECT_EQ(array.children[1]->buffers[1], int_values);
+  EXPECT_EQ(array.children[4]->buffers[2], string_data);
+  // There are no nulls in the BIGINT column.
+  EXPECT_TRUE(array.children[2]->buffers[0] == nullptr);
+
+  // A child moved out by the consumer keeps the batch alive.
+  ArrowArray child = *array.children[4];
+  array.children[4]->release = nullptr;
+  array.release(&array);
+  EXPECT_TRUE(array.release == nullptr);
+  CheckArray(child, "u", expected[4]);
+  child.release(&child);
+}
+
+TEST_F(ArrowExportTest, TestExportConcatenated) {
+  // Batches that aren't a multiple of 8 rows exercise the unaligned validity bitmaps.
+  vector<unique_ptr<ColumnarRowSet>> batches;
+  vector<ExpectedColumn> expected;
+  bool has_more_rows = true;
+  while (has_more_rows) {
+    unique_ptr<ColumnarRowSet> batch;
+    EXPECT_OK(op_->Fetch(333, FetchOrientation::NEXT, &batch, &has_more_rows));
+    AppendExpected(*batch, column_descs_, &expected);
+    batches.push_back(std::move(batch));
+  }
+  EXPECT_GT(batches.size(), 1);
+
+  ArrowArray array;
+  EXPECT_OK(ExportArrowArray(column_descs_, std::move(batches), &array));
+  EXPECT_EQ(array.length, 2500);
+  CheckStructArray(array, expected);
+  array.release(&array);
+  EXPECT_TRUE(array.release == nullptr);
+
+  // An empty result set.
+  EXPECT_OK(ExportArrowArray(column_descs_, vector<unique_ptr<ColumnarRowSet>>(),
+      &array));
+  EXPECT_EQ(array.length, 0);
+  CheckStructArray(array, vector<ExpectedColumn>(formats_.size()));
+  array.release(&array);
+}
+
+TEST_F(ArrowExportTest, TestMismatchedSchema) {
+  unique_ptr<ColumnarRowSet> batch;
+  bool has_more_rows;
+  EXPECT_OK(op_->Fetch(100, FetchOrientation::NEXT, &batch, &has_more_rows));
+
+  // The INT column described as a BIGINT has no BIGINT values.
+  vector<ColumnDesc> column_descs;
+  for (const ColumnDesc& desc : column_descs_) {
+    ColumnType::TypeId type_id = desc.type()->type_id();
+    if (type_id == ColumnType::TypeId::INT) type_id = ColumnType::TypeId::BIGINT;
+    unique_ptr<ColumnType> type;
+    if (type_id == ColumnType::TypeId::DECIMAL) {
+      type.reset(new DecimalType(type_id, 9, 2));
+    } else {
+      type.reset(new PrimitiveType(type_id));
+    }
+    column_descs.emplace_back(desc.column_name(), std::move(type), desc.position(), "");
+  }
+  ArrowArray array;
+  EXPECT_ERROR(ExportArrowArray(column_descs, std::move(batch), &array));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,447 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/arrow-export.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+using std::string;
+using std::unique_ptr;
+
+namespace hs2client {
+
+namespace {
+
+typedef std::vector<unique_ptr<ColumnarRowSet>> Batches;
+
+// Schema export
+
+// Owns the memory of an exported ArrowSchema.
+struct SchemaData {
+  string format;
+  string name;
+  std::vector<ArrowSchema> children;
+  std::vector<ArrowSchema*> child_ptrs;
+};
+
+void ReleaseSchema(ArrowSchema* schema) {
+  SchemaData* data = static_cast<SchemaData*>(schema->private_data);
+  // Children that the consumer moved out have already been marked released.
+  for (ArrowSchema& child : data->children) {
+    if (child.release != nullptr) child.release(&child);
+  }
+  delete data;
+  schema->release = nullptr;
+}
+
+void InitSchema(SchemaData* data, int64_t flags, ArrowSchema* out) {
+  for (ArrowSchema& child : data->children) data->child_ptrs.push_back(&child);
+  out->format = data->format.c_str();
+  out->name = data->name.c_str();
+  out->metadata = nullptr;
+  out->flags = flags;
+  out->n_children = data->children.size();
+  out->children = data->child_ptrs.empty() ? nullptr : data->child_ptrs.data();
+  out->dictionary = nullptr;
+  out->release = ReleaseSchema;
+  out->private_data = data;
+}
+
+// Sets 'format' to the Arrow format string of the column described by 'desc'.
+Status GetFormat(const ColumnDesc& desc, string* format) {
+  switch (desc.type()->type_id()) {
+    case ColumnType::TypeId::BOOLEAN:
+      *format = "b";
+      break;
+    case ColumnType::TypeId::TINYINT:
+      *format = "c";
+      break;
+    case ColumnType::TypeId::SMALLINT:
+      *format = "s";
+      break;
+    case ColumnType::TypeId::INT:
+      *format = "i";
+      break;
+    case ColumnType::TypeId::BIGINT:
+      *format = "l";
+      break;
+    case ColumnType::TypeId::FLOAT:
+    case ColumnType::TypeId::DOUBLE:
+      *format = "g";
+      break;
+    case ColumnType::TypeId::STRING:
+    case ColumnType::TypeId::VARCHAR:
+    case ColumnType::TypeId::CHAR:
+    case ColumnType::TypeId::ARRAY:
+    case ColumnType::TypeId::MAP:
+    case ColumnType::TypeId::STRUCT:
+    case ColumnType::TypeId::UNION:
+    case ColumnType::TypeId::USER_DEFINED:
+      *format = "u";
+      break;
+    case ColumnType::TypeId::BINARY:
+      *format = "z";
+      break;
+    case ColumnType::TypeId::TIMESTAMP:
+      *format = "tsn:";
+      break;
+    case ColumnType::TypeId::DATE:
+      *format = "tdD";
+      break;
+    case ColumnType::TypeId::DECIMAL: {
+      const DecimalType* type = desc.GetDecimalType();
+      std::stringstream ss;
+      ss << "d:" << type->precision() << "," << type->scale();
+      *format = ss.str();
+      break;
+    }
+    case ColumnType::TypeId::NULL_TYPE:
+      *format = "n";
+      break;
+    default:
+      return Status::Error("Column " + desc.column_name() + " of type " +
+          desc.type()->ToString() + " can't be exported to Arrow");
+  }
+  return Status::OK();
+}
+
+// Array export
+
+// Owns the memory of an exported ArrowArray. Buffers are either allocated here, or
+// shared with 'batches' or 'columns', which are kept alive until the array is released.
+struct ArrayData {
+  std::shared_ptr<Batches> batches;
+  std::vector<std::shared_ptr<Column>> columns;
+  // Allocated as uint64_t to align the buffers to 8 bytes.
+  std::vector<unique_ptr<uint64_t[]>> allocations;
+
+  std::vector<const void*> buffers;
+  std::vector<ArrowArray> children;
+  std::vector<ArrowArray*> child_ptrs;
+
+  // Returns a zeroed buffer of 'size' bytes.
+  uint8_t* Allocate(int64_t size) {
+    allocations.emplace_back(new uint64_t[(size + 7) / 8]());
+    return reinterpret_cast<uint8_t*>(allocations.back().get());
+  }
+};
+
+// Releases the children of 'data' that haven't been moved out by the consumer.
+void ReleaseChildren(ArrayData* data) {
+  for (ArrowArray& child : data->children) {
+    if (child.release != nullptr) child.release(&child);
+  }
+}
+
+void ReleaseArray(ArrowArray* array) {
+  ArrayData* data = static_cast<ArrayData*>(array->private_data);
+  ReleaseChildren(data);
+  delete data;
+  array->release = nullptr;
+}
+
+void InitArray(unique_ptr<ArrayData> data, int64_t length, int64_t null_count,
+    ArrowArray* out) {
+  for (ArrowArray& child : data->children) data->child_ptrs.push_back(&child);
+  out->length = length;
+  out->null_count = null_count;
+  out->offset = 0;
+  out->n_buffers = data->buffers.size();
+  out->n_children = data->children.size();
+  out->buffers = data->buffers.empty() ? nullptr : data->buffers.data();
+  out->children = data->child_ptrs.empty() ? nullptr : data->child_ptrs.data();
+  out->dictionary = nullptr;
+  out->release = ReleaseArray;
+  out->private_data = data.release();
+}
+
+// Exports column 'col_index' of 'batches', concatenated, as a child of the struct array.
+// The buffers of a single batch are shared, and those of several batches are copied.
+class ColumnExporter {
+ public:
+  ColumnExporter(const ColumnDesc& desc, int col_index,
+      const std::shared_ptr<Batches>& batches, int64_t length)
+    : desc_(desc), col_index_(col_index), batches_(*batches), length_(length),
+      data_(new ArrayData()), validity_(nullptr), offset_(0) {
+    if (batches->size() == 1) data_->batches = batches;
+  }
+
+  Status Export(ArrowArray* out) {
+    int i = col_index_;
+    switch (desc_.type()->type_id()) {
+      case ColumnType::TypeId::BOOLEAN:
+        HS2CLIENT_RETURN_IF_ERROR(ExportBoolean());
+        break;
+      case ColumnType::TypeId::TINYINT:
+        HS2CLIENT_RETURN_IF_ERROR(ExportFixedWidth<ByteColumn>(
+            [i](const ColumnarRowSet& batch) { return batch.GetByteCol(i); }));
+        break;
+      case ColumnType::TypeId::SMALLINT:
+        HS2CLIENT_RETURN_IF_ERROR(ExportFixedWidth<Int16Column>(
+            [i](const ColumnarRowSet& batch) { return batch.GetInt16Col(i); }));
+        break;
+      case ColumnType::TypeId::INT:
+        HS2CLIENT_RETURN_IF_ERROR(ExportFixedWidth<Int32Column>(
+            [i](const ColumnarRowSet& batch) { return batch.GetInt32Col(i); }));
+        break;
+      case ColumnType::TypeId::BIGINT:
+        HS2CLIENT_RETURN_IF_ERROR(ExportFixedWidth<Int64Column>(
+            [i](const ColumnarRowSet& batch) { return batch.GetInt64Col(i); }));
+        break;
+      case ColumnType::TypeId::FLOAT:
+      case ColumnType::TypeId::DOUBLE:
+        HS2CLIENT_RETURN_IF_ERROR(ExportFixedWidth<DoubleColumn>(
+            [i](const ColumnarRowSet& batch) { return batch.GetDoubleCol(i); }));
+        break;
+      case ColumnType::TypeId::TIMESTAMP:
+        HS2CLIENT_RETURN_IF_ERROR(ExportFixedWidth<TimestampColumn>(
+            [i](const ColumnarRowSet& batch) { return batch.GetTimestampCol(i); }));
+        break;
+      case ColumnType::TypeId::DATE:
+        HS2CLIENT_RETURN_IF_ERROR(ExportFixedWidth<DateColumn>(
+            [i](const ColumnarRowSet& batch) { return batch.GetDateCol(i); }));
+        break;
+      case ColumnType::TypeId::DECIMAL: {
+        const DecimalType& type = *desc_.GetDecimalType();
+        HS2CLIENT_RETURN_IF_ERROR(ExportFixedWidth<Decimal128Column>(
+            [i, &type](const ColumnarRowSet& batch) {
+              return batch.GetDecimal128Col(i, type);
+            }));
+        break;
+      }
+      case ColumnType::TypeId::NULL_TYPE:
+        // The null type has no buffers.
+        InitArray(std::move(data_), length_, length_, out);
+        return Status::OK();
+      default:
+        HS2CLIENT_RETURN_IF_ERROR(ExportBinary());
+        break;
+    }
+
+    // The validity bitmap may be omitted if there are no nulls.
+    int64_t num_valid = 0;
+    for (int64_t j = 0; j < (length_ + 7) / 8; ++j) {
+      num_valid += __builtin_popcount(validity_[j]);
+    }
+    if (num_valid == length_) data_->buffers[0] = nullptr;
+    InitArray(std::move(data_), length_, length_ - num_valid, out);
+    return Status::OK();
+  }
+
+ private:
+  // Allocates the validity bitmap and 'num_buffers' - 1 other buffers.
+  void InitBuffers(int num_buffers) {
+    validity_ = data_->Allocate((length_ + 7) / 8);
+    data_->buffers.assign(num_buffers, nullptr);
+    data_->buffers[0] = validity_;
+  }
+
+  // Appends the validity of 'col', which comes from 'batch', to the bitmap at offset_,
+  // and advances offset_. Returns an error if the column doesn't have a value for each
+  // row of the batch, eg. because its type doesn't match its ColumnDesc.
+  Status AppendValidity(const ColumnarRowSet& batch, const Column& col) {
+    int64_t length = col.length();
+    if (length != batch.num_rows()) {
+      std::stringstream ss;
+      ss << "Column " << desc_.column_name() << " has " << length << " values in a "
+         << "batch of " << batch.num_rows() << " rows";
+      return Status::Error(ss.str());
+    }
+
+    // The null bitmap may have fewer bytes than expected, see HUE-2722, in which case
+    // the missing values are not null.
+    const uint8_t* nulls = col.nulls();
+    int64_t nulls_size = col.nulls_size();
+    if (offset_ % 8 == 0) {
+      uint8_t* out = validity_ + offset_ / 8;
+      int64_t num_bytes = (length + 7) / 8;
+      int64_t j = 0;
+      for (; j < std::min(num_bytes, nulls_size); ++j) out[j] = ~nulls[j];
+      for (; j < num_bytes; ++j) out[j] = 0xff;
+      // Clear the bits past the end of the column, for the next batch to set.
+      if (length % 8 != 0) out[num_bytes - 1] &= (1 << (length % 8)) - 1;
+    } else {
+      for (int64_t j = 0; j < length; ++j) {
+        if (j / 8 < nulls_size && (nulls[j / 8] & (1 << (j % 8)))) continue;
+        int64_t bit = offset_ + j;
+        validity_[bit / 8] |= static_cast<uint8_t>(1 << (bit % 8));
+      }
+    }
+    offset_ += length;
+    return Status::OK();
+  }
+
+  // Exports a column whose values are a std::vector of a fixed-width type, eg.
+  // Int32Column or TimestampColumn. 'get_col' returns the column of a batch.
+  template <typename ColumnT>
+  Status ExportFixedWidth(
+      const std::function<unique_ptr<ColumnT>(const ColumnarRowSet&)>& get_col) {
+    InitBuffers(2);
+    if (batches_.size() == 1) {
+      std::shared_ptr<ColumnT> col = get_col(*batches_[0]);
+      HS2CLIENT_RETURN_IF_ERROR(AppendValidity(*batches_[0], *col));
+      data_->buffers[1] = col->data().data();
+      // Columns that own their values, eg. TimestampColumn, must outlive the array.
+      data_->columns.push_back(col);
+      return Status::OK();
+    }
+
+    typedef typename std::decay<decltype(get_col(*batches_[0])->data()[0])>::type T;
+    uint8_t* values = data_->Allocate(length_ * sizeof(T));
+    data_->buffers[1] = values;
+    for (const unique_ptr<ColumnarRowSet>& batch : batches_) {
+      unique_ptr<ColumnT> col = get_col(*batch);
+      int64_t offset = offset_;
+      HS2CLIENT_RETURN_IF_ERROR(AppendValidity(*batch, *col));
+      memcpy(values + offset * sizeof(T), col->data().data(), col->length() * sizeof(T));
+    }
+    return Status::OK();
+  }
+
+  // Booleans are bit-packed by Arrow, so they are always copied.
+  Status ExportBoolean() {
+    InitBuffers(2);
+    uint8_t* values = data_->Allocate((length_ + 7) / 8);
+    data_->buffers[1] = values;
+    for (const unique_ptr<ColumnarRowSet>& batch : batches_) {
+      unique_ptr<BoolColumn> col = batch->GetBoolCol(col_index_);
+      int64_t offset = offset_;
+      HS2CLIENT_RETURN_IF_ERROR(AppendValidity(*batch, *col));
+      const std::vector<bool>& data = col->data();
+      for (size_t j = 0; j < data.size(); ++j) {
+        if (!data[j]) continue;
+        int64_t bit = offset + j;
+        values[bit / 8] |= static_cast<uint8_t>(1 << (bit % 8));
+      }
+    }
+    return Status::OK();
+  }
+
+  // Exports a STRING or BINARY column, whose offsets and data have the same layout as
+  // Arrow's, from StringViewColumns.
+  Status ExportBinary() {
+    InitBuffers(3);
+    if (batches_.size() == 1) {
+      std::shared_ptr<StringViewColumn> col = batches_[0]->GetStringViewCol(col_index_);
+      HS2CLIENT_RETURN_IF_ERROR(AppendValidity(*batches_[0], *col));
+      data_->buffers[1] = col->offsets();
+      data_->buffers[2] = col->data();
+      return Status::OK();
+    }
+
+    std::vector<unique_ptr<StringViewColumn>> cols;
+    int64_t num_bytes = 0;
+    for (const unique_ptr<ColumnarRowSet>& batch : batches_) {
+      cols.push_back(batch->GetStringViewCol(col_index_));
+      num_bytes += cols.back()->offsets()[cols.back()->length()];
+    }
+    if (num_bytes > INT32_MAX) {
+      return Status::Error("Column " + desc_.column_name() + " has too much data to "
+          "export as a single Arrow array");
+    }
+
+    int32_t* offsets =
+        reinterpret_cast<int32_t*>(data_->Allocate((length_ + 1) * sizeof(int32_t)));
+    char* values = reinterpret_cast<char*>(data_->Allocate(num_bytes));
+    data_->buffers[1] = offsets;
+    data_->buffers[2] = values;
+    int32_t base = 0;
+    for (size_t b = 0; b < batches_.size(); ++b) {
+      const StringViewColumn& col = *cols[b];
+      int64_t offset = offset_;
+      HS2CLIENT_RETURN_IF_ERROR(AppendValidity(*batches_[b], col));
+      for (int64_t j = 0; j < col.length(); ++j) {
+        offsets[offset + j] = base + col.offsets()[j];
+      }
+      int32_t size = col.offsets()[col.length()];
+      memcpy(values + base, col.data(), size);
+      base += size;
+    }
+    offsets[length_] = base;
+    return Status::OK();
+  }
+
+  const ColumnDesc& desc_;
+  const int col_index_;
+  const Batches& batches_;
+  const int64_t length_;
+
+  unique_ptr<ArrayData> data_;
+  uint8_t* validity_;
+  // The number of rows appended so far.
+  int64_t offset_;
+};
+
+} // namespace
+
+Status ExportArrowSchema(const std::vector<ColumnDesc>& column_descs,
+    ArrowSchema* out) {
+  unique_ptr<SchemaData> data(new SchemaData());
+  data->format = "+s";
+  data->children.resize(column_descs.size());
+  for (size_t i = 0; i < column_descs.size(); ++i) {
+    unique_ptr<SchemaData> child(new SchemaData());
+    Status status = GetFormat(column_descs[i], &child->format);
+    if (!status.ok()) {
+      for (size_t j = 0; j < i; ++j) ReleaseSchema(&data->children[j]);
+      return status;
+    }
+    child->name = column_descs[i].column_name();
+    InitSchema(child.release(), ARROW_FLAG_NULLABLE, &data->children[i]);
+  }
+  InitSchema(data.release(), 0, out);
+  return Status::OK();
+}
+
+Status ExportArrowArray(const std::vector<ColumnDesc>& column_descs,
+    unique_ptr<ColumnarRowSet> batch, ArrowArray* out) {
+  Batches batches;
+  batches.push_back(std::move(batch));
+  return ExportArrowArray(column_descs, std::move(batches), out);
+}
+
+Status ExportArrowArray(const std::vector<ColumnDesc>& column_descs,
+    Batches batches, ArrowArray* out) {
+  std::shared_ptr<Batches> shared_batches(new Batches(std::move(batches)));
+  int64_t length = 0;
+  for (const unique_ptr<ColumnarRowSet>& batch : *shared_batches) {
+    if (batch->num_columns() != static_cast<int>(column_descs.size())) {
+      return Status::Error("The number of columns in a batch doesn't match its schema");
+    }
+    length += batch->num_rows();
+  }
+
+  // The struct array itself has no nulls, and only a validity buffer.
+  unique_ptr<ArrayData> data(new ArrayData());
+  data->buffers.push_back(nullptr);
+  data->children.resize(column_descs.size());
+  for (size_t i = 0; i < column_descs.size(); ++i) {
+    ColumnExporter exporter(column_descs[i], i, shared_batches, length);
+    Status status = exporter.Export(&data->children[i]);
+    if (!status.ok()) {
+      ReleaseChildren(data.get());
+      return status;
+    }
+  }
+  InitArray(std::move(data), length, 0, out);
+  return Status::OK();
+}
+
+} // namespace hs2client
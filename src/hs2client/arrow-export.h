@@ -0,0 +1,135 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HS2CLIENT_ARROW_EXPORT_H
+#define HS2CLIENT_ARROW_EXPORT_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hs2client/columnar-row-set.h"
+#include "hs2client/status.h"
+#include "hs2client/types.h"
+
+// The structs of the Arrow C data interface, as defined by the Arrow project. They are
+// part of a stable ABI, so any library that defines them can consume what we export,
+// and we don't depend on Arrow itself. The guard is shared with Arrow's own definition.
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+extern "C" {
+
+struct ArrowSchema {
+  // Array type description
+  const char* format;
+  const char* name;
+  const char* metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema** children;
+  struct ArrowSchema* dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowSchema*);
+  // Opaque producer-specific data
+  void* private_data;
+};
+
+struct ArrowArray {
+  // Array data description
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void** buffers;
+  struct ArrowArray** children;
+  struct ArrowArray* dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowArray*);
+  // Opaque producer-specific data
+  void* private_data;
+};
+
+} // extern "C"
+
+#endif // ARROW_C_DATA_INTERFACE
+
+namespace hs2client {
+
+// Exporting results through the Arrow C data interface, so that engines which consume
+// it, eg. pyarrow, DuckDB or Polars, can read them without a conversion to pandas.
+//
+// A result set is exported as a struct array with one child per column, described by a
+// struct schema built from the ColumnDescs returned by Operation::GetResultSetMetadata.
+// Types are mapped as follows:
+//
+//   BOOLEAN                   bool
+//   TINYINT ... BIGINT        int8 ... int64
+//   FLOAT, DOUBLE             float64, as HiveServer2 sends both as doubles
+//   STRING, VARCHAR, CHAR     utf8
+//   BINARY                    binary
+//   TIMESTAMP                 timestamp[ns], parsed as for TimestampColumn
+//   DATE                      date32, parsed as for DateColumn
+//   DECIMAL(p, s)             decimal128(p, s), parsed as for Decimal128Column
+//   ARRAY, MAP, STRUCT,       utf8, as HiveServer2 sends them as JSON strings
+//     UNION, USER_DEFINED
+//   NULL_TYPE                 null
+//
+// Every child is nullable. Its validity bitmap is built from the HiveServer2 null
+// bitmap, which has the opposite sense, and is omitted if there are no nulls.
+//
+// Both structs are filled in as described by the C data interface: the consumer takes
+// ownership of them and must call their release callbacks once done, which frees any
+// memory that they hold. The exported data remains valid until then, independently of
+// the objects that it was exported from.
+//
+// Example:
+// vector<ColumnDesc> column_descs;
+// HS2CLIENT_RETURN_IF_ERROR(op->GetResultSetMetadata(&column_descs));
+// unique_ptr<ColumnarRowSet> batch;
+// HS2CLIENT_RETURN_IF_ERROR(op->Fetch(&batch, &has_more_rows));
+// struct ArrowSchema schema;
+// struct ArrowArray array;
+// HS2CLIENT_RETURN_IF_ERROR(ExportArrowSchema(column_descs, &schema));
+// HS2CLIENT_RETURN_IF_ERROR(ExportArrowArray(column_descs, std::move(batch), &array));
+// // hand 'schema' and 'array' to the consumer, eg. pyarrow.RecordBatch._import_from_c
+
+// Exports the schema of a result set with columns 'column_descs'. Returns an error if a
+// column has a type that can't be exported, in which case 'out' is not modified.
+Status ExportArrowSchema(const std::vector<ColumnDesc>& column_descs,
+    struct ArrowSchema* out);
+
+// Exports the results in 'batch', whose columns are described by 'column_descs'. Takes
+// ownership of the batch, so that the buffers of fixed-width numeric, STRING and BINARY
+// columns can be shared rather than copied, and frees it when 'out' is released.
+Status ExportArrowArray(const std::vector<ColumnDesc>& column_descs,
+    std::unique_ptr<ColumnarRowSet> batch, struct ArrowArray* out);
+
+// Exports the concatenation of 'batches' as a single array, eg. all of the batches of a
+// chunk from a ResultStream. Values are copied into contiguous buffers, and the batches
+// are freed before this returns. Returns an error if a STRING or BINARY column has
+// more than 2GB of data in total, which doesn't fit in its 32-bit offsets.
+Status ExportArrowArray(const std::vector<ColumnDesc>& column_descs,
+    std::vector<std::unique_ptr<ColumnarRowSet>> batches, struct ArrowArray* out);
+
+} // namespace hs2client
+
+#endif // HS2CLIENT_ARROW_EXPORT_H
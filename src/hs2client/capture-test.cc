@@ -0,0 +1,181 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hs2client/capture.h"
+
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <thrift/transport/TBufferTransports.h>
+
+#include "hs2client/mock-server.h"
+#include "hs2client/operation.h"
+#include "hs2client/service.h"
+#include "hs2client/session.h"
+#include "hs2client/test-util.h"
+
+using apache::thrift::transport::TMemoryBuffer;
+using namespace hs2client;
+using namespace std;
+
+// Returns the direction and message of each record in the capture file at 'path'.
+vector<pair<int, string>> ReadRecords(const string& path) {
+  ifstream file(path.c_str(), ios::binary);
+  stringstream ss;
+  ss << file.rdbuf();
+  string contents = ss.str();
+  vector<pair<int, string>> records;
+  // Skip the magic and the protocol.
+  size_t pos = 9;
+  while (pos + 5 <= contents.size()) {
+    uint32_t len = 0;
+    for (int i = 0; i < 4; ++i) {
+      uint8_t byte = contents[pos + 1 + i];
+      len |= static_cast<uint32_t>(byte) << (8 * i);
+    }
+    records.emplace_back(contents[pos], contents.substr(pos + 5, len));
+    pos += 5 + len;
+  }
+  EXPECT_EQ(pos, contents.size());
+  return records;
+}
+
+class CaptureTest : public MockSessionTestBase {
+ protected:
+  virtual void SetUp() {
+    capture_path_ = "/tmp/hs2client-capture-test.cap";
+
+    spec_.num_rows = 2500;
+    spec_.columns.emplace_back(ColumnType::TypeId::BIGINT, 0.2);
+    spec_.columns.emplace_back(ColumnType::TypeId::STRING, 0.2);
+    ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+  }
+
+  virtual void TearDown() {
+    MockSessionTestBase::TearDown();
+    remove(capture_path_.c_str());
+  }
+
+  string capture_path_;
+};
+
+TEST_F(CaptureTest, TestCaptureAndReplay) {
+  EXPECT_OK(service_->StartCapture(capture_path_));
+  EXPECT_ERROR(service_->StartCapture(capture_path_));
+
+  unique_ptr<Operation> op;
+  EXPECT_OK(session_->ExecuteStatement("select * from mock", &op));
+  vector<int64_t> int_values;
+  vector<string> string_values;
+  vector<bool> nulls;
+  bool has_more_rows = true;
+  int num_batches = 0;
+  while (has_more_rows) {
+    unique_ptr<ColumnarRowSet> results;
+    EXPECT_OK(op->Fetch(1000, FetchOrientation::NEXT, &results, &has_more_rows));
+    unique_ptr<Int64Column> int_col = results->GetInt64Col(0);
+    unique_ptr<StringViewColumn> string_col = results->GetStringViewCol(1);
+    for (int i = 0; i < int_col->length(); ++i) {
+      int_values.push_back(int_col->GetData(i));
+      string_values.push_back(string_col->GetData(i).ToString());
+      nulls.push_back(string_col->IsNull(i));
+    }
+    ++num_batches;
+  }
+  EXPECT_OK(op->Close());
+  EXPECT_OK(service_->StopCapture());
+
+  // RPCs after capture stops are not recorded.
+  unique_ptr<Operation> op2;
+  EXPECT_OK(session_->ExecuteStatement("select * from mock", &op2));
+  unique_ptr<ColumnarRowSet> results;
+  EXPECT_OK(op2->Fetch(&results, &has_more_rows));
+  EXPECT_OK(op2->Close());
+
+  unique_ptr<FetchReplay> replay;
+  EXPECT_OK(FetchReplay::Open(capture_path_, &replay));
+  EXPECT_EQ(replay->num_replies(), num_batches);
+  EXPECT_GT(replay->num_reply_bytes(), 0);
+
+  // Replay twice to check Rewind.
+  for (int pass = 0; pass < 2; ++pass) {
+    size_t row = 0;
+    bool eos = false;
+    while (true) {
+      unique_ptr<ColumnarRowSet> replayed;
+      EXPECT_OK(replay->Next(&replayed, &has_more_rows, &eos));
+      if (eos) break;
+      unique_ptr<Int64Column> int_col = replayed->GetInt64Col(0);
+      unique_ptr<StringViewColumn> string_col = replayed->GetStringViewCol(1);
+      for (int i = 0; i < int_col->length(); ++i, ++row) {
+        ASSERT_LT(row, int_values.size());
+        EXPECT_EQ(int_col->GetData(i), int_values[row]);
+        EXPECT_EQ(string_col->GetData(i).ToString(), string_values[row]);
+        EXPECT_EQ(string_col->IsNull(i), nulls[row]);
+      }
+    }
+    EXPECT_FALSE(has_more_rows);
+    EXPECT_EQ(row, int_values.size());
+    replay->Rewind();
+  }
+}
+
+TEST_F(CaptureTest, TestPartialReply) {
+  // Requests written to a memory buffer are read back as their replies.
+  boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  boost::shared_ptr<CaptureTransport> capture;
+  ASSERT_OK(CaptureTransport::Create(buffer, WireProtocol::BINARY, capture_path_,
+      &capture));
+  capture->write(reinterpret_cast<const uint8_t*>("req1"), 4);
+  capture->flush();
+
+  // The first reply is abandoned part way, eg. because it failed to deserialize.
+  uint8_t buf[8];
+  EXPECT_EQ(capture->read(buf, 2), 2u);
+
+  capture->write(reinterpret_cast<const uint8_t*>("req2"), 4);
+  capture->flush();
+  EXPECT_EQ(capture->read(buf, 6), 6u);
+  capture->readEnd();
+  EXPECT_OK(capture->Finish());
+
+  vector<pair<int, string>> records = ReadRecords(capture_path_);
+  ASSERT_EQ(records.size(), 3);
+  EXPECT_EQ(records[0], make_pair(0, string("req1")));
+  EXPECT_EQ(records[1], make_pair(0, string("req2")));
+  // Only the bytes read since the second request was sent.
+  EXPECT_EQ(records[2], make_pair(1, string("q1req2")));
+}
+
+TEST_F(CaptureTest, TestInvalidFile) {
+  unique_ptr<FetchReplay> replay;
+  EXPECT_ERROR(FetchReplay::Open("/tmp/hs2client-does-not-exist.cap", &replay));
+
+  FILE* file = fopen(capture_path_.c_str(), "w");
+  ASSERT_TRUE(file != NULL);
+  fputs("not a capture file", file);
+  fclose(file);
+  EXPECT_ERROR(FetchReplay::Open(capture_path_, &replay));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,252 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hs2client/capture.h"
+
+#include <sstream>
+#include <vector>
+
+#include <thrift/transport/TBufferTransports.h>
+
+#include "hs2client/logging.h"
+#include "hs2client/thrift-internal.h"
+
+#include "gen-cpp/ImpalaHiveServer2Service.h"
+#include "gen-cpp/TCLIService.h"
+
+namespace hs2 = apache::hive::service::cli::thrift;
+
+using apache::thrift::TException;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransport;
+using std::string;
+using std::unique_ptr;
+
+namespace hs2client {
+
+namespace {
+
+const string CAPTURE_MAGIC = "HS2CAP01";
+const uint8_t DIRECTION_SENT = 0;
+const uint8_t DIRECTION_RECEIVED = 1;
+
+// The size of a record's direction and length.
+const int RECORD_HEADER_SIZE = 5;
+
+} // namespace
+
+// CaptureTransport
+
+CaptureTransport::CaptureTransport(const boost::shared_ptr<TTransport>& transport)
+  : transport_(transport) {}
+
+Status CaptureTransport::Create(const boost::shared_ptr<TTransport>& transport,
+    WireProtocol protocol, const string& path,
+    boost::shared_ptr<CaptureTransport>* out) {
+  boost::shared_ptr<CaptureTransport> capture(new CaptureTransport(transport));
+  capture->file_.open(path.c_str(), std::ios::binary | std::ios::trunc);
+  if (!capture->file_.is_open()) {
+    return Status::Error("Failed to open capture file " + path);
+  }
+  capture->file_.write(CAPTURE_MAGIC.data(), CAPTURE_MAGIC.size());
+  capture->file_.put(static_cast<char>(protocol));
+  if (!capture->file_) return Status::Error("Failed to write capture file " + path);
+  *out = capture;
+  return Status::OK();
+}
+
+uint32_t CaptureTransport::read(uint8_t* buf, uint32_t len) {
+  uint32_t bytes_read;
+  try {
+    bytes_read = transport_->read(buf, len);
+  } catch (const TException&) {
+    // The reply won't be read to its end, so it isn't recorded.
+    recv_buf_.clear();
+    throw;
+  }
+  recv_buf_.append(reinterpret_cast<const char*>(buf), bytes_read);
+  return bytes_read;
+}
+
+uint32_t CaptureTransport::readEnd() {
+  WriteRecord(DIRECTION_RECEIVED, &recv_buf_);
+  return transport_->readEnd();
+}
+
+void CaptureTransport::write(const uint8_t* buf, uint32_t len) {
+  send_buf_.append(reinterpret_cast<const char*>(buf), len);
+  transport_->write(buf, len);
+}
+
+void CaptureTransport::flush() {
+  // Sending a request starts a new exchange. Whatever is left of a reply that failed to
+  // deserialize, and so never reached readEnd, is dropped rather than prepended to the
+  // next reply's record.
+  recv_buf_.clear();
+  WriteRecord(DIRECTION_SENT, &send_buf_);
+  transport_->flush();
+}
+
+void CaptureTransport::WriteRecord(uint8_t direction, string* message) {
+  if (message->empty()) return;
+  char header[RECORD_HEADER_SIZE];
+  header[0] = static_cast<char>(direction);
+  uint32_t len = message->size();
+  for (int i = 0; i < 4; ++i) {
+    header[i + 1] = static_cast<char>((len >> (8 * i)) & 0xff);
+  }
+  file_.write(header, RECORD_HEADER_SIZE);
+  file_.write(message->data(), message->size());
+  message->clear();
+}
+
+Status CaptureTransport::Finish() {
+  if (!file_.is_open()) return Status::OK();
+  file_.close();
+  if (!file_) return Status::Error("Failed to write capture file");
+  return Status::OK();
+}
+
+// FetchReplay
+
+struct FetchReplay::FetchReplayImpl {
+  // The contents of the capture file.
+  string contents;
+
+  // The offset and length in 'contents' of each FetchResults reply.
+  std::vector<std::pair<uint32_t, uint32_t>> replies;
+  int64_t num_reply_bytes;
+
+  // The index in 'replies' of the next reply to return.
+  size_t next_reply;
+
+  // Each reply is fed into the client through 'buffer'.
+  boost::shared_ptr<TMemoryBuffer> buffer;
+  unique_ptr<impala::ImpalaHiveServer2ServiceClient> client;
+};
+
+FetchReplay::FetchReplay() : impl_(new FetchReplayImpl()) {}
+
+FetchReplay::~FetchReplay() = default;
+
+Status FetchReplay::Open(const string& path, unique_ptr<FetchReplay>* replay) {
+  unique_ptr<FetchReplay> out(new FetchReplay());
+  FetchReplayImpl* impl = out->impl_.get();
+
+  std::ifstream file(path.c_str(), std::ios::binary);
+  if (!file.is_open()) return Status::Error("Failed to open capture file " + path);
+  std::stringstream ss;
+  ss << file.rdbuf();
+  impl->contents = ss.str();
+
+  const string& contents = impl->contents;
+  size_t header_size = CAPTURE_MAGIC.size() + 1;
+  if (contents.size() < header_size || contents.compare(0, CAPTURE_MAGIC.size(),
+      CAPTURE_MAGIC) != 0) {
+    return Status::Error(path + " is not a capture file");
+  }
+  uint8_t protocol_id = contents[CAPTURE_MAGIC.size()];
+  if (protocol_id != static_cast<uint8_t>(WireProtocol::BINARY) &&
+      protocol_id != static_cast<uint8_t>(WireProtocol::COMPACT)) {
+    std::stringstream msg;
+    msg << "Unsupported capture protocol " << static_cast<int>(protocol_id);
+    return Status::Error(msg.str());
+  }
+  WireProtocol protocol = static_cast<WireProtocol>(protocol_id);
+
+  impl->buffer.reset(new TMemoryBuffer());
+  boost::shared_ptr<TProtocol> iprot = NewProtocol(protocol, impl->buffer);
+  // Replaying never sends anything, but the client requires an output protocol.
+  boost::shared_ptr<TProtocol> oprot = NewProtocol(protocol,
+      boost::shared_ptr<TTransport>(new TMemoryBuffer()));
+  impl->client.reset(new impala::ImpalaHiveServer2ServiceClient(iprot, oprot));
+
+  // Index the FetchResults replies.
+  impl->num_reply_bytes = 0;
+  size_t offset = header_size;
+  while (offset < contents.size()) {
+    if (contents.size() - offset < RECORD_HEADER_SIZE) {
+      return Status::Error(path + " is truncated");
+    }
+    uint8_t direction = contents[offset];
+    uint32_t len = 0;
+    for (int i = 0; i < 4; ++i) {
+      len |= static_cast<uint32_t>(static_cast<uint8_t>(contents[offset + 1 + i]))
+          << (8 * i);
+    }
+    offset += RECORD_HEADER_SIZE;
+    if (contents.size() - offset < len) return Status::Error(path + " is truncated");
+
+    if (direction == DIRECTION_RECEIVED) {
+      string name;
+      TMessageType type;
+      int32_t seqid;
+      try {
+        impl->buffer->resetBuffer(
+            reinterpret_cast<uint8_t*>(&impl->contents[offset]), len);
+        iprot->readMessageBegin(name, type, seqid);
+      } catch (const TException& e) {
+        return Status::Error(string("Invalid message in capture file: ") + e.what());
+      }
+      if (name == "FetchResults") {
+        impl->replies.push_back(std::make_pair(offset, len));
+        impl->num_reply_bytes += len;
+      }
+    }
+    offset += len;
+  }
+
+  impl->next_reply = 0;
+  *replay = std::move(out);
+  return Status::OK();
+}
+
+Status FetchReplay::Next(unique_ptr<ColumnarRowSet>* results, bool* has_more_rows,
+    bool* eos) {
+  if (impl_->next_reply >= impl_->replies.size()) {
+    *eos = true;
+    return Status::OK();
+  }
+  *eos = false;
+
+  const std::pair<uint32_t, uint32_t>& reply = impl_->replies[impl_->next_reply++];
+  impl_->buffer->resetBuffer(
+      reinterpret_cast<uint8_t*>(&impl_->contents[reply.first]), reply.second);
+
+  unique_ptr<ColumnarRowSet::ColumnarRowSetImpl> row_set_impl(
+      new ColumnarRowSet::ColumnarRowSetImpl());
+  TRY_RPC_OR_RETURN(RecvFetchResults(impl_->client->getInputProtocol().get(),
+      &row_set_impl->resp, &row_set_impl->string_columns));
+  RETURN_NOT_OK(row_set_impl->resp.status);
+
+  *has_more_rows = row_set_impl->resp.hasMoreRows;
+  results->reset(new ColumnarRowSet(row_set_impl.release()));
+  return Status::OK();
+}
+
+void FetchReplay::Rewind() {
+  impl_->next_reply = 0;
+}
+
+int FetchReplay::num_replies() const {
+  return impl_->replies.size();
+}
+
+int64_t FetchReplay::num_reply_bytes() const {
+  return impl_->num_reply_bytes;
+}
+
+} // namespace hs2client
@@ -0,0 +1,91 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HS2CLIENT_CAPTURE_H
+#define HS2CLIENT_CAPTURE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "hs2client/columnar-row-set.h"
+#include "hs2client/macros.h"
+#include "hs2client/status.h"
+
+namespace hs2client {
+
+// Capture files are recorded by Service::StartCapture, and contain the raw bytes of
+// every RPC message sent and received by a Service. A capture file consists of:
+// - An 8 byte magic number, "HS2CAP01".
+// - A 1 byte protocol id, the WireProtocol used to serialize messages.
+// - One record per message, consisting of a 1 byte direction (0 for a request sent by
+//   the client, 1 for a reply received from the server), a 4 byte little-endian
+//   length, and the serialized message.
+
+// Replays the FetchResults replies in a capture file, deserializing them in the same
+// way as Operation::Fetch but without a server. Used to profile deserialization and
+// conversion of real result sets offline. All other messages in the file are skipped.
+//
+// The whole file is read into memory by Open.
+//
+// Example:
+// unique_ptr<FetchReplay> replay;
+// HS2CLIENT_RETURN_IF_ERROR(FetchReplay::Open("fetch.cap", &replay));
+// bool eos = false;
+// while (true) {
+//   unique_ptr<ColumnarRowSet> results;
+//   bool has_more_rows;
+//   HS2CLIENT_RETURN_IF_ERROR(replay->Next(&results, &has_more_rows, &eos));
+//   if (eos) break;
+//   ...
+// }
+//
+// This class is not thread-safe.
+class FetchReplay {
+ public:
+  // Reads the capture file at 'path'. Returns an error if it can't be read or isn't a
+  // valid capture file.
+  static Status Open(const std::string& path, std::unique_ptr<FetchReplay>* replay);
+
+  ~FetchReplay();
+
+  // Deserializes the next FetchResults reply into 'results' and sets 'has_more_rows'
+  // to the value that the server returned. Sets 'eos' to true if there are no more
+  // replies, in which case 'results' is not set. Returns an error if the reply can't
+  // be deserialized or if the server returned an error status.
+  Status Next(std::unique_ptr<ColumnarRowSet>* results, bool* has_more_rows, bool* eos);
+
+  // Restarts replaying from the first FetchResults reply.
+  void Rewind();
+
+  // Returns the number of FetchResults replies in the file.
+  int num_replies() const;
+
+  // Returns the total size in bytes of the serialized FetchResults replies.
+  int64_t num_reply_bytes() const;
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(FetchReplay);
+
+  // Hides Thrift objects from the header.
+  struct FetchReplayImpl;
+
+  FetchReplay();
+
+  std::unique_ptr<FetchReplayImpl> impl_;
+};
+
+} // namespace hs2client
+
+#endif // HS2CLIENT_CAPTURE_H
@@ -14,26 +14,517 @@
 
 #include "hs2client/columnar-row-set.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#include <thrift/protocol/TBinaryProtocol.h>
+
 #include "hs2client/logging.h"
+#include "hs2client/parse-util.h"
 #include "hs2client/thrift-internal.h"
 
 #include "gen-cpp/TCLIService.h"
 
 namespace hs2 = apache::hive::service::cli::thrift;
+using apache::thrift::TApplicationException;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TProtocolException;
+using apache::thrift::protocol::TType;
+using apache::thrift::transport::TTransport;
+using std::string;
 using std::unique_ptr;
 
 namespace hs2client {
 
+// FetchResults deserialization
+//
+// These functions mirror the Thrift-generated read() functions for TFetchResultsResp
+// and its children, except that TStringColumn and TBinaryColumn are read into
+// StringColumnData. All other structs are read with their generated read().
+namespace {
+
+// A guess at the average size of a string value, used to size the buffer of a column
+// before its values are read. It grows as usual if the guess is too small.
+const size_t EXPECTED_STRING_VALUE_SIZE = 8;
+
+// Throws if 'size' more bytes of values would overflow the int32 offsets of 'out'.
+void CheckStringColumnSize(const StringColumnData& out, size_t size) {
+  if (out.data.size() + size > static_cast<size_t>(INT32_MAX)) {
+    throw TProtocolException(TProtocolException::SIZE_LIMIT,
+        "String column exceeds 2GB in one batch");
+  }
+}
+
+// Reads a TStringColumn or TBinaryColumn. With the binary protocol, whose strings are
+// a length followed by the bytes, each value is read straight into 'out->data'. Other
+// protocols read each value into a scratch string whose capacity is reused, so no
+// allocation is needed per value.
+uint32_t ReadStringColumn(TProtocol* iprot, StringColumnData* out) {
+  uint32_t xfer = 0;
+  string fname;
+  TType ftype;
+  int16_t fid;
+  string value;
+  bool binary_protocol = dynamic_cast<TBinaryProtocol*>(iprot) != NULL;
+  TTransport* trans = iprot->getTransport().get();
+
+  xfer += iprot->readStructBegin(fname);
+  while (true) {
+    xfer += iprot->readFieldBegin(fname, ftype, fid);
+    if (ftype == apache::thrift::protocol::T_STOP) break;
+
+    if (fid == 1 && ftype == apache::thrift::protocol::T_LIST) {
+      TType etype;
+      uint32_t size;
+      xfer += iprot->readListBegin(etype, size);
+      out->offsets.clear();
+      out->offsets.reserve(size + 1);
+      out->offsets.push_back(0);
+      out->data.reserve(std::min(static_cast<size_t>(INT32_MAX),
+          out->data.size() + size * EXPECTED_STRING_VALUE_SIZE));
+      for (uint32_t i = 0; i < size; ++i) {
+        if (binary_protocol) {
+          int32_t len;
+          xfer += iprot->readI32(len);
+          if (len < 0) throw TProtocolException(TProtocolException::NEGATIVE_SIZE);
+          CheckStringColumnSize(*out, len);
+          size_t start = out->data.size();
+          out->data.resize(start + len);
+          if (len > 0) {
+            xfer += trans->readAll(reinterpret_cast<uint8_t*>(&out->data[start]), len);
+          }
+        } else {
+          xfer += iprot->readBinary(value);
+          CheckStringColumnSize(*out, value.size());
+          out->data.append(value);
+        }
+        out->offsets.push_back(static_cast<int32_t>(out->data.size()));
+      }
+      xfer += iprot->readListEnd();
+    } else if (fid == 2 && ftype == apache::thrift::protocol::T_STRING) {
+      xfer += iprot->readBinary(out->nulls);
+    } else {
+      xfer += iprot->skip(ftype);
+    }
+    xfer += iprot->readFieldEnd();
+  }
+  xfer += iprot->readStructEnd();
+
+  if (out->offsets.empty()) out->offsets.push_back(0);
+  return xfer;
+}
+
+// Reads a TColumn union. 'string_data' is set if the column is a STRING or BINARY.
+uint32_t ReadColumn(TProtocol* iprot, hs2::TColumn* col,
+    unique_ptr<StringColumnData>* string_data) {
+  uint32_t xfer = 0;
+  string fname;
+  TType ftype;
+  int16_t fid;
+
+  xfer += iprot->readStructBegin(fname);
+  while (true) {
+    xfer += iprot->readFieldBegin(fname, ftype, fid);
+    if (ftype == apache::thrift::protocol::T_STOP) break;
+
+    if (ftype != apache::thrift::protocol::T_STRUCT) {
+      xfer += iprot->skip(ftype);
+      xfer += iprot->readFieldEnd();
+      continue;
+    }
+
+    switch (fid) {
+      case 1:
+        xfer += col->boolVal.read(iprot);
+        col->__isset.boolVal = true;
+        break;
+      case 2:
+        xfer += col->byteVal.read(iprot);
+        col->__isset.byteVal = true;
+        break;
+      case 3:
+        xfer += col->i16Val.read(iprot);
+        col->__isset.i16Val = true;
+        break;
+      case 4:
+        xfer += col->i32Val.read(iprot);
+        col->__isset.i32Val = true;
+        break;
+      case 5:
+        xfer += col->i64Val.read(iprot);
+        col->__isset.i64Val = true;
+        break;
+      case 6:
+        xfer += col->doubleVal.read(iprot);
+        col->__isset.doubleVal = true;
+        break;
+      case 7:
+        string_data->reset(new StringColumnData());
+        xfer += ReadStringColumn(iprot, string_data->get());
+        col->__isset.stringVal = true;
+        break;
+      case 8:
+        string_data->reset(new StringColumnData());
+        xfer += ReadStringColumn(iprot, string_data->get());
+        col->__isset.binaryVal = true;
+        break;
+      default:
+        xfer += iprot->skip(ftype);
+        break;
+    }
+    xfer += iprot->readFieldEnd();
+  }
+  xfer += iprot->readStructEnd();
+  return xfer;
+}
+
+uint32_t ReadRowSet(TProtocol* iprot, hs2::TRowSet* row_set,
+    std::vector<unique_ptr<StringColumnData>>* string_columns) {
+  uint32_t xfer = 0;
+  string fname;
+  TType ftype;
+  int16_t fid;
+
+  xfer += iprot->readStructBegin(fname);
+  while (true) {
+    xfer += iprot->readFieldBegin(fname, ftype, fid);
+    if (ftype == apache::thrift::protocol::T_STOP) break;
+
+    if (fid == 1 && ftype == apache::thrift::protocol::T_I64) {
+      xfer += iprot->readI64(row_set->startRowOffset);
+    } else if (fid == 2 && ftype == apache::thrift::protocol::T_LIST) {
+      TType etype;
+      uint32_t size;
+      xfer += iprot->readListBegin(etype, size);
+      row_set->rows.resize(size);
+      for (uint32_t i = 0; i < size; ++i) {
+        xfer += row_set->rows[i].read(iprot);
+      }
+      xfer += iprot->readListEnd();
+    } else if (fid == 3 && ftype == apache::thrift::protocol::T_LIST) {
+      TType etype;
+      uint32_t size;
+      xfer += iprot->readListBegin(etype, size);
+      row_set->columns.resize(size);
+      string_columns->resize(size);
+      for (uint32_t i = 0; i < size; ++i) {
+        xfer += ReadColumn(iprot, &row_set->columns[i], &(*string_columns)[i]);
+      }
+      xfer += iprot->readListEnd();
+      row_set->__isset.columns = true;
+    } else {
+      xfer += iprot->skip(ftype);
+    }
+    xfer += iprot->readFieldEnd();
+  }
+  xfer += iprot->readStructEnd();
+  return xfer;
+}
+
+uint32_t ReadFetchResultsResp(TProtocol* iprot, hs2::TFetchResultsResp* resp,
+    std::vector<unique_ptr<StringColumnData>>* string_columns) {
+  uint32_t xfer = 0;
+  string fname;
+  TType ftype;
+  int16_t fid;
+
+  xfer += iprot->readStructBegin(fname);
+  while (true) {
+    xfer += iprot->readFieldBegin(fname, ftype, fid);
+    if (ftype == apache::thrift::protocol::T_STOP) break;
+
+    if (fid == 1 && ftype == apache::thrift::protocol::T_STRUCT) {
+      xfer += resp->status.read(iprot);
+    } else if (fid == 2 && ftype == apache::thrift::protocol::T_BOOL) {
+      xfer += iprot->readBool(resp->hasMoreRows);
+      resp->__isset.hasMoreRows = true;
+    } else if (fid == 3 && ftype == apache::thrift::protocol::T_STRUCT) {
+      xfer += ReadRowSet(iprot, &resp->results, string_columns);
+      resp->__isset.results = true;
+    } else {
+      xfer += iprot->skip(ftype);
+    }
+    xfer += iprot->readFieldEnd();
+  }
+  xfer += iprot->readStructEnd();
+  return xfer;
+}
+
+// Moves the null bits of the first 'n' values in 'nulls' to 'front', and shifts the
+// rest down. Either bitmap may be shorter than its values, as the server may trim
+// trailing zero bytes.
+void SplitNulls(int64_t n, string* nulls, string* front) {
+  int64_t size = nulls->size();
+  int64_t front_size = std::min(size, (n + 7) / 8);
+  int shift = n % 8;
+  front->assign(*nulls, 0, front_size);
+  if (shift != 0 && front_size == (n + 7) / 8) {
+    (*front)[front_size - 1] &= static_cast<char>((1 << shift) - 1);
+  }
+
+  string rest;
+  for (int64_t i = n / 8; i < size; ++i) {
+    uint8_t lo = static_cast<uint8_t>((*nulls)[i]);
+    uint8_t hi = i + 1 < size ? static_cast<uint8_t>((*nulls)[i + 1]) : 0;
+    rest.push_back(static_cast<char>(
+        shift == 0 ? lo : (lo >> shift) | static_cast<uint8_t>(hi << (8 - shift))));
+  }
+  nulls->swap(rest);
+}
+
+// Moves the first 'n' values of 'col', one of the typed members of a TColumn, to
+// 'front'.
+template <typename T>
+void SplitValues(int64_t n, T* col, T* front) {
+  front->values.assign(col->values.begin(), col->values.begin() + n);
+  col->values.erase(col->values.begin(), col->values.begin() + n);
+  SplitNulls(n, &col->nulls, &front->nulls);
+}
+
+// Moves the first 'n' values of 'data' to 'front'.
+void SplitStrings(int64_t n, StringColumnData* data, StringColumnData* front) {
+  int32_t end = data->offsets[n];
+  front->offsets.assign(data->offsets.begin(), data->offsets.begin() + n + 1);
+  front->data.assign(data->data, 0, end);
+  data->offsets.erase(data->offsets.begin(), data->offsets.begin() + n);
+  for (int32_t& offset : data->offsets) offset -= end;
+  data->data.erase(0, end);
+  SplitNulls(n, &data->nulls, &front->nulls);
+}
+
+} // namespace
+
+// Equivalent to the generated TCLIServiceClient::recv_FetchResults.
+void RecvFetchResults(TProtocol* iprot, hs2::TFetchResultsResp* resp,
+    std::vector<unique_ptr<StringColumnData>>* string_columns) {
+  int32_t rseqid = 0;
+  string fname;
+  TMessageType mtype;
+
+  iprot->readMessageBegin(fname, mtype, rseqid);
+  if (mtype == apache::thrift::protocol::T_EXCEPTION) {
+    TApplicationException x;
+    x.read(iprot);
+    iprot->readMessageEnd();
+    iprot->getTransport()->readEnd();
+    throw x;
+  }
+  if (mtype != apache::thrift::protocol::T_REPLY || fname != "FetchResults") {
+    iprot->skip(apache::thrift::protocol::T_STRUCT);
+    iprot->readMessageEnd();
+    iprot->getTransport()->readEnd();
+    throw TApplicationException(TApplicationException::INVALID_MESSAGE_TYPE,
+        "Unexpected reply to FetchResults: " + fname);
+  }
+
+  // The reply is a struct with the result in field 0.
+  bool has_result = false;
+  TType ftype;
+  int16_t fid;
+  iprot->readStructBegin(fname);
+  while (true) {
+    iprot->readFieldBegin(fname, ftype, fid);
+    if (ftype == apache::thrift::protocol::T_STOP) break;
+
+    if (fid == 0 && ftype == apache::thrift::protocol::T_STRUCT) {
+      ReadFetchResultsResp(iprot, resp, string_columns);
+      has_result = true;
+    } else {
+      iprot->skip(ftype);
+    }
+    iprot->readFieldEnd();
+  }
+  iprot->readStructEnd();
+  iprot->readMessageEnd();
+  iprot->getTransport()->readEnd();
+
+  if (!has_result) {
+    throw TApplicationException(TApplicationException::MISSING_RESULT,
+        "FetchResults failed: unknown result");
+  }
+}
+
+void FetchResults(impala::ImpalaHiveServer2ServiceClient* client,
+    const hs2::TFetchResultsReq& req, hs2::TFetchResultsResp* resp,
+    std::vector<unique_ptr<StringColumnData>>* string_columns) {
+  client->send_FetchResults(req);
+  RecvFetchResults(client->getInputProtocol().get(), resp, string_columns);
+}
+
+void ColumnarRowSet::ColumnarRowSetImpl::MaterializeStrings(int i) {
+  if (i >= static_cast<int>(string_columns.size()) || !string_columns[i]) return;
+  StringColumnData* data = string_columns[i].get();
+  // GetStringCol is const, so may be called concurrently for the same column.
+  std::call_once(data->materialize_once, [this, i, data]() {
+    // The StringColumn accessors read from stringVal for both STRING and BINARY columns.
+    hs2::TStringColumn& col = resp.results.columns[i].stringVal;
+    size_t length = data->offsets.size() - 1;
+    col.values.resize(length);
+    for (size_t j = 0; j < length; ++j) {
+      col.values[j].assign(data->data, data->offsets[j],
+          data->offsets[j + 1] - data->offsets[j]);
+    }
+    col.nulls = data->nulls;
+  });
+}
+
+unique_ptr<ColumnarRowSet::ColumnarRowSetImpl>
+ColumnarRowSet::ColumnarRowSetImpl::SplitFront(int64_t num_rows) {
+  unique_ptr<ColumnarRowSetImpl> front(new ColumnarRowSetImpl());
+  front->resp.status = resp.status;
+  front->resp.__set_hasMoreRows(true);
+  front->resp.__isset.results = resp.__isset.results;
+  hs2::TRowSet& rows = resp.results;
+  hs2::TRowSet& front_rows = front->resp.results;
+  front_rows.startRowOffset = rows.startRowOffset;
+  rows.startRowOffset += num_rows;
+  front_rows.__isset.columns = rows.__isset.columns;
+  front_rows.columns.resize(rows.columns.size());
+  front->string_columns.resize(string_columns.size());
+
+  for (size_t i = 0; i < rows.columns.size(); ++i) {
+    hs2::TColumn& col = rows.columns[i];
+    hs2::TColumn& front_col = front_rows.columns[i];
+    front_col.__isset = col.__isset;
+    if (i < string_columns.size() && string_columns[i]) {
+      front->string_columns[i].reset(new StringColumnData());
+      SplitStrings(num_rows, string_columns[i].get(), front->string_columns[i].get());
+    } else if (col.__isset.boolVal) {
+      SplitValues(num_rows, &col.boolVal, &front_col.boolVal);
+    } else if (col.__isset.byteVal) {
+      SplitValues(num_rows, &col.byteVal, &front_col.byteVal);
+    } else if (col.__isset.i16Val) {
+      SplitValues(num_rows, &col.i16Val, &front_col.i16Val);
+    } else if (col.__isset.i32Val) {
+      SplitValues(num_rows, &col.i32Val, &front_col.i32Val);
+    } else if (col.__isset.i64Val) {
+      SplitValues(num_rows, &col.i64Val, &front_col.i64Val);
+    } else if (col.__isset.doubleVal) {
+      SplitValues(num_rows, &col.doubleVal, &front_col.doubleVal);
+    } else if (col.__isset.stringVal) {
+      SplitValues(num_rows, &col.stringVal, &front_col.stringVal);
+    } else if (col.__isset.binaryVal) {
+      SplitValues(num_rows, &col.binaryVal, &front_col.binaryVal);
+    }
+  }
+  return front;
+}
+
 Column::Column(const std::string* nulls) {
   DCHECK(nulls);
   nulls_ = reinterpret_cast<const uint8_t*>(nulls->c_str());
   nulls_size_ = nulls->size();
 }
 
+// The bitmap that columns which own their values are constructed with, before they
+// point Column at their own.
+static const std::string* EmptyNulls() {
+  static const std::string empty;
+  return &empty;
+}
+
+// Parses the values of 'col' with parse(StringPiece, T*), which returns false for invalid
+// values, into 'data'. 'null_bits' is set to the null bitmap of 'col', extended to its
+// length, with the invalid values set. Returns the number of invalid values.
+template <typename T, typename ParseFn>
+static int64_t ParseColumn(const StringViewColumn& col, const ParseFn& parse,
+    std::vector<T>* data, std::string* null_bits) {
+  int64_t length = col.length();
+  data->assign(length, T());
+  null_bits->assign((length + 7) / 8, '\0');
+  // The source bitmap may be shorter than the column, see HUE-2722.
+  size_t nulls_size = std::min<size_t>(col.nulls_size(), null_bits->size());
+  null_bits->replace(0, nulls_size, reinterpret_cast<const char*>(col.nulls()),
+      nulls_size);
+
+  int64_t num_invalid = 0;
+  for (int64_t i = 0; i < length; ++i) {
+    char& null_byte = (*null_bits)[i / 8];
+    if (null_byte & (1 << (i % 8))) continue;
+    if (!parse(col.GetData(i), &(*data)[i])) {
+      (*data)[i] = T();
+      null_byte |= static_cast<char>(1 << (i % 8));
+      ++num_invalid;
+    }
+  }
+  return num_invalid;
+}
+
+TimestampColumn::TimestampColumn(const StringViewColumn& col) : Column(EmptyNulls()) {
+  num_invalid_ = ParseColumn(col, [](const StringPiece& value, int64_t* out) {
+    return ParseTimestamp(value.data(), value.size(), out);
+  }, &data_, &null_bits_);
+  nulls_ = reinterpret_cast<const uint8_t*>(null_bits_.data());
+  nulls_size_ = null_bits_.size();
+}
+
+DateColumn::DateColumn(const StringViewColumn& col) : Column(EmptyNulls()) {
+  num_invalid_ = ParseColumn(col, [](const StringPiece& value, int32_t* out) {
+    return ParseDate(value.data(), value.size(), out);
+  }, &data_, &null_bits_);
+  nulls_ = reinterpret_cast<const uint8_t*>(null_bits_.data());
+  nulls_size_ = null_bits_.size();
+}
+
+Decimal128Column::Decimal128Column(const StringViewColumn& col, int precision, int scale)
+  : Column(EmptyNulls()), precision_(precision), scale_(scale) {
+  num_invalid_ = ParseColumn(col, [scale](const StringPiece& value, int128_t* out) {
+    return ParseDecimal(value.data(), value.size(), scale, out);
+  }, &data_, &null_bits_);
+  nulls_ = reinterpret_cast<const uint8_t*>(null_bits_.data());
+  nulls_size_ = null_bits_.size();
+}
+
+string Decimal128Column::FormatData(int i) const {
+  return FormatDecimal(data_[i], scale_);
+}
+
+void Decimal128Column::ToDouble(double* out) const {
+  // Powers of 10 up to 10^22 are exact in a double.
+  double divisor = static_cast<double>(PowerOfTen(scale_));
+  for (size_t i = 0; i < data_.size(); ++i) {
+    out[i] = IsNull(i) ? NAN : static_cast<double>(data_[i]) / divisor;
+  }
+}
+
+bool Decimal128Column::ToInt64(int64_t* out) const {
+  for (size_t i = 0; i < data_.size(); ++i) {
+    int128_t value = data_[i];
+    if (value < INT64_MIN || value > INT64_MAX) return false;
+    out[i] = static_cast<int64_t>(value);
+  }
+  return true;
+}
+
 ColumnarRowSet::ColumnarRowSet(ColumnarRowSetImpl* impl) : impl_(impl) {}
 
 ColumnarRowSet::~ColumnarRowSet() = default;
 
+int ColumnarRowSet::num_columns() const {
+  return impl_->resp.results.columns.size();
+}
+
+int64_t ColumnarRowSet::num_rows() const {
+  if (impl_->resp.results.columns.empty()) return 0;
+  if (!impl_->string_columns.empty() && impl_->string_columns[0]) {
+    return impl_->string_columns[0]->offsets.size() - 1;
+  }
+  const hs2::TColumn& col = impl_->resp.results.columns[0];
+  if (col.__isset.boolVal) return col.boolVal.values.size();
+  if (col.__isset.byteVal) return col.byteVal.values.size();
+  if (col.__isset.i16Val) return col.i16Val.values.size();
+  if (col.__isset.i32Val) return col.i32Val.values.size();
+  if (col.__isset.i64Val) return col.i64Val.values.size();
+  if (col.__isset.doubleVal) return col.doubleVal.values.size();
+  if (col.__isset.stringVal) return col.stringVal.values.size();
+  if (col.__isset.binaryVal) return col.binaryVal.values.size();
+  return 0;
+}
+
 template <typename T>
 struct type_helpers {};
 
@@ -65,10 +556,59 @@ unique_ptr<T> ColumnarRowSet::GetCol(int i) const {
 
   DCHECK_LT(i, static_cast<int>(impl_->resp.results.columns.size()));
 
+  if (std::is_same<T, StringColumn>::value) impl_->MaterializeStrings(i);
+
   const hs2::TColumn& col = impl_->resp.results.columns[i];
   return unique_ptr<T>(new T(helper::GetNulls(col), helper::GetValues(col)));
 }
 
+template <>
+unique_ptr<StringViewColumn> ColumnarRowSet::GetCol<StringViewColumn>(int i) const {
+  DCHECK_LT(i, static_cast<int>(impl_->resp.results.columns.size()));
+
+  // Other column types are returned as empty, as for the typed getters.
+  static const StringColumnData* EMPTY_COLUMN = [] {
+    StringColumnData* data = new StringColumnData();
+    data->offsets.push_back(0);
+    return data;
+  }();
+  const StringColumnData* data = EMPTY_COLUMN;
+  if (i < static_cast<int>(impl_->string_columns.size()) && impl_->string_columns[i]) {
+    data = impl_->string_columns[i].get();
+  }
+
+  return unique_ptr<StringViewColumn>(new StringViewColumn(&data->nulls,
+      data->data.data(), data->offsets.data(), data->offsets.size() - 1));
+}
+
+unique_ptr<StringViewColumn> ColumnarRowSet::GetStringViewCol(int i) const {
+  return GetCol<StringViewColumn>(i);
+}
+
+template <>
+unique_ptr<TimestampColumn> ColumnarRowSet::GetCol<TimestampColumn>(int i) const {
+  return unique_ptr<TimestampColumn>(new TimestampColumn(*GetStringViewCol(i)));
+}
+
+unique_ptr<TimestampColumn> ColumnarRowSet::GetTimestampCol(int i) const {
+  return GetCol<TimestampColumn>(i);
+}
+
+template <>
+unique_ptr<DateColumn> ColumnarRowSet::GetCol<DateColumn>(int i) const {
+  return unique_ptr<DateColumn>(new DateColumn(*GetStringViewCol(i)));
+}
+
+unique_ptr<DateColumn> ColumnarRowSet::GetDateCol(int i) const {
+  return GetCol<DateColumn>(i);
+}
+
+unique_ptr<Decimal128Column> ColumnarRowSet::GetDecimal128Col(int i,
+    const DecimalType& type) const {
+  return unique_ptr<Decimal128Column>(
+      new Decimal128Column(*GetStringViewCol(i), type.precision(), type.scale()));
+}
+
 #define TYPED_GETTER(FUNC_NAME, TYPE)                                   \
   unique_ptr<TYPE> ColumnarRowSet::FUNC_NAME(int i) const {             \
     return GetCol<TYPE>(i);                                             \
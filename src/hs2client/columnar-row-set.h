@@ -21,6 +21,7 @@
 #include <vector>
 
 #include "hs2client/macros.h"
+#include "hs2client/types.h"
 
 namespace hs2client {
 
@@ -93,6 +94,202 @@ class TypedColumn : public Column {
   const std::vector<T>* data_;
 };
 
+// A reference to a string value that is owned by someone else, e.g. a
+// StringViewColumn. Modeled after std::string_view, which is not available in C++11.
+class StringPiece {
+ public:
+  StringPiece() : data_(NULL), size_(0) {}
+  StringPiece(const char* data, int32_t size) : data_(data), size_(size) {}
+  StringPiece(const std::string& str)  // NOLINT(runtime/explicit)
+    : data_(str.data()), size_(static_cast<int32_t>(str.size())) {}
+
+  const char* data() const { return data_; }
+  int32_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  char operator[](int32_t i) const { return data_[i]; }
+
+  std::string ToString() const { return std::string(data_, size_); }
+
+  bool operator==(const StringPiece& other) const {
+    return size_ == other.size_ && std::char_traits<char>::compare(
+        data_, other.data_, size_) == 0;
+  }
+  bool operator!=(const StringPiece& other) const { return !(*this == other); }
+
+ private:
+  const char* data_;
+  int32_t size_;
+};
+
+// Provides access to the values of a STRING or BINARY column without a separate
+// allocation per value. The values are stored back to back in a single buffer, data(),
+// and the i-th value spans the bytes [offsets()[i], offsets()[i + 1]) of that buffer,
+// so offsets() has length() + 1 entries.
+//
+// Example:
+// unique_ptr<StringViewColumn> col = columnar_row_set->GetStringViewCol(0);
+// for (int i = 0; i < col->length(); i++) {
+//   if (!col->IsNull(i)) {
+//     StringPiece value = col->GetData(i);
+//     cout.write(value.data(), value.size()) << "\n";
+//   }
+// }
+class StringViewColumn : public Column {
+ public:
+  int64_t length() const { return length_; }
+
+  const char* data() const { return data_; }
+  const int32_t* offsets() const { return offsets_; }
+
+  // Returns the value for the i-th row within this set of data for this column.
+  StringPiece GetData(int i) const {
+    return StringPiece(data_ + offsets_[i], offsets_[i + 1] - offsets_[i]);
+  }
+
+ private:
+  // For access to the c'tor.
+  friend class ColumnarRowSet;
+
+  StringViewColumn(const std::string* nulls, const char* data, const int32_t* offsets,
+      int64_t length)
+      : Column(nulls), data_(data), offsets_(offsets), length_(length) {}
+
+  const char* data_;
+  const int32_t* offsets_;
+  int64_t length_;
+};
+
+// Provides the values of a TIMESTAMP column, which HiveServer2 sends as strings, as
+// nanoseconds since the Unix epoch. The strings are parsed with ParseTimestamp when the
+// column is created, and no time zone is applied. Values that can't be parsed, or are
+// outside of the range of int64 nanoseconds, are null, and counted by num_invalid().
+//
+// Unlike other columns, a TimestampColumn owns its values, so it remains valid after
+// the ColumnarRowSet that created it is destroyed.
+//
+// Example:
+// unique_ptr<TimestampColumn> col = columnar_row_set->GetTimestampCol(0);
+// for (int i = 0; i < col->length(); i++) {
+//   if (!col->IsNull(i)) cout << col->GetData(i) << "\n";
+// }
+class TimestampColumn : public Column {
+ public:
+  int64_t length() const { return data_.size(); }
+
+  // The nanoseconds of each value, or 0 for nulls.
+  const std::vector<int64_t>& data() const { return data_; }
+
+  // Returns the value for the i-th row within this set of data for this column.
+  int64_t GetData(int i) const { return data_[i]; }
+
+  // The number of values that weren't null in the result set, but couldn't be parsed.
+  int64_t num_invalid() const { return num_invalid_; }
+
+ private:
+  // For access to the c'tor.
+  friend class ColumnarRowSet;
+
+  explicit TimestampColumn(const StringViewColumn& col);
+
+  std::vector<int64_t> data_;
+
+  // The null bitmap, which includes the invalid values.
+  std::string null_bits_;
+
+  int64_t num_invalid_;
+};
+
+// Provides the values of a DATE column, which HiveServer2 sends as 'YYYY-MM-DD' strings,
+// as the number of days since the Unix epoch. The strings are parsed with ParseDate when
+// the column is created. Values that can't be parsed are null, and counted by
+// num_invalid().
+//
+// As for TimestampColumn, the column owns its values.
+class DateColumn : public Column {
+ public:
+  int64_t length() const { return data_.size(); }
+
+  // The days of each value, or 0 for nulls.
+  const std::vector<int32_t>& data() const { return data_; }
+
+  // Returns the value for the i-th row within this set of data for this column.
+  int32_t GetData(int i) const { return data_[i]; }
+
+  // The number of values that weren't null in the result set, but couldn't be parsed.
+  int64_t num_invalid() const { return num_invalid_; }
+
+ private:
+  // For access to the c'tor.
+  friend class ColumnarRowSet;
+
+  explicit DateColumn(const StringViewColumn& col);
+
+  std::vector<int32_t> data_;
+
+  // The null bitmap, which includes the invalid values.
+  std::string null_bits_;
+
+  int64_t num_invalid_;
+};
+
+// Provides the values of a DECIMAL column, which HiveServer2 sends as strings, as
+// unscaled 128-bit integers at the column's scale, eg. "-1.50" in a DECIMAL(5, 2) is
+// -150. The strings are parsed with ParseDecimal when the column is created. Values that
+// can't be parsed are null, and counted by num_invalid().
+//
+// As for TimestampColumn, the column owns its values.
+//
+// Example:
+// unique_ptr<Decimal128Column> col =
+//     columnar_row_set->GetDecimal128Col(0, *column_desc.GetDecimalType());
+// vector<double> values(col->length());
+// col->ToDouble(values.data());
+class Decimal128Column : public Column {
+ public:
+  int64_t length() const { return data_.size(); }
+
+  int precision() const { return precision_; }
+  int scale() const { return scale_; }
+
+  // The unscaled value of each value, or 0 for nulls.
+  const std::vector<int128_t>& data() const { return data_; }
+
+  // Returns the unscaled value for the i-th row within this set of data for this column.
+  int128_t GetData(int i) const { return data_[i]; }
+
+  // Returns the i-th value formatted at the column's scale, eg. "-1.50".
+  std::string FormatData(int i) const;
+
+  // The number of values that weren't null in the result set, but couldn't be parsed.
+  int64_t num_invalid() const { return num_invalid_; }
+
+  // Bulk conversions of all length() values, for clients that don't need the full
+  // precision.
+
+  // Writes each value divided by 10^scale, or NaN for nulls.
+  void ToDouble(double* out) const;
+
+  // Writes each unscaled value, or 0 for nulls, and returns true if they all fit in an
+  // int64. Otherwise returns false, and the contents of 'out' are undefined.
+  bool ToInt64(int64_t* out) const;
+
+ private:
+  // For access to the c'tor.
+  friend class ColumnarRowSet;
+
+  Decimal128Column(const StringViewColumn& col, int precision, int scale);
+
+  const int precision_;
+  const int scale_;
+
+  std::vector<int128_t> data_;
+
+  // The null bitmap, which includes the invalid values.
+  std::string null_bits_;
+
+  int64_t num_invalid_;
+};
+
 typedef TypedColumn<bool> BoolColumn;
 typedef TypedColumn<int8_t> ByteColumn;
 typedef TypedColumn<int16_t> Int16Column;
@@ -122,6 +319,11 @@ class ColumnarRowSet {
  public:
   ~ColumnarRowSet();
 
+  int num_columns() const;
+
+  // The number of rows in this batch. All columns have the same length.
+  int64_t num_rows() const;
+
   std::unique_ptr<BoolColumn> GetBoolCol(int i) const;
   std::unique_ptr<ByteColumn> GetByteCol(int i) const;
   std::unique_ptr<Int16Column> GetInt16Col(int i) const;
@@ -131,6 +333,21 @@ class ColumnarRowSet {
   std::unique_ptr<StringColumn> GetStringCol(int i) const;
   std::unique_ptr<BinaryColumn> GetBinaryCol(int i) const;
 
+  // Returns a STRING or BINARY column without copying its values into std::strings.
+  // Prefer this to GetStringCol or GetBinaryCol, which construct a std::string per
+  // value on first access.
+  std::unique_ptr<StringViewColumn> GetStringViewCol(int i) const;
+
+  // Returns a TIMESTAMP column with its values parsed into nanoseconds.
+  std::unique_ptr<TimestampColumn> GetTimestampCol(int i) const;
+
+  // Returns a DATE column with its values parsed into days since the epoch.
+  std::unique_ptr<DateColumn> GetDateCol(int i) const;
+
+  // Returns a DECIMAL column of type 'type', from the column's ColumnDesc, with its
+  // values parsed into 128-bit integers.
+  std::unique_ptr<Decimal128Column> GetDecimal128Col(int i, const DecimalType& type) const;
+
   template <typename T>
   std::unique_ptr<T> GetCol(int i) const;
 
@@ -141,6 +358,9 @@ class ColumnarRowSet {
   HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(ColumnarRowSet);
 
   // For access to the c'tor.
+  friend class AsyncOperation;
+  friend class ExecuteStatementOperation;
+  friend class FetchReplay;
   friend class Operation;
 
   ColumnarRowSet(ColumnarRowSetImpl* impl);
@@ -148,6 +368,14 @@ class ColumnarRowSet {
   std::unique_ptr<ColumnarRowSetImpl> impl_;
 };
 
+template <>
+std::unique_ptr<StringViewColumn> ColumnarRowSet::GetCol<StringViewColumn>(int i) const;
+
+template <>
+std::unique_ptr<TimestampColumn> ColumnarRowSet::GetCol<TimestampColumn>(int i) const;
+
+template <>
+std::unique_ptr<DateColumn> ColumnarRowSet::GetCol<DateColumn>(int i) const;
 
 } // namespace hs2client
 
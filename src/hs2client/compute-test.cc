@@ -0,0 +1,286 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/compute.h"
+
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using namespace hs2client;
+using namespace std;
+
+void AddValue(int32_t value, Aggregates<int32_t>* aggs) {
+  ++aggs->count;
+  aggs->sum += value;
+  aggs->min = min(aggs->min, value);
+  aggs->max = max(aggs->max, value);
+}
+
+class ComputeTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    // Not a multiple of the block size, with a null bitmap that covers every row.
+    srand(0);
+    num_rows_ = 1000;
+    nulls_.assign((num_rows_ + 7) / 8, 0);
+    for (int i = 0; i < num_rows_; ++i) {
+      values_.push_back(rand() % 100 - 50);
+      if (rand() % 10 == 0) nulls_[i / 8] |= 1 << (i % 8);
+    }
+  }
+
+  bool IsNull(int i) const { return (nulls_[i / 8] & (1 << (i % 8))) != 0; }
+
+  ColumnView<int32_t> view() const {
+    return ColumnView<int32_t>(values_.data(), num_rows_, nulls_.data(), nulls_.size());
+  }
+
+  int num_rows_;
+  vector<int32_t> values_;
+  vector<uint8_t> nulls_;
+};
+
+TEST_F(ComputeTest, TestFilter) {
+  const CompareOp ops[] = {CompareOp::EQ, CompareOp::NE, CompareOp::LT, CompareOp::LE,
+      CompareOp::GT, CompareOp::GE};
+  for (CompareOp op : ops) {
+    SelectionVector expected;
+    for (int i = 0; i < num_rows_; ++i) {
+      int32_t v = values_[i];
+      bool pass = false;
+      switch (op) {
+        case CompareOp::EQ: pass = v == 7; break;
+        case CompareOp::NE: pass = v != 7; break;
+        case CompareOp::LT: pass = v < 7; break;
+        case CompareOp::LE: pass = v <= 7; break;
+        case CompareOp::GT: pass = v > 7; break;
+        case CompareOp::GE: pass = v >= 7; break;
+      }
+      if (pass && !IsNull(i)) expected.push_back(i);
+    }
+    SelectionVector selection;
+    Filter<int32_t>(view(), op, 7, &selection);
+    EXPECT_EQ(selection, expected);
+
+    // Combined with another filter, in place.
+    SelectionVector combined;
+    for (int32_t row : expected) {
+      if (values_[row] % 2 == 0) combined.push_back(row);
+    }
+    SelectionVector even;
+    for (int i = 0; i < num_rows_; ++i) {
+      if (values_[i] % 2 == 0) even.push_back(i);
+    }
+    Filter<int32_t>(view(), op, 7, even, &even);
+    EXPECT_EQ(even, combined);
+  }
+}
+
+TEST_F(ComputeTest, TestFilterNulls) {
+  // Without a null bitmap, and with one that is shorter than the column, see HUE-2722.
+  SelectionVector selection;
+  Filter<int32_t>(ColumnView<int32_t>(values_.data(), num_rows_), CompareOp::GE, -50,
+      &selection);
+  EXPECT_EQ(selection.size(), num_rows_);
+
+  vector<uint8_t> short_nulls(2, 0xff);
+  Filter<int32_t>(ColumnView<int32_t>(values_.data(), num_rows_, short_nulls.data(),
+      short_nulls.size()), CompareOp::GE, -50, &selection);
+  ASSERT_EQ(selection.size(), num_rows_ - 16);
+  EXPECT_EQ(selection[0], 16);
+
+  vector<double> doubles = {1.5, -2.0, 3.0};
+  Filter<double>(ColumnView<double>(doubles.data(), doubles.size()), CompareOp::LT, 2.0,
+      &selection);
+  EXPECT_EQ(selection, SelectionVector({0, 1}));
+}
+
+TEST_F(ComputeTest, TestFilterEquals) {
+  string data = "foobarfoofoox";
+  vector<int32_t> offsets = {0, 3, 6, 9, 9, 13};
+  uint8_t nulls = 1 << 2;
+  StringColumnView col(data.data(), offsets.data(), 5, &nulls, 1);
+  SelectionVector selection;
+  FilterEquals(col, string("foo"), &selection);
+  EXPECT_EQ(selection, SelectionVector({0}));
+  FilterEquals(col, string(""), &selection);
+  EXPECT_EQ(selection, SelectionVector({3}));
+}
+
+TEST_F(ComputeTest, TestAggregate) {
+  Aggregates<int32_t> expected;
+  for (int i = 0; i < num_rows_; ++i) {
+    if (!IsNull(i)) AddValue(values_[i], &expected);
+  }
+
+  Aggregates<int32_t> aggs;
+  Aggregate<int32_t>(view(), &aggs);
+  EXPECT_EQ(aggs.count, expected.count);
+  EXPECT_EQ(aggs.sum, expected.sum);
+  EXPECT_EQ(aggs.min, expected.min);
+  EXPECT_EQ(aggs.max, expected.max);
+
+  // Accumulating a second batch, and merging.
+  Aggregates<int32_t> merged;
+  merged.Merge(aggs);
+  merged.Merge(aggs);
+  Aggregate<int32_t>(view(), &aggs);
+  EXPECT_EQ(aggs.count, 2 * expected.count);
+  EXPECT_EQ(aggs.sum, 2 * expected.sum);
+  EXPECT_EQ(merged.count, aggs.count);
+  EXPECT_EQ(merged.sum, aggs.sum);
+  EXPECT_EQ(merged.min, expected.min);
+
+  // Only the selected rows, which include a null.
+  SelectionVector selection;
+  for (int i = 0; i < num_rows_; i += 3) selection.push_back(i);
+  Aggregates<int32_t> selected;
+  Aggregate<int32_t>(view(), &selected, &selection);
+  int64_t count = 0;
+  int64_t sum = 0;
+  for (int32_t row : selection) {
+    if (IsNull(row)) continue;
+    ++count;
+    sum += values_[row];
+  }
+  EXPECT_EQ(selected.count, count);
+  EXPECT_EQ(selected.sum, sum);
+
+  // All nulls.
+  vector<uint8_t> all_nulls(nulls_.size(), 0xff);
+  Aggregates<int32_t> empty;
+  Aggregate<int32_t>(ColumnView<int32_t>(values_.data(), num_rows_, all_nulls.data(),
+      all_nulls.size()), &empty);
+  EXPECT_EQ(empty.count, 0);
+  EXPECT_EQ(empty.sum, 0);
+
+  vector<double> doubles = {1.5, -2.0, 3.0};
+  Aggregates<double> double_aggs;
+  Aggregate<double>(ColumnView<double>(doubles.data(), doubles.size()), &double_aggs);
+  EXPECT_EQ(double_aggs.count, 3);
+  EXPECT_DOUBLE_EQ(double_aggs.sum, 2.5);
+  EXPECT_EQ(double_aggs.min, -2.0);
+  EXPECT_EQ(double_aggs.max, 3.0);
+}
+
+TEST_F(ComputeTest, TestIntegerGroupBy) {
+  vector<int64_t> keys = {5, 3, 5, 0, 3};
+  uint8_t nulls = 1 << 3;
+  IntegerGroupBy<int64_t> group_by;
+  vector<int32_t> group_ids;
+  group_by.Consume(ColumnView<int64_t>(keys.data(), keys.size(), &nulls, 1), &group_ids);
+  EXPECT_EQ(group_ids, vector<int32_t>({0, 1, 0, 2, 1}));
+  EXPECT_EQ(group_by.num_groups(), 3);
+  EXPECT_EQ(group_by.key(0), 5);
+  EXPECT_EQ(group_by.key(1), 3);
+  EXPECT_EQ(group_by.null_group(), 2);
+
+  // Ids are stable across batches, and the key 0 is distinct from the null group.
+  group_by.Consume(ColumnView<int64_t>(keys.data(), keys.size()), &group_ids);
+  EXPECT_EQ(group_ids, vector<int32_t>({0, 1, 0, 2, 1, 0, 1, 0, 3, 1}));
+  EXPECT_EQ(group_by.key(3), 0);
+
+  // Enough keys to rehash several times.
+  IntegerGroupBy<int32_t> large;
+  group_ids.clear();
+  large.Consume(view(), &group_ids);
+  for (int pass = 0; pass < 2; ++pass) {
+    vector<int32_t> many_keys;
+    for (int i = 0; i < 10000; ++i) many_keys.push_back(i * 7919);
+    vector<int32_t> many_ids;
+    large.Consume(ColumnView<int32_t>(many_keys.data(), many_keys.size()), &many_ids);
+    for (int i = 0; i < 10000; ++i) {
+      ASSERT_EQ(large.key(many_ids[i]), many_keys[i]);
+    }
+  }
+  for (int i = 0; i < num_rows_; ++i) {
+    if (IsNull(i)) {
+      EXPECT_EQ(group_ids[i], large.null_group());
+    } else {
+      EXPECT_EQ(large.key(group_ids[i]), values_[i]);
+    }
+  }
+}
+
+TEST_F(ComputeTest, TestStringGroupBy) {
+  string data = "foobarfoobar";
+  vector<int32_t> offsets = {0, 3, 6, 6, 9, 12};
+  uint8_t nulls = 1 << 2;
+  StringColumnView col(data.data(), offsets.data(), 5, &nulls, 1);
+  StringGroupBy group_by;
+  vector<int32_t> group_ids;
+  group_by.Consume(col, &group_ids);
+  EXPECT_EQ(group_ids, vector<int32_t>({0, 1, 2, 0, 1}));
+  EXPECT_EQ(group_by.num_groups(), 3);
+  EXPECT_EQ(group_by.key(0).ToString(), "foo");
+  EXPECT_EQ(group_by.key(1).ToString(), "bar");
+  EXPECT_EQ(group_by.null_group(), 2);
+
+  SelectionVector selection = {1, 2};
+  group_by.Consume(col, &group_ids, &selection);
+  EXPECT_EQ(group_ids, vector<int32_t>({0, 1, 2, 0, 1, 1, 2}));
+}
+
+TEST_F(ComputeTest, TestAggregateGroups) {
+  // Group by the sign of the values, over the values that pass a filter.
+  vector<int64_t> keys;
+  for (int32_t value : values_) keys.push_back(value < 0 ? -1 : 1);
+  SelectionVector selection;
+  Filter<int32_t>(view(), CompareOp::NE, 0, &selection);
+
+  IntegerGroupBy<int64_t> group_by;
+  vector<int32_t> group_ids;
+  group_by.Consume(ColumnView<int64_t>(keys.data(), keys.size()), &group_ids,
+      &selection);
+  ASSERT_EQ(group_ids.size(), selection.size());
+  vector<Aggregates<int32_t>> aggs;
+  AggregateGroups<int32_t>(view(), group_ids, group_by.num_groups(), &aggs, &selection);
+  ASSERT_EQ(aggs.size(), 2);
+  vector<int64_t> counts;
+  CountGroups(group_ids, group_by.num_groups(), &counts);
+
+  for (int32_t group = 0; group < 2; ++group) {
+    int64_t key = group_by.key(group);
+    Aggregates<int32_t> expected;
+    for (int32_t row : selection) {
+      if (keys[row] == key) AddValue(values_[row], &expected);
+    }
+    EXPECT_EQ(aggs[group].count, expected.count);
+    EXPECT_EQ(aggs[group].sum, expected.sum);
+    EXPECT_EQ(aggs[group].min, expected.min);
+    EXPECT_EQ(aggs[group].max, expected.max);
+    // No null values pass the filter.
+    EXPECT_EQ(counts[group], expected.count);
+  }
+
+  // Over all rows, including the nulls and zeros.
+  vector<int32_t> all_ids;
+  group_by.Consume(ColumnView<int64_t>(keys.data(), keys.size()), &all_ids);
+  vector<Aggregates<int32_t>> all_aggs;
+  AggregateGroups<int32_t>(view(), all_ids, group_by.num_groups(), &all_aggs);
+  Aggregates<int32_t> total;
+  for (const Aggregates<int32_t>& agg : all_aggs) total.Merge(agg);
+  Aggregates<int32_t> expected;
+  Aggregate<int32_t>(view(), &expected);
+  EXPECT_EQ(total.count, expected.count);
+  EXPECT_EQ(total.sum, expected.sum);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,335 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/compute.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#include "hs2client/logging.h"
+
+namespace hs2client {
+
+namespace {
+
+// The number of rows whose comparisons are combined into one bitmask.
+const int64_t BLOCK_SIZE = 64;
+
+const size_t INITIAL_SLOTS = 64;
+const uint64_t HASH_MULTIPLIER = 0x9e3779b97f4a7c15ULL;
+
+// Returns true if row 'i' is null. The null bitmap may have fewer bytes than expected,
+// see HUE-2722, in which case the missing values are not null.
+inline bool IsNull(const uint8_t* nulls, int nulls_size, int64_t i) {
+  return i / 8 < nulls_size && (nulls[i / 8] & (1 << (i % 8))) != 0;
+}
+
+// Returns the null bits of the 64 rows starting at 'start', which must be a multiple of
+// 64, with bit j set if row start + j is null. Assumes a little-endian platform.
+inline uint64_t NullWord(const uint8_t* nulls, int nulls_size, int64_t start) {
+  int64_t offset = start / 8;
+  if (nulls == NULL || offset >= nulls_size) return 0;
+  uint64_t word = 0;
+  memcpy(&word, nulls + offset, std::min<int64_t>(8, nulls_size - offset));
+  return word;
+}
+
+// Sets 'out' to the rows of 'col' for which Cmp()(value, 'value') is true.
+template <typename T, typename Cmp>
+void FilterBlocks(const ColumnView<T>& col, T value, SelectionVector* out) {
+  Cmp cmp;
+  out->resize(col.length);
+  int32_t* indices = out->data();
+  int64_t num_selected = 0;
+  for (int64_t start = 0; start < col.length; start += BLOCK_SIZE) {
+    int64_t block_length = std::min(BLOCK_SIZE, col.length - start);
+    const T* values = col.values + start;
+    uint64_t mask = 0;
+    for (int64_t j = 0; j < block_length; ++j) {
+      mask |= static_cast<uint64_t>(cmp(values[j], value)) << j;
+    }
+    mask &= ~NullWord(col.nulls, col.nulls_size, start);
+    while (mask != 0) {
+      indices[num_selected++] = static_cast<int32_t>(start + __builtin_ctzll(mask));
+      mask &= mask - 1;
+    }
+  }
+  out->resize(num_selected);
+}
+
+// Sets 'out' to the rows in 'selection' for which Cmp()(value, 'value') is true. 'out'
+// may be 'selection', as each row is written at or before the position it is read from.
+template <typename T, typename Cmp>
+void FilterSelected(const ColumnView<T>& col, T value, const SelectionVector& selection,
+    SelectionVector* out) {
+  Cmp cmp;
+  size_t num_rows = selection.size();
+  out->resize(num_rows);
+  int32_t* indices = out->data();
+  size_t num_selected = 0;
+  for (size_t i = 0; i < num_rows; ++i) {
+    int32_t row = selection[i];
+    indices[num_selected] = row;
+    num_selected += cmp(col.values[row], value) && !IsNull(col.nulls, col.nulls_size, row);
+  }
+  out->resize(num_selected);
+}
+
+template <typename T>
+inline void Update(T value, Aggregates<T>* out) {
+  ++out->count;
+  out->sum += value;
+  if (value < out->min) out->min = value;
+  if (value > out->max) out->max = value;
+}
+
+inline uint64_t HashInteger(int64_t key) {
+  uint64_t h = static_cast<uint64_t>(key) * HASH_MULTIPLIER;
+  return h ^ (h >> 32);
+}
+
+} // namespace
+
+// Filters
+
+template <typename T>
+void Filter(const ColumnView<T>& col, CompareOp op, T value, SelectionVector* out) {
+  switch (op) {
+    case CompareOp::EQ: FilterBlocks<T, std::equal_to<T>>(col, value, out); break;
+    case CompareOp::NE: FilterBlocks<T, std::not_equal_to<T>>(col, value, out); break;
+    case CompareOp::LT: FilterBlocks<T, std::less<T>>(col, value, out); break;
+    case CompareOp::LE: FilterBlocks<T, std::less_equal<T>>(col, value, out); break;
+    case CompareOp::GT: FilterBlocks<T, std::greater<T>>(col, value, out); break;
+    case CompareOp::GE: FilterBlocks<T, std::greater_equal<T>>(col, value, out); break;
+  }
+}
+
+template <typename T>
+void Filter(const ColumnView<T>& col, CompareOp op, T value,
+    const SelectionVector& selection, SelectionVector* out) {
+  switch (op) {
+    case CompareOp::EQ:
+      FilterSelected<T, std::equal_to<T>>(col, value, selection, out);
+      break;
+    case CompareOp::NE:
+      FilterSelected<T, std::not_equal_to<T>>(col, value, selection, out);
+      break;
+    case CompareOp::LT:
+      FilterSelected<T, std::less<T>>(col, value, selection, out);
+      break;
+    case CompareOp::LE:
+      FilterSelected<T, std::less_equal<T>>(col, value, selection, out);
+      break;
+    case CompareOp::GT:
+      FilterSelected<T, std::greater<T>>(col, value, selection, out);
+      break;
+    case CompareOp::GE:
+      FilterSelected<T, std::greater_equal<T>>(col, value, selection, out);
+      break;
+  }
+}
+
+void FilterEquals(const StringColumnView& col, const StringPiece& value,
+    SelectionVector* out) {
+  out->clear();
+  for (int64_t i = 0; i < col.length; ++i) {
+    // Compare the lengths first, which rules out most values without reading them.
+    if (col.offsets[i + 1] - col.offsets[i] != value.size()) continue;
+    if (IsNull(col.nulls, col.nulls_size, i) || col.GetData(i) != value) continue;
+    out->push_back(static_cast<int32_t>(i));
+  }
+}
+
+// Aggregates
+
+template <typename T>
+void Aggregate(const ColumnView<T>& col, Aggregates<T>* out,
+    const SelectionVector* selection) {
+  if (selection != NULL) {
+    for (int32_t row : *selection) {
+      if (!IsNull(col.nulls, col.nulls_size, row)) Update(col.values[row], out);
+    }
+    return;
+  }
+
+  for (int64_t start = 0; start < col.length; start += BLOCK_SIZE) {
+    int64_t block_length = std::min(BLOCK_SIZE, col.length - start);
+    const T* values = col.values + start;
+    uint64_t nulls = NullWord(col.nulls, col.nulls_size, start);
+    if (nulls == 0) {
+      // Accumulate into locals, which the compiler can keep in vector registers.
+      typename Aggregates<T>::SumType sum = 0;
+      T min = out->min;
+      T max = out->max;
+      for (int64_t j = 0; j < block_length; ++j) {
+        T value = values[j];
+        sum += value;
+        min = value < min ? value : min;
+        max = value > max ? value : max;
+      }
+      out->count += block_length;
+      out->sum += sum;
+      out->min = min;
+      out->max = max;
+    } else {
+      for (int64_t j = 0; j < block_length; ++j) {
+        if ((nulls & (1ULL << j)) == 0) Update(values[j], out);
+      }
+    }
+  }
+}
+
+template <typename T>
+void AggregateGroups(const ColumnView<T>& col, const std::vector<int32_t>& group_ids,
+    int32_t num_groups, std::vector<Aggregates<T>>* out,
+    const SelectionVector* selection) {
+  if (static_cast<int32_t>(out->size()) < num_groups) out->resize(num_groups);
+  Aggregates<T>* aggs = out->data();
+  if (selection != NULL) {
+    DCHECK_EQ(group_ids.size(), selection->size());
+    for (size_t i = 0; i < selection->size(); ++i) {
+      int32_t row = (*selection)[i];
+      if (!IsNull(col.nulls, col.nulls_size, row)) {
+        Update(col.values[row], &aggs[group_ids[i]]);
+      }
+    }
+    return;
+  }
+
+  DCHECK_EQ(static_cast<int64_t>(group_ids.size()), col.length);
+  for (int64_t i = 0; i < col.length; ++i) {
+    if (!IsNull(col.nulls, col.nulls_size, i)) Update(col.values[i], &aggs[group_ids[i]]);
+  }
+}
+
+void CountGroups(const std::vector<int32_t>& group_ids, int32_t num_groups,
+    std::vector<int64_t>* counts) {
+  if (static_cast<int32_t>(counts->size()) < num_groups) counts->resize(num_groups);
+  for (int32_t group : group_ids) ++(*counts)[group];
+}
+
+// IntegerGroupBy
+
+template <typename T>
+IntegerGroupBy<T>::IntegerGroupBy() : slots_(INITIAL_SLOTS, -1), null_group_(-1) {}
+
+template <typename T>
+void IntegerGroupBy<T>::Consume(const ColumnView<T>& keys,
+    std::vector<int32_t>* group_ids, const SelectionVector* selection) {
+  int64_t num_rows = selection != NULL ? selection->size() : keys.length;
+  group_ids->reserve(group_ids->size() + num_rows);
+  for (int64_t i = 0; i < num_rows; ++i) {
+    int64_t row = selection != NULL ? (*selection)[i] : i;
+    if (IsNull(keys.nulls, keys.nulls_size, row)) {
+      if (null_group_ == -1) {
+        null_group_ = num_groups();
+        keys_.push_back(0);
+      }
+      group_ids->push_back(null_group_);
+    } else {
+      group_ids->push_back(GetOrInsert(keys.values[row]));
+    }
+  }
+}
+
+template <typename T>
+int32_t IntegerGroupBy<T>::GetOrInsert(T key) {
+  size_t mask = slots_.size() - 1;
+  size_t slot = HashInteger(key) & mask;
+  while (slots_[slot] != -1) {
+    int32_t group = slots_[slot];
+    if (keys_[group] == key) return group;
+    slot = (slot + 1) & mask;
+  }
+
+  int32_t group = num_groups();
+  keys_.push_back(key);
+  slots_[slot] = group;
+  if (keys_.size() * 2 > slots_.size()) Rehash(slots_.size() * 2);
+  return group;
+}
+
+template <typename T>
+void IntegerGroupBy<T>::Rehash(size_t num_slots) {
+  slots_.assign(num_slots, -1);
+  size_t mask = num_slots - 1;
+  for (int32_t group = 0; group < num_groups(); ++group) {
+    if (group == null_group_) continue;
+    size_t slot = HashInteger(keys_[group]) & mask;
+    while (slots_[slot] != -1) slot = (slot + 1) & mask;
+    slots_[slot] = group;
+  }
+}
+
+// StringGroupBy
+
+void StringGroupBy::Consume(const StringColumnView& keys,
+    std::vector<int32_t>* group_ids, const SelectionVector* selection) {
+  if (selection != NULL) {
+    group_ids->reserve(group_ids->size() + selection->size());
+    for (int32_t row : *selection) group_ids->push_back(GetGroup(keys, row));
+  } else {
+    group_ids->reserve(group_ids->size() + keys.length);
+    for (int64_t i = 0; i < keys.length; ++i) group_ids->push_back(GetGroup(keys, i));
+  }
+}
+
+int32_t StringGroupBy::GetGroup(const StringColumnView& keys, int64_t i) {
+  if (IsNull(keys.nulls, keys.nulls_size, i)) {
+    if (null_group_ == -1) {
+      null_group_ = num_groups();
+      group_codes_.push_back(-1);
+    }
+    return null_group_;
+  }
+
+  int32_t code = dict_.GetOrInsert(keys.GetData(i));
+  if (code == static_cast<int32_t>(code_groups_.size())) {
+    code_groups_.push_back(num_groups());
+    group_codes_.push_back(code);
+  }
+  return code_groups_[code];
+}
+
+StringPiece StringGroupBy::key(int32_t group) const {
+  int32_t code = group_codes_[group];
+  return code == -1 ? StringPiece() : dict_.value(code);
+}
+
+#define INSTANTIATE_KERNELS(T)                                                  \
+  template void Filter<T>(const ColumnView<T>&, CompareOp, T, SelectionVector*); \
+  template void Filter<T>(const ColumnView<T>&, CompareOp, T,                   \
+      const SelectionVector&, SelectionVector*);                                \
+  template void Aggregate<T>(const ColumnView<T>&, Aggregates<T>*,              \
+      const SelectionVector*);                                                  \
+  template void AggregateGroups<T>(const ColumnView<T>&,                        \
+      const std::vector<int32_t>&, int32_t, std::vector<Aggregates<T>>*,        \
+      const SelectionVector*);
+
+INSTANTIATE_KERNELS(int8_t);
+INSTANTIATE_KERNELS(int16_t);
+INSTANTIATE_KERNELS(int32_t);
+INSTANTIATE_KERNELS(int64_t);
+INSTANTIATE_KERNELS(double);
+
+#undef INSTANTIATE_KERNELS
+
+template class IntegerGroupBy<int8_t>;
+template class IntegerGroupBy<int16_t>;
+template class IntegerGroupBy<int32_t>;
+template class IntegerGroupBy<int64_t>;
+
+} // namespace hs2client
@@ -0,0 +1,253 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef HS2CLIENT_COMPUTE_H
+#define HS2CLIENT_COMPUTE_H
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "hs2client/columnar-row-set.h"
+#include "hs2client/macros.h"
+#include "hs2client/string-dictionary.h"
+
+namespace hs2client {
+
+// Vectorized filters and aggregations over fetched results, so that clients can compute
+// several roll-ups of one result set without a query per roll-up or a loop over
+// GetData() per row.
+//
+// The kernels work on the raw values and null bitmaps of columns in blocks of 64 rows:
+// each block's comparisons are computed into a bitmask without branches and combined
+// with the block's null bits, and blocks without nulls are aggregated with plain loops,
+// so that the compiler can vectorize them. The fixed-width kernels are instantiated for
+// int8_t, int16_t, int32_t, int64_t and double.
+//
+// Example, the equivalent of "select k, count(v), sum(v) from t where v > 10 group by k":
+// unique_ptr<StringViewColumn> k = columnar_row_set->GetStringViewCol(0);
+// unique_ptr<Int32Column> v = columnar_row_set->GetInt32Col(1);
+// SelectionVector selection;
+// Filter<int32_t>(*v, CompareOp::GT, 10, &selection);
+// StringGroupBy group_by;
+// vector<int32_t> group_ids;
+// group_by.Consume(*k, &group_ids, &selection);
+// vector<Aggregates<int32_t>> aggs;
+// AggregateGroups<int32_t>(*v, group_ids, group_by.num_groups(), &aggs, &selection);
+// for (int32_t g = 0; g < group_by.num_groups(); ++g) {
+//   cout << group_by.key(g).ToString() << " " << aggs[g].count << " " << aggs[g].sum;
+// }
+
+// The indices of the rows that pass a filter, in increasing order.
+typedef std::vector<int32_t> SelectionVector;
+
+// The values and null bitmap of a fixed-width column. Constructed implicitly from a
+// TypedColumn, or from the data() of a column that owns its values, eg. a
+// TimestampColumn, or from raw arrays. Must not outlive the column.
+template <typename T>
+struct ColumnView {
+  ColumnView(const TypedColumn<T>& col)  // NOLINT(runtime/explicit)
+    : values(col.data().data()), length(col.length()), nulls(col.nulls()),
+      nulls_size(col.nulls_size()) {}
+
+  ColumnView(const Column& col, const std::vector<T>& data)
+    : values(data.data()), length(data.size()), nulls(col.nulls()),
+      nulls_size(col.nulls_size()) {}
+
+  // 'nulls' may be shorter than the column, or NULL if there are no nulls.
+  ColumnView(const T* values, int64_t length, const uint8_t* nulls = NULL,
+      int nulls_size = 0)
+    : values(values), length(length), nulls(nulls), nulls_size(nulls_size) {}
+
+  const T* values;
+  int64_t length;
+  const uint8_t* nulls;
+  int nulls_size;
+};
+
+// The values and null bitmap of a STRING or BINARY column, laid out as for a
+// StringViewColumn.
+struct StringColumnView {
+  StringColumnView(const StringViewColumn& col)  // NOLINT(runtime/explicit)
+    : data(col.data()), offsets(col.offsets()), length(col.length()),
+      nulls(col.nulls()), nulls_size(col.nulls_size()) {}
+
+  StringColumnView(const char* data, const int32_t* offsets, int64_t length,
+      const uint8_t* nulls = NULL, int nulls_size = 0)
+    : data(data), offsets(offsets), length(length), nulls(nulls),
+      nulls_size(nulls_size) {}
+
+  StringPiece GetData(int64_t i) const {
+    return StringPiece(data + offsets[i], offsets[i + 1] - offsets[i]);
+  }
+
+  const char* data;
+  const int32_t* offsets;
+  int64_t length;
+  const uint8_t* nulls;
+  int nulls_size;
+};
+
+// Filters
+
+enum class CompareOp { EQ, NE, LT, LE, GT, GE };
+
+// Sets 'out' to the rows of 'col' whose values compare to 'value' with 'op', eg. the
+// rows where col < value for LT. Null values never pass, as in SQL.
+template <typename T>
+void Filter(const ColumnView<T>& col, CompareOp op, T value, SelectionVector* out);
+
+// As above, but only considers the rows in 'selection', so that filters can be combined
+// with AND. 'out' may be the same as 'selection'.
+template <typename T>
+void Filter(const ColumnView<T>& col, CompareOp op, T value,
+    const SelectionVector& selection, SelectionVector* out);
+
+// Sets 'out' to the rows of 'col' whose values equal 'value'.
+void FilterEquals(const StringColumnView& col, const StringPiece& value,
+    SelectionVector* out);
+
+// Aggregates
+
+// The results of COUNT, SUM, MIN and MAX over the values of a column, ignoring nulls as
+// SQL does. Integers are summed as int64_t, which wraps on overflow, and doubles as
+// doubles. 'min' and 'max' are only meaningful if 'count' is greater than 0.
+template <typename T>
+struct Aggregates {
+  typedef typename std::conditional<std::is_floating_point<T>::value, double,
+      int64_t>::type SumType;
+
+  Aggregates()
+    : count(0), sum(0), min(std::numeric_limits<T>::max()),
+      max(std::numeric_limits<T>::lowest()) {}
+
+  // Combines the aggregates of another set of values, eg. another batch, into these.
+  void Merge(const Aggregates& other) {
+    count += other.count;
+    sum += other.sum;
+    if (other.min < min) min = other.min;
+    if (other.max > max) max = other.max;
+  }
+
+  // The number of values that aren't null.
+  int64_t count;
+  SumType sum;
+  T min;
+  T max;
+};
+
+// Accumulates the values of 'col' into 'out', which may already hold the aggregates of
+// other batches. If 'selection' is set, only those rows are included.
+template <typename T>
+void Aggregate(const ColumnView<T>& col, Aggregates<T>* out,
+    const SelectionVector* selection = NULL);
+
+// Group by
+
+// Assigns each distinct integer key a dense group id, 0, 1, 2, ..., in order of first
+// appearance, with the rows whose keys are null in a group of their own. Ids are stable
+// across calls to Consume, so a result set can be grouped one batch at a time.
+//
+// This class is not thread-safe.
+template <typename T>
+class IntegerGroupBy {
+ public:
+  IntegerGroupBy();
+
+  // Appends the group id of each row of 'keys', or of the rows in 'selection' if it is
+  // set, to 'group_ids'.
+  void Consume(const ColumnView<T>& keys, std::vector<int32_t>* group_ids,
+      const SelectionVector* selection = NULL);
+
+  int32_t num_groups() const { return static_cast<int32_t>(keys_.size()); }
+
+  // The key of group 'group', or 0 for the null group.
+  T key(int32_t group) const { return keys_[group]; }
+
+  // The id of the group of rows whose keys are null, or -1 if there isn't one.
+  int32_t null_group() const { return null_group_; }
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(IntegerGroupBy);
+
+  int32_t GetOrInsert(T key);
+
+  // Rebuilds 'slots_' with 'num_slots' slots, which must be a power of 2.
+  void Rehash(size_t num_slots);
+
+  // Indexed by group id.
+  std::vector<T> keys_;
+
+  // An open addressing hash table, probed linearly, of the ids of the groups, or -1 for
+  // empty slots. Kept at most half full. Doesn't include the null group.
+  std::vector<int32_t> slots_;
+
+  int32_t null_group_;
+};
+
+// As IntegerGroupBy, for STRING keys. Keeps its own copy of each distinct key.
+//
+// This class is not thread-safe.
+class StringGroupBy {
+ public:
+  StringGroupBy() : null_group_(-1) {}
+
+  // Appends the group id of each row of 'keys', or of the rows in 'selection' if it is
+  // set, to 'group_ids'.
+  void Consume(const StringColumnView& keys, std::vector<int32_t>* group_ids,
+      const SelectionVector* selection = NULL);
+
+  int32_t num_groups() const { return static_cast<int32_t>(group_codes_.size()); }
+
+  // The key of group 'group', or an empty string for the null group. Remains valid until
+  // the next call to Consume.
+  StringPiece key(int32_t group) const;
+
+  // The id of the group of rows whose keys are null, or -1 if there isn't one.
+  int32_t null_group() const { return null_group_; }
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(StringGroupBy);
+
+  int32_t GetGroup(const StringColumnView& keys, int64_t i);
+
+  StringDictionary dict_;
+
+  // The group id of each code in 'dict_', and the code of each group, or -1 for the null
+  // group. The null group takes an id but not a code.
+  std::vector<int32_t> code_groups_;
+  std::vector<int32_t> group_codes_;
+
+  int32_t null_group_;
+};
+
+// Accumulates the value of each row of 'col', or of the rows in 'selection' if it is
+// set, into the Aggregates of its group, where 'group_ids' holds the group of each of
+// those rows, as returned by IntegerGroupBy or StringGroupBy. 'out' is resized to
+// 'num_groups' and may already hold the aggregates of other batches.
+template <typename T>
+void AggregateGroups(const ColumnView<T>& col, const std::vector<int32_t>& group_ids,
+    int32_t num_groups, std::vector<Aggregates<T>>* out,
+    const SelectionVector* selection = NULL);
+
+// Adds the number of rows in each group, ie. COUNT(*), to 'counts', which is resized to
+// 'num_groups'.
+void CountGroups(const std::vector<int32_t>& group_ids, int32_t num_groups,
+    std::vector<int64_t>* counts);
+
+} // namespace hs2client
+
+#endif // HS2CLIENT_COMPUTE_H
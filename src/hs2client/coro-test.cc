@@ -0,0 +1,131 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/coro.h"
+
+#include <gtest/gtest.h>
+#include <iostream>
+
+#ifdef HS2CLIENT_HAS_COROUTINES
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "hs2client/mock-server.h"
+#include "hs2client/test-util.h"
+
+using namespace hs2client;
+using namespace std;
+
+class CoroTest : public MockServerTestBase {
+ protected:
+  virtual void SetUp() {
+    spec_.num_rows = 2500;
+    spec_.columns.emplace_back(ColumnType::TypeId::INT);
+    ASSERT_NO_FATAL_FAILURE(StartServer());
+    ASSERT_OK(EventLoop::Create(&loop_));
+    ASSERT_OK(AsyncService::Connect(loop_.get(), "localhost", server_->port(), 0,
+        ProtocolVersion::HS2CLIENT_PROTOCOL_V7, ConnectionOptions(), &service_));
+  }
+
+  virtual void TearDown() {
+    if (service_) EXPECT_OK(service_->Close());
+    loop_.reset();
+    MockServerTestBase::TearDown();
+  }
+
+  unique_ptr<EventLoop> loop_;
+  unique_ptr<AsyncService> service_;
+};
+
+// Runs a query to completion and returns the number of rows.
+Task<AsyncResult<int64_t>> CountRows(const AsyncSession& session) {
+  AsyncResult<int64_t> out{Status::OK(), 0};
+  AsyncResult<unique_ptr<AsyncOperation>> exec =
+      co_await ExecuteStatementAsync(session, "select * from mock");
+  if (!exec.status.ok()) {
+    out.status = exec.status;
+    co_return out;
+  }
+  bool has_more_rows = true;
+  while (has_more_rows && out.status.ok()) {
+    FetchResult fetch = co_await FetchAsync(*exec.value, 1000);
+    out.status = fetch.status;
+    if (!fetch.status.ok()) break;
+    out.value += fetch.results->num_rows();
+    has_more_rows = fetch.has_more_rows;
+  }
+  AsyncResult<Operation::State> state = co_await GetStateAsync(*exec.value);
+  if (out.status.ok()) out.status = state.status;
+  if (out.status.ok() && state.value != Operation::State::FINISHED) {
+    out.status = Status::Error("Query did not finish");
+  }
+  Status close_status = co_await CloseAsync(*exec.value);
+  if (out.status.ok()) out.status = close_status;
+  co_return out;
+}
+
+Task<Status> RunQueries(const AsyncService& service, int num_queries,
+    int64_t* num_rows) {
+  AsyncResult<unique_ptr<AsyncSession>> session =
+      co_await OpenSessionAsync(service, "user", HS2ClientConfig());
+  HS2CLIENT_CO_RETURN_IF_ERROR(session.status);
+  for (int i = 0; i < num_queries; ++i) {
+    AsyncResult<int64_t> count = co_await CountRows(*session.value);
+    HS2CLIENT_CO_RETURN_IF_ERROR(count.status);
+    *num_rows += count.value;
+  }
+  co_return co_await CloseAsync(*session.value);
+}
+
+TEST_F(CoroTest, TestSyncWait) {
+  int64_t num_rows = 0;
+  EXPECT_OK(SyncWait(RunQueries(*service_, 3, &num_rows)));
+  EXPECT_EQ(num_rows, 3 * spec_.num_rows);
+}
+
+TEST_F(CoroTest, TestSpawn) {
+  // Each spawned task runs on the loop's thread, with its RPCs interleaved with the
+  // others' on the one connection.
+  const int num_tasks = 8;
+  atomic<int> num_done(0);
+  atomic<int64_t> num_rows(0);
+  atomic<bool> all_ok(true);
+  for (int i = 0; i < num_tasks; ++i) {
+    Spawn(loop_.get(), [](const AsyncService& service, atomic<int>* num_done,
+        atomic<int64_t>* num_rows, atomic<bool>* all_ok) -> Task<void> {
+      int64_t rows = 0;
+      Status status = co_await RunQueries(service, 1, &rows);
+      if (!status.ok()) *all_ok = false;
+      *num_rows += rows;
+      ++*num_done;
+    }(*service_, &num_done, &num_rows, &all_ok));
+  }
+  while (num_done < num_tasks) this_thread::sleep_for(chrono::milliseconds(1));
+  EXPECT_TRUE(all_ok);
+  EXPECT_EQ(num_rows, num_tasks * spec_.num_rows);
+}
+
+#endif // HS2CLIENT_HAS_COROUTINES
+
+int main(int argc, char** argv) {
+#ifndef HS2CLIENT_HAS_COROUTINES
+  std::cout << "Skipping coro-test: not built as C++20" << std::endl;
+#endif
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
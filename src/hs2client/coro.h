@@ -0,0 +1,422 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef HS2CLIENT_CORO_H
+#define HS2CLIENT_CORO_H
+
+// Awaitable wrappers around the asynchronous API in event-loop.h, for code built as
+// C++20 or later. The rest of the library only requires C++11, so everything here is
+// header-only and compiled out for older standards, in which case
+// HS2CLIENT_HAS_COROUTINES is not defined.
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>)
+#define HS2CLIENT_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifdef HS2CLIENT_HAS_COROUTINES
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "hs2client/columnar-row-set.h"
+#include "hs2client/event-loop.h"
+#include "hs2client/operation.h"
+#include "hs2client/status.h"
+
+// Like HS2CLIENT_RETURN_IF_ERROR, for coroutines returning Task<Status>.
+#define HS2CLIENT_CO_RETURN_IF_ERROR(stmt) \
+  do { \
+    Status __status__ = (stmt); \
+    if (!__status__.ok()) co_return __status__; \
+  } while (false)
+
+namespace hs2client {
+
+// The result of an awaited RPC. 'value' is only set if 'status' is OK.
+template <typename T>
+struct AsyncResult {
+  Status status;
+  T value;
+};
+
+// The result of an awaited FetchAsync.
+struct FetchResult {
+  FetchResult() : has_more_rows(false) {}
+
+  Status status;
+  std::unique_ptr<ColumnarRowSet> results;
+  bool has_more_rows;
+};
+
+template <typename T = void>
+class Task;
+
+namespace internal {
+
+template <typename T>
+class TaskPromiseBase {
+ public:
+  // Resumes the awaiting coroutine, if any, when the task finishes.
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+
+    template <typename PROMISE>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<PROMISE> handle) noexcept {
+      std::coroutine_handle<> continuation = handle.promise().continuation();
+      return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+  // Tasks are lazy: they start when they are awaited.
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+
+  void unhandled_exception() { exception_ = std::current_exception(); }
+
+  std::coroutine_handle<> continuation() const { return continuation_; }
+  void set_continuation(std::coroutine_handle<> continuation) {
+    continuation_ = continuation;
+  }
+
+  void RethrowIfFailed() {
+    if (exception_) std::rethrow_exception(exception_);
+  }
+
+ private:
+  std::coroutine_handle<> continuation_;
+  std::exception_ptr exception_;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase<T> {
+ public:
+  Task<T> get_return_object();
+
+  void return_value(T value) { value_.emplace(std::move(value)); }
+
+  T TakeValue() {
+    this->RethrowIfFailed();
+    return std::move(*value_);
+  }
+
+ private:
+  std::optional<T> value_;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase<void> {
+ public:
+  Task<void> get_return_object();
+
+  void return_void() {}
+
+  void TakeValue() { RethrowIfFailed(); }
+};
+
+// Awaits an asynchronous call that reports its result to a callback. 'START' is called
+// with the callback, which resumes the awaiting coroutine on the EventLoop's thread.
+template <typename RESULT, typename START>
+class CallbackAwaiter {
+ public:
+  explicit CallbackAwaiter(START start) : start_(std::move(start)) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    // The callback may resume the coroutine, destroying this awaiter, before 'start'
+    // returns, so nothing in it may be used afterwards.
+    START start = std::move(start_);
+    RESULT* result = &result_;
+    start([result, handle](RESULT value) {
+      *result = std::move(value);
+      handle.resume();
+    });
+  }
+
+  RESULT await_resume() { return std::move(result_); }
+
+ private:
+  START start_;
+  RESULT result_;
+};
+
+template <typename RESULT, typename START>
+CallbackAwaiter<RESULT, START> AwaitCallback(START start) {
+  return CallbackAwaiter<RESULT, START>(std::move(start));
+}
+
+// A coroutine that runs to completion without being awaited, and frees itself.
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() const noexcept { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+};
+
+// Signals the thread in SyncWait once the awaited task finishes.
+struct SyncWaitState {
+  SyncWaitState() : done(false) {}
+
+  std::mutex lock;
+  std::condition_variable cv;
+  bool done;
+  std::exception_ptr exception;
+};
+
+struct SyncWaitTask {
+  struct promise_type {
+    struct FinalAwaiter {
+      bool await_ready() const noexcept { return false; }
+
+      void await_suspend(std::coroutine_handle<promise_type> handle) const noexcept {
+        SyncWaitState* state = handle.promise().state;
+        std::lock_guard<std::mutex> l(state->lock);
+        state->done = true;
+        state->cv.notify_all();
+      }
+
+      void await_resume() const noexcept {}
+    };
+
+    SyncWaitTask get_return_object() {
+      return SyncWaitTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() { state->exception = std::current_exception(); }
+
+    SyncWaitState* state = nullptr;
+  };
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+} // namespace internal
+
+// The return type of coroutines that use this API. A Task doesn't start until it's
+// awaited, and then resumes its awaiter once it finishes, with the value passed to
+// co_return. Exceptions thrown by the coroutine are rethrown to the awaiter.
+//
+// Example:
+// Task<Status> CountRows(const AsyncSession& session, int64_t* num_rows) {
+//   AsyncResult<std::unique_ptr<AsyncOperation>> exec =
+//       co_await ExecuteStatementAsync(session, "select * from t");
+//   HS2CLIENT_CO_RETURN_IF_ERROR(exec.status);
+//   bool has_more_rows = true;
+//   while (has_more_rows) {
+//     FetchResult fetch = co_await FetchAsync(*exec.value, 1024);
+//     HS2CLIENT_CO_RETURN_IF_ERROR(fetch.status);
+//     *num_rows += fetch.results->num_rows();
+//     has_more_rows = fetch.has_more_rows;
+//   }
+//   co_return co_await CloseAsync(*exec.value);
+// }
+template <typename T>
+class [[nodiscard]] Task {
+ public:
+  typedef internal::TaskPromise<T> promise_type;
+
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      if (handle_) handle_.destroy();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+
+  ~Task() {
+    if (handle_) handle_.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    handle_.promise().set_continuation(awaiter);
+    return handle_;
+  }
+
+  T await_resume() { return handle_.promise().TakeValue(); }
+
+ private:
+  friend class internal::TaskPromise<T>;
+
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+namespace internal {
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+  return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+} // namespace internal
+
+// Resumes the awaiting coroutine on 'loop's thread. If the loop is stopping, the
+// coroutine continues on the current thread instead.
+inline auto Schedule(EventLoop* loop) {
+  struct ScheduleAwaiter {
+    EventLoop* loop;
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) const {
+      return loop->Post([handle]() { handle.resume(); });
+    }
+
+    void await_resume() const noexcept {}
+  };
+  return ScheduleAwaiter{loop};
+}
+
+// Runs 'task' on 'loop's thread without waiting for it. The loop acts as the executor:
+// the task, and the coroutines it awaits, are resumed on its thread as their RPCs
+// complete, so any number of them can be in flight without a thread each. They must
+// not block.
+inline void Spawn(EventLoop* loop, Task<void> task) {
+  [](EventLoop* loop, Task<void> task) -> internal::DetachedTask {
+    co_await Schedule(loop);
+    co_await task;
+  }(loop, std::move(task));
+}
+
+// Blocks the calling thread until 'task' finishes, and returns its value. Must not be
+// called from an EventLoop's thread.
+template <typename T>
+T SyncWait(Task<T> task) {
+  internal::SyncWaitState state;
+  std::optional<T> result;
+  internal::SyncWaitTask wait_task = [](Task<T>& task, std::optional<T>* result)
+      -> internal::SyncWaitTask { result->emplace(co_await task); }(task, &result);
+  wait_task.handle.promise().state = &state;
+  wait_task.handle.resume();
+  {
+    std::unique_lock<std::mutex> l(state.lock);
+    state.cv.wait(l, [&state]() { return state.done; });
+  }
+  wait_task.handle.destroy();
+  if (state.exception) std::rethrow_exception(state.exception);
+  return std::move(*result);
+}
+
+inline void SyncWait(Task<void> task) {
+  internal::SyncWaitState state;
+  internal::SyncWaitTask wait_task = [](Task<void>& task) -> internal::SyncWaitTask {
+    co_await task;
+  }(task);
+  wait_task.handle.promise().state = &state;
+  wait_task.handle.resume();
+  {
+    std::unique_lock<std::mutex> l(state.lock);
+    state.cv.wait(l, [&state]() { return state.done; });
+  }
+  wait_task.handle.destroy();
+  if (state.exception) std::rethrow_exception(state.exception);
+}
+
+// Awaitable versions of the AsyncService, AsyncSession and AsyncOperation methods. The
+// awaiting coroutine is resumed on the EventLoop's thread once the RPC completes. The
+// object must remain valid until then.
+
+inline auto OpenSessionAsync(const AsyncService& service, const std::string& user,
+    const HS2ClientConfig& config) {
+  typedef AsyncResult<std::unique_ptr<AsyncSession>> Result;
+  return internal::AwaitCallback<Result>(
+      [&service, user, config](std::function<void(Result)> resume) {
+        service.OpenSession(user, config,
+            [resume](const Status& status, std::unique_ptr<AsyncSession> session) {
+              resume(Result{status, std::move(session)});
+            });
+      });
+}
+
+inline auto ExecuteStatementAsync(const AsyncSession& session,
+    const std::string& statement) {
+  typedef AsyncResult<std::unique_ptr<AsyncOperation>> Result;
+  return internal::AwaitCallback<Result>(
+      [&session, statement](std::function<void(Result)> resume) {
+        session.ExecuteStatement(statement,
+            [resume](const Status& status, std::unique_ptr<AsyncOperation> op) {
+              resume(Result{status, std::move(op)});
+            });
+      });
+}
+
+inline auto CloseAsync(const AsyncSession& session) {
+  return internal::AwaitCallback<Status>(
+      [&session](std::function<void(Status)> resume) {
+        session.Close([resume](const Status& status) { resume(status); });
+      });
+}
+
+inline auto GetStateAsync(const AsyncOperation& op) {
+  typedef AsyncResult<Operation::State> Result;
+  return internal::AwaitCallback<Result>(
+      [&op](std::function<void(Result)> resume) {
+        op.GetState([resume](const Status& status, Operation::State state) {
+          resume(Result{status, state});
+        });
+      });
+}
+
+inline auto FetchAsync(const AsyncOperation& op, int max_rows) {
+  return internal::AwaitCallback<FetchResult>(
+      [&op, max_rows](std::function<void(FetchResult)> resume) {
+        op.Fetch(max_rows, [resume](const Status& status,
+            std::unique_ptr<ColumnarRowSet> results, bool has_more_rows) {
+          FetchResult result;
+          result.status = status;
+          result.results = std::move(results);
+          result.has_more_rows = has_more_rows;
+          resume(std::move(result));
+        });
+      });
+}
+
+inline auto CloseAsync(const AsyncOperation& op) {
+  return internal::AwaitCallback<Status>(
+      [&op](std::function<void(Status)> resume) {
+        op.Close([resume](const Status& status) { resume(status); });
+      });
+}
+
+} // namespace hs2client
+
+#endif // HS2CLIENT_HAS_COROUTINES
+
+#endif // HS2CLIENT_CORO_H
@@ -0,0 +1,291 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/event-loop.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <gtest/gtest.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "hs2client/mock-server.h"
+#include "hs2client/test-util.h"
+
+using namespace hs2client;
+using namespace std;
+
+// Lets the test thread wait for a number of callbacks, and records the first error.
+class Latch {
+ public:
+  explicit Latch(int count) : count_(count) {}
+
+  void CountDown(const Status& status) {
+    lock_guard<mutex> l(lock_);
+    if (status_.ok()) status_ = status;
+    if (--count_ == 0) cv_.notify_all();
+  }
+
+  // Returns an error if the callbacks haven't all been run within a minute, so that a
+  // lost callback fails the test rather than hanging it.
+  Status Wait() {
+    unique_lock<mutex> l(lock_);
+    if (!cv_.wait_for(l, chrono::seconds(60), [this]() { return count_ == 0; })) {
+      return Status::Error("Timed out waiting for callbacks");
+    }
+    return status_;
+  }
+
+ private:
+  mutex lock_;
+  condition_variable cv_;
+  int count_;
+  Status status_;
+};
+
+// A query driven entirely from callbacks: it's executed, fetched until there are no
+// more rows and closed, and then counts down 'latch'.
+struct Query {
+  unique_ptr<AsyncOperation> op;
+  Latch* latch;
+  atomic<int64_t>* num_rows;
+  int max_rows;
+};
+
+void FetchAll(const shared_ptr<Query>& query) {
+  query->op->Fetch(query->max_rows, [query](const Status& status,
+      unique_ptr<ColumnarRowSet> results, bool has_more_rows) {
+    if (!status.ok()) {
+      query->latch->CountDown(status);
+      return;
+    }
+    *query->num_rows += results->GetInt32Col(0)->length();
+    if (has_more_rows) {
+      FetchAll(query);
+      return;
+    }
+    query->op->Close([query](const Status& status) { query->latch->CountDown(status); });
+  });
+}
+
+void RunQuery(AsyncSession* session, Latch* latch, atomic<int64_t>* num_rows,
+    int max_rows = 1000) {
+  session->ExecuteStatement("select * from mock",
+      [latch, num_rows, max_rows](const Status& status, unique_ptr<AsyncOperation> op) {
+        if (!status.ok()) {
+          latch->CountDown(status);
+          return;
+        }
+        shared_ptr<Query> query(new Query());
+        query->op = std::move(op);
+        query->latch = latch;
+        query->num_rows = num_rows;
+        query->max_rows = max_rows;
+        FetchAll(query);
+      });
+}
+
+class EventLoopTest : public MockServerTestBase {
+ protected:
+  virtual void SetUp() {
+    spec_.num_rows = 2500;
+    spec_.columns.emplace_back(ColumnType::TypeId::INT);
+    spec_.columns.emplace_back(ColumnType::TypeId::STRING, 0.1);
+    ASSERT_OK(EventLoop::Create(&loop_));
+  }
+
+  virtual void TearDown() {
+    for (unique_ptr<AsyncService>& service : services_) EXPECT_OK(service->Close());
+    services_.clear();
+    loop_.reset();
+    MockServerTestBase::TearDown();
+  }
+
+  // Connects 'num_services' services and opens a session on each. Fails fatally on any
+  // error, so call with ASSERT_NO_FATAL_FAILURE.
+  void ConnectAndOpenSessions(int num_services) {
+    ConnectionOptions options = conn_options_;
+    options.transport = server_options_.transport;
+    options.protocol = server_options_.protocol;
+    Latch latch(num_services);
+    sessions_.resize(num_services);
+    for (int i = 0; i < num_services; ++i) {
+      unique_ptr<AsyncService> service;
+      // Sessions already being opened hold on to 'latch', so wait for them on errors.
+      Status status = AsyncService::Connect(loop_.get(), "localhost", server_->port(), 0,
+          ProtocolVersion::HS2CLIENT_PROTOCOL_V7, options, &service);
+      if (!status.ok()) {
+        latch.CountDown(status);
+        continue;
+      }
+      unique_ptr<AsyncSession>* session = &sessions_[i];
+      service->OpenSession("user", HS2ClientConfig(),
+          [&latch, session](const Status& status, unique_ptr<AsyncSession> opened) {
+            *session = std::move(opened);
+            latch.CountDown(status);
+          });
+      services_.push_back(std::move(service));
+    }
+    ASSERT_OK(latch.Wait());
+  }
+
+  void CloseSessions() {
+    Latch latch(sessions_.size());
+    for (unique_ptr<AsyncSession>& session : sessions_) {
+      session->Close([&latch](const Status& status) { latch.CountDown(status); });
+    }
+    EXPECT_OK(latch.Wait());
+    sessions_.clear();
+  }
+
+  // The transport and protocol are taken from 'server_options_'.
+  ConnectionOptions conn_options_;
+
+  unique_ptr<EventLoop> loop_;
+  vector<unique_ptr<AsyncService>> services_;
+  vector<unique_ptr<AsyncSession>> sessions_;
+};
+
+TEST_F(EventLoopTest, TestConcurrentQueries) {
+  ASSERT_NO_FATAL_FAILURE(StartServer());
+  const int num_services = 4;
+  const int queries_per_session = 5;
+  ASSERT_NO_FATAL_FAILURE(ConnectAndOpenSessions(num_services));
+
+  // All of the queries are in flight at once, driven by the loop's thread.
+  Latch latch(num_services * queries_per_session);
+  atomic<int64_t> num_rows(0);
+  for (unique_ptr<AsyncSession>& session : sessions_) {
+    for (int i = 0; i < queries_per_session; ++i) {
+      RunQuery(session.get(), &latch, &num_rows);
+    }
+  }
+  EXPECT_OK(latch.Wait());
+  EXPECT_EQ(num_rows, num_services * queries_per_session * spec_.num_rows);
+  CloseSessions();
+
+  ServiceMetrics metrics = services_[0]->GetMetrics();
+  EXPECT_EQ(metrics.rpc(RpcMethod::EXECUTE_STATEMENT).count, queries_per_session);
+  // Batches of 1000, 1000 and 500 rows.
+  EXPECT_EQ(metrics.rpc(RpcMethod::FETCH_RESULTS).count, queries_per_session * 3);
+  EXPECT_EQ(metrics.rpc(RpcMethod::CLOSE_SESSION).count, 1);
+  EXPECT_EQ(metrics.rows_fetched, queries_per_session * spec_.num_rows);
+  EXPECT_GT(metrics.bytes_read, 0);
+}
+
+TEST_F(EventLoopTest, TestFramedTransport) {
+  server_options_.transport = TransportType::FRAMED;
+  ASSERT_NO_FATAL_FAILURE(StartServer());
+  ASSERT_NO_FATAL_FAILURE(ConnectAndOpenSessions(1));
+
+  Latch latch(2);
+  atomic<int64_t> num_rows(0);
+  RunQuery(sessions_[0].get(), &latch, &num_rows);
+  RunQuery(sessions_[0].get(), &latch, &num_rows);
+  EXPECT_OK(latch.Wait());
+  EXPECT_EQ(num_rows, 2 * spec_.num_rows);
+  CloseSessions();
+}
+
+TEST_F(EventLoopTest, TestLargeUnframedBatch) {
+  // A single reply of several MB, which arrives over many reads of the 64KB read buffer
+  // and is only complete once the last of them has been read.
+  spec_.num_rows = 200000;
+  ASSERT_NO_FATAL_FAILURE(StartServer());
+  ASSERT_NO_FATAL_FAILURE(ConnectAndOpenSessions(1));
+
+  Latch latch(1);
+  atomic<int64_t> num_rows(0);
+  RunQuery(sessions_[0].get(), &latch, &num_rows, spec_.num_rows);
+  EXPECT_OK(latch.Wait());
+  EXPECT_EQ(num_rows, spec_.num_rows);
+  CloseSessions();
+
+  ServiceMetrics metrics = services_[0]->GetMetrics();
+  EXPECT_EQ(metrics.rpc(RpcMethod::FETCH_RESULTS).count, 1);
+  EXPECT_GT(metrics.bytes_read, 4 * 1024 * 1024);
+}
+
+TEST_F(EventLoopTest, TestUnframedRepliesSplitAcrossReads) {
+  // With a small socket receive buffer, replies larger than it arrive over several
+  // reads, and are often completed by a read that adds less than had already arrived.
+  // Each batch size leaves the replies split at different points.
+  conn_options_.socket_recv_buffer_size = 4096;
+  conn_options_.read_buffer_size = 1024;
+  ASSERT_NO_FATAL_FAILURE(StartServer());
+  ASSERT_NO_FATAL_FAILURE(ConnectAndOpenSessions(1));
+
+  vector<int> batch_sizes = {50, 90, 150, 250, 400, 700, 1000};
+  Latch latch(batch_sizes.size());
+  atomic<int64_t> num_rows(0);
+  for (int max_rows : batch_sizes) {
+    RunQuery(sessions_[0].get(), &latch, &num_rows, max_rows);
+  }
+  EXPECT_OK(latch.Wait());
+  EXPECT_EQ(num_rows, batch_sizes.size() * spec_.num_rows);
+  CloseSessions();
+}
+
+TEST_F(EventLoopTest, TestCompactProtocol) {
+  server_options_.protocol = WireProtocol::COMPACT;
+  ASSERT_NO_FATAL_FAILURE(StartServer());
+  ASSERT_NO_FATAL_FAILURE(ConnectAndOpenSessions(1));
+
+  Latch latch(2);
+  atomic<int64_t> num_rows(0);
+  RunQuery(sessions_[0].get(), &latch, &num_rows);
+  RunQuery(sessions_[0].get(), &latch, &num_rows);
+  EXPECT_OK(latch.Wait());
+  EXPECT_EQ(num_rows, 2 * spec_.num_rows);
+  CloseSessions();
+}
+
+TEST_F(EventLoopTest, TestCloseFailsPendingCalls) {
+  server_options_.exec_latency_us = 200000;
+  ASSERT_NO_FATAL_FAILURE(StartServer());
+  ASSERT_NO_FATAL_FAILURE(ConnectAndOpenSessions(1));
+
+  // The fetch is held by the server until the query finishes, so it's still pending
+  // when the connection is closed.
+  Latch latch(1);
+  atomic<int64_t> num_rows(0);
+  RunQuery(sessions_[0].get(), &latch, &num_rows);
+  EXPECT_OK(services_[0]->Close());
+  EXPECT_ERROR(latch.Wait());
+
+  // Later calls fail immediately.
+  Latch closed_latch(1);
+  sessions_[0]->Close([&closed_latch](const Status& status) {
+    closed_latch.CountDown(status);
+  });
+  EXPECT_ERROR(closed_latch.Wait());
+  sessions_.clear();
+}
+
+TEST_F(EventLoopTest, TestConnectError) {
+  // Nothing listens on the server's port once it has stopped.
+  ASSERT_NO_FATAL_FAILURE(StartServer());
+  EXPECT_OK(server_->Stop());
+  unique_ptr<AsyncService> service;
+  EXPECT_ERROR(AsyncService::Connect(loop_.get(), "localhost", server_->port(), 0,
+      ProtocolVersion::HS2CLIENT_PROTOCOL_V7, ConnectionOptions(), &service));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,793 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/event-loop.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <future>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TSocket.h>
+
+#include "hs2client/logging.h"
+#include "hs2client/message-scanner.h"
+#include "hs2client/thrift-internal.h"
+
+#include "gen-cpp/ImpalaHiveServer2Service.h"
+#include "gen-cpp/TCLIService.h"
+
+namespace hs2 = apache::hive::service::cli::thrift;
+
+using apache::thrift::TException;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TSocket;
+using impala::ImpalaHiveServer2ServiceClient;
+using std::string;
+using std::unique_ptr;
+
+namespace hs2client {
+
+namespace internal {
+
+typedef std::chrono::steady_clock Clock;
+
+namespace {
+
+// The maximum number of events returned by each epoll_wait.
+const int MAX_EVENTS = 256;
+
+// The size of a framed message's big-endian length prefix.
+const uint32_t FRAME_HEADER_SIZE = 4;
+
+// Returns an error for the failed system call 'what', from errno.
+Status ErrnoToStatus(const string& what) {
+  std::stringstream ss;
+  ss << what << ": " << strerror(errno);
+  return Status::Error(ss.str());
+}
+
+} // namespace
+
+// An RPC issued through an AsyncConnection.
+struct AsyncCall {
+  RpcMethod method;
+
+  // Serializes the request with the client's output protocol.
+  std::function<void(ImpalaHiveServer2ServiceClient*)> send;
+
+  // Deserializes the reply, all of which has arrived, with the client's input protocol
+  // and returns its status.
+  std::function<hs2::TStatus(ImpalaHiveServer2ServiceClient*)> recv;
+
+  // Run with OK once 'recv' has succeeded, or with the error that failed the RPC.
+  std::function<void(const Status&)> done;
+
+  Clock::time_point start;
+};
+
+// Owns an epoll instance and the thread that waits on it. Tasks posted from other
+// threads are run on the loop's thread, after it's woken through an eventfd.
+class EventLoopImpl {
+ public:
+  EventLoopImpl() : epoll_fd_(-1), wake_fd_(-1), stopping_(false) {}
+
+  ~EventLoopImpl() {
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+    if (wake_fd_ >= 0) close(wake_fd_);
+  }
+
+  Status Init(const std::shared_ptr<EventLoopImpl>& self);
+
+  // Runs the tasks that are already queued, fails the connections that are still
+  // registered and joins the loop's thread. Must not be called from the loop's thread.
+  void Stop();
+
+  // Queues 'task' to run on the loop's thread. Returns false, without queuing it, if
+  // the loop is stopping. Thread-safe.
+  bool Post(const std::function<void()>& task);
+
+  // The following may only be called on the loop's thread.
+
+  // Starts watching 'conn's socket for replies.
+  Status Register(const std::shared_ptr<AsyncConnection>& conn);
+  void Unregister(int fd);
+
+  // Starts or stops watching 'fd' for writability, as well as for replies.
+  Status WatchWritable(int fd, bool writable);
+
+ private:
+  void Run();
+
+  int epoll_fd_;
+  // Written by Post to wake the loop.
+  int wake_fd_;
+
+  std::thread thread_;
+
+  // Protects 'tasks_' and 'stopping_'.
+  std::mutex lock_;
+  std::vector<std::function<void()>> tasks_;
+  bool stopping_;
+
+  // The registered connections, by socket. Only accessed on the loop's thread.
+  std::map<int, std::shared_ptr<AsyncConnection>> connections_;
+};
+
+// A non-blocking connection driven by an EventLoopImpl. Requests are serialized into
+// 'out_buf_' and written as the socket accepts them. Replies are read into 'in_buf_',
+// and each one is deserialized by the oldest pending call once it's complete.
+class AsyncConnection : public std::enable_shared_from_this<AsyncConnection> {
+ public:
+  AsyncConnection(const std::shared_ptr<EventLoopImpl>& loop,
+      const ConnectionOptions& options)
+    : loop_(loop), options_(options), fd_(-1), out_offset_(0), watching_writable_(false),
+      in_scanner_(options.protocol), closed_(false) {}
+
+  // Connects the socket, blocking the calling thread, and registers it with the loop.
+  Status Connect(const string& host, int port, int conn_timeout);
+
+  // Queues an RPC to be sent on the loop's thread. Thread-safe.
+  void Call(RpcMethod method,
+      const std::function<void(ImpalaHiveServer2ServiceClient*)>& send,
+      const std::function<hs2::TStatus(ImpalaHiveServer2ServiceClient*)>& recv,
+      const std::function<void(const Status&)>& done);
+
+  // Fails any RPCs in flight and closes the socket. Blocks until the loop has done so.
+  // Thread-safe, but must not be called on the loop's thread.
+  void Close();
+
+  bool closed() const { return closed_; }
+
+  int fd() const { return fd_; }
+
+  // The following may only be called on the loop's thread.
+
+  // Handles the epoll events 'events' for the socket.
+  void HandleEvents(uint32_t events);
+
+  // Closes the socket and fails all of the pending calls, and all later ones, with
+  // 'status'. Does nothing if the connection is already closed.
+  void Fail(const Status& status);
+
+  MetricsRecorder metrics;
+
+ private:
+  void Send(const std::shared_ptr<AsyncCall>& call);
+
+  // Writes as much of 'out_buf_' as the socket accepts, and watches for writability if
+  // any of it is left.
+  void FlushWrites();
+
+  // Reads from the socket until it would block, and completes the calls whose replies
+  // have arrived.
+  void ReadReplies();
+  void ProcessReplies();
+
+  std::shared_ptr<EventLoopImpl> loop_;
+  const ConnectionOptions options_;
+
+  boost::shared_ptr<TSocket> socket_;
+  int fd_;
+
+  // Requests are serialized into 'out_mem_' and replies deserialized from 'in_mem_',
+  // which observes part of 'in_buf_'.
+  boost::shared_ptr<TMemoryBuffer> out_mem_;
+  boost::shared_ptr<TMemoryBuffer> in_mem_;
+  unique_ptr<ImpalaHiveServer2ServiceClient> client_;
+
+  // Requests that haven't been written yet, from 'out_offset_'.
+  string out_buf_;
+  size_t out_offset_;
+  bool watching_writable_;
+
+  // Bytes read but not yet deserialized.
+  string in_buf_;
+  // For unframed transports, finds the end of the reply at the start of 'in_buf_', so
+  // that it's only deserialized once all of it has arrived. The scan resumes where it
+  // stopped as more of the reply arrives, rather than starting again from its first
+  // byte, which would be quadratic in its size.
+  MessageScanner in_scanner_;
+  std::vector<char> read_buf_;
+
+  // Calls whose requests have been serialized, in order.
+  std::deque<std::shared_ptr<AsyncCall>> pending_;
+
+  // Set on the loop's thread, and read by AsyncService's destructor.
+  std::atomic<bool> closed_;
+  Status close_status_;
+};
+
+Status EventLoopImpl::Init(const std::shared_ptr<EventLoopImpl>& self) {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) return ErrnoToStatus("Failed to create epoll instance");
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0) return ErrnoToStatus("Failed to create eventfd");
+  epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = wake_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event) != 0) {
+    return ErrnoToStatus("Failed to watch eventfd");
+  }
+  thread_ = std::thread(&EventLoopImpl::Run, self.get());
+  return Status::OK();
+}
+
+void EventLoopImpl::Stop() {
+  if (!thread_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> l(lock_);
+    if (stopping_) return;
+    stopping_ = true;
+  }
+  uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    HS2CLIENT_LOG(ERROR) << "Failed to wake event loop: " << strerror(errno);
+  }
+  thread_.join();
+}
+
+bool EventLoopImpl::Post(const std::function<void()>& task) {
+  {
+    std::lock_guard<std::mutex> l(lock_);
+    if (stopping_) return false;
+    tasks_.push_back(task);
+  }
+  uint64_t one = 1;
+  // The counter only overflows if the loop has stopped reading it, so EAGAIN still
+  // leaves the loop woken.
+  if (write(wake_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    HS2CLIENT_LOG(ERROR) << "Failed to wake event loop: " << strerror(errno);
+  }
+  return true;
+}
+
+Status EventLoopImpl::Register(const std::shared_ptr<AsyncConnection>& conn) {
+  epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = conn->fd();
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, conn->fd(), &event) != 0) {
+    return ErrnoToStatus("Failed to watch socket");
+  }
+  connections_[conn->fd()] = conn;
+  return Status::OK();
+}
+
+void EventLoopImpl::Unregister(int fd) {
+  if (connections_.erase(fd) == 0) return;
+  // Closing the socket also removes it from the epoll set, but it may be shared.
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+}
+
+Status EventLoopImpl::WatchWritable(int fd, bool writable) {
+  epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) != 0) {
+    return ErrnoToStatus("Failed to watch socket");
+  }
+  return Status::OK();
+}
+
+void EventLoopImpl::Run() {
+  std::vector<epoll_event> events(MAX_EVENTS);
+  while (true) {
+    int num_events = epoll_wait(epoll_fd_, events.data(), MAX_EVENTS, -1);
+    if (num_events < 0 && errno != EINTR) {
+      HS2CLIENT_LOG(ERROR) << "epoll_wait failed: " << strerror(errno);
+      break;
+    }
+    for (int i = 0; i < num_events; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == wake_fd_) {
+        uint64_t count;
+        while (read(wake_fd_, &count, sizeof(count)) > 0) {}
+        continue;
+      }
+      std::map<int, std::shared_ptr<AsyncConnection>>::iterator it =
+          connections_.find(fd);
+      // The connection may have been closed by an earlier event in this batch.
+      if (it == connections_.end()) continue;
+      // Keeps the connection alive if it's unregistered while handling the events.
+      std::shared_ptr<AsyncConnection> conn = it->second;
+      conn->HandleEvents(events[i].events);
+    }
+
+    std::vector<std::function<void()>> tasks;
+    bool stopping;
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      tasks.swap(tasks_);
+      stopping = stopping_;
+    }
+    for (const std::function<void()>& task : tasks) task();
+    if (stopping) break;
+  }
+
+  while (!connections_.empty()) {
+    std::shared_ptr<AsyncConnection> conn = connections_.begin()->second;
+    conn->Fail(Status::Error("Event loop stopped"));
+  }
+}
+
+Status AsyncConnection::Connect(const string& host, int port, int conn_timeout) {
+  socket_.reset(new TSocket(host, port));
+  socket_->setConnTimeout(conn_timeout);
+  socket_->setNoDelay(options_.tcp_nodelay);
+  TRY_RPC_OR_RETURN(socket_->open());
+  fd_ = socket_->getSocketFD();
+  HS2CLIENT_RETURN_IF_ERROR(
+      SetSocketBufferSize(fd_, SO_RCVBUF, options_.socket_recv_buffer_size));
+  HS2CLIENT_RETURN_IF_ERROR(
+      SetSocketBufferSize(fd_, SO_SNDBUF, options_.socket_send_buffer_size));
+  int flags = fcntl(fd_, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd_, F_SETFL, flags | O_NONBLOCK) < 0) {
+    return ErrnoToStatus("Failed to make socket non-blocking");
+  }
+
+  out_mem_.reset(new TMemoryBuffer(options_.write_buffer_size));
+  in_mem_.reset(new TMemoryBuffer());
+  client_.reset(new ImpalaHiveServer2ServiceClient(
+      NewProtocol(options_.protocol, in_mem_), NewProtocol(options_.protocol, out_mem_)));
+  read_buf_.resize(options_.read_buffer_size);
+
+  // Calls are queued behind the registration, so none are sent before it.
+  std::shared_ptr<AsyncConnection> self = shared_from_this();
+  bool posted = loop_->Post([self]() {
+    Status status = self->loop_->Register(self);
+    if (!status.ok()) self->Fail(status);
+  });
+  if (!posted) return Status::Error("Event loop stopped");
+  return Status::OK();
+}
+
+void AsyncConnection::Call(RpcMethod method,
+    const std::function<void(ImpalaHiveServer2ServiceClient*)>& send,
+    const std::function<hs2::TStatus(ImpalaHiveServer2ServiceClient*)>& recv,
+    const std::function<void(const Status&)>& done) {
+  std::shared_ptr<AsyncCall> call(new AsyncCall());
+  call->method = method;
+  call->send = send;
+  call->recv = recv;
+  call->done = done;
+  std::shared_ptr<AsyncConnection> self = shared_from_this();
+  if (!loop_->Post([self, call]() { self->Send(call); })) {
+    done(Status::Error("Event loop stopped"));
+  }
+}
+
+void AsyncConnection::Close() {
+  std::shared_ptr<AsyncConnection> self = shared_from_this();
+  std::shared_ptr<std::promise<void>> closed(new std::promise<void>());
+  bool posted = loop_->Post([self, closed]() {
+    self->Fail(Status::Error("Connection closed"));
+    closed->set_value();
+  });
+  // Otherwise the loop has stopped and already failed the connection.
+  if (posted) closed->get_future().wait();
+}
+
+void AsyncConnection::HandleEvents(uint32_t events) {
+  if (events & EPOLLOUT) FlushWrites();
+  if (!closed_ && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) ReadReplies();
+}
+
+void AsyncConnection::Fail(const Status& status) {
+  if (closed_) return;
+  closed_ = true;
+  close_status_ = status;
+  // Unregistering may drop the loop's reference.
+  std::shared_ptr<AsyncConnection> self = shared_from_this();
+  loop_->Unregister(fd_);
+  try {
+    socket_->close();
+  } catch (const TException& e) {
+    HS2CLIENT_LOG(WARNING) << "Failed to close socket: " << e.what();
+  }
+  out_buf_.clear();
+  in_buf_.clear();
+
+  std::deque<std::shared_ptr<AsyncCall>> pending;
+  pending.swap(pending_);
+  Clock::time_point now = Clock::now();
+  for (const std::shared_ptr<AsyncCall>& call : pending) {
+    int64_t latency_us =
+        std::chrono::duration_cast<std::chrono::microseconds>(now - call->start).count();
+    metrics.RecordRpc(call->method, latency_us, false);
+    call->done(status);
+  }
+}
+
+void AsyncConnection::Send(const std::shared_ptr<AsyncCall>& call) {
+  if (closed_) {
+    call->done(close_status_);
+    return;
+  }
+  try {
+    call->send(client_.get());
+  } catch (const TException& e) {
+    out_mem_->resetBuffer();
+    call->done(Status::Error(e.what()));
+    return;
+  }
+  string message = out_mem_->getBufferAsString();
+  out_mem_->resetBuffer();
+  if (options_.transport == TransportType::FRAMED) {
+    uint32_t len = message.size();
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      out_buf_.push_back(static_cast<char>((len >> shift) & 0xff));
+    }
+  }
+  out_buf_.append(message);
+  call->start = Clock::now();
+  pending_.push_back(call);
+  FlushWrites();
+}
+
+void AsyncConnection::FlushWrites() {
+  while (out_offset_ < out_buf_.size()) {
+    ssize_t n = send(fd_, out_buf_.data() + out_offset_, out_buf_.size() - out_offset_,
+        MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (!watching_writable_) {
+          Status status = loop_->WatchWritable(fd_, true);
+          if (!status.ok()) {
+            Fail(status);
+            return;
+          }
+          watching_writable_ = true;
+        }
+        return;
+      }
+      Fail(ErrnoToStatus("Failed to write to socket"));
+      return;
+    }
+    out_offset_ += n;
+    metrics.AddBytesWritten(n);
+  }
+  out_buf_.clear();
+  out_offset_ = 0;
+  if (watching_writable_) {
+    Status status = loop_->WatchWritable(fd_, false);
+    if (!status.ok()) {
+      Fail(status);
+      return;
+    }
+    watching_writable_ = false;
+  }
+}
+
+void AsyncConnection::ReadReplies() {
+  while (true) {
+    ssize_t n = recv(fd_, read_buf_.data(), read_buf_.size(), 0);
+    if (n > 0) {
+      in_buf_.append(read_buf_.data(), n);
+      metrics.AddBytesRead(n);
+      continue;
+    }
+    if (n == 0) {
+      ProcessReplies();
+      Fail(Status::Error("Connection closed by server"));
+      return;
+    }
+    if (errno == EINTR) continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+    Fail(ErrnoToStatus("Failed to read from socket"));
+    return;
+  }
+  ProcessReplies();
+}
+
+void AsyncConnection::ProcessReplies() {
+  bool framed = options_.transport == TransportType::FRAMED;
+  size_t offset = 0;
+  while (!closed_ && !pending_.empty() && offset < in_buf_.size()) {
+    uint8_t* data = reinterpret_cast<uint8_t*>(&in_buf_[offset]);
+    uint32_t len = in_buf_.size() - offset;
+    if (framed) {
+      if (len < FRAME_HEADER_SIZE) break;
+      uint32_t frame_len = 0;
+      for (uint32_t i = 0; i < FRAME_HEADER_SIZE; ++i) {
+        frame_len = (frame_len << 8) | data[i];
+      }
+      if (len - FRAME_HEADER_SIZE < frame_len) break;
+      data += FRAME_HEADER_SIZE;
+      len = frame_len;
+    } else {
+      size_t reply_len;
+      Status status = in_scanner_.Scan(data, len, &reply_len);
+      if (!status.ok()) {
+        Fail(status);
+        return;
+      }
+      if (reply_len == 0) break;
+      len = reply_len;
+    }
+
+    std::shared_ptr<AsyncCall> call = pending_.front();
+    in_mem_->resetBuffer(data, len);
+    hs2::TStatus reply_status;
+    try {
+      reply_status = call->recv(client_.get());
+    } catch (const TException& e) {
+      Fail(Status::Error(e.what()));
+      return;
+    }
+    offset += framed ? FRAME_HEADER_SIZE + len : len;
+    in_scanner_.Reset();
+
+    pending_.pop_front();
+    int64_t latency_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        Clock::now() - call->start).count();
+    metrics.RecordRpc(call->method, latency_us, true);
+    if (IsServerError(reply_status)) metrics.RecordServerError(call->method);
+    call->done(Status::OK());
+  }
+  // Don't let 'in_mem_' observe the bytes that are about to move.
+  in_mem_->resetBuffer();
+  if (!closed_) in_buf_.erase(0, offset);
+}
+
+} // namespace internal
+
+using internal::AsyncConnection;
+using internal::EventLoopImpl;
+
+namespace {
+
+// Returns 'status' if the RPC failed, otherwise the status in its reply.
+Status ReplyStatus(const Status& status, const hs2::TStatus& tstatus) {
+  if (!status.ok()) return status;
+  return TStatusToStatus(tstatus);
+}
+
+} // namespace
+
+struct AsyncSession::AsyncSessionImpl {
+  std::shared_ptr<AsyncConnection> conn;
+  hs2::TSessionHandle handle;
+};
+
+struct AsyncOperation::AsyncOperationImpl {
+  std::shared_ptr<AsyncConnection> conn;
+  hs2::TOperationHandle handle;
+};
+
+// EventLoop
+
+EventLoop::EventLoop() : impl_(new EventLoopImpl()) {}
+
+EventLoop::~EventLoop() {
+  impl_->Stop();
+}
+
+bool EventLoop::Post(const std::function<void()>& task) {
+  return impl_->Post(task);
+}
+
+Status EventLoop::Create(unique_ptr<EventLoop>* loop) {
+  unique_ptr<EventLoop> out(new EventLoop());
+  HS2CLIENT_RETURN_IF_ERROR(out->impl_->Init(out->impl_));
+  *loop = std::move(out);
+  return Status::OK();
+}
+
+// AsyncService
+
+AsyncService::AsyncService(const std::shared_ptr<AsyncConnection>& conn) : conn_(conn) {}
+
+AsyncService::~AsyncService() {
+  DCHECK(conn_->closed());
+}
+
+Status AsyncService::Connect(EventLoop* loop, const string& host, int port,
+    int conn_timeout, ProtocolVersion protocol_version, const ConnectionOptions& options,
+    unique_ptr<AsyncService>* service) {
+  if (ProtocolVersionToTProtocolVersion(protocol_version) <
+      hs2::TProtocolVersion::HIVE_CLI_SERVICE_PROTOCOL_V6) {
+    return Status::Error("Unsupported protocol");
+  }
+  if (options.read_buffer_size <= 0 || options.write_buffer_size <= 0) {
+    return Status::Error("Transport buffer sizes must be positive");
+  }
+  std::shared_ptr<AsyncConnection> conn(new AsyncConnection(loop->impl_, options));
+  HS2CLIENT_RETURN_IF_ERROR(conn->Connect(host, port, conn_timeout));
+  service->reset(new AsyncService(conn));
+  return Status::OK();
+}
+
+Status AsyncService::Close() {
+  conn_->Close();
+  return Status::OK();
+}
+
+void AsyncService::OpenSession(const string& user, const HS2ClientConfig& config,
+    const OpenSessionCallback& callback) const {
+  hs2::TOpenSessionReq req;
+  req.__set_configuration(config.GetConfig());
+  req.__set_username(user);
+  std::shared_ptr<hs2::TOpenSessionResp> resp(new hs2::TOpenSessionResp());
+  std::shared_ptr<AsyncConnection> conn = conn_;
+  conn_->Call(RpcMethod::OPEN_SESSION,
+      [req](ImpalaHiveServer2ServiceClient* client) { client->send_OpenSession(req); },
+      [resp](ImpalaHiveServer2ServiceClient* client) -> hs2::TStatus {
+        client->recv_OpenSession(*resp);
+        return resp->status;
+      },
+      [conn, resp, callback](const Status& rpc_status) {
+        Status status = ReplyStatus(rpc_status, resp->status);
+        if (!status.ok()) {
+          callback(status, unique_ptr<AsyncSession>());
+          return;
+        }
+        AsyncSession::AsyncSessionImpl* impl = new AsyncSession::AsyncSessionImpl();
+        impl->conn = conn;
+        impl->handle = resp->sessionHandle;
+        callback(status, unique_ptr<AsyncSession>(new AsyncSession(impl)));
+      });
+}
+
+ServiceMetrics AsyncService::GetMetrics() const {
+  ServiceMetrics metrics;
+  conn_->metrics.Snapshot(&metrics);
+  return metrics;
+}
+
+// AsyncSession
+
+AsyncSession::AsyncSession(AsyncSessionImpl* impl) : impl_(impl) {}
+
+AsyncSession::~AsyncSession() = default;
+
+void AsyncSession::ExecuteStatement(const string& statement,
+    const ExecuteCallback& callback) const {
+  hs2::TExecuteStatementReq req;
+  req.__set_sessionHandle(impl_->handle);
+  req.__set_statement(statement);
+  std::shared_ptr<hs2::TExecuteStatementResp> resp(new hs2::TExecuteStatementResp());
+  std::shared_ptr<AsyncConnection> conn = impl_->conn;
+  conn->Call(RpcMethod::EXECUTE_STATEMENT,
+      [req](ImpalaHiveServer2ServiceClient* client) {
+        client->send_ExecuteStatement(req);
+      },
+      [resp](ImpalaHiveServer2ServiceClient* client) -> hs2::TStatus {
+        client->recv_ExecuteStatement(*resp);
+        return resp->status;
+      },
+      [conn, resp, callback](const Status& rpc_status) {
+        Status status = ReplyStatus(rpc_status, resp->status);
+        if (!status.ok()) {
+          callback(status, unique_ptr<AsyncOperation>());
+          return;
+        }
+        AsyncOperation::AsyncOperationImpl* impl =
+            new AsyncOperation::AsyncOperationImpl();
+        impl->conn = conn;
+        impl->handle = resp->operationHandle;
+        callback(status, unique_ptr<AsyncOperation>(new AsyncOperation(impl)));
+      });
+}
+
+void AsyncSession::Close(const StatusCallback& callback) const {
+  hs2::TCloseSessionReq req;
+  req.__set_sessionHandle(impl_->handle);
+  std::shared_ptr<hs2::TCloseSessionResp> resp(new hs2::TCloseSessionResp());
+  impl_->conn->Call(RpcMethod::CLOSE_SESSION,
+      [req](ImpalaHiveServer2ServiceClient* client) { client->send_CloseSession(req); },
+      [resp](ImpalaHiveServer2ServiceClient* client) -> hs2::TStatus {
+        client->recv_CloseSession(*resp);
+        return resp->status;
+      },
+      [resp, callback](const Status& rpc_status) {
+        callback(ReplyStatus(rpc_status, resp->status));
+      });
+}
+
+// AsyncOperation
+
+AsyncOperation::AsyncOperation(AsyncOperationImpl* impl) : impl_(impl) {}
+
+AsyncOperation::~AsyncOperation() = default;
+
+void AsyncOperation::GetState(const GetStateCallback& callback) const {
+  hs2::TGetOperationStatusReq req;
+  req.__set_operationHandle(impl_->handle);
+  std::shared_ptr<hs2::TGetOperationStatusResp> resp(
+      new hs2::TGetOperationStatusResp());
+  impl_->conn->Call(RpcMethod::GET_OPERATION_STATUS,
+      [req](ImpalaHiveServer2ServiceClient* client) {
+        client->send_GetOperationStatus(req);
+      },
+      [resp](ImpalaHiveServer2ServiceClient* client) -> hs2::TStatus {
+        client->recv_GetOperationStatus(*resp);
+        return resp->status;
+      },
+      [resp, callback](const Status& rpc_status) {
+        Status status = ReplyStatus(rpc_status, resp->status);
+        if (!status.ok()) {
+          callback(status, Operation::State::UNKNOWN);
+          return;
+        }
+        callback(status, TOperationStateToOperationState(resp->operationState));
+      });
+}
+
+void AsyncOperation::Fetch(int max_rows, const FetchCallback& callback) const {
+  hs2::TFetchResultsReq req;
+  req.__set_operationHandle(impl_->handle);
+  req.__set_orientation(hs2::TFetchOrientation::FETCH_NEXT);
+  req.__set_maxRows(max_rows);
+  // Owns the row set until it's handed to the callback.
+  std::shared_ptr<unique_ptr<ColumnarRowSet::ColumnarRowSetImpl>> row_set(
+      new unique_ptr<ColumnarRowSet::ColumnarRowSetImpl>(
+          new ColumnarRowSet::ColumnarRowSetImpl()));
+  std::shared_ptr<AsyncConnection> conn = impl_->conn;
+  conn->Call(RpcMethod::FETCH_RESULTS,
+      [req](ImpalaHiveServer2ServiceClient* client) { client->send_FetchResults(req); },
+      [row_set](ImpalaHiveServer2ServiceClient* client) -> hs2::TStatus {
+        (*row_set)->resp = hs2::TFetchResultsResp();
+        (*row_set)->string_columns.clear();
+        RecvFetchResults(client->getInputProtocol().get(), &(*row_set)->resp,
+            &(*row_set)->string_columns);
+        return (*row_set)->resp.status;
+      },
+      [conn, row_set, callback](const Status& rpc_status) {
+        Status status = ReplyStatus(rpc_status, (*row_set)->resp.status);
+        if (!status.ok()) {
+          callback(status, unique_ptr<ColumnarRowSet>(), false);
+          return;
+        }
+        bool has_more_rows = (*row_set)->resp.hasMoreRows;
+        unique_ptr<ColumnarRowSet> results(new ColumnarRowSet(row_set->release()));
+        conn->metrics.AddRowsFetched(results->num_rows());
+        callback(status, std::move(results), has_more_rows);
+      });
+}
+
+void AsyncOperation::Close(const StatusCallback& callback) const {
+  hs2::TCloseOperationReq req;
+  req.__set_operationHandle(impl_->handle);
+  std::shared_ptr<hs2::TCloseOperationResp> resp(new hs2::TCloseOperationResp());
+  impl_->conn->Call(RpcMethod::CLOSE_OPERATION,
+      [req](ImpalaHiveServer2ServiceClient* client) { client->send_CloseOperation(req); },
+      [resp](ImpalaHiveServer2ServiceClient* client) -> hs2::TStatus {
+        client->recv_CloseOperation(*resp);
+        return resp->status;
+      },
+      [resp, callback](const Status& rpc_status) {
+        callback(ReplyStatus(rpc_status, resp->status));
+      });
+}
+
+} // namespace hs2client
@@ -0,0 +1,199 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef HS2CLIENT_EVENT_LOOP_H
+#define HS2CLIENT_EVENT_LOOP_H
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "hs2client/columnar-row-set.h"
+#include "hs2client/macros.h"
+#include "hs2client/metrics.h"
+#include "hs2client/operation.h"
+#include "hs2client/service.h"
+#include "hs2client/status.h"
+#include "hs2client/types.h"
+
+namespace hs2client {
+
+class AsyncOperation;
+class AsyncSession;
+
+namespace internal {
+class AsyncConnection;
+class EventLoopImpl;
+}
+
+// Callbacks for the asynchronous API. They are run on the EventLoop's thread, so they
+// must not block: to issue a follow-up RPC, call another asynchronous method, which
+// returns immediately.
+typedef std::function<void(const Status&)> StatusCallback;
+typedef std::function<void(const Status&, std::unique_ptr<AsyncSession>)>
+    OpenSessionCallback;
+typedef std::function<void(const Status&, std::unique_ptr<AsyncOperation>)>
+    ExecuteCallback;
+typedef std::function<void(const Status&, Operation::State)> GetStateCallback;
+typedef std::function<void(const Status&, std::unique_ptr<ColumnarRowSet>, bool)>
+    FetchCallback;
+
+// A reactor thread that drives the sockets of any number of AsyncServices with epoll,
+// so that one thread can keep thousands of RPCs in flight. Requests are serialized into
+// buffers and written as the sockets become writable, and replies are read into
+// buffers and deserialized once they are complete, all on the loop's thread, which
+// then runs the RPC's callback.
+//
+// Only available on Linux.
+//
+// Example:
+// unique_ptr<EventLoop> loop;
+// HS2CLIENT_RETURN_IF_ERROR(EventLoop::Create(&loop));
+// unique_ptr<AsyncService> service;
+// HS2CLIENT_RETURN_IF_ERROR(AsyncService::Connect(loop.get(), "localhost", 21050, 0,
+//     ProtocolVersion::HS2CLIENT_PROTOCOL_V7, ConnectionOptions(), &service));
+// service->OpenSession("user", HS2ClientConfig(),
+//     [](const Status& status, unique_ptr<AsyncSession> session) { ... });
+//
+// The loop is built on epoll, so the asynchronous API is only available on Linux.
+//
+// This class is thread-safe.
+class EventLoop {
+ public:
+  // Creates a loop and starts its thread.
+  static Status Create(std::unique_ptr<EventLoop>* loop);
+
+  // Stops the loop's thread. All of its AsyncServices must have been closed.
+  ~EventLoop();
+
+  // Queues 'task' to run on the loop's thread, after any events that are ready. Returns
+  // false, without queuing it, if the loop is stopping. Like callbacks, tasks must not
+  // block.
+  bool Post(const std::function<void()>& task);
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(EventLoop);
+
+  // For access to 'impl_'.
+  friend class AsyncService;
+
+  EventLoop();
+
+  std::shared_ptr<internal::EventLoopImpl> impl_;
+};
+
+// The asynchronous counterpart of Service: a connection to a HiveServer2 server whose
+// RPCs are driven by an EventLoop. Each method queues its RPC and returns immediately,
+// and its callback is run on the loop's thread once the reply arrives, or with an error
+// if the connection fails. RPCs on a connection are pipelined: a request is written as
+// soon as it's issued, without waiting for earlier replies, and replies are matched to
+// requests in order. Servers handle a connection's requests one at a time, so RPCs that
+// need to overlap, eg. fetches that block until their queries finish, should use
+// different connections.
+//
+// Unframed replies can only be delimited by attempting to deserialize them, which is
+// retried as more of a reply arrives, so TransportType::FRAMED is cheaper for large
+// fetches.
+//
+// Connect, Close and GetMetrics may be called from any thread, other methods from any
+// thread including the loop's. AsyncServices must have Close called on them before they
+// are deleted.
+class AsyncService {
+ public:
+  // Connects to the server, blocking the calling thread for up to 'conn_timeout'
+  // milliseconds, or indefinitely if 0, and registers the socket with 'loop', which
+  // must outlive the service.
+  static Status Connect(EventLoop* loop, const std::string& host, int port,
+      int conn_timeout, ProtocolVersion protocol_version,
+      const ConnectionOptions& options, std::unique_ptr<AsyncService>* service);
+
+  ~AsyncService();
+
+  // Closes the connection, failing any RPCs that are still in flight, and waits for the
+  // loop to unregister it. Must not be called from a callback.
+  Status Close();
+
+  void OpenSession(const std::string& user, const HS2ClientConfig& config,
+      const OpenSessionCallback& callback) const;
+
+  // Returns the metrics of this connection's RPCs, as for Service::GetMetrics.
+  ServiceMetrics GetMetrics() const;
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(AsyncService);
+
+  explicit AsyncService(const std::shared_ptr<internal::AsyncConnection>& conn);
+
+  std::shared_ptr<internal::AsyncConnection> conn_;
+};
+
+// The asynchronous counterpart of Session, created by AsyncService::OpenSession. Must
+// be closed before its service.
+class AsyncSession {
+ public:
+  ~AsyncSession();
+
+  void ExecuteStatement(const std::string& statement,
+      const ExecuteCallback& callback) const;
+
+  void Close(const StatusCallback& callback) const;
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(AsyncSession);
+
+  // For access to the c'tor.
+  friend class AsyncService;
+
+  // Hides Thrift objects from the header.
+  struct AsyncSessionImpl;
+
+  explicit AsyncSession(AsyncSessionImpl* impl);
+
+  std::unique_ptr<AsyncSessionImpl> impl_;
+};
+
+// The asynchronous counterpart of Operation, created by AsyncSession::ExecuteStatement.
+// Should be closed before it's deleted, otherwise the server keeps its resources until
+// the connection is closed.
+class AsyncOperation {
+ public:
+  ~AsyncOperation();
+
+  void GetState(const GetStateCallback& callback) const;
+
+  // Fetches the next batch of up to 'max_rows' rows. Like Operation::Fetch, the server
+  // holds the reply until rows are ready, so this also waits for the query to finish.
+  // The callback is passed the batch and whether there are more rows.
+  void Fetch(int max_rows, const FetchCallback& callback) const;
+
+  void Close(const StatusCallback& callback) const;
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(AsyncOperation);
+
+  // For access to the c'tor.
+  friend class AsyncSession;
+
+  // Hides Thrift objects from the header.
+  struct AsyncOperationImpl;
+
+  explicit AsyncOperation(AsyncOperationImpl* impl);
+
+  std::unique_ptr<AsyncOperationImpl> impl_;
+};
+
+} // namespace hs2client
+
+#endif // HS2CLIENT_EVENT_LOOP_H
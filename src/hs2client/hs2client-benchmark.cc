@@ -0,0 +1,402 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Throughput benchmarks for the client, run against an in-process MockServer.
+//
+// Usage: hs2client-benchmark [--filter=<substring>] [--rows=<n>] [--min_time=<seconds>]
+//                            [--port=<port>] [--serve] [--replay=<capture file>]
+//                            [--framed] [--compact] [--read_buffer_size=<bytes>]
+//
+// --framed, --compact and --read_buffer_size set the ConnectionOptions used by the
+// client, and the transport and protocol of the mock server.
+//
+// --serve runs only the mock server, with a result set of every supported column
+// type, until the process is killed. This is used to benchmark the Python converters
+// (see python/benchmarks/converters_benchmark.py).
+//
+// --replay measures deserialization of the FetchResults replies in a capture file
+// recorded with Service::StartCapture, instead of running the other benchmarks.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hs2client/api.h"
+#include "hs2client/mock-server.h"
+
+using namespace hs2client;
+using namespace std;
+
+namespace {
+
+typedef ColumnType::TypeId TypeId;
+
+struct BenchmarkOptions {
+  BenchmarkOptions() : rows(1000000), min_time(1.0), port(21060), serve(false) {}
+
+  string filter;
+  string replay_path;
+  int64_t rows;
+  double min_time;
+  int port;
+  bool serve;
+  ConnectionOptions connection;
+};
+
+#define CHECK_OK(stmt)                                                \
+  do {                                                                \
+    Status _s = (stmt);                                               \
+    if (!_s.ok()) {                                                   \
+      cerr << #stmt << " failed: " << _s.GetMessage() << endl;        \
+      exit(1);                                                        \
+    }                                                                 \
+  } while (false)
+
+// Runs 'fn' until at least 'min_time' seconds have passed, after one warmup run, and
+// prints the average time per iteration and the throughput. 'fn' performs a single
+// iteration and sets the number of rows and bytes it processed.
+template <typename Fn>
+void RunBenchmark(const BenchmarkOptions& options, const string& name, Fn fn) {
+  if (name.find(options.filter) == string::npos) return;
+
+  int64_t rows = 0;
+  int64_t bytes = 0;
+  fn(&rows, &bytes);
+
+  typedef chrono::steady_clock Clock;
+  int iterations = 0;
+  int64_t total_rows = 0;
+  int64_t total_bytes = 0;
+  Clock::time_point start = Clock::now();
+  double elapsed = 0;
+  while (elapsed < options.min_time || iterations < 3) {
+    fn(&rows, &bytes);
+    ++iterations;
+    total_rows += rows;
+    total_bytes += bytes;
+    elapsed = chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  cout << left << setw(48) << name << right
+       << setw(8) << iterations
+       << setw(12) << fixed << setprecision(3) << elapsed * 1000 / iterations << " ms"
+       << setw(14) << setprecision(0) << total_rows / elapsed << " rows/s"
+       << setw(10) << setprecision(1) << total_bytes / elapsed / (1 << 20) << " MB/s"
+       << endl;
+}
+
+// Returns the number of bytes of data, including the null bitmap, in column 'i' of
+// 'results', using the accessor that matches 'type'. String values are each read, as a
+// caller would, rather than taking the size of their buffer. Sets the number of rows in
+// 'length'.
+int64_t ColumnBytes(const ColumnarRowSet& results, int i, TypeId type, int64_t* length) {
+  switch (type) {
+    case TypeId::BOOLEAN: {
+      unique_ptr<BoolColumn> col = results.GetBoolCol(i);
+      *length = col->length();
+      return col->length() * sizeof(bool) + col->nulls_size();
+    }
+    case TypeId::TINYINT: {
+      unique_ptr<ByteColumn> col = results.GetByteCol(i);
+      *length = col->length();
+      return col->length() * sizeof(int8_t) + col->nulls_size();
+    }
+    case TypeId::SMALLINT: {
+      unique_ptr<Int16Column> col = results.GetInt16Col(i);
+      *length = col->length();
+      return col->length() * sizeof(int16_t) + col->nulls_size();
+    }
+    case TypeId::INT: {
+      unique_ptr<Int32Column> col = results.GetInt32Col(i);
+      *length = col->length();
+      return col->length() * sizeof(int32_t) + col->nulls_size();
+    }
+    case TypeId::BIGINT: {
+      unique_ptr<Int64Column> col = results.GetInt64Col(i);
+      *length = col->length();
+      return col->length() * sizeof(int64_t) + col->nulls_size();
+    }
+    case TypeId::FLOAT:
+    case TypeId::DOUBLE: {
+      unique_ptr<DoubleColumn> col = results.GetDoubleCol(i);
+      *length = col->length();
+      return col->length() * sizeof(double) + col->nulls_size();
+    }
+    default: {
+      // All other types are returned as strings.
+      unique_ptr<StringViewColumn> col = results.GetStringViewCol(i);
+      *length = col->length();
+      int64_t bytes = col->nulls_size();
+      for (int j = 0; j < col->length(); ++j) {
+        if (!col->IsNull(j)) bytes += col->GetData(j).size();
+      }
+      return bytes;
+    }
+  }
+}
+
+string ColumnName(const MockColumnSpec& col) {
+  stringstream ss;
+  ss << PrimitiveType(col.type).ToString();
+  if (col.type == TypeId::STRING) ss << "(" << col.string_length << ")";
+  return ss.str();
+}
+
+class Benchmarks {
+ public:
+  explicit Benchmarks(const BenchmarkOptions& options) : options_(options) {}
+
+  void Run() {
+    MockServerOptions server_options;
+    server_options.port = options_.port;
+    server_options.transport = options_.connection.transport;
+    server_options.protocol = options_.connection.protocol;
+    MockServer server(server_options, MockResultSpec());
+    CHECK_OK(server.Start());
+    CHECK_OK(Service::Connect("localhost", server.port(), 0,
+        ProtocolVersion::HS2CLIENT_PROTOCOL_V7, options_.connection, &service_));
+    CHECK_OK(service_->OpenSession("user", HS2ClientConfig(), &session_));
+    server_ = &server;
+
+    cout << left << setw(48) << "Benchmark" << right << setw(8) << "Iters"
+         << setw(15) << "Time/iter" << setw(21) << "Rows/s" << setw(15) << "MB/s" << endl;
+
+    vector<MockColumnSpec> columns;
+    columns.emplace_back(TypeId::BOOLEAN);
+    columns.emplace_back(TypeId::INT);
+    columns.emplace_back(TypeId::BIGINT);
+    columns.emplace_back(TypeId::DOUBLE);
+    columns.emplace_back(TypeId::STRING, 0, 8);
+    columns.emplace_back(TypeId::STRING, 0, 64);
+    columns.emplace_back(TypeId::TIMESTAMP);
+    columns.emplace_back(TypeId::DECIMAL);
+
+    for (MockColumnSpec col : columns) {
+      for (double null_fraction : {0.0, 0.5}) {
+        col.null_fraction = null_fraction;
+        for (int batch_size : {1024, 10000, 100000}) {
+          FetchBenchmark(col, batch_size);
+        }
+        GetColBenchmark(col, false);
+        if (col.type == TypeId::STRING) GetColBenchmark(col, true);
+      }
+    }
+    PrintResultsBenchmark(columns);
+
+    CHECK_OK(session_->Close());
+    CHECK_OK(service_->Close());
+    CHECK_OK(server.Stop());
+  }
+
+ private:
+  void SetSpec(const vector<MockColumnSpec>& columns, int64_t rows) {
+    MockResultSpec spec;
+    spec.columns = columns;
+    spec.num_rows = rows;
+    CHECK_OK(server_->SetResultSpec(spec));
+  }
+
+  // Measures end-to-end Operation::Fetch throughput for a single column.
+  void FetchBenchmark(const MockColumnSpec& col, int batch_size) {
+    stringstream name;
+    name << "Fetch/" << ColumnName(col) << "/batch=" << batch_size
+         << "/nulls=" << col.null_fraction;
+    SetSpec({col}, options_.rows);
+
+    RunBenchmark(options_, name.str(), [&](int64_t* rows, int64_t* bytes) {
+      *rows = 0;
+      *bytes = 0;
+      unique_ptr<Operation> op;
+      CHECK_OK(session_->ExecuteStatement("select * from mock", &op));
+      bool has_more_rows = true;
+      while (has_more_rows) {
+        unique_ptr<ColumnarRowSet> results;
+        CHECK_OK(op->Fetch(batch_size, FetchOrientation::NEXT, &results,
+            &has_more_rows));
+        int64_t length;
+        *bytes += ColumnBytes(*results, 0, col.type, &length);
+        *rows += length;
+      }
+      CHECK_OK(op->Close());
+    });
+  }
+
+  // Measures ColumnarRowSet::GetCol over already fetched batches. With 'as_strings',
+  // measures GetStringCol, which copies each value into a std::string, rather than
+  // GetStringViewCol.
+  void GetColBenchmark(const MockColumnSpec& col, bool as_strings) {
+    stringstream name;
+    name << (as_strings ? "GetStringCol/" : "GetCol/") << ColumnName(col) << "/nulls="
+         << col.null_fraction;
+    if (name.str().find(options_.filter) == string::npos) return;
+    SetSpec({col}, options_.rows);
+
+    vector<unique_ptr<ColumnarRowSet>> batches;
+    unique_ptr<Operation> op;
+    CHECK_OK(session_->ExecuteStatement("select * from mock", &op));
+    bool has_more_rows = true;
+    while (has_more_rows) {
+      unique_ptr<ColumnarRowSet> results;
+      CHECK_OK(op->Fetch(10000, FetchOrientation::NEXT, &results, &has_more_rows));
+      batches.push_back(move(results));
+    }
+    CHECK_OK(op->Close());
+
+    RunBenchmark(options_, name.str(), [&](int64_t* rows, int64_t* bytes) {
+      *rows = 0;
+      *bytes = 0;
+      for (const unique_ptr<ColumnarRowSet>& batch : batches) {
+        if (as_strings) {
+          unique_ptr<StringColumn> string_col = batch->GetStringCol(0);
+          *rows += string_col->length();
+          *bytes += string_col->nulls_size();
+          for (const string& value : string_col->data()) *bytes += value.size();
+        } else {
+          int64_t length;
+          *bytes += ColumnBytes(*batch, 0, col.type, &length);
+          *rows += length;
+        }
+      }
+    });
+  }
+
+  // Measures Util::PrintResults, including fetching, for a result set with all of
+  // the benchmarked column types.
+  void PrintResultsBenchmark(const vector<MockColumnSpec>& columns) {
+    const string name = "PrintResults/all_types";
+    if (name.find(options_.filter) == string::npos) return;
+    int64_t num_rows = max<int64_t>(options_.rows / 100, 1);
+    SetSpec(columns, num_rows);
+
+    RunBenchmark(options_, name, [&](int64_t* rows, int64_t* bytes) {
+      unique_ptr<Operation> op;
+      CHECK_OK(session_->ExecuteStatement("select * from mock", &op));
+      stringstream out;
+      Util::PrintResults(op.get(), out);
+      CHECK_OK(op->Close());
+      *rows = num_rows;
+      *bytes = out.tellp();
+    });
+  }
+
+  const BenchmarkOptions options_;
+
+  MockServer* server_;
+  unique_ptr<Service> service_;
+  unique_ptr<Session> session_;
+};
+
+// Runs a mock server returning a column of each type that the Python converters
+// support, until the process is killed.
+void Serve(const BenchmarkOptions& options) {
+  MockServerOptions server_options;
+  server_options.port = options.port;
+  server_options.transport = options.connection.transport;
+  server_options.protocol = options.connection.protocol;
+  MockResultSpec spec;
+  spec.num_rows = options.rows;
+  spec.columns.emplace_back(TypeId::BOOLEAN, 0.1);
+  spec.columns.emplace_back(TypeId::TINYINT, 0.1);
+  spec.columns.emplace_back(TypeId::SMALLINT, 0.1);
+  spec.columns.emplace_back(TypeId::INT, 0.1);
+  spec.columns.emplace_back(TypeId::BIGINT, 0.1);
+  spec.columns.emplace_back(TypeId::FLOAT, 0.1);
+  spec.columns.emplace_back(TypeId::DOUBLE, 0.1);
+  spec.columns.emplace_back(TypeId::STRING, 0.1, 16);
+  spec.columns.emplace_back(TypeId::TIMESTAMP, 0.1);
+
+  MockServer server(server_options, spec);
+  CHECK_OK(server.Start());
+  cout << "Serving " << spec.num_rows << " rows on port " << options.port << endl;
+  while (true) this_thread::sleep_for(chrono::seconds(1));
+}
+
+// Measures deserialization of the FetchResults replies in a capture file.
+void Replay(const BenchmarkOptions& options) {
+  unique_ptr<FetchReplay> replay;
+  CHECK_OK(FetchReplay::Open(options.replay_path, &replay));
+  cout << "Replaying " << replay->num_replies() << " FetchResults replies ("
+       << replay->num_reply_bytes() << " bytes)" << endl;
+
+  RunBenchmark(options, "Replay/" + options.replay_path,
+      [&](int64_t* rows, int64_t* bytes) {
+    *rows = 0;
+    replay->Rewind();
+    while (true) {
+      unique_ptr<ColumnarRowSet> results;
+      bool has_more_rows;
+      bool eos;
+      CHECK_OK(replay->Next(&results, &has_more_rows, &eos));
+      if (eos) break;
+      *rows += results->num_rows();
+    }
+    *bytes = replay->num_reply_bytes();
+  });
+}
+
+bool ParseFlag(const char* arg, const char* flag, string* value) {
+  size_t len = strlen(flag);
+  if (strncmp(arg, flag, len) != 0 || arg[len] != '=') return false;
+  *value = arg + len + 1;
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  BenchmarkOptions options;
+  for (int i = 1; i < argc; ++i) {
+    string value;
+    if (ParseFlag(argv[i], "--filter", &value)) {
+      options.filter = value;
+    } else if (ParseFlag(argv[i], "--rows", &value)) {
+      options.rows = atoll(value.c_str());
+    } else if (ParseFlag(argv[i], "--min_time", &value)) {
+      options.min_time = atof(value.c_str());
+    } else if (ParseFlag(argv[i], "--port", &value)) {
+      options.port = atoi(value.c_str());
+    } else if (ParseFlag(argv[i], "--replay", &value)) {
+      options.replay_path = value;
+    } else if (ParseFlag(argv[i], "--read_buffer_size", &value)) {
+      options.connection.read_buffer_size = atoi(value.c_str());
+    } else if (strcmp(argv[i], "--serve") == 0) {
+      options.serve = true;
+    } else if (strcmp(argv[i], "--framed") == 0) {
+      options.connection.transport = TransportType::FRAMED;
+    } else if (strcmp(argv[i], "--compact") == 0) {
+      options.connection.protocol = WireProtocol::COMPACT;
+    } else {
+      cerr << "Usage: " << argv[0] << " [--filter=<substring>] [--rows=<n>] "
+           << "[--min_time=<seconds>] [--port=<port>] [--serve] "
+           << "[--replay=<capture file>] [--framed] [--compact] "
+           << "[--read_buffer_size=<bytes>]" << endl;
+      return 1;
+    }
+  }
+
+  if (options.serve) {
+    Serve(options);
+  } else if (!options.replay_path.empty()) {
+    Replay(options);
+  } else {
+    Benchmarks(options).Run();
+  }
+  return 0;
+}
@@ -0,0 +1,154 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hs2client/message-scanner.h"
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include <thrift/TApplicationException.h>
+#include <thrift/transport/TBufferTransports.h>
+
+#include "hs2client/test-util.h"
+#include "hs2client/thrift-internal.h"
+
+namespace hs2 = apache::hive::service::cli::thrift;
+
+using apache::thrift::TApplicationException;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using namespace hs2client;
+using namespace std;
+
+namespace {
+
+// Returns a FetchResults reply with 'num_rows' rows of INT, STRING and BOOLEAN columns,
+// serialized as the server would.
+string WriteReply(WireProtocol protocol, int num_rows) {
+  hs2::TFetchResultsResp resp;
+  resp.status.__set_statusCode(hs2::TStatusCode::SUCCESS_STATUS);
+  resp.__set_hasMoreRows(true);
+  hs2::TRowSet& results = resp.results;
+  results.__set_startRowOffset(1000);
+  hs2::TI32Column ints;
+  hs2::TStringColumn strings;
+  hs2::TBoolColumn bools;
+  for (int i = 0; i < num_rows; ++i) {
+    ints.values.push_back(i * 37 - 500);
+    strings.values.push_back(string(i % 23, 'x'));
+    bools.values.push_back(i % 2 == 0);
+  }
+  ints.nulls.assign((num_rows + 7) / 8, '\x05');
+  vector<hs2::TColumn> columns(3);
+  columns[0].__set_i32Val(ints);
+  columns[1].__set_stringVal(strings);
+  columns[2].__set_boolVal(bools);
+  results.__set_columns(columns);
+
+  boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  boost::shared_ptr<TProtocol> prot = NewProtocol(protocol, buffer);
+  prot->writeMessageBegin("FetchResults", apache::thrift::protocol::T_REPLY, 1);
+  prot->writeStructBegin("TCLIService_FetchResults_result");
+  prot->writeFieldBegin("success", apache::thrift::protocol::T_STRUCT, 0);
+  resp.write(prot.get());
+  prot->writeFieldEnd();
+  prot->writeFieldStop();
+  prot->writeStructEnd();
+  prot->writeMessageEnd();
+  return buffer->getBufferAsString();
+}
+
+string WriteException(WireProtocol protocol) {
+  boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  boost::shared_ptr<TProtocol> prot = NewProtocol(protocol, buffer);
+  TApplicationException x(TApplicationException::INTERNAL_ERROR, "Mock failure");
+  prot->writeMessageBegin("FetchResults", apache::thrift::protocol::T_EXCEPTION, 1);
+  x.write(prot.get());
+  prot->writeMessageEnd();
+  return buffer->getBufferAsString();
+}
+
+const uint8_t* Data(const string& bytes) {
+  return reinterpret_cast<const uint8_t*>(bytes.data());
+}
+
+} // namespace
+
+class MessageScannerTest : public ::testing::TestWithParam<WireProtocol> {};
+
+TEST_P(MessageScannerTest, TestIncremental) {
+  for (int num_rows : {0, 1, 15, 16, 3000}) {
+    string reply = WriteReply(GetParam(), num_rows);
+    // The next reply has already started to arrive.
+    string bytes = reply + WriteReply(GetParam(), 1);
+
+    MessageScanner scanner(GetParam());
+    size_t message_size;
+    for (size_t len = 0; len < reply.size(); ++len) {
+      EXPECT_OK(scanner.Scan(Data(bytes), len, &message_size));
+      ASSERT_EQ(message_size, 0) << num_rows << " rows, " << len << " bytes";
+    }
+    EXPECT_OK(scanner.Scan(Data(bytes), bytes.size(), &message_size));
+    EXPECT_EQ(message_size, reply.size());
+
+    scanner.Reset();
+    EXPECT_OK(scanner.Scan(Data(bytes) + reply.size(), bytes.size() - reply.size(),
+        &message_size));
+    EXPECT_EQ(message_size, bytes.size() - reply.size());
+  }
+}
+
+TEST_P(MessageScannerTest, TestException) {
+  string reply = WriteException(GetParam());
+  MessageScanner scanner(GetParam());
+  size_t message_size;
+  EXPECT_OK(scanner.Scan(Data(reply), reply.size() - 1, &message_size));
+  EXPECT_EQ(message_size, 0);
+  EXPECT_OK(scanner.Scan(Data(reply), reply.size(), &message_size));
+  EXPECT_EQ(message_size, reply.size());
+}
+
+TEST_P(MessageScannerTest, TestMalformed) {
+  MessageScanner scanner(GetParam());
+  size_t message_size;
+  // An unknown protocol version.
+  string bytes = GetParam() == WireProtocol::COMPACT ?
+      string("\x82\x02\x01\x00", 4) : string("\x80\x02\x00\x02", 4);
+  EXPECT_OK(scanner.Scan(Data(bytes), 1, &message_size));
+  EXPECT_ERROR(scanner.Scan(Data(bytes), bytes.size(), &message_size));
+
+  // The type of the result's first field is invalid. Its field header follows the
+  // message header, which holds the name and a sequence id of 1.
+  string reply = WriteReply(GetParam(), 10);
+  size_t name_size = strlen("FetchResults");
+  if (GetParam() == WireProtocol::COMPACT) {
+    reply[2 + 1 + 1 + name_size] = '\x0d';
+  } else {
+    reply[4 + 4 + name_size + 4] = '\x01';
+  }
+  scanner.Reset();
+  Status status = scanner.Scan(Data(reply), reply.size(), &message_size);
+  EXPECT_ERROR(status);
+  EXPECT_EQ(message_size, 0);
+}
+
+INSTANTIATE_TEST_CASE_P(Protocols, MessageScannerTest,
+    ::testing::Values(WireProtocol::BINARY, WireProtocol::COMPACT));
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
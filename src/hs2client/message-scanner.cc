@@ -0,0 +1,381 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/message-scanner.h"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+#include <thrift/protocol/TProtocol.h>
+
+#include "hs2client/logging.h"
+
+using apache::thrift::protocol::T_BOOL;
+using apache::thrift::protocol::T_BYTE;
+using apache::thrift::protocol::T_DOUBLE;
+using apache::thrift::protocol::T_I16;
+using apache::thrift::protocol::T_I32;
+using apache::thrift::protocol::T_I64;
+using apache::thrift::protocol::T_LIST;
+using apache::thrift::protocol::T_MAP;
+using apache::thrift::protocol::T_SET;
+using apache::thrift::protocol::T_STOP;
+using apache::thrift::protocol::T_STRING;
+using apache::thrift::protocol::T_STRUCT;
+using std::string;
+
+namespace hs2client {
+
+namespace {
+
+// The same limit on nesting as Thrift's own deserializers.
+const size_t MAX_DEPTH = 64;
+
+// The longest varint, that of a 64-bit value.
+const int MAX_VARINT_SIZE = 10;
+
+const uint32_t BINARY_VERSION_MASK = 0xffff0000;
+const uint32_t BINARY_VERSION_1 = 0x80010000;
+
+const uint8_t COMPACT_PROTOCOL_ID = 0x82;
+const uint8_t COMPACT_VERSION = 1;
+const uint8_t COMPACT_VERSION_MASK = 0x1f;
+
+// Returns the Thrift type for the type of a compact protocol field or element, or
+// T_STOP if it isn't one.
+uint8_t CompactToTType(uint8_t compact_type) {
+  switch (compact_type) {
+    case 1: // BOOLEAN_TRUE
+    case 2: // BOOLEAN_FALSE
+      return T_BOOL;
+    case 3: return T_BYTE;
+    case 4: return T_I16;
+    case 5: return T_I32;
+    case 6: return T_I64;
+    case 7: return T_DOUBLE;
+    case 8: return T_STRING;
+    case 9: return T_LIST;
+    case 10: return T_SET;
+    case 11: return T_MAP;
+    case 12: return T_STRUCT;
+    default: return T_STOP;
+  }
+}
+
+// Returns the Thrift type for the element type 'wire_type' of a list, set or map.
+uint8_t ElementType(WireProtocol protocol, uint8_t wire_type) {
+  return protocol == WireProtocol::COMPACT ? CompactToTType(wire_type) : wire_type;
+}
+
+} // namespace
+
+// Reads from the bytes that have arrived, starting at the end of the last complete
+// item. Each read returns false if its bytes haven't all arrived yet.
+class MessageScanner::Cursor {
+ public:
+  Cursor(const uint8_t* data, size_t pos, size_t len, string* error)
+    : data_(data), pos_(pos), len_(len), error_(error) {}
+
+  size_t pos() const { return pos_; }
+  size_t available() const { return len_ - pos_; }
+
+  bool Skip(uint64_t n) {
+    if (available() < n) return false;
+    pos_ += n;
+    return true;
+  }
+
+  bool ReadByte(uint8_t* value) {
+    if (available() < 1) return false;
+    *value = data_[pos_++];
+    return true;
+  }
+
+  bool ReadBigEndian32(int32_t* value) {
+    if (available() < 4) return false;
+    uint32_t result = 0;
+    for (int i = 0; i < 4; ++i) result = (result << 8) | data_[pos_++];
+    *value = static_cast<int32_t>(result);
+    return true;
+  }
+
+  // Sets 'error_' if the varint is too long.
+  bool ReadVarint(uint64_t* value) {
+    uint64_t result = 0;
+    for (int i = 0; i < MAX_VARINT_SIZE; ++i) {
+      uint8_t byte;
+      if (!ReadByte(&byte)) return false;
+      result |= static_cast<uint64_t>(byte & 0x7f) << (7 * i);
+      if ((byte & 0x80) == 0) {
+        *value = result;
+        return true;
+      }
+    }
+    *error_ = "varint is too long";
+    return false;
+  }
+
+ private:
+  const uint8_t* data_;
+  size_t pos_;
+  size_t len_;
+  string* error_;
+};
+
+MessageScanner::MessageScanner(WireProtocol protocol) : protocol_(protocol) {
+  Reset();
+}
+
+void MessageScanner::Reset() {
+  pos_ = 0;
+  header_done_ = false;
+  stack_.clear();
+  error_.clear();
+}
+
+Status MessageScanner::Scan(const uint8_t* data, size_t len, size_t* message_size) {
+  DCHECK_GE(len, pos_);
+  *message_size = 0;
+  while (error_.empty()) {
+    if (header_done_ && stack_.empty()) {
+      *message_size = pos_;
+      return Status::OK();
+    }
+    Cursor cursor(data, pos_, len, &error_);
+    if (!header_done_) {
+      if (!ReadMessageHeader(&cursor)) break;
+      header_done_ = true;
+      // The body of every reply, including an exception, is a struct.
+      stack_.push_back(Container{true, {T_STOP, T_STOP}, 0});
+    } else if (!Step(&cursor)) {
+      break;
+    }
+    pos_ = cursor.pos();
+  }
+  if (!error_.empty()) return Status::Error("Malformed reply: " + error_);
+  return Status::OK();
+}
+
+bool MessageScanner::ReadMessageHeader(Cursor* cursor) {
+  if (protocol_ == WireProtocol::COMPACT) {
+    uint8_t protocol_id, version_and_type;
+    if (!cursor->ReadByte(&protocol_id) || !cursor->ReadByte(&version_and_type)) {
+      return false;
+    }
+    if (protocol_id != COMPACT_PROTOCOL_ID ||
+        (version_and_type & COMPACT_VERSION_MASK) != COMPACT_VERSION) {
+      error_ = "bad compact protocol message header";
+      return false;
+    }
+    uint64_t seqid;
+    int64_t name_size;
+    return cursor->ReadVarint(&seqid) && ReadSize(cursor, &name_size) &&
+        cursor->Skip(name_size);
+  }
+
+  int32_t size;
+  if (!cursor->ReadBigEndian32(&size)) return false;
+  if (size < 0) {
+    // A strict header: the version and type, the name and the sequence id.
+    if ((static_cast<uint32_t>(size) & BINARY_VERSION_MASK) != BINARY_VERSION_1) {
+      error_ = "bad binary protocol version";
+      return false;
+    }
+    int64_t name_size;
+    return ReadSize(cursor, &name_size) && cursor->Skip(name_size) && cursor->Skip(4);
+  }
+  // An old style header: the name, whose size was just read, the type and the sequence
+  // id.
+  return cursor->Skip(size) && cursor->Skip(1) && cursor->Skip(4);
+}
+
+bool MessageScanner::ReadFieldHeader(Cursor* cursor, uint8_t* type) {
+  uint8_t byte;
+  if (!cursor->ReadByte(&byte)) return false;
+  if (protocol_ == WireProtocol::COMPACT) {
+    if (byte == 0) {
+      *type = T_STOP;
+      return true;
+    }
+    // The field id is either a delta in the high nibble or follows as a varint.
+    uint64_t field_id;
+    if ((byte >> 4) == 0 && !cursor->ReadVarint(&field_id)) return false;
+    *type = CompactToTType(byte & 0x0f);
+    if (*type == T_STOP) {
+      error_ = "bad field type";
+      return false;
+    }
+    return true;
+  }
+  *type = byte;
+  return *type == T_STOP || cursor->Skip(2);
+}
+
+bool MessageScanner::ReadSize(Cursor* cursor, int64_t* size) {
+  if (protocol_ == WireProtocol::COMPACT) {
+    uint64_t value;
+    if (!cursor->ReadVarint(&value)) return false;
+    if (value > static_cast<uint64_t>(std::numeric_limits<int32_t>::max())) {
+      error_ = "size is too large";
+      return false;
+    }
+    *size = static_cast<int64_t>(value);
+    return true;
+  }
+  int32_t value;
+  if (!cursor->ReadBigEndian32(&value)) return false;
+  if (value < 0) {
+    error_ = "negative size";
+    return false;
+  }
+  *size = value;
+  return true;
+}
+
+bool MessageScanner::ReadValue(Cursor* cursor, uint8_t type, bool is_field,
+    Container* container, bool* is_container) {
+  bool compact = protocol_ == WireProtocol::COMPACT;
+  *is_container = false;
+  switch (type) {
+    case T_BOOL:
+      // A compact protocol field carries its value in its type.
+      return (compact && is_field) || cursor->Skip(1);
+    case T_BYTE:
+      return cursor->Skip(1);
+    case T_DOUBLE:
+      return cursor->Skip(8);
+    case T_I16:
+    case T_I32:
+    case T_I64: {
+      if (compact) {
+        uint64_t value;
+        return cursor->ReadVarint(&value);
+      }
+      return cursor->Skip(type == T_I16 ? 2 : (type == T_I32 ? 4 : 8));
+    }
+    case T_STRING: {
+      int64_t size;
+      return ReadSize(cursor, &size) && cursor->Skip(size);
+    }
+    case T_STRUCT:
+      *container = Container{true, {T_STOP, T_STOP}, 0};
+      *is_container = true;
+      return true;
+    case T_LIST:
+    case T_SET: {
+      uint8_t header;
+      int64_t size;
+      if (!cursor->ReadByte(&header)) return false;
+      if (compact) {
+        // The size is in the high nibble, or follows as a varint if it's 15 or more.
+        size = header >> 4;
+        if (size == 15 && !ReadSize(cursor, &size)) return false;
+        header &= 0x0f;
+      } else if (!ReadSize(cursor, &size)) {
+        return false;
+      }
+      uint8_t elem_type = ElementType(protocol_, header);
+      *container = Container{false, {elem_type, elem_type}, size};
+      *is_container = true;
+      return true;
+    }
+    case T_MAP: {
+      uint8_t key_type = T_STOP;
+      uint8_t value_type = T_STOP;
+      int64_t size;
+      if (compact) {
+        // The key and value types are only written for a non-empty map.
+        uint8_t types;
+        if (!ReadSize(cursor, &size)) return false;
+        if (size > 0) {
+          if (!cursor->ReadByte(&types)) return false;
+          key_type = ElementType(protocol_, types >> 4);
+          value_type = ElementType(protocol_, types & 0x0f);
+        }
+      } else {
+        if (!cursor->ReadByte(&key_type) || !cursor->ReadByte(&value_type) ||
+            !ReadSize(cursor, &size)) {
+          return false;
+        }
+      }
+      *container = Container{false, {key_type, value_type}, 2 * size};
+      *is_container = true;
+      return true;
+    }
+    default: {
+      std::stringstream ss;
+      ss << "bad type " << static_cast<int>(type);
+      error_ = ss.str();
+      return false;
+    }
+  }
+}
+
+bool MessageScanner::Step(Cursor* cursor) {
+  Container& top = stack_.back();
+  uint8_t type;
+  if (top.is_struct) {
+    if (!ReadFieldHeader(cursor, &type)) return false;
+    if (type == T_STOP) {
+      stack_.pop_back();
+      return true;
+    }
+  } else {
+    if (top.remaining == 0) {
+      stack_.pop_back();
+      return true;
+    }
+    // Keys come before values, so a map's key is next when an even number are left.
+    type = top.types[top.remaining % 2 == 0 ? 0 : 1];
+    // The elements of a list of fixed size values, eg. a column's INT values, are
+    // skipped together.
+    int width = 0;
+    if (top.types[0] == top.types[1]) {
+      bool compact = protocol_ == WireProtocol::COMPACT;
+      switch (type) {
+        case T_BOOL:
+        case T_BYTE: width = 1; break;
+        case T_DOUBLE: width = 8; break;
+        case T_I16: width = compact ? 0 : 2; break;
+        case T_I32: width = compact ? 0 : 4; break;
+        case T_I64: width = compact ? 0 : 8; break;
+        default: break;
+      }
+    }
+    if (width > 0) {
+      int64_t n = std::min<int64_t>(top.remaining, cursor->available() / width);
+      if (n == 0) return false;
+      cursor->Skip(n * width);
+      top.remaining -= n;
+      return true;
+    }
+  }
+
+  Container container;
+  bool is_container;
+  if (!ReadValue(cursor, type, top.is_struct, &container, &is_container)) return false;
+  if (!top.is_struct) --top.remaining;
+  if (is_container) {
+    if (stack_.size() == MAX_DEPTH) {
+      error_ = "too deeply nested";
+      return false;
+    }
+    stack_.push_back(container);
+  }
+  return true;
+}
+
+} // namespace hs2client
@@ -0,0 +1,90 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef HS2CLIENT_MESSAGE_SCANNER_H
+#define HS2CLIENT_MESSAGE_SCANNER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "hs2client/service.h"
+#include "hs2client/status.h"
+
+namespace hs2client {
+
+// Finds where an unframed Thrift message ends, so that it is only deserialized once all
+// of it has arrived. The message is scanned incrementally: each call to Scan resumes
+// where the last one stopped, so a message that arrives over many reads is walked once,
+// and values are skipped over rather than decoded.
+class MessageScanner {
+ public:
+  explicit MessageScanner(WireProtocol protocol);
+
+  // Scans 'data', the first 'len' bytes of a message, which must start with the bytes
+  // passed to the previous calls since the last Reset. Sets 'message_size' to the size
+  // of the message once all of it is in 'data', and to 0 if more bytes are needed.
+  // Returns an error if the message is malformed.
+  Status Scan(const uint8_t* data, size_t len, size_t* message_size);
+
+  // Prepares to scan the next message.
+  void Reset();
+
+ private:
+  class Cursor;
+
+  // A struct, list, set or map whose contents are being scanned.
+  struct Container {
+    bool is_struct;
+    // The Thrift types of the elements of a list or set, which are both the same, or of
+    // the keys and values of a map.
+    uint8_t types[2];
+    // The number of elements left, counting a map's keys and values separately.
+    int64_t remaining;
+  };
+
+  // Each of the following consumes one item from 'cursor' and returns true, or returns
+  // false if its bytes haven't all arrived or it is malformed, in which case 'error_'
+  // is set. Nothing is changed unless they return true.
+  bool ReadMessageHeader(Cursor* cursor);
+  bool ReadFieldHeader(Cursor* cursor, uint8_t* type);
+  bool ReadSize(Cursor* cursor, int64_t* size);
+
+  // Consumes a value of 'type'. For a struct, list, set or map, only its header is
+  // consumed and its contents are set in 'container'. 'is_field' is true if the value
+  // is a struct field rather than an element.
+  bool ReadValue(Cursor* cursor, uint8_t type, bool is_field, Container* container,
+      bool* is_container);
+
+  // Consumes the next field of the innermost struct or the next elements of the
+  // innermost container, or the end of either.
+  bool Step(Cursor* cursor);
+
+  const WireProtocol protocol_;
+
+  // The number of bytes of the message scanned so far.
+  size_t pos_;
+  bool header_done_;
+  // The containers that are being scanned, innermost last. Empty once the message's
+  // header has been read only if all of it has been scanned.
+  std::vector<Container> stack_;
+  // Set if the message is malformed.
+  std::string error_;
+};
+
+} // namespace hs2client
+
+#endif // HS2CLIENT_MESSAGE_SCANNER_H
@@ -0,0 +1,93 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/metrics.h"
+
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+using namespace hs2client;
+using namespace std;
+
+TEST(MetricsTest, TestBuckets) {
+  EXPECT_EQ(LatencyHistogram::Bucket(0), 0);
+  EXPECT_EQ(LatencyHistogram::Bucket(1), 1);
+  EXPECT_EQ(LatencyHistogram::Bucket(2), 2);
+  EXPECT_EQ(LatencyHistogram::Bucket(3), 2);
+  EXPECT_EQ(LatencyHistogram::Bucket(4), 3);
+  EXPECT_EQ(LatencyHistogram::Bucket(1000), 10);
+  EXPECT_EQ(LatencyHistogram::Bucket(1LL << 40), LatencyHistogram::NUM_BUCKETS - 1);
+}
+
+TEST(MetricsTest, TestRecord) {
+  MetricsRecorder recorder;
+  ServiceMetrics metrics;
+  recorder.Snapshot(&metrics);
+  EXPECT_EQ(metrics.rpc(RpcMethod::FETCH_RESULTS).count, 0);
+  EXPECT_EQ(metrics.rpc(RpcMethod::FETCH_RESULTS).latency.Percentile(99), 0);
+
+  // 90 fast fetches, 10 slow ones and a failed one.
+  for (int i = 0; i < 90; ++i) recorder.RecordRpc(RpcMethod::FETCH_RESULTS, 100, true);
+  for (int i = 0; i < 10; ++i) recorder.RecordRpc(RpcMethod::FETCH_RESULTS, 5000, true);
+  recorder.RecordRpc(RpcMethod::FETCH_RESULTS, 20000, false);
+  recorder.RecordRpc(RpcMethod::OPEN_SESSION, 10, true);
+  recorder.AddBytesRead(100);
+  recorder.AddBytesWritten(10);
+  recorder.AddRowsFetched(1024);
+
+  recorder.Snapshot(&metrics);
+  const RpcMetrics& fetches = metrics.rpc(RpcMethod::FETCH_RESULTS);
+  EXPECT_EQ(fetches.count, 101);
+  EXPECT_EQ(fetches.num_errors, 1);
+  EXPECT_EQ(fetches.latency.count, 101);
+  EXPECT_EQ(fetches.latency.sum_us, 90 * 100 + 10 * 5000 + 20000);
+  EXPECT_EQ(fetches.latency.Percentile(50), 128);
+  EXPECT_EQ(fetches.latency.Percentile(95), 8192);
+  EXPECT_EQ(fetches.latency.Percentile(100), 32768);
+  EXPECT_EQ(metrics.rpc(RpcMethod::OPEN_SESSION).count, 1);
+  EXPECT_EQ(metrics.rpc(RpcMethod::CLOSE_SESSION).count, 0);
+  EXPECT_EQ(metrics.bytes_read, 100);
+  EXPECT_EQ(metrics.bytes_written, 10);
+  EXPECT_EQ(metrics.rows_fetched, 1024);
+
+  EXPECT_STREQ(RpcMethodToString(RpcMethod::FETCH_RESULTS), "FetchResults");
+  EXPECT_STREQ(RpcMethodToString(RpcMethod::CLOSE_OPERATION), "CloseOperation");
+}
+
+TEST(MetricsTest, TestConcurrentRecord) {
+  MetricsRecorder recorder;
+  vector<thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&recorder]() {
+      for (int j = 0; j < 10000; ++j) {
+        recorder.RecordRpc(RpcMethod::GET_OPERATION_STATUS, j, true);
+        recorder.AddBytesRead(1);
+      }
+    });
+  }
+  for (thread& t : threads) t.join();
+
+  ServiceMetrics metrics;
+  recorder.Snapshot(&metrics);
+  EXPECT_EQ(metrics.rpc(RpcMethod::GET_OPERATION_STATUS).count, 40000);
+  EXPECT_EQ(metrics.rpc(RpcMethod::GET_OPERATION_STATUS).latency.count, 40000);
+  EXPECT_EQ(metrics.bytes_read, 40000);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,100 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/metrics.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace hs2client {
+
+const char* RpcMethodToString(RpcMethod method) {
+  switch (method) {
+    case RpcMethod::OPEN_SESSION: return "OpenSession";
+    case RpcMethod::CLOSE_SESSION: return "CloseSession";
+    case RpcMethod::GET_INFO: return "GetInfo";
+    case RpcMethod::EXECUTE_STATEMENT: return "ExecuteStatement";
+    case RpcMethod::GET_OPERATION_STATUS: return "GetOperationStatus";
+    case RpcMethod::GET_LOG: return "GetLog";
+    case RpcMethod::GET_RUNTIME_PROFILE: return "GetRuntimeProfile";
+    case RpcMethod::GET_RESULT_SET_METADATA: return "GetResultSetMetadata";
+    case RpcMethod::FETCH_RESULTS: return "FetchResults";
+    case RpcMethod::CANCEL_OPERATION: return "CancelOperation";
+    case RpcMethod::CLOSE_OPERATION: return "CloseOperation";
+  }
+  return "Unknown";
+}
+
+LatencyHistogram::LatencyHistogram() : count(0), sum_us(0) {
+  std::fill(buckets, buckets + NUM_BUCKETS, 0);
+}
+
+int LatencyHistogram::Bucket(int64_t latency_us) {
+  if (latency_us <= 0) return 0;
+  // The number of significant bits, so 1 is in bucket 1, 2-3 in bucket 2, etc.
+  int bucket = 64 - __builtin_clzll(static_cast<uint64_t>(latency_us));
+  return std::min(bucket, NUM_BUCKETS - 1);
+}
+
+int64_t LatencyHistogram::Percentile(double percentile) const {
+  if (count == 0) return 0;
+  int64_t rank = std::max<int64_t>(1, std::ceil(count * percentile / 100.0));
+  int64_t seen = 0;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    seen += buckets[i];
+    if (seen >= rank) return i == 0 ? 1 : (1LL << i);
+  }
+  return 1LL << (NUM_BUCKETS - 1);
+}
+
+MetricsRecorder::MetricsRecorder()
+  : bytes_read_(0), bytes_written_(0), rows_fetched_(0) {
+  for (Counters& counters : rpcs_) {
+    counters.count = 0;
+    counters.num_errors = 0;
+    counters.num_server_errors = 0;
+    counters.sum_us = 0;
+    for (std::atomic<int64_t>& bucket : counters.buckets) bucket = 0;
+  }
+}
+
+void MetricsRecorder::RecordRpc(RpcMethod method, int64_t latency_us, bool ok) {
+  Counters& counters = rpcs_[static_cast<int>(method)];
+  Add(&counters.count, 1);
+  if (!ok) Add(&counters.num_errors, 1);
+  Add(&counters.sum_us, latency_us);
+  Add(&counters.buckets[LatencyHistogram::Bucket(latency_us)], 1);
+}
+
+void MetricsRecorder::Snapshot(ServiceMetrics* out) const {
+  for (int i = 0; i < NUM_RPC_METHODS; ++i) {
+    const Counters& counters = rpcs_[i];
+    RpcMetrics* rpc = &out->rpcs[i];
+    rpc->count = counters.count.load(std::memory_order_relaxed);
+    rpc->num_errors = counters.num_errors.load(std::memory_order_relaxed);
+    rpc->num_server_errors = counters.num_server_errors.load(std::memory_order_relaxed);
+    rpc->latency.sum_us = counters.sum_us.load(std::memory_order_relaxed);
+    rpc->latency.count = 0;
+    for (int j = 0; j < LatencyHistogram::NUM_BUCKETS; ++j) {
+      rpc->latency.buckets[j] = counters.buckets[j].load(std::memory_order_relaxed);
+      rpc->latency.count += rpc->latency.buckets[j];
+    }
+  }
+  out->bytes_read = bytes_read_.load(std::memory_order_relaxed);
+  out->bytes_written = bytes_written_.load(std::memory_order_relaxed);
+  out->rows_fetched = rows_fetched_.load(std::memory_order_relaxed);
+}
+
+} // namespace hs2client
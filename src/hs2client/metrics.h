@@ -0,0 +1,154 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef HS2CLIENT_METRICS_H
+#define HS2CLIENT_METRICS_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "hs2client/macros.h"
+
+namespace hs2client {
+
+// The RPCs that the client issues, named after the HiveServer2 methods.
+enum class RpcMethod {
+  OPEN_SESSION,
+  CLOSE_SESSION,
+  GET_INFO,
+  EXECUTE_STATEMENT,
+  GET_OPERATION_STATUS,
+  GET_LOG,
+  GET_RUNTIME_PROFILE,
+  GET_RESULT_SET_METADATA,
+  FETCH_RESULTS,
+  CANCEL_OPERATION,
+  CLOSE_OPERATION,
+};
+
+const int NUM_RPC_METHODS = static_cast<int>(RpcMethod::CLOSE_OPERATION) + 1;
+
+// Returns the HiveServer2 name of 'method', eg. "FetchResults".
+const char* RpcMethodToString(RpcMethod method);
+
+// A histogram of latencies with power of 2 buckets. Bucket 0 counts latencies under 1
+// microsecond, and bucket i > 0 those in [2^(i - 1), 2^i) microseconds. The last bucket
+// also counts all larger latencies, ie. those of 2^30 microseconds, about 18 minutes, or
+// more.
+struct LatencyHistogram {
+  static const int NUM_BUCKETS = 32;
+
+  LatencyHistogram();
+
+  // Returns the bucket that counts 'latency_us'.
+  static int Bucket(int64_t latency_us);
+
+  // Returns an upper bound in microseconds of the 'percentile' percentile, between 0 and
+  // 100, which is the upper bound of the bucket that contains it. Returns 0 if the
+  // histogram is empty.
+  int64_t Percentile(double percentile) const;
+
+  int64_t buckets[NUM_BUCKETS];
+  int64_t count;
+  int64_t sum_us;
+};
+
+// The metrics of one RPC method.
+struct RpcMetrics {
+  RpcMetrics() : count(0), num_errors(0), num_server_errors(0) {}
+
+  // The number of RPCs issued, including those that failed.
+  int64_t count;
+
+  // The number of RPCs that failed to complete, eg. because the connection was lost or
+  // timed out. Errors returned by the server in a reply aren't counted.
+  int64_t num_errors;
+
+  // The number of RPCs whose reply had an ERROR or INVALID_HANDLE status. These RPCs
+  // completed, so aren't counted in 'num_errors'.
+  int64_t num_server_errors;
+
+  // The time from sending each request until its reply has been read, not including any
+  // time spent waiting for other RPCs on the connection to finish.
+  LatencyHistogram latency;
+};
+
+// A snapshot of the metrics of a connection, see Service::GetMetrics.
+struct ServiceMetrics {
+  ServiceMetrics() : bytes_read(0), bytes_written(0), rows_fetched(0) {}
+
+  const RpcMetrics& rpc(RpcMethod method) const {
+    return rpcs[static_cast<int>(method)];
+  }
+
+  // Indexed by RpcMethod.
+  RpcMetrics rpcs[NUM_RPC_METHODS];
+
+  // The bytes read from and written to the socket, including any framing.
+  int64_t bytes_read;
+  int64_t bytes_written;
+
+  // The number of rows returned by FetchResults.
+  int64_t rows_fetched;
+};
+
+// Records the metrics of a connection. Thread-safe, and cheap enough to be updated for
+// every RPC and socket read: RPCs over a connection are serialized, so the counters
+// aren't contended, and are relaxed atomics so that Snapshot doesn't wait for an RPC
+// that is in progress.
+class MetricsRecorder {
+ public:
+  MetricsRecorder();
+
+  void RecordRpc(RpcMethod method, int64_t latency_us, bool ok);
+
+  // Records that the reply of an RPC of 'method', also passed to RecordRpc, had an
+  // error status.
+  void RecordServerError(RpcMethod method) {
+    Add(&rpcs_[static_cast<int>(method)].num_server_errors, 1);
+  }
+
+  void AddBytesRead(int64_t bytes) { Add(&bytes_read_, bytes); }
+  void AddBytesWritten(int64_t bytes) { Add(&bytes_written_, bytes); }
+  void AddRowsFetched(int64_t rows) { Add(&rows_fetched_, rows); }
+
+  // Copies the current values into 'out'. Counters are read individually, so a snapshot
+  // taken during an RPC may include some of its updates and not others.
+  void Snapshot(ServiceMetrics* out) const;
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(MetricsRecorder);
+
+  struct Counters {
+    std::atomic<int64_t> count;
+    std::atomic<int64_t> num_errors;
+    std::atomic<int64_t> num_server_errors;
+    std::atomic<int64_t> sum_us;
+    std::atomic<int64_t> buckets[LatencyHistogram::NUM_BUCKETS];
+  };
+
+  static void Add(std::atomic<int64_t>* counter, int64_t value) {
+    counter->fetch_add(value, std::memory_order_relaxed);
+  }
+
+  Counters rpcs_[NUM_RPC_METHODS];
+  std::atomic<int64_t> bytes_read_;
+  std::atomic<int64_t> bytes_written_;
+  std::atomic<int64_t> rows_fetched_;
+};
+
+} // namespace hs2client
+
+#endif // HS2CLIENT_METRICS_H
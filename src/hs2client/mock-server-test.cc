@@ -0,0 +1,497 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hs2client/mock-server.h"
+
+#include <cmath>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hs2client/operation.h"
+#include "hs2client/parse-util.h"
+#include "hs2client/service.h"
+#include "hs2client/session.h"
+#include "hs2client/test-util.h"
+
+using namespace hs2client;
+using namespace std;
+
+class MockServerTest : public MockSessionTestBase {
+ protected:
+  virtual void SetUp() {
+    spec_.num_rows = 2500;
+    spec_.columns.emplace_back(ColumnType::TypeId::INT, 0.1);
+    spec_.columns.emplace_back(ColumnType::TypeId::STRING, 0.5, 8);
+    spec_.columns.emplace_back(ColumnType::TypeId::DOUBLE);
+    spec_.columns.emplace_back(ColumnType::TypeId::DECIMAL);
+    spec_.columns.back().precision = 9;
+    spec_.columns.back().scale = 2;
+  }
+};
+
+TEST_F(MockServerTest, TestFetch) {
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  unique_ptr<Operation> op;
+  EXPECT_OK(session_->ExecuteStatement("select * from mock", &op));
+  EXPECT_TRUE(op->HasResultSet());
+  EXPECT_OK(Wait(op));
+
+  vector<ColumnDesc> column_descs;
+  EXPECT_OK(op->GetResultSetMetadata(&column_descs));
+  ASSERT_EQ(column_descs.size(), 4);
+  EXPECT_EQ(column_descs[0].type()->type_id(), ColumnType::TypeId::INT);
+  EXPECT_EQ(column_descs[1].type()->type_id(), ColumnType::TypeId::STRING);
+  EXPECT_EQ(column_descs[2].type()->type_id(), ColumnType::TypeId::DOUBLE);
+  EXPECT_EQ(column_descs[3].type()->type_id(), ColumnType::TypeId::DECIMAL);
+  EXPECT_EQ(column_descs[3].GetDecimalType()->precision(), 9);
+  EXPECT_EQ(column_descs[3].GetDecimalType()->scale(), 2);
+
+  int64_t total_rows = 0;
+  int64_t int_nulls = 0;
+  int64_t string_nulls = 0;
+  bool has_more_rows = true;
+  while (has_more_rows) {
+    unique_ptr<ColumnarRowSet> results;
+    EXPECT_OK(op->Fetch(1000, FetchOrientation::NEXT, &results, &has_more_rows));
+    unique_ptr<Int32Column> int_col = results->GetInt32Col(0);
+    unique_ptr<StringColumn> string_col = results->GetStringCol(1);
+    unique_ptr<StringColumn> decimal_col = results->GetStringCol(3);
+    EXPECT_LE(int_col->length(), 1000);
+    EXPECT_EQ(int_col->length(), string_col->length());
+    for (int i = 0; i < int_col->length(); ++i) {
+      if (int_col->IsNull(i)) ++int_nulls;
+      if (string_col->IsNull(i)) {
+        ++string_nulls;
+      } else {
+        EXPECT_EQ(string_col->data()[i].size(), 8);
+      }
+      EXPECT_EQ(decimal_col->data()[i].find('.'), decimal_col->data()[i].size() - 3);
+    }
+    total_rows += int_col->length();
+  }
+  EXPECT_EQ(total_rows, spec_.num_rows);
+  EXPECT_GT(int_nulls, 0);
+  EXPECT_LT(int_nulls, string_nulls);
+  EXPECT_LT(string_nulls, total_rows);
+
+  EXPECT_OK(op->Close());
+}
+
+TEST_F(MockServerTest, TestDeterministic) {
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  vector<string> values[2];
+  for (int i = 0; i < 2; ++i) {
+    unique_ptr<Operation> op;
+    EXPECT_OK(session_->ExecuteStatement("SELECT 1", &op));
+    unique_ptr<ColumnarRowSet> results;
+    bool has_more_rows;
+    EXPECT_OK(op->Fetch(&results, &has_more_rows));
+    values[i] = results->GetStringCol(1)->data();
+    EXPECT_OK(op->Close());
+  }
+  EXPECT_EQ(values[0], values[1]);
+}
+
+TEST_F(MockServerTest, TestTimestampColumn) {
+  spec_.columns.clear();
+  spec_.columns.emplace_back(ColumnType::TypeId::TIMESTAMP, 0.2);
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  unique_ptr<Operation> op;
+  EXPECT_OK(session_->ExecuteStatement("select * from mock", &op));
+  int64_t total_rows = 0;
+  bool has_more_rows = true;
+  while (has_more_rows) {
+    unique_ptr<ColumnarRowSet> results;
+    EXPECT_OK(op->Fetch(1000, FetchOrientation::NEXT, &results, &has_more_rows));
+    unique_ptr<StringViewColumn> string_col = results->GetStringViewCol(0);
+    unique_ptr<TimestampColumn> ts_col = results->GetTimestampCol(0);
+    ASSERT_EQ(ts_col->length(), string_col->length());
+    EXPECT_EQ(ts_col->num_invalid(), 0);
+    for (int i = 0; i < ts_col->length(); ++i) {
+      EXPECT_EQ(ts_col->IsNull(i), string_col->IsNull(i));
+      if (string_col->IsNull(i)) continue;
+      StringPiece value = string_col->GetData(i);
+      int64_t expected;
+      ASSERT_TRUE(ParseTimestamp(value.data(), value.size(), &expected));
+      EXPECT_EQ(ts_col->GetData(i), expected);
+      // The mock server generates timestamps between 1970 and 2037.
+      EXPECT_GE(ts_col->GetData(i), 0);
+    }
+    total_rows += ts_col->length();
+  }
+  EXPECT_EQ(total_rows, spec_.num_rows);
+  EXPECT_OK(op->Close());
+}
+
+TEST_F(MockServerTest, TestDateColumn) {
+  spec_.columns.clear();
+  spec_.columns.emplace_back(ColumnType::TypeId::DATE, 0.2);
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  unique_ptr<Operation> op;
+  EXPECT_OK(session_->ExecuteStatement("select * from mock", &op));
+  unique_ptr<ColumnarRowSet> results;
+  bool has_more_rows;
+  EXPECT_OK(op->Fetch(1000, FetchOrientation::NEXT, &results, &has_more_rows));
+  unique_ptr<StringViewColumn> string_col = results->GetStringViewCol(0);
+  unique_ptr<DateColumn> date_col = results->GetDateCol(0);
+  ASSERT_EQ(date_col->length(), string_col->length());
+  EXPECT_EQ(date_col->num_invalid(), 0);
+  for (int i = 0; i < date_col->length(); ++i) {
+    EXPECT_EQ(date_col->IsNull(i), string_col->IsNull(i));
+    if (string_col->IsNull(i)) continue;
+    // Midnight of the same day.
+    StringPiece value = string_col->GetData(i);
+    int64_t nanos;
+    ASSERT_TRUE(ParseTimestamp(value.data(), value.size(), &nanos));
+    EXPECT_EQ(date_col->GetData(i) * 86400LL * 1000000000LL, nanos);
+  }
+  EXPECT_OK(op->Close());
+}
+
+TEST_F(MockServerTest, TestDecimal128Column) {
+  spec_.columns.clear();
+  spec_.columns.emplace_back(ColumnType::TypeId::DECIMAL, 0.2);
+  spec_.columns.back().precision = 9;
+  spec_.columns.back().scale = 2;
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  unique_ptr<Operation> op;
+  EXPECT_OK(session_->ExecuteStatement("select * from mock", &op));
+  vector<ColumnDesc> column_descs;
+  EXPECT_OK(op->GetResultSetMetadata(&column_descs));
+  const DecimalType* type = column_descs[0].GetDecimalType();
+
+  unique_ptr<ColumnarRowSet> results;
+  bool has_more_rows;
+  EXPECT_OK(op->Fetch(1000, FetchOrientation::NEXT, &results, &has_more_rows));
+  unique_ptr<StringViewColumn> string_col = results->GetStringViewCol(0);
+  unique_ptr<Decimal128Column> decimal_col = results->GetDecimal128Col(0, *type);
+  ASSERT_EQ(decimal_col->length(), string_col->length());
+  EXPECT_EQ(decimal_col->precision(), 9);
+  EXPECT_EQ(decimal_col->scale(), 2);
+  EXPECT_EQ(decimal_col->num_invalid(), 0);
+
+  vector<double> doubles(decimal_col->length());
+  vector<int64_t> int64s(decimal_col->length());
+  decimal_col->ToDouble(doubles.data());
+  EXPECT_TRUE(decimal_col->ToInt64(int64s.data()));
+  for (int i = 0; i < decimal_col->length(); ++i) {
+    EXPECT_EQ(decimal_col->IsNull(i), string_col->IsNull(i));
+    if (string_col->IsNull(i)) {
+      EXPECT_TRUE(std::isnan(doubles[i]));
+      continue;
+    }
+    string value = string_col->GetData(i).ToString();
+    EXPECT_EQ(decimal_col->FormatData(i), value);
+    EXPECT_TRUE(decimal_col->GetData(i) == int64s[i]);
+    EXPECT_DOUBLE_EQ(doubles[i], std::stod(value));
+  }
+  EXPECT_OK(op->Close());
+}
+
+TEST_F(MockServerTest, TestNoResultSet) {
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  unique_ptr<Operation> op;
+  EXPECT_OK(session_->ExecuteStatement("create table mock (i int)", &op));
+  EXPECT_FALSE(op->HasResultSet());
+  Operation::State state;
+  EXPECT_OK(op->GetState(&state));
+  EXPECT_EQ(state, Operation::State::FINISHED);
+  EXPECT_OK(op->Close());
+
+  // The handle is no longer valid once the operation is closed on the server.
+  EXPECT_ERROR(op->GetState(&state));
+  // The RPC completed, so the error is only counted as one returned by the server.
+  ServiceMetrics metrics = service_->GetMetrics();
+  EXPECT_EQ(metrics.rpc(RpcMethod::GET_OPERATION_STATUS).count, 2);
+  EXPECT_EQ(metrics.rpc(RpcMethod::GET_OPERATION_STATUS).num_errors, 0);
+  EXPECT_EQ(metrics.rpc(RpcMethod::GET_OPERATION_STATUS).num_server_errors, 1);
+}
+
+TEST_F(MockServerTest, TestWaitForCompletionMaxRows) {
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  // The batch fetched while waiting is returned at most 'max_rows' rows at a time, with
+  // the same values as an operation that wasn't waited on. 300 rows isn't a whole number
+  // of bytes of the null bitmaps.
+  vector<string> strings[2];
+  vector<bool> nulls[2];
+  for (int i = 0; i < 2; ++i) {
+    unique_ptr<Operation> op;
+    EXPECT_OK(session_->ExecuteStatement("select * from mock", &op));
+    if (i == 1) EXPECT_OK(op->WaitForCompletion());
+    bool has_more_rows = true;
+    while (has_more_rows) {
+      unique_ptr<ColumnarRowSet> results;
+      EXPECT_OK(op->Fetch(300, FetchOrientation::NEXT, &results, &has_more_rows));
+      EXPECT_LE(results->num_rows(), 300);
+      unique_ptr<Int32Column> int_col = results->GetInt32Col(0);
+      unique_ptr<StringColumn> string_col = results->GetStringCol(1);
+      for (int j = 0; j < int_col->length(); ++j) {
+        nulls[i].push_back(int_col->IsNull(j));
+        nulls[i].push_back(string_col->IsNull(j));
+        strings[i].push_back(string_col->data()[j]);
+      }
+    }
+    EXPECT_OK(op->Close());
+  }
+  EXPECT_EQ(strings[0].size(), spec_.num_rows);
+  EXPECT_EQ(strings[0], strings[1]);
+  EXPECT_EQ(nulls[0], nulls[1]);
+  // OpenSession, 2 ExecuteStatements and CloseOperations, 9 FetchResults for the first
+  // operation, and for the second 1 of 1024 rows while waiting and 5 for the rest.
+  EXPECT_EQ(server_->num_rpcs(), 1 + 2 + 2 + 9 + 6);
+}
+
+TEST_F(MockServerTest, TestLatency) {
+  server_options_.exec_latency_us = 200000;
+  server_options_.rpc_latency_us = 1000;
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  unique_ptr<Operation> op;
+  EXPECT_OK(session_->ExecuteStatement("select * from mock", &op));
+  Operation::State state;
+  EXPECT_OK(op->GetState(&state));
+  EXPECT_EQ(state, Operation::State::RUNNING);
+
+  // Fetch blocks until the query has finished.
+  unique_ptr<ColumnarRowSet> results;
+  bool has_more_rows;
+  EXPECT_OK(op->Fetch(&results, &has_more_rows));
+  EXPECT_OK(op->GetState(&state));
+  EXPECT_EQ(state, Operation::State::FINISHED);
+  EXPECT_OK(op->Close());
+
+  // OpenSession, ExecuteStatement, GetOperationStatus x2, FetchResults, CloseOperation
+  EXPECT_EQ(server_->num_rpcs(), 6);
+}
+
+TEST_F(MockServerTest, TestWaitForCompletion) {
+  server_options_.exec_latency_us = 100000;
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  // The first batch is fetched while waiting, without polling, and returned by the next
+  // Fetch without another RPC.
+  unique_ptr<Operation> op;
+  EXPECT_OK(session_->ExecuteStatement("select * from mock", &op));
+  EXPECT_OK(op->WaitForCompletion());
+  // OpenSession, ExecuteStatement, FetchResults
+  EXPECT_EQ(server_->num_rpcs(), 3);
+  EXPECT_OK(op->WaitForCompletion());
+  EXPECT_EQ(server_->num_rpcs(), 3);
+  int64_t num_rows = 0;
+  bool has_more_rows = true;
+  while (has_more_rows) {
+    unique_ptr<ColumnarRowSet> results;
+    EXPECT_OK(op->Fetch(1000, FetchOrientation::NEXT, &results, &has_more_rows));
+    if (num_rows == 0) {
+      EXPECT_EQ(server_->num_rpcs(), 3);
+    }
+    num_rows += results->num_rows();
+  }
+  EXPECT_EQ(num_rows, spec_.num_rows);
+  EXPECT_OK(op->Close());
+
+  // Operations without a result set are polled, and time out while running.
+  EXPECT_OK(session_->ExecuteStatement("create table mock (i int)", &op));
+  Status status = op->WaitForCompletion(10);
+  EXPECT_TRUE(status.IsStillExecuting());
+  EXPECT_OK(op->WaitForCompletion(1000));
+  Operation::State state;
+  EXPECT_OK(op->GetState(&state));
+  EXPECT_EQ(state, Operation::State::FINISHED);
+  EXPECT_OK(op->Close());
+
+  // Canceled operations fail.
+  EXPECT_OK(session_->ExecuteStatement("create table mock (i int)", &op));
+  EXPECT_OK(op->Cancel());
+  EXPECT_ERROR(op->WaitForCompletion());
+  EXPECT_OK(op->Close());
+}
+
+TEST_F(MockServerTest, TestExecuteAndFetch) {
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  // All of the rows fit in the first batch, so the operation is closed lazily.
+  vector<ColumnDesc> column_descs;
+  unique_ptr<ColumnarRowSet> results;
+  bool has_more_rows;
+  unique_ptr<Operation> op;
+  EXPECT_OK(session_->ExecuteAndFetch("select * from mock", 10000, &column_descs,
+      &results, &has_more_rows, &op));
+  EXPECT_FALSE(has_more_rows);
+  ASSERT_EQ(column_descs.size(), 4);
+  EXPECT_EQ(column_descs[1].type()->type_id(), ColumnType::TypeId::STRING);
+  EXPECT_EQ(results->GetInt32Col(0)->length(), spec_.num_rows);
+  // OpenSession, ExecuteStatement, GetResultSetMetadata, FetchResults
+  EXPECT_EQ(server_->num_rpcs(), 4);
+  EXPECT_OK(op->Close());
+  EXPECT_EQ(server_->num_rpcs(), 4);
+
+  // The deferred CloseOperation is sent along with the next ExecuteStatement.
+  EXPECT_OK(session_->ExecuteAndFetch("select * from mock", 1000, &column_descs,
+      &results, &has_more_rows, &op));
+  EXPECT_EQ(server_->num_rpcs(), 8);
+  EXPECT_TRUE(has_more_rows);
+  EXPECT_EQ(results->GetInt32Col(0)->length(), 1000);
+
+  // The remaining rows can be fetched from the open operation, and the cached schema
+  // is returned without an RPC.
+  EXPECT_OK(op->GetResultSetMetadata(&column_descs));
+  EXPECT_EQ(column_descs.size(), 4);
+  EXPECT_EQ(server_->num_rpcs(), 8);
+  int64_t num_rows = 1000;
+  while (has_more_rows) {
+    EXPECT_OK(op->Fetch(1000, FetchOrientation::NEXT, &results, &has_more_rows));
+    num_rows += results->num_rows();
+  }
+  EXPECT_EQ(num_rows, spec_.num_rows);
+  EXPECT_OK(op->Close());
+
+  // Without an operation, it is closed lazily even if there are more rows, and the
+  // close is flushed before the next RPC of any kind.
+  EXPECT_OK(session_->ExecuteAndFetch("select * from mock", 10, &column_descs,
+      &results, &has_more_rows, NULL));
+  EXPECT_TRUE(has_more_rows);
+  int64_t num_rpcs = server_->num_rpcs();
+  EXPECT_OK(session_->Ping());
+  EXPECT_EQ(server_->num_rpcs(), num_rpcs + 2);
+
+  // Statements without a result set are waited for.
+  EXPECT_OK(session_->ExecuteAndFetch("create table mock (i int)", 10, &column_descs,
+      &results, &has_more_rows, NULL));
+  EXPECT_TRUE(column_descs.empty());
+  EXPECT_TRUE(results == NULL);
+  EXPECT_FALSE(has_more_rows);
+
+  ServiceMetrics metrics = service_->GetMetrics();
+  EXPECT_EQ(metrics.rpc(RpcMethod::CLOSE_OPERATION).count, 3);
+  EXPECT_EQ(metrics.rpc(RpcMethod::GET_RESULT_SET_METADATA).count, 3);
+  EXPECT_EQ(metrics.rpc(RpcMethod::FETCH_RESULTS).count, 5);
+}
+
+TEST_F(MockServerTest, TestExecuteAndFetchFailure) {
+  server_options_.failed_rpcs.push_back(RpcMethod::GET_RESULT_SET_METADATA);
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  // The FetchResults reply is left unread behind the failed GetResultSetMetadata, so the
+  // connection is closed rather than letting a later RPC read it.
+  vector<ColumnDesc> column_descs;
+  unique_ptr<ColumnarRowSet> results;
+  bool has_more_rows;
+  unique_ptr<Operation> op;
+  EXPECT_ERROR(session_->ExecuteAndFetch("select * from mock", 100, &column_descs,
+      &results, &has_more_rows, &op));
+  EXPECT_FALSE(service_->IsConnected());
+  ServiceMetrics metrics = service_->GetMetrics();
+  EXPECT_EQ(metrics.rpc(RpcMethod::GET_RESULT_SET_METADATA).num_errors, 1);
+  EXPECT_EQ(metrics.rpc(RpcMethod::FETCH_RESULTS).num_errors, 1);
+
+  // Later RPCs fail without being sent, and the session and operation are closed.
+  Status status = session_->Ping();
+  EXPECT_ERROR(status);
+  EXPECT_NE(status.GetMessage().find("Mock failure of GetResultSetMetadata"),
+      string::npos);
+  EXPECT_ERROR(op->Close());
+  EXPECT_OK(op->Close());
+  EXPECT_ERROR(session_->Close());
+  EXPECT_OK(session_->Close());
+  metrics = service_->GetMetrics();
+  EXPECT_EQ(metrics.rpc(RpcMethod::GET_INFO).count, 0);
+  EXPECT_EQ(metrics.rpc(RpcMethod::CLOSE_OPERATION).count, 0);
+  EXPECT_EQ(metrics.rpc(RpcMethod::CLOSE_SESSION).count, 0);
+}
+
+TEST_F(MockServerTest, TestCloseAsync) {
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  const int num_ops = 5;
+  vector<unique_ptr<Operation>> ops(num_ops);
+  for (int i = 0; i < num_ops; ++i) {
+    EXPECT_OK(session_->ExecuteStatement("select * from mock", &ops[i]));
+  }
+  ops[0]->CancelAsync();
+  for (unique_ptr<Operation>& op : ops) {
+    op->CloseAsync();
+    // Already closed as far as the caller is concerned.
+    EXPECT_OK(op->Close());
+    op.reset();
+  }
+  session_->CloseAsync();
+  EXPECT_OK(session_->Close());
+
+  // Service::Close waits for the queued RPCs to be sent.
+  EXPECT_OK(service_->Close());
+  // OpenSession, 5 ExecuteStatements, CancelOperation, 5 CloseOperations, CloseSession
+  EXPECT_EQ(server_->num_rpcs(), 1 + num_ops + 1 + num_ops + 1);
+  ServiceMetrics metrics = service_->GetMetrics();
+  EXPECT_EQ(metrics.rpc(RpcMethod::CANCEL_OPERATION).count, 1);
+  EXPECT_EQ(metrics.rpc(RpcMethod::CLOSE_OPERATION).count, num_ops);
+  EXPECT_EQ(metrics.rpc(RpcMethod::CLOSE_SESSION).count, 1);
+  EXPECT_EQ(metrics.rpc(RpcMethod::CLOSE_SESSION).num_errors, 0);
+}
+
+TEST_F(MockServerTest, TestCloseAsyncFailure) {
+  server_options_.failed_rpcs.push_back(RpcMethod::CLOSE_OPERATION);
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  const int num_ops = 3;
+  vector<unique_ptr<Operation>> ops(num_ops);
+  for (int i = 0; i < num_ops; ++i) {
+    EXPECT_OK(session_->ExecuteStatement("select * from mock", &ops[i]));
+  }
+  for (unique_ptr<Operation>& op : ops) op->CloseAsync();
+
+  // Once a pipelined CloseOperation fails, the ones after it are recorded as failed
+  // rather than dropped, and the connection is closed since their replies may still
+  // arrive. Ping flushes anything still queued, and fails without being sent.
+  Status status = session_->Ping();
+  EXPECT_ERROR(status);
+  EXPECT_NE(status.GetMessage().find("Mock failure of CloseOperation"), string::npos);
+  EXPECT_FALSE(service_->IsConnected());
+  ServiceMetrics metrics = service_->GetMetrics();
+  EXPECT_EQ(metrics.rpc(RpcMethod::GET_INFO).count, 0);
+  EXPECT_EQ(metrics.rpc(RpcMethod::CLOSE_OPERATION).count, num_ops);
+  EXPECT_EQ(metrics.rpc(RpcMethod::CLOSE_OPERATION).num_errors, num_ops);
+  EXPECT_ERROR(session_->Close());
+}
+
+TEST_F(MockServerTest, TestStartErrors) {
+  ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+
+  // The port is already in use.
+  MockServerOptions options2;
+  options2.port = server_->port();
+  MockServer server2(options2, spec_);
+  EXPECT_ERROR(server2.Start());
+
+  // Complex types can't be generated.
+  MockResultSpec invalid_spec;
+  invalid_spec.columns.emplace_back(ColumnType::TypeId::ARRAY);
+  EXPECT_ERROR(server_->SetResultSpec(invalid_spec));
+  MockServer server3(MockServerOptions(), invalid_spec);
+  EXPECT_ERROR(server3.Start());
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
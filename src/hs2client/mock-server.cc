@@ -0,0 +1,774 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hs2client/mock-server.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/server/TThreadedServer.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TServerSocket.h>
+
+#include "hs2client/logging.h"
+#include "hs2client/thrift-internal.h"
+
+#include "gen-cpp/ImpalaHiveServer2Service.h"
+#include "gen-cpp/TCLIService.h"
+
+namespace hs2 = apache::hive::service::cli::thrift;
+
+using apache::thrift::TException;
+using apache::thrift::TProcessor;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::protocol::TCompactProtocolFactory;
+using apache::thrift::protocol::TProtocolFactory;
+using apache::thrift::server::TServerEventHandler;
+using apache::thrift::server::TThreadedServer;
+using apache::thrift::transport::TBufferedTransportFactory;
+using apache::thrift::transport::TFramedTransportFactory;
+using apache::thrift::transport::TServerSocket;
+using apache::thrift::transport::TTransportFactory;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+
+namespace hs2client {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// The number of free ports that Start() tries when the options don't specify one.
+const int MAX_START_ATTEMPTS = 5;
+
+// The number of values that are generated for each column. Longer columns are
+// produced by repeating these values.
+const int BLOCK_ROWS = 1024;
+
+// A small, fast PRNG (xorshift64*), so that value generation is deterministic and
+// doesn't dominate benchmarks.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed * 2685821657736338717ULL + 1) {}
+
+  uint64_t Next() {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 2685821657736338717ULL;
+  }
+
+  // Returns a value in [0, 1).
+  double NextDouble() { return (Next() >> 11) * (1.0 / 9007199254740992.0); }
+
+  int64_t Uniform(int64_t lo, int64_t hi) {
+    return lo + static_cast<int64_t>(Next() % static_cast<uint64_t>(hi - lo + 1));
+  }
+
+ private:
+  uint64_t state_;
+};
+
+// The values generated for a single column, along with its schema.
+struct MockColumn {
+  hs2::TColumnDesc desc;
+
+  // Contains BLOCK_ROWS values.
+  hs2::TColumn block;
+  std::vector<bool> nulls;
+};
+
+// The generated form of a MockResultSpec, shared by all operations that return it.
+struct MockResultSet {
+  int64_t num_rows;
+  std::vector<MockColumn> columns;
+};
+
+// The state of a single operation on the server.
+struct MockOperation {
+  // Null if the statement doesn't return a result set.
+  shared_ptr<const MockResultSet> results;
+  int64_t next_row;
+  Clock::time_point finish_time;
+  bool canceled;
+};
+
+void SetError(const string& msg, hs2::TStatus* status) {
+  status->__set_statusCode(hs2::TStatusCode::ERROR_STATUS);
+  status->__set_errorMessage(msg);
+}
+
+Status TypeIdToTTypeId(ColumnType::TypeId type_id, hs2::TTypeId::type* out) {
+  switch (type_id) {
+    case ColumnType::TypeId::BOOLEAN: *out = hs2::TTypeId::BOOLEAN_TYPE; break;
+    case ColumnType::TypeId::TINYINT: *out = hs2::TTypeId::TINYINT_TYPE; break;
+    case ColumnType::TypeId::SMALLINT: *out = hs2::TTypeId::SMALLINT_TYPE; break;
+    case ColumnType::TypeId::INT: *out = hs2::TTypeId::INT_TYPE; break;
+    case ColumnType::TypeId::BIGINT: *out = hs2::TTypeId::BIGINT_TYPE; break;
+    case ColumnType::TypeId::FLOAT: *out = hs2::TTypeId::FLOAT_TYPE; break;
+    case ColumnType::TypeId::DOUBLE: *out = hs2::TTypeId::DOUBLE_TYPE; break;
+    case ColumnType::TypeId::STRING: *out = hs2::TTypeId::STRING_TYPE; break;
+    case ColumnType::TypeId::TIMESTAMP: *out = hs2::TTypeId::TIMESTAMP_TYPE; break;
+    case ColumnType::TypeId::BINARY: *out = hs2::TTypeId::BINARY_TYPE; break;
+    case ColumnType::TypeId::DECIMAL: *out = hs2::TTypeId::DECIMAL_TYPE; break;
+    case ColumnType::TypeId::DATE: *out = hs2::TTypeId::DATE_TYPE; break;
+    case ColumnType::TypeId::VARCHAR: *out = hs2::TTypeId::VARCHAR_TYPE; break;
+    case ColumnType::TypeId::CHAR: *out = hs2::TTypeId::CHAR_TYPE; break;
+    default:
+      return Status::Error("MockServer can't generate columns of type " +
+          TypeIdToString(type_id));
+  }
+  return Status::OK();
+}
+
+hs2::TTypeQualifierValue I32Qualifier(int value) {
+  hs2::TTypeQualifierValue qualifier;
+  qualifier.__set_i32Value(value);
+  return qualifier;
+}
+
+string RandomString(int length, Random* rand) {
+  string value(length, ' ');
+  for (int i = 0; i < length; ++i) {
+    value[i] = static_cast<char>('a' + rand->Uniform(0, 25));
+  }
+  return value;
+}
+
+// Returns a date between 1970 and 2037 formatted as Impala does, ie. "YYYY-MM-DD".
+string RandomDate(Random* rand) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%04d-%02d-%02d", static_cast<int>(rand->Uniform(1970, 2037)),
+      static_cast<int>(rand->Uniform(1, 12)), static_cast<int>(rand->Uniform(1, 28)));
+  return buf;
+}
+
+// Returns a timestamp formatted as Impala does, ie. "YYYY-MM-DD HH:MM:SS.fffffffff".
+string RandomTimestamp(Random* rand) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), " %02d:%02d:%02d.%09d",
+      static_cast<int>(rand->Uniform(0, 23)), static_cast<int>(rand->Uniform(0, 59)),
+      static_cast<int>(rand->Uniform(0, 59)),
+      static_cast<int>(rand->Uniform(0, 999999999)));
+  return RandomDate(rand) + buf;
+}
+
+// Returns a decimal with the given precision and scale, eg. "-1234.5678". Precisions
+// above 18 are generated with 18 significant digits.
+string RandomDecimal(int precision, int scale, Random* rand) {
+  int digits = std::min(precision, 18);
+  int64_t max_unscaled = 1;
+  for (int i = 0; i < digits; ++i) max_unscaled *= 10;
+  int64_t unscaled = rand->Uniform(-(max_unscaled - 1), max_unscaled - 1);
+
+  std::stringstream ss;
+  if (unscaled < 0) ss << '-';
+  string abs_digits = std::to_string(unscaled < 0 ? -unscaled : unscaled);
+  if (scale == 0) {
+    ss << abs_digits;
+  } else {
+    if (static_cast<int>(abs_digits.size()) <= scale) {
+      abs_digits.insert(0, scale + 1 - abs_digits.size(), '0');
+    }
+    ss << abs_digits.substr(0, abs_digits.size() - scale) << '.'
+       << abs_digits.substr(abs_digits.size() - scale);
+  }
+  return ss.str();
+}
+
+Status GenerateColumn(const MockColumnSpec& spec, int position, Random* rand,
+    MockColumn* out) {
+  hs2::TTypeId::type ttype_id;
+  HS2CLIENT_RETURN_IF_ERROR(TypeIdToTTypeId(spec.type, &ttype_id));
+  if (spec.null_fraction < 0 || spec.null_fraction > 1) {
+    return Status::Error("null_fraction must be between 0 and 1");
+  }
+
+  hs2::TPrimitiveTypeEntry primitive_entry;
+  primitive_entry.__set_type(ttype_id);
+  if (spec.type == ColumnType::TypeId::CHAR || spec.type == ColumnType::TypeId::VARCHAR) {
+    hs2::TTypeQualifiers qualifiers;
+    qualifiers.qualifiers[hs2::g_TCLIService_constants.CHARACTER_MAXIMUM_LENGTH] =
+        I32Qualifier(spec.string_length);
+    primitive_entry.__set_typeQualifiers(qualifiers);
+  } else if (spec.type == ColumnType::TypeId::DECIMAL) {
+    if (spec.precision < 1 || spec.scale < 0 || spec.scale > spec.precision) {
+      return Status::Error("Invalid decimal precision or scale");
+    }
+    hs2::TTypeQualifiers qualifiers;
+    qualifiers.qualifiers[hs2::g_TCLIService_constants.PRECISION] =
+        I32Qualifier(spec.precision);
+    qualifiers.qualifiers[hs2::g_TCLIService_constants.SCALE] = I32Qualifier(spec.scale);
+    primitive_entry.__set_typeQualifiers(qualifiers);
+  }
+  hs2::TTypeEntry type_entry;
+  type_entry.__set_primitiveEntry(primitive_entry);
+
+  std::stringstream name;
+  name << "col" << position;
+  out->desc.__set_columnName(name.str());
+  out->desc.typeDesc.types.push_back(type_entry);
+  out->desc.__set_position(position);
+
+  out->nulls.resize(BLOCK_ROWS);
+  for (int i = 0; i < BLOCK_ROWS; ++i) {
+    out->nulls[i] = rand->NextDouble() < spec.null_fraction;
+  }
+
+  // Nulls have default values, as in the HiveServer2 interface.
+  hs2::TColumn& block = out->block;
+  for (int i = 0; i < BLOCK_ROWS; ++i) {
+    bool null = out->nulls[i];
+    switch (spec.type) {
+      case ColumnType::TypeId::BOOLEAN:
+        block.boolVal.values.push_back(!null && rand->Uniform(0, 1) == 1);
+        break;
+      case ColumnType::TypeId::TINYINT:
+        block.byteVal.values.push_back(null ? 0 : rand->Uniform(-128, 127));
+        break;
+      case ColumnType::TypeId::SMALLINT:
+        block.i16Val.values.push_back(null ? 0 : rand->Uniform(-32768, 32767));
+        break;
+      case ColumnType::TypeId::INT:
+        block.i32Val.values.push_back(null ? 0 : static_cast<int32_t>(rand->Next()));
+        break;
+      case ColumnType::TypeId::BIGINT:
+        block.i64Val.values.push_back(null ? 0 : static_cast<int64_t>(rand->Next()));
+        break;
+      case ColumnType::TypeId::FLOAT:
+      case ColumnType::TypeId::DOUBLE:
+        // Impala returns FLOAT columns as doubles.
+        block.doubleVal.values.push_back(null ? 0 : rand->NextDouble() * 1e6 - 5e5);
+        break;
+      case ColumnType::TypeId::STRING:
+      case ColumnType::TypeId::VARCHAR:
+      case ColumnType::TypeId::CHAR:
+        block.stringVal.values.push_back(null ? "" : RandomString(spec.string_length, rand));
+        break;
+      case ColumnType::TypeId::BINARY:
+        block.binaryVal.values.push_back(null ? "" : RandomString(spec.string_length, rand));
+        break;
+      case ColumnType::TypeId::TIMESTAMP:
+        block.stringVal.values.push_back(null ? "" : RandomTimestamp(rand));
+        break;
+      case ColumnType::TypeId::DATE:
+        block.stringVal.values.push_back(null ? "" : RandomDate(rand));
+        break;
+      case ColumnType::TypeId::DECIMAL:
+        block.stringVal.values.push_back(
+            null ? "" : RandomDecimal(spec.precision, spec.scale, rand));
+        break;
+      default:
+        DCHECK(false);
+    }
+  }
+  return Status::OK();
+}
+
+Status GenerateResultSet(const MockResultSpec& spec,
+    shared_ptr<const MockResultSet>* out) {
+  if (spec.num_rows < 0) return Status::Error("num_rows must not be negative");
+  shared_ptr<MockResultSet> results(new MockResultSet());
+  results->num_rows = spec.num_rows;
+  results->columns.resize(spec.columns.size());
+  for (size_t i = 0; i < spec.columns.size(); ++i) {
+    Random rand(spec.seed + i);
+    HS2CLIENT_RETURN_IF_ERROR(
+        GenerateColumn(spec.columns[i], i, &rand, &results->columns[i]));
+  }
+  *out = results;
+  return Status::OK();
+}
+
+// Copies the values for rows [start, start + num_rows) from 'block' to 'out'.
+template <typename T>
+void SliceValues(const std::vector<T>& block, int64_t start, int num_rows,
+    std::vector<T>* out) {
+  out->resize(num_rows);
+  for (int i = 0; i < num_rows; ++i) {
+    (*out)[i] = block[(start + i) % BLOCK_ROWS];
+  }
+}
+
+string SliceNulls(const std::vector<bool>& nulls, int64_t start, int num_rows) {
+  string out((num_rows + 7) / 8, '\0');
+  for (int i = 0; i < num_rows; ++i) {
+    if (nulls[(start + i) % BLOCK_ROWS]) out[i / 8] |= 1 << (i % 8);
+  }
+  return out;
+}
+
+void SliceColumn(const MockColumn& col, int64_t start, int num_rows, hs2::TColumn* out) {
+  string nulls = SliceNulls(col.nulls, start, num_rows);
+  const hs2::TColumn& block = col.block;
+#define SLICE_COLUMN(ATTR_NAME)                                         \
+  if (!block.ATTR_NAME.values.empty()) {                                \
+    SliceValues(block.ATTR_NAME.values, start, num_rows,                \
+        &out->ATTR_NAME.values);                                        \
+    out->ATTR_NAME.nulls = nulls;                                       \
+    out->__isset.ATTR_NAME = true;                                      \
+    return;                                                             \
+  }
+  SLICE_COLUMN(boolVal);
+  SLICE_COLUMN(byteVal);
+  SLICE_COLUMN(i16Val);
+  SLICE_COLUMN(i32Val);
+  SLICE_COLUMN(i64Val);
+  SLICE_COLUMN(doubleVal);
+  SLICE_COLUMN(stringVal);
+  SLICE_COLUMN(binaryVal);
+#undef SLICE_COLUMN
+}
+
+bool ReturnsResultSet(const string& statement) {
+  size_t start = 0;
+  while (start < statement.size() && isspace(statement[start])) ++start;
+  static const string SELECT = "select";
+  if (statement.size() - start < SELECT.size()) return false;
+  for (size_t i = 0; i < SELECT.size(); ++i) {
+    if (tolower(statement[start + i]) != SELECT[i]) return false;
+  }
+  return true;
+}
+
+// Implements the Impala HiveServer2 interface. Only the RPCs used by hs2client are
+// implemented; the rest are inherited from ImpalaHiveServer2ServiceNull.
+class MockService : public impala::ImpalaHiveServer2ServiceNull {
+ public:
+  explicit MockService(const MockServerOptions& options) : options_(options), next_id_(0),
+      num_rpcs_(0) {}
+
+  Status SetResultSpec(const MockResultSpec& spec) {
+    shared_ptr<const MockResultSet> results;
+    HS2CLIENT_RETURN_IF_ERROR(GenerateResultSet(spec, &results));
+    std::lock_guard<std::mutex> l(lock_);
+    results_ = results;
+    return Status::OK();
+  }
+
+  int64_t num_rpcs() const { return num_rpcs_.load(); }
+
+  void OpenSession(hs2::TOpenSessionResp& resp, const hs2::TOpenSessionReq& req) {
+    OnRpc(RpcMethod::OPEN_SESSION);
+    std::lock_guard<std::mutex> l(lock_);
+    hs2::THandleIdentifier id = NewId();
+    sessions_[id.guid] = true;
+    resp.sessionHandle.__set_sessionId(id);
+    resp.__isset.sessionHandle = true;
+    resp.__set_serverProtocolVersion(std::min(req.client_protocol,
+        hs2::TProtocolVersion::HIVE_CLI_SERVICE_PROTOCOL_V7));
+  }
+
+  void CloseSession(hs2::TCloseSessionResp& resp, const hs2::TCloseSessionReq& req) {
+    OnRpc(RpcMethod::CLOSE_SESSION);
+    std::lock_guard<std::mutex> l(lock_);
+    if (sessions_.erase(req.sessionHandle.sessionId.guid) == 0) {
+      SetError("Invalid session handle", &resp.status);
+    }
+  }
+
+  void GetInfo(hs2::TGetInfoResp& resp, const hs2::TGetInfoReq& req) {
+    OnRpc(RpcMethod::GET_INFO);
+    std::lock_guard<std::mutex> l(lock_);
+    if (sessions_.count(req.sessionHandle.sessionId.guid) == 0) {
+      SetError("Invalid session handle", &resp.status);
+      return;
+    }
+    switch (req.infoType) {
+      case hs2::TGetInfoType::CLI_SERVER_NAME:
+      case hs2::TGetInfoType::CLI_DBMS_NAME:
+        resp.infoValue.__set_stringValue("Impala (mock)");
+        break;
+      default:
+        SetError("Unsupported info type", &resp.status);
+    }
+  }
+
+  void ExecuteStatement(hs2::TExecuteStatementResp& resp,
+      const hs2::TExecuteStatementReq& req) {
+    OnRpc(RpcMethod::EXECUTE_STATEMENT);
+    std::lock_guard<std::mutex> l(lock_);
+    if (sessions_.count(req.sessionHandle.sessionId.guid) == 0) {
+      SetError("Invalid session handle", &resp.status);
+      return;
+    }
+
+    bool has_result_set = ReturnsResultSet(req.statement);
+    MockOperation op;
+    if (has_result_set) op.results = results_;
+    op.next_row = 0;
+    op.finish_time = Clock::now() + std::chrono::microseconds(options_.exec_latency_us);
+    op.canceled = false;
+
+    hs2::THandleIdentifier id = NewId();
+    operations_[id.guid] = op;
+    resp.operationHandle.__set_operationId(id);
+    resp.operationHandle.__set_operationType(hs2::TOperationType::EXECUTE_STATEMENT);
+    resp.operationHandle.__set_hasResultSet(has_result_set);
+    resp.__isset.operationHandle = true;
+  }
+
+  void GetOperationStatus(hs2::TGetOperationStatusResp& resp,
+      const hs2::TGetOperationStatusReq& req) {
+    OnRpc(RpcMethod::GET_OPERATION_STATUS);
+    std::lock_guard<std::mutex> l(lock_);
+    MockOperation* op = GetOperation(req.operationHandle, &resp.status);
+    if (op == NULL) return;
+    if (op->canceled) {
+      resp.__set_operationState(hs2::TOperationState::CANCELED_STATE);
+    } else if (Clock::now() < op->finish_time) {
+      resp.__set_operationState(hs2::TOperationState::RUNNING_STATE);
+    } else {
+      resp.__set_operationState(hs2::TOperationState::FINISHED_STATE);
+    }
+  }
+
+  void CancelOperation(hs2::TCancelOperationResp& resp,
+      const hs2::TCancelOperationReq& req) {
+    OnRpc(RpcMethod::CANCEL_OPERATION);
+    std::lock_guard<std::mutex> l(lock_);
+    MockOperation* op = GetOperation(req.operationHandle, &resp.status);
+    if (op != NULL) op->canceled = true;
+  }
+
+  void CloseOperation(hs2::TCloseOperationResp& resp,
+      const hs2::TCloseOperationReq& req) {
+    OnRpc(RpcMethod::CLOSE_OPERATION);
+    std::lock_guard<std::mutex> l(lock_);
+    if (operations_.erase(req.operationHandle.operationId.guid) == 0) {
+      SetError("Invalid query handle", &resp.status);
+    }
+  }
+
+  void GetResultSetMetadata(hs2::TGetResultSetMetadataResp& resp,
+      const hs2::TGetResultSetMetadataReq& req) {
+    OnRpc(RpcMethod::GET_RESULT_SET_METADATA);
+    std::lock_guard<std::mutex> l(lock_);
+    MockOperation* op = GetOperation(req.operationHandle, &resp.status);
+    if (op == NULL) return;
+    if (op->results) {
+      for (const MockColumn& col : op->results->columns) {
+        resp.schema.columns.push_back(col.desc);
+      }
+    }
+    resp.__isset.schema = true;
+  }
+
+  void FetchResults(hs2::TFetchResultsResp& resp, const hs2::TFetchResultsReq& req) {
+    OnRpc(RpcMethod::FETCH_RESULTS);
+    shared_ptr<const MockResultSet> results;
+    Clock::time_point finish_time;
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      MockOperation* op = GetOperation(req.operationHandle, &resp.status);
+      if (op == NULL) return;
+      if (!op->results) {
+        SetError("Operation has no result set", &resp.status);
+        return;
+      }
+      if (req.orientation == hs2::TFetchOrientation::FETCH_FIRST) {
+        op->next_row = 0;
+      } else if (req.orientation != hs2::TFetchOrientation::FETCH_NEXT) {
+        SetError("Unsupported fetch orientation", &resp.status);
+        return;
+      }
+      results = op->results;
+      finish_time = op->finish_time;
+    }
+
+    // Like Impala, block until the query has finished producing rows.
+    std::this_thread::sleep_until(finish_time);
+
+    int64_t start;
+    int num_rows;
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      MockOperation* op = GetOperation(req.operationHandle, &resp.status);
+      if (op == NULL) return;
+      if (op->canceled) {
+        SetError("Cancelled", &resp.status);
+        return;
+      }
+      start = op->next_row;
+      num_rows = static_cast<int>(std::min<int64_t>(std::max<int64_t>(req.maxRows, 0),
+          results->num_rows - start));
+      op->next_row += num_rows;
+    }
+
+    // Generate the batch outside of the lock so that concurrent fetches proceed.
+    resp.results.__set_startRowOffset(start);
+    resp.results.columns.resize(results->columns.size());
+    for (size_t i = 0; i < results->columns.size(); ++i) {
+      SliceColumn(results->columns[i], start, num_rows, &resp.results.columns[i]);
+    }
+    resp.results.__isset.columns = true;
+    resp.__isset.results = true;
+    resp.__set_hasMoreRows(start + num_rows < results->num_rows);
+  }
+
+  void GetLog(hs2::TGetLogResp& resp, const hs2::TGetLogReq& req) {
+    OnRpc(RpcMethod::GET_LOG);
+    std::lock_guard<std::mutex> l(lock_);
+    GetOperation(req.operationHandle, &resp.status);
+  }
+
+  void GetRuntimeProfile(impala::TGetRuntimeProfileResp& resp,
+      const impala::TGetRuntimeProfileReq& req) {
+    OnRpc(RpcMethod::GET_RUNTIME_PROFILE);
+    std::lock_guard<std::mutex> l(lock_);
+    MockOperation* op = GetOperation(req.operationHandle, &resp.status);
+    if (op == NULL) return;
+    std::stringstream ss;
+    ss << "Mock query\n"
+       << "  Rows returned: " << op->next_row << "\n";
+    resp.__set_profile(ss.str());
+  }
+
+ private:
+  void OnRpc(RpcMethod method) {
+    ++num_rpcs_;
+    if (options_.rpc_latency_us > 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(options_.rpc_latency_us));
+    }
+    if (std::find(options_.failed_rpcs.begin(), options_.failed_rpcs.end(), method) !=
+        options_.failed_rpcs.end()) {
+      // The processor replies with a TApplicationException.
+      throw TException(string("Mock failure of ") + RpcMethodToString(method));
+    }
+  }
+
+  // Returns a new, unique handle identifier. 'lock_' must be held by the caller.
+  hs2::THandleIdentifier NewId() {
+    uint64_t id = ++next_id_;
+    hs2::THandleIdentifier handle_id;
+    handle_id.guid.assign(reinterpret_cast<const char*>(&id), sizeof(id));
+    handle_id.guid.append(8, '\0');
+    handle_id.secret.assign(16, '\0');
+    return handle_id;
+  }
+
+  // Returns the operation for 'handle', or sets an error in 'status' and returns NULL
+  // if it doesn't exist. 'lock_' must be held by the caller.
+  MockOperation* GetOperation(const hs2::TOperationHandle& handle, hs2::TStatus* status) {
+    auto it = operations_.find(handle.operationId.guid);
+    if (it == operations_.end()) {
+      SetError("Invalid query handle", status);
+      return NULL;
+    }
+    return &it->second;
+  }
+
+  const MockServerOptions options_;
+
+  // Protects all of the following members.
+  std::mutex lock_;
+  uint64_t next_id_;
+  shared_ptr<const MockResultSet> results_;
+  // Keyed by the guid of the handle.
+  std::map<string, bool> sessions_;
+  std::map<string, MockOperation> operations_;
+
+  std::atomic<int64_t> num_rpcs_;
+};
+
+// Sets 'port' to a port that is free to listen on, chosen by the kernel. Another process
+// may take it before the server listens on it.
+Status PickFreePort(int* port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return Status::Error(string("MockServer failed to create a socket: ") +
+        strerror(errno));
+  }
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = 0;
+  socklen_t addr_len = sizeof(addr);
+  Status status;
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) {
+    status = Status::Error(string("MockServer failed to find a free port: ") +
+        strerror(errno));
+  } else {
+    *port = ntohs(addr.sin_port);
+  }
+  close(fd);
+  return status;
+}
+
+} // namespace
+
+struct MockServer::MockServerImpl : public TServerEventHandler {
+  explicit MockServerImpl(const MockServerOptions& options)
+    : options(options), port(options.port), service(new MockService(options)),
+      state(STOPPED) {}
+
+  // Called by the server thread once it's listening for connections.
+  virtual void preServe() {
+    std::lock_guard<std::mutex> l(lock);
+    state = SERVING;
+    state_cv.notify_all();
+  }
+
+  void Serve() {
+    string error;
+    try {
+      server->serve();
+    } catch (const TException& e) {
+      error = e.what();
+    }
+
+    std::lock_guard<std::mutex> l(lock);
+    if (state == STARTING) {
+      // The server returns from serve() without calling preServe() if it fails to
+      // listen, eg. because the port is in use.
+      std::stringstream ss;
+      ss << "MockServer failed to listen on port " << port;
+      if (!error.empty()) ss << ": " << error;
+      start_error = ss.str();
+    }
+    state = STOPPED;
+    state_cv.notify_all();
+  }
+
+  // Starts serving on 'port' on a background thread, returning once the server is
+  // listening for connections or has failed to.
+  Status Start(int port);
+
+  enum State { STOPPED, STARTING, SERVING };
+
+  const MockServerOptions options;
+  // The port that the server listens on. Differs from the one in 'options' if that's 0.
+  int port;
+  boost::shared_ptr<MockService> service;
+  boost::shared_ptr<TThreadedServer> server;
+  std::thread thread;
+
+  std::mutex lock;
+  std::condition_variable state_cv;
+  State state;
+  string start_error;
+};
+
+MockServer::MockServer(const MockServerOptions& options, const MockResultSpec& spec)
+  : impl_(new MockServerImpl(options)),
+    init_status_(impl_->service->SetResultSpec(spec)) {
+}
+
+MockServer::~MockServer() {
+  Status status = Stop();
+  if (!status.ok()) {
+    HS2CLIENT_LOG(WARNING) << "Failed to stop MockServer: " << status.GetMessage();
+  }
+}
+
+Status MockServer::Start() {
+  HS2CLIENT_RETURN_IF_ERROR(init_status_);
+  if (impl_->thread.joinable()) return Status::Error("MockServer is already running");
+  if (impl_->options.port != 0) return impl_->Start(impl_->options.port);
+
+  Status status;
+  for (int i = 0; i < MAX_START_ATTEMPTS; ++i) {
+    int port;
+    HS2CLIENT_RETURN_IF_ERROR(PickFreePort(&port));
+    status = impl_->Start(port);
+    if (status.ok()) break;
+  }
+  return status;
+}
+
+Status MockServer::MockServerImpl::Start(int port) {
+  this->port = port;
+  boost::shared_ptr<TProcessor> processor(
+      new impala::ImpalaHiveServer2ServiceProcessor(service));
+  boost::shared_ptr<TServerSocket> socket(new TServerSocket(port));
+  boost::shared_ptr<TTransportFactory> transport_factory;
+  if (options.transport == TransportType::FRAMED) {
+    transport_factory.reset(new TFramedTransportFactory());
+  } else {
+    transport_factory.reset(new TBufferedTransportFactory());
+  }
+  boost::shared_ptr<TProtocolFactory> protocol_factory;
+  if (options.protocol == WireProtocol::COMPACT) {
+    protocol_factory.reset(new TCompactProtocolFactory());
+  } else {
+    protocol_factory.reset(new TBinaryProtocolFactory());
+  }
+  server.reset(new TThreadedServer(processor, socket, transport_factory,
+      protocol_factory));
+  // The handler is this, which outlives the server.
+  server->setServerEventHandler(boost::shared_ptr<TServerEventHandler>(
+      this, [](TServerEventHandler*) {}));
+
+  {
+    std::lock_guard<std::mutex> l(lock);
+    state = STARTING;
+    start_error.clear();
+  }
+  thread = std::thread(&MockServerImpl::Serve, this);
+
+  std::unique_lock<std::mutex> l(lock);
+  state_cv.wait(l, [this] { return state != STARTING; });
+  if (state == SERVING) return Status::OK();
+
+  string error = start_error;
+  l.unlock();
+  thread.join();
+  server.reset();
+  return Status::Error(error);
+}
+
+Status MockServer::Stop() {
+  if (!impl_->thread.joinable()) return Status::OK();
+  try {
+    impl_->server->stop();
+  } catch (const TException& e) {
+    return Status::Error(e.what());
+  }
+  impl_->thread.join();
+  impl_->server.reset();
+  return Status::OK();
+}
+
+Status MockServer::SetResultSpec(const MockResultSpec& spec) {
+  return impl_->service->SetResultSpec(spec);
+}
+
+int MockServer::port() const {
+  return impl_->port;
+}
+
+int64_t MockServer::num_rpcs() const {
+  return impl_->service->num_rpcs();
+}
+
+} // namespace hs2client
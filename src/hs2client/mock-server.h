@@ -0,0 +1,147 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HS2CLIENT_MOCK_SERVER_H
+#define HS2CLIENT_MOCK_SERVER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hs2client/macros.h"
+#include "hs2client/service.h"
+#include "hs2client/status.h"
+#include "hs2client/types.h"
+
+namespace hs2client {
+
+// Describes a single column of the synthetic result set returned by a MockServer.
+struct MockColumnSpec {
+  explicit MockColumnSpec(ColumnType::TypeId type, double null_fraction = 0.0,
+      int string_length = 16)
+    : type(type), null_fraction(null_fraction), string_length(string_length),
+      precision(18), scale(4) {}
+
+  ColumnType::TypeId type;
+
+  // The fraction of values in this column that are null, between 0 and 1.
+  double null_fraction;
+
+  // The length of each generated STRING, BINARY, VARCHAR or CHAR value.
+  int string_length;
+
+  // The precision and scale of a DECIMAL column.
+  int precision;
+  int scale;
+};
+
+// Describes the result set returned for every query executed against a MockServer.
+struct MockResultSpec {
+  MockResultSpec() : num_rows(1024), seed(0) {}
+
+  std::vector<MockColumnSpec> columns;
+
+  // The total number of rows returned by each query.
+  int64_t num_rows;
+
+  // Seeds the generation of values, so that results are reproducible.
+  uint32_t seed;
+};
+
+struct MockServerOptions {
+  MockServerOptions()
+    : port(0), transport(TransportType::BUFFERED), protocol(WireProtocol::BINARY),
+      rpc_latency_us(0), exec_latency_us(0) {}
+
+  // If 0, the server listens on a free port chosen when it starts, so that servers in
+  // concurrent tests don't collide. Clients connect to MockServer::port().
+  int port;
+
+  // Clients must connect with matching ConnectionOptions.
+  TransportType transport;
+  WireProtocol protocol;
+
+  // Time that the server sleeps before handling each RPC, to simulate network latency.
+  int rpc_latency_us;
+
+  // Time that each query remains in the RUNNING state before it finishes. Fetches
+  // issued before then block until the query finishes, as they do in Impala.
+  int exec_latency_us;
+
+  // RPCs of these methods fail with a TApplicationException rather than a reply, as
+  // they do when the server hits an unexpected error.
+  std::vector<RpcMethod> failed_rpcs;
+};
+
+// An in-process HiveServer2 server implementing the Impala flavor of the HiveServer2
+// interface, which returns synthetic columnar result sets. Intended as a stand-in for
+// Impala in tests and benchmarks.
+//
+// Statements beginning with "select" (case-insensitive) return the result set
+// described by the current MockResultSpec. All other statements finish immediately
+// without a result set. Values are deterministic for a given seed.
+//
+// Example:
+// MockServerOptions options;
+// MockResultSpec spec;
+// spec.columns.emplace_back(ColumnType::TypeId::INT, 0.1);
+// spec.num_rows = 100000;
+// MockServer server(options, spec);
+// HS2CLIENT_RETURN_IF_ERROR(server.Start());
+// ... connect with Service::Connect("localhost", server.port(), ...) ...
+// HS2CLIENT_RETURN_IF_ERROR(server.Stop());
+//
+// This class is thread-safe.
+class MockServer {
+ public:
+  MockServer(const MockServerOptions& options, const MockResultSpec& spec);
+
+  // Stops the server if it is running.
+  ~MockServer();
+
+  // Starts serving on a background thread. Returns once the server is listening for
+  // connections, or an error if it could not start, eg. because the port is in use or
+  // the result spec is invalid.
+  Status Start();
+
+  // Stops the server. All clients should have closed their connections first, since
+  // the server waits for its connection threads to exit.
+  Status Stop();
+
+  // Replaces the result set returned by queries executed after this call. Returns an
+  // error if the spec contains a column type that the server can't generate.
+  Status SetResultSpec(const MockResultSpec& spec);
+
+  // Returns the port that the server listens on, which is only known once it has
+  // started if MockServerOptions::port is 0.
+  int port() const;
+
+  // Returns the number of RPCs handled since the server was created.
+  int64_t num_rpcs() const;
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(MockServer);
+
+  // Hides Thrift objects from the header.
+  struct MockServerImpl;
+
+  std::unique_ptr<MockServerImpl> impl_;
+
+  // The result of applying the spec passed to the c'tor. Returned by Start().
+  Status init_status_;
+};
+
+} // namespace hs2client
+
+#endif // HS2CLIENT_MOCK_SERVER_H
@@ -74,6 +74,47 @@ TEST_F(OperationTest, TestFetch) {
   EXPECT_OK(select_op->Close());
 }
 
+TEST_F(OperationTest, TestPrefetch) {
+  CreateTestTable();
+  InsertIntoTestTable(vector<int>({1, 2, 3, 4, 5}),
+      vector<string>({"a", "b", "c", "d", "e"}));
+
+  unique_ptr<Operation> select_op;
+  EXPECT_OK(session_->ExecuteStatement("select * from " + TEST_TBL + " order by int_col",
+      &select_op));
+  EXPECT_ERROR(select_op->StartPrefetch(0, 2));
+  EXPECT_OK(select_op->StartPrefetch(2, 2));
+  EXPECT_ERROR(select_op->StartPrefetch(2, 2));
+
+  // The batches are returned in order, as they would be by Fetch.
+  vector<int> ints;
+  vector<string> strings;
+  unique_ptr<ColumnarRowSet> results;
+  bool has_more_rows = true;
+  while (has_more_rows) {
+    EXPECT_OK(select_op->NextBatch(&results, &has_more_rows));
+    unique_ptr<Int32Column> int_col = results->GetInt32Col(0);
+    unique_ptr<StringColumn> string_col = results->GetStringCol(1);
+    EXPECT_LE(int_col->length(), 2);
+    ints.insert(ints.end(), int_col->data().begin(), int_col->data().end());
+    strings.insert(strings.end(), string_col->data().begin(), string_col->data().end());
+  }
+  EXPECT_EQ(ints, vector<int>({1, 2, 3, 4, 5}));
+  EXPECT_EQ(strings, vector<string>({"a", "b", "c", "d", "e"}));
+
+  // Once the prefetched batches are exhausted, NextBatch behaves like Fetch.
+  EXPECT_OK(select_op->NextBatch(&results, &has_more_rows));
+  EXPECT_EQ(results->GetInt32Col(0)->length(), 0);
+  EXPECT_FALSE(has_more_rows);
+  EXPECT_OK(select_op->Close());
+
+  // Closing an operation stops any prefetching in progress.
+  unique_ptr<Operation> close_op;
+  EXPECT_OK(session_->ExecuteStatement("select * from " + TEST_TBL, &close_op));
+  EXPECT_OK(close_op->StartPrefetch(4, 1));
+  EXPECT_OK(close_op->Close());
+}
+
 TEST_F(OperationTest, TestIsNull) {
   CreateTestTable();
   // Insert some NULLs and ensure Column::IsNull() is correct.
@@ -101,6 +142,15 @@ TEST_F(OperationTest, TestIsNull) {
     EXPECT_EQ(string_col->IsNull(i), string_nulls[i]);
   }
 
+  unique_ptr<StringViewColumn> string_view_col = nulls_results->GetStringViewCol(1);
+  EXPECT_EQ(string_view_col->length(), string_col->length());
+  for (int i = 0; i < string_view_col->length(); i++) {
+    EXPECT_EQ(string_view_col->IsNull(i), string_nulls[i]);
+    if (!string_nulls[i]) {
+      EXPECT_EQ(string_view_col->GetData(i).ToString(), string_col->GetData(i));
+    }
+  }
+
   EXPECT_OK(select_nulls_op->Close());
 }
 
@@ -14,6 +14,13 @@
 
 #include "hs2client/operation.h"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 #include "hs2client/logging.h"
 #include "hs2client/macros.h"
 #include "hs2client/thrift-internal.h"
@@ -29,6 +36,108 @@ namespace hs2client {
 // Max rows to fetch, if not specified.
 const static int DEFAULT_MAX_ROWS = 1024;
 
+// The bounds of the exponential backoff between polls in WaitForCompletion.
+const static int MIN_POLL_INTERVAL_US = 1000;
+const static int MAX_POLL_INTERVAL_US = 100000;
+
+// Fetches batches of results for an operation on a background thread and buffers them
+// in a bounded queue. At most 'depth' batches are in flight or buffered at any time.
+class FetchPipeline {
+ public:
+  FetchPipeline(const Operation* op, int depth, int max_rows)
+    : op_(op), depth_(depth), max_rows_(max_rows), done_(false), stopped_(false) {
+    thread_ = std::thread(&FetchPipeline::Run, this);
+  }
+
+  ~FetchPipeline() {
+    Stop();
+  }
+
+  // Blocks until a batch is available and moves it into the output parameters. Returns
+  // false if the fetcher thread has finished and all batches have been consumed.
+  bool Next(Status* status, unique_ptr<ColumnarRowSet>* results, bool* has_more_rows) {
+    std::unique_lock<std::mutex> l(lock_);
+    not_empty_.wait(l, [this] { return !queue_.empty() || done_; });
+    if (queue_.empty()) return false;
+
+    Batch batch = std::move(queue_.front());
+    queue_.pop_front();
+    l.unlock();
+    not_full_.notify_one();
+
+    *status = batch.status;
+    *results = std::move(batch.results);
+    if (has_more_rows != NULL) *has_more_rows = batch.has_more_rows;
+    return true;
+  }
+
+  // Stops the fetcher thread, waiting for any in-flight fetch to complete.
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      stopped_ = true;
+    }
+    not_full_.notify_all();
+    if (thread_.joinable()) thread_.join();
+  }
+
+ private:
+  struct Batch {
+    Batch() : status(Status::OK()), has_more_rows(false) {}
+
+    Status status;
+    unique_ptr<ColumnarRowSet> results;
+    bool has_more_rows;
+  };
+
+  void Run() {
+    bool has_more_rows = true;
+    while (has_more_rows) {
+      {
+        std::unique_lock<std::mutex> l(lock_);
+        not_full_.wait(l, [this] {
+          return stopped_ || static_cast<int>(queue_.size()) < depth_;
+        });
+        if (stopped_) break;
+      }
+
+      Batch batch;
+      batch.status = op_->Fetch(max_rows_, FetchOrientation::NEXT, &batch.results,
+          &batch.has_more_rows);
+      has_more_rows = batch.status.ok() && batch.has_more_rows;
+
+      {
+        std::lock_guard<std::mutex> l(lock_);
+        queue_.push_back(std::move(batch));
+      }
+      not_empty_.notify_one();
+    }
+
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      done_ = true;
+    }
+    not_empty_.notify_all();
+  }
+
+  const Operation* op_;
+  const int depth_;
+  const int max_rows_;
+
+  // Protects all members below.
+  std::mutex lock_;
+  // Signaled when a batch is consumed or Stop is called.
+  std::condition_variable not_full_;
+  // Signaled when a batch is added or the fetcher thread finishes.
+  std::condition_variable not_empty_;
+  std::deque<Batch> queue_;
+  // True once the fetcher thread will not add any more batches.
+  bool done_;
+  bool stopped_;
+
+  std::thread thread_;
+};
+
 Operation::Operation(const std::shared_ptr<ThriftRPC>& rpc)
   : impl_(new OperationImpl()), rpc_(rpc), open_(false) {}
 
@@ -40,9 +149,13 @@ Status Operation::GetState(Operation::State* out) const {
   hs2::TGetOperationStatusReq req;
   req.__set_operationHandle(impl_->handle);
   hs2::TGetOperationStatusResp resp;
-  TRY_RPC_OR_RETURN(rpc_->client->GetOperationStatus(resp, req));
+  TRY_LOCKED_RPC_OR_RETURN(rpc_, RpcMethod::GET_OPERATION_STATUS, &impl_->session_handle,
+      &impl_->handle, rpc_->client->GetOperationStatus(resp, req), resp.status);
   RETURN_NOT_OK(resp.status);
   *out = TOperationStateToOperationState(resp.operationState);
+  if (*out == State::FINISHED) {
+    impl_->TraceMilestone(rpc_.get(), OperationMilestone::FINISHED);
+  }
   return TStatusToStatus(resp.status);
 }
 
@@ -50,7 +163,8 @@ Status Operation::GetLog(std::string* out) const {
   hs2::TGetLogReq req;
   req.__set_operationHandle(impl_->handle);
   hs2::TGetLogResp resp;
-  TRY_RPC_OR_RETURN(rpc_->client->GetLog(resp, req));
+  TRY_LOCKED_RPC_OR_RETURN(rpc_, RpcMethod::GET_LOG, &impl_->session_handle,
+      &impl_->handle, rpc_->client->GetLog(resp, req), resp.status);
   RETURN_NOT_OK(resp.status);
   *out = resp.log;
   return TStatusToStatus(resp.status);
@@ -61,27 +175,27 @@ Status Operation::GetProfile(std::string* out) const {
   req.__set_operationHandle(impl_->handle);
   req.__set_sessionHandle(impl_->session_handle);
   impala::TGetRuntimeProfileResp resp;
-  TRY_RPC_OR_RETURN(rpc_->client->GetRuntimeProfile(resp, req));
+  TRY_LOCKED_RPC_OR_RETURN(rpc_, RpcMethod::GET_RUNTIME_PROFILE, &impl_->session_handle,
+      &impl_->handle, rpc_->client->GetRuntimeProfile(resp, req), resp.status);
   RETURN_NOT_OK(resp.status);
   *out = resp.profile;
   return TStatusToStatus(resp.status);
 }
 
 Status Operation::GetResultSetMetadata(std::vector<ColumnDesc>* column_descs) const {
+  if (impl_->cached_schema) {
+    TTableSchemaToColumnDescs(*impl_->cached_schema, column_descs);
+    return Status::OK();
+  }
+
   hs2::TGetResultSetMetadataReq req;
   req.__set_operationHandle(impl_->handle);
   hs2::TGetResultSetMetadataResp resp;
-  TRY_RPC_OR_RETURN(rpc_->client->GetResultSetMetadata(resp, req));
+  TRY_LOCKED_RPC_OR_RETURN(rpc_, RpcMethod::GET_RESULT_SET_METADATA,
+      &impl_->session_handle, &impl_->handle,
+      rpc_->client->GetResultSetMetadata(resp, req), resp.status);
   RETURN_NOT_OK(resp.status);
-
-  column_descs->clear();
-  column_descs->reserve(resp.schema.columns.size());
-  for (const hs2::TColumnDesc& tcolumn_desc: resp.schema.columns) {
-    column_descs->emplace_back(tcolumn_desc.columnName,
-        TTypeDescToColumnType(tcolumn_desc.typeDesc), tcolumn_desc.position,
-        tcolumn_desc.comment);
-  }
-
+  TTableSchemaToColumnDescs(resp.schema, column_descs);
   return TStatusToStatus(resp.status);
 }
 
@@ -91,45 +205,181 @@ Status Operation::Fetch(unique_ptr<ColumnarRowSet>* results, bool* has_more_rows
 
 Status Operation::Fetch(int max_rows, FetchOrientation orientation,
     unique_ptr<ColumnarRowSet>* results, bool* has_more_rows) const {
+  if (orientation == FetchOrientation::NEXT) {
+    if (impl_->TakePendingBatch(max_rows, results, has_more_rows)) return Status::OK();
+  } else {
+    // The batch fetched by WaitForCompletion is superseded by fetching from elsewhere.
+    impl_->ClearPendingBatch();
+  }
+
+  bool more_rows = false;
+  HS2CLIENT_RETURN_IF_ERROR(impl_->FetchBatch(rpc_.get(), max_rows, orientation, results,
+      &more_rows));
+  if (has_more_rows != NULL) *has_more_rows = more_rows;
+  impl_->TraceBatch(rpc_.get(), (*results)->num_rows(), more_rows);
+  return Status::OK();
+}
+
+bool Operation::OperationImpl::TakePendingBatch(int max_rows,
+    unique_ptr<ColumnarRowSet>* results, bool* has_more_rows) {
+  std::lock_guard<std::mutex> l(pending_lock);
+  if (!pending_batch) return false;
+  if (max_rows > 0 && pending_batch->num_rows() > max_rows) {
+    results->reset(new ColumnarRowSet(
+        pending_batch->impl_->SplitFront(max_rows).release()));
+    if (has_more_rows != NULL) *has_more_rows = true;
+    return true;
+  }
+  *results = std::move(pending_batch);
+  if (has_more_rows != NULL) *has_more_rows = pending_has_more_rows;
+  return true;
+}
+
+Status Operation::OperationImpl::FetchBatch(ThriftRPC* rpc, int max_rows,
+    FetchOrientation orientation, unique_ptr<ColumnarRowSet>* results,
+    bool* has_more_rows) {
   hs2::TFetchResultsReq req;
-  req.__set_operationHandle(impl_->handle);
+  req.__set_operationHandle(handle);
   req.__set_orientation(FetchOrientationToTFetchOrientation(orientation));
   req.__set_maxRows(max_rows);
   std::unique_ptr<ColumnarRowSet::ColumnarRowSetImpl> row_set_impl(
       new ColumnarRowSet::ColumnarRowSetImpl());
-  TRY_RPC_OR_RETURN(rpc_->client->FetchResults(row_set_impl->resp, req));
+  TRY_LOCKED_RPC_OR_RETURN(rpc, RpcMethod::FETCH_RESULTS, &session_handle, &handle,
+      FetchResults(rpc->client.get(), req, &row_set_impl->resp,
+          &row_set_impl->string_columns), row_set_impl->resp.status);
   RETURN_NOT_OK(row_set_impl->resp.status);
 
-  if (has_more_rows != NULL) {
-    *has_more_rows = row_set_impl->resp.hasMoreRows;
-  }
-  Status status = TStatusToStatus(row_set_impl->resp.status);
-  DCHECK(status.ok());
+  *has_more_rows = row_set_impl->resp.hasMoreRows;
   results->reset(new ColumnarRowSet(row_set_impl.release()));
-  return status;
+  rpc->metrics.AddRowsFetched((*results)->num_rows());
+  return Status::OK();
+}
+
+Status Operation::WaitForCompletion(int timeout_ms) {
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+  {
+    std::lock_guard<std::mutex> l(impl_->pending_lock);
+    if (impl_->pending_batch) return Status::OK();
+  }
+
+  bool fetch_as_wait = impl_->handle.hasResultSet;
+  int interval_us = MIN_POLL_INTERVAL_US;
+  while (true) {
+    Clock::time_point rpc_start = Clock::now();
+    if (fetch_as_wait) {
+      unique_ptr<ColumnarRowSet> batch;
+      bool has_more_rows = false;
+      Status status = impl_->FetchBatch(rpc_.get(), DEFAULT_MAX_ROWS,
+          FetchOrientation::NEXT, &batch, &has_more_rows);
+      if (status.ok() && (batch->num_rows() > 0 || !has_more_rows)) {
+        impl_->TraceMilestone(rpc_.get(), OperationMilestone::FINISHED);
+        impl_->TraceBatch(rpc_.get(), batch->num_rows(), has_more_rows);
+        std::lock_guard<std::mutex> l(impl_->pending_lock);
+        impl_->pending_batch = std::move(batch);
+        impl_->pending_has_more_rows = has_more_rows;
+        return Status::OK();
+      } else if (!status.ok()) {
+        // Either the operation failed, or the server doesn't block FetchResults until
+        // rows are ready. GetState tells them apart.
+        fetch_as_wait = false;
+        State state;
+        HS2CLIENT_RETURN_IF_ERROR(GetState(&state));
+        if (state == State::ERROR || state == State::CANCELED || state == State::CLOSED) {
+          return status;
+        }
+        if (state == State::FINISHED) return Status::OK();
+      }
+      // Otherwise the server's fetch timeout expired before any rows were ready.
+    } else {
+      State state;
+      HS2CLIENT_RETURN_IF_ERROR(GetState(&state));
+      if (state == State::FINISHED) return Status::OK();
+      if (state == State::ERROR || state == State::CANCELED || state == State::CLOSED) {
+        return Status::Error("Operation is " + OperationStateToString(state));
+      }
+    }
+
+    Clock::time_point now = Clock::now();
+    if (timeout_ms >= 0 && now >= deadline) return Status::StillExecuting();
+    // Don't back off after an RPC that the server held for longer than the interval.
+    std::chrono::microseconds sleep = std::chrono::microseconds(interval_us) -
+        std::chrono::duration_cast<std::chrono::microseconds>(now - rpc_start);
+    if (timeout_ms >= 0) {
+      sleep = std::min(sleep,
+          std::chrono::duration_cast<std::chrono::microseconds>(deadline - now));
+    }
+    if (sleep.count() > 0) std::this_thread::sleep_for(sleep);
+    interval_us = std::min(interval_us * 2, MAX_POLL_INTERVAL_US);
+  }
+}
+
+Status Operation::StartPrefetch(int depth, int max_rows) {
+  if (prefetch_) return Status::Error("Prefetching has already been started.");
+  if (depth <= 0 || max_rows <= 0) {
+    return Status::Error("Prefetch depth and max rows must be positive.");
+  }
+  prefetch_.reset(new FetchPipeline(this, depth, max_rows));
+  return Status::OK();
+}
+
+Status Operation::NextBatch(unique_ptr<ColumnarRowSet>* results, bool* has_more_rows) {
+  if (prefetch_) {
+    Status status = Status::OK();
+    if (prefetch_->Next(&status, results, has_more_rows)) return status;
+  }
+  return Fetch(results, has_more_rows);
 }
 
 Status Operation::Cancel() const {
   hs2::TCancelOperationReq req;
   req.__set_operationHandle(impl_->handle);
   hs2::TCancelOperationResp resp;
-  TRY_RPC_OR_RETURN(rpc_->client->CancelOperation(resp, req));
+  TRY_LOCKED_RPC_OR_RETURN(rpc_, RpcMethod::CANCEL_OPERATION, &impl_->session_handle,
+      &impl_->handle, rpc_->client->CancelOperation(resp, req), resp.status);
   return TStatusToStatus(resp.status);
 }
 
+void Operation::CancelAsync() const {
+  rpc_->Defer(DeferredRpc(RpcMethod::CANCEL_OPERATION, impl_->session_handle,
+      &impl_->handle), true);
+}
+
 Status Operation::Close() {
+  // Stop the fetcher thread before the handle becomes invalid.
+  prefetch_.reset();
+  impl_->ClearPendingBatch();
   if (!open_) return Status::OK();
+  // As for Session::Close, a broken connection can't be used to close the operation.
+  Status broken = rpc_->BrokenStatus();
+  if (!broken.ok()) {
+    open_ = false;
+    return broken;
+  }
 
   hs2::TCloseOperationReq req;
   req.__set_operationHandle(impl_->handle);
   hs2::TCloseOperationResp resp;
-  TRY_RPC_OR_RETURN(rpc_->client->CloseOperation(resp, req));
+  TRY_LOCKED_RPC_OR_RETURN(rpc_, RpcMethod::CLOSE_OPERATION, &impl_->session_handle,
+      &impl_->handle, rpc_->client->CloseOperation(resp, req), resp.status);
   RETURN_NOT_OK(resp.status);
 
   open_ = false;
+  impl_->TraceMilestone(rpc_.get(), OperationMilestone::CLOSED);
   return TStatusToStatus(resp.status);
 }
 
+void Operation::CloseAsync() {
+  prefetch_.reset();
+  impl_->ClearPendingBatch();
+  if (!open_) return;
+
+  rpc_->Defer(DeferredRpc(RpcMethod::CLOSE_OPERATION, impl_->session_handle,
+      &impl_->handle), true);
+  open_ = false;
+  impl_->TraceMilestone(rpc_.get(), OperationMilestone::CLOSED);
+}
+
 bool Operation::HasResultSet() const {
   State op_state;
   Status s = GetState(&op_state);
@@ -15,6 +15,7 @@
 #ifndef HS2CLIENT_OPERATION_H
 #define HS2CLIENT_OPERATION_H
 
+#include <memory>
 #include <string>
 
 #include "hs2client/columnar-row-set.h"
@@ -24,6 +25,7 @@
 
 namespace hs2client {
 
+class FetchPipeline;
 struct ThriftRPC;
 
 // Maps directly to TFetchOrientation in the HiveServer2 interface.
@@ -43,7 +45,10 @@ enum class FetchOrientation {
 // Operations are created using Session functions, eg. ExecuteStatement. They must
 // have Close called on them before they can be deleted.
 //
-// This class is not thread-safe.
+// The const methods, eg. GetState, Fetch and Cancel, may be called concurrently with
+// each other, and with methods of other Operations and Sessions from the same Service.
+// StartPrefetch, NextBatch, Close and CloseAsync must not be called concurrently with
+// any other method.
 class Operation {
  public:
 
@@ -83,14 +88,60 @@ class Operation {
   Status Fetch(int max_rows, FetchOrientation orientation,
       std::unique_ptr<ColumnarRowSet>* results, bool* has_more_rows) const;
 
+  // Blocks until the operation has finished, ie. its results are ready, or until
+  // 'timeout_ms' has passed if it's not negative. Returns StillExecuting on timeout, and
+  // an error if the operation failed or was canceled.
+  //
+  // For operations with a result set this fetches the first batch of results, since
+  // Impala blocks FetchResults until rows are ready, and returns as soon as they are
+  // without any GetState round trips. The batch is kept and returned by the next
+  // Fetches or NextBatches with the NEXT orientation, up to their max_rows at a time.
+  // Otherwise, or if the server fails a FetchResults for a running operation as Hive
+  // does, GetState is polled with exponential backoff from 1ms to 100ms, never sleeping
+  // past the timeout. A blocking FetchResults may overrun the timeout by up to the
+  // server's own fetch timeout, eg. Impala's FETCH_ROWS_TIMEOUT_MS query option.
+  //
+  // Must not be called concurrently with any other method.
+  Status WaitForCompletion(int timeout_ms = -1);
+
+  // Starts fetching results on a background thread, keeping up to 'depth' batches of
+  // up to 'max_rows' rows each in flight or buffered, so that network time overlaps
+  // with the processing of previously fetched batches. The buffered batches are
+  // retrieved with NextBatch. Returns an error if prefetching has already been started.
+  //
+  // The background thread's FetchResults RPCs share the connection of the Service that
+  // created this operation, so other RPCs through that Service wait for any fetch that
+  // is in flight.
+  Status StartPrefetch(int depth, int max_rows);
+
+  // Returns the next batch of results. If StartPrefetch has been called, the batch is
+  // taken from the prefetch queue, blocking until one is available, otherwise this is
+  // equivalent to Fetch(results, has_more_rows). Once all prefetched batches have been
+  // returned, further calls fall back to Fetch.
+  Status NextBatch(std::unique_ptr<ColumnarRowSet>* results, bool* has_more_rows);
+
   // May be called after successfully creating the operation and before calling Close.
   Status Cancel() const;
 
+  // Like Cancel, but returns immediately, and the CancelOperation RPC is sent by the
+  // Service's reaper thread, see CloseAsync.
+  void CancelAsync() const;
+
   // Closes the operation. Must be called before the operation is deleted. May be safely
   // called on an invalid or already closed operation - will only return an error if the
-  // operation is open but the close rpc fails.
+  // operation is open but the close rpc fails. Stops any prefetching that is in
+  // progress, discarding the buffered batches.
   Status Close();
 
+  // Like Close, but returns immediately, after which the operation may be deleted. The
+  // CloseOperation RPC is queued to a background reaper thread owned by the Service,
+  // which sends everything queued to it as soon as the connection is free, so a burst of
+  // closes is pipelined into about one round trip. RPCs queued on a Service are sent in
+  // order, so an operation closed before its session is closed on the server first.
+  // Service::Close waits for the queue to be sent. Failures are logged rather than
+  // returned.
+  void CloseAsync();
+
   // May be called after successfully creating the operation and before calling Close.
   bool HasResultSet() const;
 
@@ -107,6 +158,9 @@ class Operation {
   std::unique_ptr<OperationImpl> impl_;
   std::shared_ptr<ThriftRPC> rpc_;
 
+  // Non-null iff StartPrefetch has been called.
+  std::unique_ptr<FetchPipeline> prefetch_;
+
   // True iff this operation has been successfully created and has not been closed yet,
   // corresponding to when the operation has a valid operation handle.
   bool open_;
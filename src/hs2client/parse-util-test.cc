@@ -0,0 +1,150 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/parse-util.h"
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+
+using namespace hs2client;
+using namespace std;
+
+namespace {
+
+bool Parse(const string& value, int64_t* nanos) {
+  return ParseTimestamp(value.data(), value.size(), nanos);
+}
+
+// Returns the nanoseconds of 'value', which must be valid.
+int64_t ParseOrDie(const string& value) {
+  int64_t nanos = 0;
+  EXPECT_TRUE(Parse(value, &nanos)) << value;
+  return nanos;
+}
+
+} // namespace
+
+TEST(ParseUtilTest, TestDaysSinceEpoch) {
+  EXPECT_EQ(DaysSinceEpoch(1970, 1, 1), 0);
+  EXPECT_EQ(DaysSinceEpoch(1970, 1, 2), 1);
+  EXPECT_EQ(DaysSinceEpoch(1969, 12, 31), -1);
+  EXPECT_EQ(DaysSinceEpoch(2000, 3, 1), 11017);
+  EXPECT_EQ(DaysSinceEpoch(1600, 1, 1), -135140);
+}
+
+TEST(ParseUtilTest, TestParseTimestamp) {
+  const int64_t NANOS = 1000000000LL;
+  EXPECT_EQ(ParseOrDie("1970-01-01 00:00:00"), 0);
+  EXPECT_EQ(ParseOrDie("1970-01-01"), 0);
+  EXPECT_EQ(ParseOrDie("1970-01-01T00:00:01"), NANOS);
+  EXPECT_EQ(ParseOrDie("2016-02-29 12:34:56"), 1456749296 * NANOS);
+  EXPECT_EQ(ParseOrDie("1969-12-31 23:59:59"), -NANOS);
+
+  // Fractional seconds of 1 to 9 digits.
+  EXPECT_EQ(ParseOrDie("1970-01-01 00:00:00.5"), NANOS / 2);
+  EXPECT_EQ(ParseOrDie("1970-01-01 00:00:00.000000001"), 1);
+  EXPECT_EQ(ParseOrDie("1970-01-01 00:00:01.123456"), NANOS + 123456000);
+  EXPECT_EQ(ParseOrDie("1969-12-31 23:59:59.9"), -NANOS / 10);
+
+  // The limits of int64 nanoseconds.
+  EXPECT_EQ(ParseOrDie("2262-04-11 23:47:16.854775807"), INT64_MAX);
+  EXPECT_EQ(ParseOrDie("1677-09-21 00:12:44"), -9223372036 * NANOS);
+}
+
+TEST(ParseUtilTest, TestInvalidTimestamps) {
+  int64_t nanos;
+  for (const char* value : {"", "2016", "2016-01-01 ", "2016-01-01 00:00",
+      "2016-01-01 00:00:00.", "2016-01-01 00:00:00.1234567890",
+      "2016-01-01 00:00:00,1", "2016-01-01 00:00:00.1x", "2016-01-01x00:00:00",
+      "2016/01/01 00:00:00", "2016-01-01 00-00-00", "2016-01-01 00:00-00",
+      "2016-0a-01 00:00:00", "2016-01-01 0a:00:00", "2016-01-01 00:00:0a",
+      " 2016-01-01", "2016-13-01", "2016-00-01", "2016-01-00", "2015-02-29",
+      "1900-02-29", "2016-04-31", "2016-01-01 24:00:00", "2016-01-01 00:60:00",
+      "2016-01-01 00:00:60", "2262-04-11 23:47:16.854775808", "2300-01-01",
+      "1677-09-21 00:12:43", "2000-01-0: 00:00:00", "2000-01-0A 00:00:00"}) {
+    EXPECT_FALSE(Parse(value, &nanos)) << value;
+  }
+  EXPECT_TRUE(Parse("2000-02-29", &nanos));
+}
+
+TEST(ParseUtilTest, TestParseDate) {
+  int32_t days;
+  EXPECT_TRUE(ParseDate("1970-01-01", 10, &days));
+  EXPECT_EQ(days, 0);
+  EXPECT_TRUE(ParseDate("1969-12-31", 10, &days));
+  EXPECT_EQ(days, -1);
+  EXPECT_TRUE(ParseDate("2016-02-29", 10, &days));
+  EXPECT_EQ(days, 16860);
+  EXPECT_TRUE(ParseDate("0001-01-01", 10, &days));
+  EXPECT_EQ(days, -719162);
+  EXPECT_TRUE(ParseDate("9999-12-31", 10, &days));
+  EXPECT_EQ(days, 2932896);
+
+  for (const char* value : {"", "2016-01-01 00:00:00", "2016-1-01", "2016-02-30",
+      "2015-02-29", "2016-13-01", "2016/01/01", "20160101xx"}) {
+    EXPECT_FALSE(ParseDate(value, strlen(value), &days)) << value;
+  }
+}
+
+// Returns the unscaled value of 'value' at 'scale', which must be valid.
+int128_t ParseDecimalOrDie(const string& value, int scale) {
+  int128_t unscaled = 0;
+  EXPECT_TRUE(ParseDecimal(value.data(), value.size(), scale, &unscaled)) << value;
+  return unscaled;
+}
+
+TEST(ParseUtilTest, TestParseDecimal) {
+  EXPECT_TRUE(ParseDecimalOrDie("0", 0) == 0);
+  EXPECT_TRUE(ParseDecimalOrDie("-0.00", 2) == 0);
+  EXPECT_TRUE(ParseDecimalOrDie("123.45", 2) == 12345);
+  EXPECT_TRUE(ParseDecimalOrDie("-1.5", 2) == -150);
+  EXPECT_TRUE(ParseDecimalOrDie("+7", 3) == 7000);
+  EXPECT_TRUE(ParseDecimalOrDie(".5", 1) == 5);
+  EXPECT_TRUE(ParseDecimalOrDie("5.", 1) == 50);
+  EXPECT_TRUE(ParseDecimalOrDie("000000000000000000000000000000000000000001", 0) == 1);
+
+  // 38 digits, past the 18 that are accumulated in 64 bits.
+  int128_t max = PowerOfTen(38) - 1;
+  EXPECT_TRUE(ParseDecimalOrDie(string(38, '9'), 0) == max);
+  EXPECT_TRUE(ParseDecimalOrDie("-" + string(28, '9') + "." + string(10, '9'), 10) ==
+      -max);
+  EXPECT_TRUE(ParseDecimalOrDie("1234567890123456789", 0) ==
+      static_cast<int128_t>(1234567890123456789LL));
+
+  int128_t unscaled;
+  for (const char* value : {"", "-", ".", "1.2.3", "1e5", "12a", " 1", "1.234",
+      "123456789012345678901234567890123456789"}) {
+    EXPECT_FALSE(ParseDecimal(value, strlen(value), 2, &unscaled)) << value;
+  }
+  // Padding to the scale would exceed 38 digits.
+  string digits(37, '9');
+  EXPECT_FALSE(ParseDecimal(digits.data(), digits.size(), 2, &unscaled));
+}
+
+TEST(ParseUtilTest, TestFormatDecimal) {
+  EXPECT_EQ(FormatDecimal(0, 0), "0");
+  EXPECT_EQ(FormatDecimal(0, 2), "0.00");
+  EXPECT_EQ(FormatDecimal(12345, 2), "123.45");
+  EXPECT_EQ(FormatDecimal(-150, 2), "-1.50");
+  EXPECT_EQ(FormatDecimal(-5, 3), "-0.005");
+  EXPECT_EQ(FormatDecimal(PowerOfTen(38) - 1, 0), string(38, '9'));
+  EXPECT_EQ(FormatDecimal(-(PowerOfTen(38) - 1), 38), "-0." + string(38, '9'));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,296 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/parse-util.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace hs2client {
+
+namespace {
+
+const int DATE_LENGTH = 10;
+const int DATE_TIME_LENGTH = 19;
+const int MAX_FRACTION_DIGITS = 9;
+
+const int64_t NANOS_PER_SECOND = 1000000000LL;
+
+// The range of seconds for which the nanoseconds fit in an int64.
+const int64_t MIN_SECONDS = INT64_MIN / NANOS_PER_SECOND;
+const int64_t MAX_SECONDS = INT64_MAX / NANOS_PER_SECOND;
+
+struct DateTime {
+  int year;
+  int month;
+  int day;
+  int hour;
+  int minute;
+  int second;
+};
+
+inline bool IsDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+inline int Digits2(const char* data) {
+  return (data[0] - '0') * 10 + (data[1] - '0');
+}
+
+// Parses the 'YYYY-MM-DD' date at the start of 'data'.
+bool ParseDateScalar(const char* data, DateTime* out) {
+  static const int DIGIT_POSITIONS[] = {0, 1, 2, 3, 5, 6, 8, 9};
+  for (int i : DIGIT_POSITIONS) {
+    if (!IsDigit(data[i])) return false;
+  }
+  if (data[4] != '-' || data[7] != '-') return false;
+  out->year = Digits2(data) * 100 + Digits2(data + 2);
+  out->month = Digits2(data + 5);
+  out->day = Digits2(data + 8);
+  return true;
+}
+
+#ifndef __SSE2__
+
+// Parses the 'HH:MM:SS' time at the start of 'data'.
+bool ParseTimeScalar(const char* data, DateTime* out) {
+  static const int DIGIT_POSITIONS[] = {0, 1, 3, 4, 6, 7};
+  for (int i : DIGIT_POSITIONS) {
+    if (!IsDigit(data[i])) return false;
+  }
+  if (data[2] != ':' || data[5] != ':') return false;
+  out->hour = Digits2(data);
+  out->minute = Digits2(data + 3);
+  out->second = Digits2(data + 6);
+  return true;
+}
+
+#else
+
+// Parses 'YYYY-MM-DD?HH:MM:SS' at the start of 'data', which must have at least
+// DATE_TIME_LENGTH bytes, without checking the date/time separator. The first 16 bytes,
+// up to the minutes, are validated and converted at once.
+bool ParseDateTimeSSE2(const char* data, DateTime* out) {
+  const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+  const __m128i digits = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+
+  // Digits are the bytes that are at most 9 once '0' is subtracted, as unsigned.
+  const __m128i nine = _mm_set1_epi8(9);
+  int is_digit = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(digits, nine), nine));
+  // Positions 0-3, 5-6, 8-9, 11-12 and 14-15.
+  const int DIGIT_POSITIONS = 0xdb6f;
+  if ((is_digit & DIGIT_POSITIONS) != DIGIT_POSITIONS) return false;
+
+  // The separators must match exactly. Position 10 is checked by the caller.
+  const __m128i separators = _mm_setr_epi8(
+      0, 0, 0, 0, '-', 0, 0, '-', 0, 0, 0, 0, 0, ':', 0, 0);
+  int is_separator = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, separators));
+  const int SEPARATOR_POSITIONS = (1 << 4) | (1 << 7) | (1 << 13);
+  if ((is_separator & SEPARATOR_POSITIONS) != SEPARATOR_POSITIONS) return false;
+
+  // Widen to 16 bits and combine adjacent pairs of digits with multiply-add. Separators
+  // are weighted 0, and the pairs that straddle a separator are summed below.
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lo = _mm_unpacklo_epi8(digits, zero);
+  const __m128i hi = _mm_unpackhi_epi8(digits, zero);
+  // Bytes 0-7: 'YYYY-MM-'
+  const __m128i lo_weights = _mm_setr_epi16(10, 1, 10, 1, 0, 10, 1, 0);
+  // Bytes 8-15: 'DD HH:MM'
+  const __m128i hi_weights = _mm_setr_epi16(10, 1, 0, 10, 1, 0, 10, 1);
+  alignas(16) int32_t lo_pairs[4];
+  alignas(16) int32_t hi_pairs[4];
+  _mm_store_si128(reinterpret_cast<__m128i*>(lo_pairs), _mm_madd_epi16(lo, lo_weights));
+  _mm_store_si128(reinterpret_cast<__m128i*>(hi_pairs), _mm_madd_epi16(hi, hi_weights));
+
+  out->year = lo_pairs[0] * 100 + lo_pairs[1];
+  out->month = lo_pairs[2] + lo_pairs[3];
+  out->day = hi_pairs[0];
+  out->hour = hi_pairs[1] + hi_pairs[2];
+  out->minute = hi_pairs[3];
+
+  // The seconds, ':SS'.
+  if (data[16] != ':' || !IsDigit(data[17]) || !IsDigit(data[18])) return false;
+  out->second = Digits2(data + 17);
+  return true;
+}
+
+#endif
+
+inline bool IsLeapYear(int year) {
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+bool IsValid(const DateTime& dt) {
+  static const int DAYS_IN_MONTH[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  if (dt.month < 1 || dt.month > 12 || dt.day < 1) return false;
+  int days_in_month = DAYS_IN_MONTH[dt.month - 1];
+  if (dt.month == 2 && IsLeapYear(dt.year)) ++days_in_month;
+  return dt.day <= days_in_month && dt.hour < 24 && dt.minute < 60 && dt.second < 60;
+}
+
+} // namespace
+
+bool ParseDate(const char* data, int32_t length, int32_t* days) {
+  DateTime dt = {0, 0, 0, 0, 0, 0};
+  if (length != DATE_LENGTH || !ParseDateScalar(data, &dt) || !IsValid(dt)) {
+    return false;
+  }
+  // Four digit years are well within the range of int32 days.
+  *days = static_cast<int32_t>(DaysSinceEpoch(dt.year, dt.month, dt.day));
+  return true;
+}
+
+int128_t PowerOfTen(int exponent) {
+  static const struct Powers {
+    Powers() {
+      values[0] = 1;
+      for (int i = 1; i <= MAX_DECIMAL_PRECISION; ++i) values[i] = values[i - 1] * 10;
+    }
+    int128_t values[MAX_DECIMAL_PRECISION + 1];
+  } POWERS;
+  return POWERS.values[exponent];
+}
+
+bool ParseDecimal(const char* data, int32_t length, int scale, int128_t* unscaled) {
+  const char* end = data + length;
+  bool negative = false;
+  if (data < end && (*data == '-' || *data == '+')) {
+    negative = *data == '-';
+    ++data;
+  }
+
+  // Most values have at most 18 digits, which are accumulated in 64 bits first.
+  const int MAX_INT64_DIGITS = 18;
+  uint64_t value64 = 0;
+  int128_t value = 0;
+  int num_digits = 0;
+  int num_significant = 0;
+  int num_fraction = -1;
+  for (; data < end; ++data) {
+    char c = *data;
+    if (c == '.') {
+      if (num_fraction >= 0) return false;
+      num_fraction = 0;
+      continue;
+    }
+    if (!IsDigit(c)) return false;
+    ++num_digits;
+    if (num_fraction >= 0 && ++num_fraction > scale) return false;
+    if (num_significant == 0 && c == '0') continue;
+    if (++num_significant > MAX_DECIMAL_PRECISION) return false;
+    if (num_significant <= MAX_INT64_DIGITS) {
+      value64 = value64 * 10 + (c - '0');
+    } else {
+      if (num_significant == MAX_INT64_DIGITS + 1) value = value64;
+      value = value * 10 + (c - '0');
+    }
+  }
+  if (num_digits == 0) return false;
+  if (num_significant <= MAX_INT64_DIGITS) value = value64;
+
+  int padding = scale - std::max(num_fraction, 0);
+  if (num_significant + padding > MAX_DECIMAL_PRECISION && value != 0) return false;
+  value *= PowerOfTen(padding);
+  *unscaled = negative ? -value : value;
+  return true;
+}
+
+std::string FormatDecimal(int128_t unscaled, int scale) {
+  bool negative = unscaled < 0;
+  // Negated as unsigned, so that the minimum value doesn't overflow.
+  unsigned __int128 value = static_cast<unsigned __int128>(unscaled);
+  if (negative) value = -value;
+
+  // The digits, from the least significant, with at least one before the point.
+  std::string digits;
+  do {
+    digits.push_back(static_cast<char>('0' + static_cast<int>(value % 10)));
+    value /= 10;
+  } while (value != 0);
+  while (static_cast<int>(digits.size()) <= scale) digits.push_back('0');
+
+  std::string out;
+  if (negative) out.push_back('-');
+  out.append(digits.rbegin(), digits.rend() - scale);
+  if (scale > 0) {
+    out.push_back('.');
+    out.append(digits.rend() - scale, digits.rend());
+  }
+  return out;
+}
+
+int64_t DaysSinceEpoch(int64_t year, int month, int day) {
+  // From Howard Hinnant's days_from_civil.
+  year -= month <= 2;
+  const int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const int64_t year_of_era = year - era * 400;
+  const int64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  const int64_t day_of_era =
+      year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+bool ParseTimestamp(const char* data, int32_t length, int64_t* nanos) {
+  DateTime dt = {0, 0, 0, 0, 0, 0};
+  if (length == DATE_LENGTH) {
+    if (!ParseDateScalar(data, &dt)) return false;
+  } else if (length >= DATE_TIME_LENGTH) {
+    if (data[DATE_LENGTH] != ' ' && data[DATE_LENGTH] != 'T') return false;
+#ifdef __SSE2__
+    if (!ParseDateTimeSSE2(data, &dt)) return false;
+#else
+    if (!ParseDateScalar(data, &dt) ||
+        !ParseTimeScalar(data + DATE_LENGTH + 1, &dt)) {
+      return false;
+    }
+#endif
+  } else {
+    return false;
+  }
+  if (!IsValid(dt)) return false;
+
+  // The fractional seconds, padded to nanoseconds.
+  int64_t fraction = 0;
+  if (length > DATE_TIME_LENGTH) {
+    int num_digits = length - DATE_TIME_LENGTH - 1;
+    if (data[DATE_TIME_LENGTH] != '.' || num_digits < 1 ||
+        num_digits > MAX_FRACTION_DIGITS) {
+      return false;
+    }
+    const char* digits = data + DATE_TIME_LENGTH + 1;
+    for (int i = 0; i < MAX_FRACTION_DIGITS; ++i) {
+      int digit = 0;
+      if (i < num_digits) {
+        if (!IsDigit(digits[i])) return false;
+        digit = digits[i] - '0';
+      }
+      fraction = fraction * 10 + digit;
+    }
+  }
+
+  int64_t seconds = DaysSinceEpoch(dt.year, dt.month, dt.day) * 86400 +
+      dt.hour * 3600 + dt.minute * 60 + dt.second;
+  if (seconds < MIN_SECONDS || seconds > MAX_SECONDS) return false;
+  if (seconds == MAX_SECONDS && fraction > INT64_MAX % NANOS_PER_SECOND) return false;
+  // For MIN_SECONDS, adding a non-negative fraction can't overflow.
+  *nanos = seconds * NANOS_PER_SECOND + fraction;
+  return true;
+}
+
+} // namespace hs2client
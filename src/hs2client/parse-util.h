@@ -0,0 +1,59 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef HS2CLIENT_PARSE_UTIL_H
+#define HS2CLIENT_PARSE_UTIL_H
+
+#include <cstdint>
+#include <string>
+
+#include "hs2client/types.h"
+
+namespace hs2client {
+
+// Parses a timestamp in the format that Impala and Hive send TIMESTAMP values in,
+// 'YYYY-MM-DD HH:MM:SS[.fffffffff]', with 1 to 9 fractional digits, into nanoseconds
+// since the Unix epoch. A 'T' may separate the date and time, and a date on its own,
+// 'YYYY-MM-DD', is midnight. No time zone is applied. Returns false if 'data' is not a
+// valid timestamp, or is outside of the range of int64 nanoseconds, about the years 1677
+// to 2262.
+//
+// The date and time are parsed with SSE2 when it is available.
+bool ParseTimestamp(const char* data, int32_t length, int64_t* nanos);
+
+// Parses a DATE in the format 'YYYY-MM-DD' into the number of days since the Unix
+// epoch. Returns false if 'data' is not a valid date.
+bool ParseDate(const char* data, int32_t length, int32_t* days);
+
+// Parses a DECIMAL value in the format that HiveServer2 sends them in,
+// '[-]ddd[.fff]', into its unscaled value at 'scale', eg. "-1.5" at scale 2 is -150.
+// Fewer than 'scale' fractional digits are padded with zeros. Returns false if 'data'
+// is not a valid decimal, has more than 'scale' fractional digits, or has more than
+// MAX_DECIMAL_PRECISION significant digits.
+bool ParseDecimal(const char* data, int32_t length, int scale, int128_t* unscaled);
+
+// Formats an unscaled DECIMAL value at 'scale', eg. -150 at scale 2 is "-1.50".
+std::string FormatDecimal(int128_t unscaled, int scale);
+
+// Returns 10^exponent, for 'exponent' from 0 to MAX_DECIMAL_PRECISION.
+int128_t PowerOfTen(int exponent);
+
+// Returns the number of days between 1970-01-01 and the given date, which may be
+// negative. 'month' is 1-12. The date is not validated.
+int64_t DaysSinceEpoch(int64_t year, int month, int day);
+
+} // namespace hs2client
+
+#endif // HS2CLIENT_PARSE_UTIL_H
@@ -0,0 +1,188 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hs2client/pool.h"
+
+#include <atomic>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "hs2client/mock-server.h"
+#include "hs2client/test-util.h"
+
+using namespace hs2client;
+using namespace std;
+
+class PoolTest : public MockServerTestBase {
+ protected:
+  virtual void SetUp() {
+    spec_.num_rows = 10;
+    spec_.columns.emplace_back(ColumnType::TypeId::INT);
+    ASSERT_NO_FATAL_FAILURE(StartServer());
+
+    options_.host = "localhost";
+    options_.port = server_->port();
+    options_.user = "user";
+  }
+
+  PoolOptions options_;
+};
+
+TEST_F(PoolTest, TestSessionReuse) {
+  options_.min_size = 2;
+  options_.max_size = 2;
+  unique_ptr<SessionPool> pool;
+  EXPECT_OK(SessionPool::Create(options_, &pool));
+  EXPECT_EQ(pool->num_idle(), 2);
+  // Two OpenSession RPCs.
+  EXPECT_EQ(server_->num_rpcs(), 2);
+
+  for (int i = 0; i < 5; ++i) {
+    unique_ptr<PooledSession> session;
+    EXPECT_OK(pool->Acquire(&session));
+    EXPECT_EQ(pool->num_in_use(), 1);
+    unique_ptr<Operation> op;
+    EXPECT_OK(session->get()->ExecuteStatement("select 1", &op));
+    EXPECT_OK(op->Close());
+  }
+  EXPECT_EQ(pool->num_idle(), 2);
+  EXPECT_EQ(pool->num_in_use(), 0);
+  // A GetInfo to validate, ExecuteStatement and CloseOperation per iteration, with no
+  // new sessions opened.
+  EXPECT_EQ(server_->num_rpcs(), 2 + 5 * 3);
+
+  EXPECT_OK(pool->Close());
+  EXPECT_EQ(pool->num_idle(), 0);
+  unique_ptr<PooledSession> session;
+  EXPECT_ERROR(pool->Acquire(&session));
+}
+
+TEST_F(PoolTest, TestMaxSize) {
+  options_.max_size = 2;
+  options_.acquire_timeout_ms = 0;
+  unique_ptr<ServicePool> pool;
+  EXPECT_OK(ServicePool::Create(options_, &pool));
+  EXPECT_EQ(pool->num_idle(), 0);
+
+  unique_ptr<PooledService> service1;
+  unique_ptr<PooledService> service2;
+  unique_ptr<PooledService> service3;
+  EXPECT_OK(pool->Acquire(&service1));
+  EXPECT_OK(pool->Acquire(&service2));
+  EXPECT_TRUE(service1->get()->IsConnected());
+  EXPECT_ERROR(pool->Acquire(&service3));
+
+  // A released connection can be acquired again.
+  service1.reset();
+  EXPECT_OK(pool->Acquire(&service3));
+  EXPECT_OK(service3->get()->Ping());
+
+  // A discarded connection is closed and replaced.
+  service2->Discard();
+  service2.reset();
+  EXPECT_EQ(pool->num_idle(), 0);
+  EXPECT_OK(pool->Acquire(&service1));
+  service1.reset();
+  service3.reset();
+  EXPECT_EQ(pool->num_idle(), 2);
+}
+
+TEST_F(PoolTest, TestAcquireTimeout) {
+  options_.max_size = 1;
+  options_.acquire_timeout_ms = 50;
+  unique_ptr<SessionPool> pool;
+  EXPECT_OK(SessionPool::Create(options_, &pool));
+
+  unique_ptr<PooledSession> session1;
+  EXPECT_OK(pool->Acquire(&session1));
+  unique_ptr<PooledSession> session2;
+  EXPECT_ERROR(pool->Acquire(&session2));
+
+  // A waiter gets the session once it is released.
+  thread releaser([&session1]() {
+    this_thread::sleep_for(chrono::milliseconds(10));
+    session1.reset();
+  });
+  EXPECT_OK(pool->Acquire(&session2));
+  releaser.join();
+}
+
+TEST_F(PoolTest, TestIdleEviction) {
+  options_.min_size = 1;
+  options_.idle_timeout_ms = 20;
+  unique_ptr<SessionPool> pool;
+  EXPECT_OK(SessionPool::Create(options_, &pool));
+
+  {
+    unique_ptr<PooledSession> session1;
+    unique_ptr<PooledSession> session2;
+    EXPECT_OK(pool->Acquire(&session1));
+    EXPECT_OK(pool->Acquire(&session2));
+  }
+  EXPECT_EQ(pool->num_idle(), 2);
+
+  // Only the session above min_size is evicted.
+  this_thread::sleep_for(chrono::milliseconds(50));
+  unique_ptr<PooledSession> session;
+  EXPECT_OK(pool->Acquire(&session));
+  session.reset();
+  EXPECT_EQ(pool->num_idle(), 1);
+}
+
+TEST_F(PoolTest, TestResetStatements) {
+  options_.max_size = 1;
+  options_.validate_on_acquire = false;
+  options_.reset_statements.push_back("use default");
+  unique_ptr<SessionPool> pool;
+  EXPECT_OK(SessionPool::Create(options_, &pool));
+
+  unique_ptr<PooledSession> session;
+  EXPECT_OK(pool->Acquire(&session));
+  int64_t num_rpcs = server_->num_rpcs();
+  session.reset();
+  // ExecuteStatement and CloseOperation for the reset statement.
+  EXPECT_EQ(server_->num_rpcs(), num_rpcs + 2);
+  EXPECT_EQ(pool->num_idle(), 1);
+}
+
+TEST_F(PoolTest, TestConcurrentAcquire) {
+  options_.max_size = 4;
+  unique_ptr<SessionPool> pool;
+  EXPECT_OK(SessionPool::Create(options_, &pool));
+
+  atomic<int> num_ok(0);
+  vector<thread> threads;
+  for (int i = 0; i < 16; ++i) {
+    threads.emplace_back([&pool, &num_ok]() {
+      for (int j = 0; j < 10; ++j) {
+        unique_ptr<PooledSession> session;
+        if (!pool->Acquire(&session).ok()) return;
+        unique_ptr<Operation> op;
+        bool ok = session->get()->ExecuteStatement("select 1", &op).ok();
+        ok = op->Close().ok() && ok;
+        if (ok) ++num_ok;
+      }
+    });
+  }
+  for (thread& t : threads) t.join();
+  EXPECT_EQ(num_ok, 16 * 10);
+  EXPECT_LE(pool->num_idle(), 4);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
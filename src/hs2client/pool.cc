@@ -0,0 +1,350 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hs2client/pool.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "hs2client/logging.h"
+#include "hs2client/operation.h"
+
+using std::string;
+using std::unique_ptr;
+
+namespace hs2client {
+
+namespace internal {
+
+typedef std::chrono::steady_clock Clock;
+
+// A pooled connection, and for SessionPool a session opened through it.
+struct PoolEntry {
+  unique_ptr<Service> service;
+  unique_ptr<Session> session;
+
+  // When this entry was last returned to the pool.
+  Clock::time_point last_used;
+};
+
+// The implementation shared by ServicePool and SessionPool. Entries are opened outside
+// of 'lock_', and the number being opened is counted towards max_size.
+class PoolImpl {
+ public:
+  PoolImpl(const PoolOptions& options, bool with_sessions)
+    : options_(options), with_sessions_(with_sessions), num_in_use_(0),
+      num_opening_(0), closed_(false) {}
+
+  ~PoolImpl() {
+    Status status = Close();
+    if (!status.ok()) {
+      HS2CLIENT_LOG(WARNING) << "Failed to close pool: " << status.GetMessage();
+    }
+  }
+
+  Status Init() {
+    if (options_.min_size < 0 || options_.max_size < 1 ||
+        options_.min_size > options_.max_size) {
+      return Status::Error("Invalid pool size");
+    }
+    for (int i = 0; i < options_.min_size; ++i) {
+      unique_ptr<PoolEntry> entry;
+      HS2CLIENT_RETURN_IF_ERROR(OpenEntry(&entry));
+      entry->last_used = Clock::now();
+      std::lock_guard<std::mutex> l(lock_);
+      idle_.push_back(std::move(entry));
+    }
+    return Status::OK();
+  }
+
+  Status Acquire(unique_ptr<PoolEntry>* out) {
+    Clock::time_point deadline =
+        Clock::now() + std::chrono::milliseconds(options_.acquire_timeout_ms);
+    std::unique_lock<std::mutex> l(lock_);
+    while (true) {
+      if (closed_) return Status::Error("Pool is closed");
+
+      std::vector<unique_ptr<PoolEntry>> evicted;
+      EvictIdle(&evicted);
+      if (!evicted.empty()) {
+        l.unlock();
+        CloseEntries(&evicted);
+        l.lock();
+        continue;
+      }
+
+      if (!idle_.empty()) {
+        // Reuse the most recently used entry, so that the oldest ones can be evicted.
+        unique_ptr<PoolEntry> entry = std::move(idle_.back());
+        idle_.pop_back();
+        ++num_in_use_;
+        l.unlock();
+        if (!options_.validate_on_acquire || Validate(entry.get()).ok()) {
+          *out = std::move(entry);
+          return Status::OK();
+        }
+        CloseEntry(entry.get());
+        l.lock();
+        --num_in_use_;
+        continue;
+      }
+
+      if (num_in_use_ + num_opening_ < options_.max_size) {
+        ++num_opening_;
+        l.unlock();
+        unique_ptr<PoolEntry> entry;
+        Status status = OpenEntry(&entry);
+        l.lock();
+        --num_opening_;
+        if (!status.ok()) {
+          // Let another waiter try to open an entry.
+          available_cv_.notify_one();
+          return status;
+        }
+        ++num_in_use_;
+        *out = std::move(entry);
+        return Status::OK();
+      }
+
+      if (options_.acquire_timeout_ms == 0) {
+        return Status::Error("All pooled connections are in use");
+      } else if (options_.acquire_timeout_ms < 0) {
+        available_cv_.wait(l);
+      } else if (available_cv_.wait_until(l, deadline) == std::cv_status::timeout) {
+        return Status::Error("Timed out waiting for a pooled connection");
+      }
+    }
+  }
+
+  void Release(unique_ptr<PoolEntry> entry, bool discard) {
+    if (!discard) discard = !Reset(entry.get()).ok();
+
+    std::vector<unique_ptr<PoolEntry>> to_close;
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      --num_in_use_;
+      if (discard || closed_) {
+        to_close.push_back(std::move(entry));
+      } else {
+        entry->last_used = Clock::now();
+        idle_.push_back(std::move(entry));
+      }
+      EvictIdle(&to_close);
+      available_cv_.notify_one();
+    }
+    CloseEntries(&to_close);
+  }
+
+  Status Close() {
+    std::vector<unique_ptr<PoolEntry>> to_close;
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      closed_ = true;
+      while (!idle_.empty()) {
+        to_close.push_back(std::move(idle_.front()));
+        idle_.pop_front();
+      }
+      available_cv_.notify_all();
+    }
+    return CloseEntries(&to_close);
+  }
+
+  int num_idle() const {
+    std::lock_guard<std::mutex> l(lock_);
+    return idle_.size();
+  }
+
+  int num_in_use() const {
+    std::lock_guard<std::mutex> l(lock_);
+    return num_in_use_;
+  }
+
+ private:
+  Status OpenEntry(unique_ptr<PoolEntry>* out) {
+    unique_ptr<PoolEntry> entry(new PoolEntry());
+    Status status = Service::Connect(options_.host, options_.port, options_.conn_timeout,
+        options_.protocol_version, options_.connection_options, &entry->service);
+    if (status.ok() && with_sessions_) {
+      status = entry->service->OpenSession(options_.user, options_.session_config,
+          &entry->session);
+    }
+    if (!status.ok()) {
+      CloseEntry(entry.get());
+      return status;
+    }
+    *out = std::move(entry);
+    return Status::OK();
+  }
+
+  Status Validate(PoolEntry* entry) {
+    if (!entry->service->IsConnected()) return Status::Error("Not connected");
+    return with_sessions_ ? entry->session->Ping() : entry->service->Ping();
+  }
+
+  // Runs the reset statements on a released session.
+  Status Reset(PoolEntry* entry) {
+    if (!with_sessions_) return Status::OK();
+    for (const string& statement : options_.reset_statements) {
+      unique_ptr<Operation> op;
+      Status status = entry->session->ExecuteStatement(statement, &op);
+      Status close_status = op->Close();
+      HS2CLIENT_RETURN_IF_ERROR(status);
+      HS2CLIENT_RETURN_IF_ERROR(close_status);
+    }
+    return Status::OK();
+  }
+
+  // Moves idle entries that have exceeded the idle timeout into 'evicted', oldest
+  // first, while more than min_size entries are open. 'lock_' must be held.
+  void EvictIdle(std::vector<unique_ptr<PoolEntry>>* evicted) {
+    Clock::time_point cutoff =
+        Clock::now() - std::chrono::milliseconds(options_.idle_timeout_ms);
+    while (!idle_.empty() && idle_.front()->last_used < cutoff &&
+        static_cast<int>(idle_.size()) + num_in_use_ > options_.min_size) {
+      evicted->push_back(std::move(idle_.front()));
+      idle_.pop_front();
+    }
+  }
+
+  Status CloseEntry(PoolEntry* entry) {
+    Status status = Status::OK();
+    if (entry->session) status = entry->session->Close();
+    if (entry->service) {
+      Status service_status = entry->service->Close();
+      if (status.ok()) status = service_status;
+    }
+    return status;
+  }
+
+  // Closes all of 'entries', returning the first error.
+  Status CloseEntries(std::vector<unique_ptr<PoolEntry>>* entries) {
+    Status status = Status::OK();
+    for (unique_ptr<PoolEntry>& entry : *entries) {
+      Status entry_status = CloseEntry(entry.get());
+      if (status.ok()) status = entry_status;
+    }
+    entries->clear();
+    return status;
+  }
+
+  const PoolOptions options_;
+  const bool with_sessions_;
+
+  // Protects all of the following members.
+  mutable std::mutex lock_;
+  // Signaled when an entry is released or may be opened.
+  std::condition_variable available_cv_;
+  // Ordered by last_used.
+  std::deque<unique_ptr<PoolEntry>> idle_;
+  int num_in_use_;
+  int num_opening_;
+  bool closed_;
+};
+
+} // namespace internal
+
+using internal::PoolEntry;
+using internal::PoolImpl;
+
+PooledService::PooledService(const std::shared_ptr<PoolImpl>& pool,
+    unique_ptr<PoolEntry> entry)
+  : pool_(pool), entry_(std::move(entry)), discard_(false) {}
+
+PooledService::~PooledService() {
+  pool_->Release(std::move(entry_), discard_);
+}
+
+Service* PooledService::get() const {
+  return entry_->service.get();
+}
+
+PooledSession::PooledSession(const std::shared_ptr<PoolImpl>& pool,
+    unique_ptr<PoolEntry> entry)
+  : pool_(pool), entry_(std::move(entry)), discard_(false) {}
+
+PooledSession::~PooledSession() {
+  pool_->Release(std::move(entry_), discard_);
+}
+
+Session* PooledSession::get() const {
+  return entry_->session.get();
+}
+
+ServicePool::ServicePool(const std::shared_ptr<PoolImpl>& impl) : impl_(impl) {}
+
+ServicePool::~ServicePool() {
+  Close();
+}
+
+Status ServicePool::Create(const PoolOptions& options, unique_ptr<ServicePool>* pool) {
+  std::shared_ptr<PoolImpl> impl(new PoolImpl(options, false));
+  HS2CLIENT_RETURN_IF_ERROR(impl->Init());
+  pool->reset(new ServicePool(impl));
+  return Status::OK();
+}
+
+Status ServicePool::Acquire(unique_ptr<PooledService>* service) {
+  unique_ptr<PoolEntry> entry;
+  HS2CLIENT_RETURN_IF_ERROR(impl_->Acquire(&entry));
+  service->reset(new PooledService(impl_, std::move(entry)));
+  return Status::OK();
+}
+
+Status ServicePool::Close() {
+  return impl_->Close();
+}
+
+int ServicePool::num_idle() const {
+  return impl_->num_idle();
+}
+
+int ServicePool::num_in_use() const {
+  return impl_->num_in_use();
+}
+
+SessionPool::SessionPool(const std::shared_ptr<PoolImpl>& impl) : impl_(impl) {}
+
+SessionPool::~SessionPool() {
+  Close();
+}
+
+Status SessionPool::Create(const PoolOptions& options, unique_ptr<SessionPool>* pool) {
+  std::shared_ptr<PoolImpl> impl(new PoolImpl(options, true));
+  HS2CLIENT_RETURN_IF_ERROR(impl->Init());
+  pool->reset(new SessionPool(impl));
+  return Status::OK();
+}
+
+Status SessionPool::Acquire(unique_ptr<PooledSession>* session) {
+  unique_ptr<PoolEntry> entry;
+  HS2CLIENT_RETURN_IF_ERROR(impl_->Acquire(&entry));
+  session->reset(new PooledSession(impl_, std::move(entry)));
+  return Status::OK();
+}
+
+Status SessionPool::Close() {
+  return impl_->Close();
+}
+
+int SessionPool::num_idle() const {
+  return impl_->num_idle();
+}
+
+int SessionPool::num_in_use() const {
+  return impl_->num_in_use();
+}
+
+} // namespace hs2client
@@ -0,0 +1,218 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HS2CLIENT_POOL_H
+#define HS2CLIENT_POOL_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hs2client/macros.h"
+#include "hs2client/service.h"
+#include "hs2client/session.h"
+#include "hs2client/status.h"
+
+namespace hs2client {
+
+namespace internal {
+class PoolImpl;
+struct PoolEntry;
+}
+
+struct PoolOptions {
+  PoolOptions()
+    : port(21050), conn_timeout(0),
+      protocol_version(ProtocolVersion::HS2CLIENT_PROTOCOL_V7), min_size(0),
+      max_size(8), idle_timeout_ms(60000), acquire_timeout_ms(-1),
+      validate_on_acquire(true) {}
+
+  // Passed to Service::Connect.
+  std::string host;
+  int port;
+  int conn_timeout;
+  ProtocolVersion protocol_version;
+  ConnectionOptions connection_options;
+
+  // Passed to Service::OpenSession. Only used by SessionPool.
+  std::string user;
+  HS2ClientConfig session_config;
+
+  // The number of connections that are opened when the pool is created, and below
+  // which idle connections are not evicted.
+  int min_size;
+
+  // The maximum number of connections, idle or in use.
+  int max_size;
+
+  // Idle connections above min_size are closed once they have been idle for this long.
+  // Eviction happens lazily, when connections are acquired or released.
+  int idle_timeout_ms;
+
+  // How long Acquire waits for a connection to be released once max_size are in use.
+  // 0 fails immediately, negative values wait indefinitely.
+  int acquire_timeout_ms;
+
+  // If true, idle connections are validated with a cheap RPC before being handed out,
+  // and replaced if the RPC fails.
+  bool validate_on_acquire;
+
+  // Statements executed when a session is released, to reset any state that the
+  // user changed, eg. "use default". If any of them fail, the session is closed rather
+  // than returned to the pool. Only used by SessionPool.
+  std::vector<std::string> reset_statements;
+};
+
+// A Service checked out from a ServicePool. Returned to the pool when destroyed.
+// Any Sessions opened through it must be closed first.
+class PooledService {
+ public:
+  ~PooledService();
+
+  Service* get() const;
+  Service* operator->() const { return get(); }
+
+  // Closes the connection when this is destroyed instead of returning it to the pool,
+  // eg. because an RPC failed.
+  void Discard() { discard_ = true; }
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(PooledService);
+
+  // For access to the c'tor.
+  friend class ServicePool;
+
+  PooledService(const std::shared_ptr<internal::PoolImpl>& pool,
+      std::unique_ptr<internal::PoolEntry> entry);
+
+  std::shared_ptr<internal::PoolImpl> pool_;
+  std::unique_ptr<internal::PoolEntry> entry_;
+  bool discard_;
+};
+
+// A Session checked out from a SessionPool. Returned to the pool when destroyed, after
+// running PoolOptions::reset_statements. Any Operations executed through it must be
+// closed first.
+class PooledSession {
+ public:
+  ~PooledSession();
+
+  Session* get() const;
+  Session* operator->() const { return get(); }
+
+  // Closes the session and its connection when this is destroyed instead of returning
+  // them to the pool, eg. because an RPC failed.
+  void Discard() { discard_ = true; }
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(PooledSession);
+
+  // For access to the c'tor.
+  friend class SessionPool;
+
+  PooledSession(const std::shared_ptr<internal::PoolImpl>& pool,
+      std::unique_ptr<internal::PoolEntry> entry);
+
+  std::shared_ptr<internal::PoolImpl> pool_;
+  std::unique_ptr<internal::PoolEntry> entry_;
+  bool discard_;
+};
+
+// Keeps a pool of open connections to a HiveServer2 server, to avoid the cost of
+// connecting for every unit of work. Connections are validated with Service::Ping
+// before being handed out.
+//
+// Example:
+// PoolOptions options;
+// options.host = "localhost";
+// unique_ptr<ServicePool> pool;
+// HS2CLIENT_RETURN_IF_ERROR(ServicePool::Create(options, &pool));
+// unique_ptr<PooledService> service;
+// HS2CLIENT_RETURN_IF_ERROR(pool->Acquire(&service));
+// service->get()->OpenSession(...);
+//
+// This class is thread-safe. PooledServices may outlive the pool, in which case they
+// are closed when destroyed.
+class ServicePool {
+ public:
+  // Creates a pool and opens options.min_size connections.
+  static Status Create(const PoolOptions& options, std::unique_ptr<ServicePool>* pool);
+
+  // Closes all idle connections.
+  ~ServicePool();
+
+  // Checks out a connection, opening a new one if none are idle and fewer than
+  // max_size are open. Otherwise waits up to acquire_timeout_ms for one to be released.
+  Status Acquire(std::unique_ptr<PooledService>* service);
+
+  // Closes all idle connections. Connections that are in use are closed when they are
+  // released, and Acquire fails from now on.
+  Status Close();
+
+  int num_idle() const;
+  int num_in_use() const;
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(ServicePool);
+
+  explicit ServicePool(const std::shared_ptr<internal::PoolImpl>& impl);
+
+  std::shared_ptr<internal::PoolImpl> impl_;
+};
+
+// Keeps a pool of open sessions, each with its own connection, to avoid the cost of
+// connecting and calling OpenSession for every unit of work. Sessions are validated
+// with Session::Ping before being handed out, and reset with
+// PoolOptions::reset_statements when they are released.
+//
+// Example:
+// unique_ptr<SessionPool> pool;
+// HS2CLIENT_RETURN_IF_ERROR(SessionPool::Create(options, &pool));
+// unique_ptr<PooledSession> session;
+// HS2CLIENT_RETURN_IF_ERROR(pool->Acquire(&session));
+// unique_ptr<Operation> op;
+// session->get()->ExecuteStatement("select 1", &op);
+//
+// This class is thread-safe. PooledSessions may outlive the pool, in which case they
+// are closed when destroyed.
+class SessionPool {
+ public:
+  // Creates a pool and opens options.min_size sessions.
+  static Status Create(const PoolOptions& options, std::unique_ptr<SessionPool>* pool);
+
+  // Closes all idle sessions.
+  ~SessionPool();
+
+  // Checks out a session, opening a new one if none are idle and fewer than max_size
+  // are open. Otherwise waits up to acquire_timeout_ms for one to be released.
+  Status Acquire(std::unique_ptr<PooledSession>* session);
+
+  // Closes all idle sessions. Sessions that are in use are closed when they are
+  // released, and Acquire fails from now on.
+  Status Close();
+
+  int num_idle() const;
+  int num_in_use() const;
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(SessionPool);
+
+  explicit SessionPool(const std::shared_ptr<internal::PoolImpl>& impl);
+
+  std::shared_ptr<internal::PoolImpl> impl_;
+};
+
+} // namespace hs2client
+
+#endif // HS2CLIENT_POOL_H
@@ -0,0 +1,89 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hs2client/result-stream.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+#include "hs2client/mock-server.h"
+#include "hs2client/service.h"
+#include "hs2client/session.h"
+#include "hs2client/test-util.h"
+
+using namespace hs2client;
+using namespace std;
+
+class ResultStreamTest : public MockSessionTestBase {
+ protected:
+  virtual void SetUp() {
+    spec_.num_rows = 2500;
+    spec_.columns.emplace_back(ColumnType::TypeId::BIGINT, 0.1);
+    spec_.columns.emplace_back(ColumnType::TypeId::STRING, 0.1);
+    ASSERT_NO_FATAL_FAILURE(StartAndConnect());
+  }
+
+  // Returns the values of the BIGINT column, fetched without a ResultStream.
+  vector<int64_t> FetchAll() {
+    vector<int64_t> values;
+    unique_ptr<Operation> op;
+    EXPECT_OK(session_->ExecuteStatement("select * from mock", &op));
+    bool has_more_rows = true;
+    while (has_more_rows) {
+      unique_ptr<ColumnarRowSet> results;
+      EXPECT_OK(op->Fetch(&results, &has_more_rows));
+      const vector<int64_t>& data = results->GetInt64Col(0)->data();
+      values.insert(values.end(), data.begin(), data.end());
+    }
+    EXPECT_OK(op->Close());
+    return values;
+  }
+};
+
+TEST_F(ResultStreamTest, TestChunks) {
+  vector<int64_t> expected = FetchAll();
+  ASSERT_EQ(expected.size(), 2500);
+
+  unique_ptr<Operation> op;
+  EXPECT_OK(session_->ExecuteStatement("select * from mock", &op));
+  ResultStream stream(op.get(), 1000, 300);
+
+  vector<int64_t> chunk_sizes;
+  vector<int64_t> values;
+  bool end_of_chunk = false;
+  bool eos = false;
+  while (!eos) {
+    unique_ptr<ColumnarRowSet> batch;
+    ASSERT_TRUE(stream.Next(&batch, &end_of_chunk, &eos).ok());
+    EXPECT_LE(batch->num_rows(), 300);
+    EXPECT_EQ(batch->num_rows(), batch->GetStringViewCol(1)->length());
+    EXPECT_LE(stream.chunk_rows(), stream.chunk_size());
+    const vector<int64_t>& data = batch->GetInt64Col(0)->data();
+    values.insert(values.end(), data.begin(), data.end());
+    if (end_of_chunk) chunk_sizes.push_back(stream.chunk_rows());
+  }
+  EXPECT_EQ(chunk_sizes, vector<int64_t>({1000, 1000, 500}));
+  EXPECT_EQ(stream.num_rows(), 2500);
+  EXPECT_EQ(values, expected);
+
+  unique_ptr<ColumnarRowSet> batch;
+  EXPECT_ERROR(stream.Next(&batch, &end_of_chunk, &eos));
+  EXPECT_OK(op->Close());
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,56 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hs2client/result-stream.h"
+
+#include <algorithm>
+
+#include "hs2client/logging.h"
+
+using std::unique_ptr;
+
+namespace hs2client {
+
+ResultStream::ResultStream(const Operation* op, int64_t chunk_size, int max_batch_rows)
+  : op_(op), chunk_size_(chunk_size), max_batch_rows_(max_batch_rows), chunk_rows_(0),
+    num_rows_(0), end_of_chunk_(false), eos_(false) {
+  DCHECK_GT(chunk_size, 0);
+  DCHECK_GT(max_batch_rows, 0);
+}
+
+Status ResultStream::Next(unique_ptr<ColumnarRowSet>* batch, bool* end_of_chunk,
+    bool* eos) {
+  if (eos_) return Status::Error("ResultStream has no more results");
+  if (end_of_chunk_) {
+    chunk_rows_ = 0;
+    end_of_chunk_ = false;
+  }
+
+  int max_rows = std::min<int64_t>(max_batch_rows_, chunk_size_ - chunk_rows_);
+  bool has_more_rows;
+  HS2CLIENT_RETURN_IF_ERROR(op_->Fetch(max_rows, FetchOrientation::NEXT, batch,
+      &has_more_rows));
+
+  int64_t batch_rows = (*batch)->num_rows();
+  chunk_rows_ += batch_rows;
+  num_rows_ += batch_rows;
+  eos_ = !has_more_rows;
+  end_of_chunk_ = eos_ || chunk_rows_ >= chunk_size_;
+
+  *end_of_chunk = end_of_chunk_;
+  *eos = eos_;
+  return Status::OK();
+}
+
+} // namespace hs2client
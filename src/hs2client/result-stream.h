@@ -0,0 +1,80 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HS2CLIENT_RESULT_STREAM_H
+#define HS2CLIENT_RESULT_STREAM_H
+
+#include <cstdint>
+#include <memory>
+
+#include "hs2client/columnar-row-set.h"
+#include "hs2client/macros.h"
+#include "hs2client/operation.h"
+#include "hs2client/status.h"
+
+namespace hs2client {
+
+// Fetches the results of an operation as a stream of batches that are grouped into
+// chunks of 'chunk_size' rows. No batch spans two chunks: the number of rows requested
+// by each fetch is capped at the number remaining in the current chunk. This lets a
+// caller convert each batch into preallocated per-chunk output as soon as it arrives and
+// free it before fetching the next, so that only one batch of results is held at once.
+//
+// Example:
+// ResultStream stream(op.get(), 100000);
+// bool end_of_chunk, eos = false;
+// while (!eos) {
+//   unique_ptr<ColumnarRowSet> batch;
+//   HS2CLIENT_RETURN_IF_ERROR(stream.Next(&batch, &end_of_chunk, &eos));
+//   // append batch to the current chunk
+//   if (end_of_chunk) // emit the chunk
+// }
+//
+// This class is not thread-safe.
+class ResultStream {
+ public:
+  // 'op' must outlive the stream. Each fetch requests at most 'max_batch_rows' rows.
+  ResultStream(const Operation* op, int64_t chunk_size, int max_batch_rows = 1024);
+
+  // Fetches the next batch. Sets 'end_of_chunk' if the batch completes the current
+  // chunk, in which case the next batch starts a new one, and 'eos' if there are no more
+  // results. The last chunk may be shorter than chunk_size, and ends with the batch that
+  // sets 'eos', which may be empty. Must not be called again once 'eos' has been set.
+  Status Next(std::unique_ptr<ColumnarRowSet>* batch, bool* end_of_chunk, bool* eos);
+
+  int64_t chunk_size() const { return chunk_size_; }
+
+  // The number of rows in the current chunk so far. Reset to 0 by the call to Next that
+  // follows the end of a chunk.
+  int64_t chunk_rows() const { return chunk_rows_; }
+
+  // The total number of rows fetched.
+  int64_t num_rows() const { return num_rows_; }
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(ResultStream);
+
+  const Operation* op_;
+  const int64_t chunk_size_;
+  const int max_batch_rows_;
+
+  int64_t chunk_rows_;
+  int64_t num_rows_;
+  bool end_of_chunk_;
+  bool eos_;
+};
+
+} // namespace hs2client
+
+#endif // HS2CLIENT_RESULT_STREAM_H
@@ -14,9 +14,16 @@
 
 #include "hs2client/service.h"
 
+#include <atomic>
+#include <cstdio>
 #include <gtest/gtest.h>
 #include <memory>
+#include <thread>
+#include <vector>
 
+#include "hs2client/capture.h"
+#include "hs2client/mock-server.h"
+#include "hs2client/operation.h"
 #include "hs2client/session.h"
 #include "hs2client/test-util.h"
 
@@ -74,6 +81,174 @@ TEST(ServiceTest, TestFailedConnect) {
       &service));
 }
 
+TEST(ServiceTest, TestConcurrentRPCs) {
+  MockResultSpec spec;
+  spec.num_rows = 3000;
+  spec.columns.emplace_back(ColumnType::TypeId::BIGINT);
+  spec.columns.emplace_back(ColumnType::TypeId::STRING, 0.1);
+  MockServer server(MockServerOptions(), spec);
+  ASSERT_OK(server.Start());
+
+  unique_ptr<Service> service;
+  EXPECT_OK(Service::Connect("localhost", server.port(), 0,
+      ProtocolVersion::HS2CLIENT_PROTOCOL_V7, &service));
+  unique_ptr<Session> session;
+  EXPECT_OK(service->OpenSession("user", HS2ClientConfig(), &session));
+
+  // Many threads running operations through one connection.
+  const int num_threads = 8;
+  atomic<int> num_ok(0);
+  vector<thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&session, &num_ok]() {
+      unique_ptr<Operation> op;
+      if (!session->ExecuteStatement("select * from mock", &op).ok()) return;
+      bool ok = true;
+      int64_t num_rows = 0;
+      bool has_more_rows = true;
+      while (ok && has_more_rows) {
+        Operation::State state;
+        ok = op->GetState(&state).ok() && state == Operation::State::FINISHED;
+        unique_ptr<ColumnarRowSet> results;
+        ok = ok && op->Fetch(500, FetchOrientation::NEXT, &results,
+            &has_more_rows).ok();
+        if (ok) num_rows += results->GetInt64Col(0)->length();
+      }
+      ok = ok && num_rows == 3000 && session->Ping().ok();
+      ok = op->Close().ok() && ok;
+      if (ok) ++num_ok;
+    });
+  }
+  for (thread& t : threads) t.join();
+  EXPECT_EQ(num_ok, num_threads);
+
+  EXPECT_OK(session->Close());
+  EXPECT_OK(service->Close());
+  EXPECT_OK(server.Stop());
+}
+
+TEST(ServiceTest, TestMetrics) {
+  MockResultSpec spec;
+  spec.num_rows = 2500;
+  spec.columns.emplace_back(ColumnType::TypeId::BIGINT);
+  MockServer server(MockServerOptions(), spec);
+  ASSERT_OK(server.Start());
+
+  unique_ptr<Service> service;
+  EXPECT_OK(Service::Connect("localhost", server.port(), 0,
+      ProtocolVersion::HS2CLIENT_PROTOCOL_V7, &service));
+  ServiceMetrics metrics = service->GetMetrics();
+  EXPECT_EQ(metrics.bytes_written, 0);
+
+  unique_ptr<Session> session;
+  EXPECT_OK(service->OpenSession("user", HS2ClientConfig(), &session));
+  unique_ptr<Operation> op;
+  EXPECT_OK(session->ExecuteStatement("select * from mock", &op));
+  int num_fetches = 0;
+  bool has_more_rows = true;
+  while (has_more_rows) {
+    unique_ptr<ColumnarRowSet> results;
+    EXPECT_OK(op->Fetch(1000, FetchOrientation::NEXT, &results, &has_more_rows));
+    ++num_fetches;
+  }
+  EXPECT_OK(op->Close());
+  EXPECT_OK(session->Close());
+
+  metrics = service->GetMetrics();
+  EXPECT_EQ(metrics.rpc(RpcMethod::OPEN_SESSION).count, 1);
+  EXPECT_EQ(metrics.rpc(RpcMethod::EXECUTE_STATEMENT).count, 1);
+  EXPECT_EQ(metrics.rpc(RpcMethod::FETCH_RESULTS).count, num_fetches);
+  EXPECT_EQ(metrics.rpc(RpcMethod::FETCH_RESULTS).latency.count, num_fetches);
+  EXPECT_EQ(metrics.rpc(RpcMethod::FETCH_RESULTS).num_errors, 0);
+  EXPECT_EQ(metrics.rpc(RpcMethod::CLOSE_OPERATION).count, 1);
+  EXPECT_EQ(metrics.rpc(RpcMethod::CLOSE_SESSION).count, 1);
+  EXPECT_EQ(metrics.rpc(RpcMethod::CANCEL_OPERATION).count, 0);
+  EXPECT_EQ(metrics.rows_fetched, spec.num_rows);
+  // At least 8 bytes per BIGINT value.
+  EXPECT_GT(metrics.bytes_read, 8 * spec.num_rows);
+  EXPECT_GT(metrics.bytes_written, 0);
+
+  // A failed RPC is counted as an error.
+  EXPECT_OK(service->Close());
+  EXPECT_ERROR(service->Ping());
+  metrics = service->GetMetrics();
+  EXPECT_EQ(metrics.rpc(RpcMethod::GET_INFO).count, 1);
+  EXPECT_EQ(metrics.rpc(RpcMethod::GET_INFO).num_errors, 1);
+  EXPECT_OK(server.Stop());
+}
+
+TEST(ServiceTest, TestConnectionOptions) {
+  MockResultSpec spec;
+  spec.num_rows = 2000;
+  spec.columns.emplace_back(ColumnType::TypeId::BIGINT, 0.1);
+  spec.columns.emplace_back(ColumnType::TypeId::STRING, 0.1, 100);
+  const string capture_path = "/tmp/hs2client-service-test.cap";
+
+  for (TransportType transport : {TransportType::BUFFERED, TransportType::FRAMED}) {
+    for (WireProtocol protocol : {WireProtocol::BINARY, WireProtocol::COMPACT}) {
+      MockServerOptions server_options;
+      server_options.transport = transport;
+      server_options.protocol = protocol;
+      MockServer server(server_options, spec);
+      ASSERT_OK(server.Start());
+
+      // Small buffers, so that messages span many reads and writes.
+      ConnectionOptions options;
+      options.transport = transport;
+      options.protocol = protocol;
+      options.read_buffer_size = 100;
+      options.write_buffer_size = 10;
+      options.tcp_nodelay = false;
+      options.socket_recv_buffer_size = 1024 * 1024;
+      options.socket_send_buffer_size = 64 * 1024;
+      unique_ptr<Service> service;
+      EXPECT_OK(Service::Connect("localhost", server.port(), 0,
+          ProtocolVersion::HS2CLIENT_PROTOCOL_V7, options, &service));
+      unique_ptr<Session> session;
+      EXPECT_OK(service->OpenSession("user", HS2ClientConfig(), &session));
+
+      // Capture files record the protocol, so they replay with either.
+      EXPECT_OK(service->StartCapture(capture_path));
+      unique_ptr<Operation> op;
+      EXPECT_OK(session->ExecuteStatement("select * from mock", &op));
+      int64_t num_rows = 0;
+      bool has_more_rows = true;
+      while (has_more_rows) {
+        unique_ptr<ColumnarRowSet> results;
+        ASSERT_TRUE(op->Fetch(1000, FetchOrientation::NEXT, &results,
+            &has_more_rows).ok());
+        num_rows += results->GetStringViewCol(1)->length();
+      }
+      EXPECT_EQ(num_rows, spec.num_rows);
+      EXPECT_OK(op->Close());
+      EXPECT_OK(service->StopCapture());
+
+      unique_ptr<FetchReplay> replay;
+      EXPECT_OK(FetchReplay::Open(capture_path, &replay));
+      int64_t num_replayed_rows = 0;
+      bool eos = false;
+      while (true) {
+        unique_ptr<ColumnarRowSet> results;
+        ASSERT_TRUE(replay->Next(&results, &has_more_rows, &eos).ok());
+        if (eos) break;
+        num_replayed_rows += results->GetInt64Col(0)->length();
+      }
+      EXPECT_EQ(num_replayed_rows, spec.num_rows);
+      remove(capture_path.c_str());
+
+      EXPECT_OK(session->Close());
+      EXPECT_OK(service->Close());
+      EXPECT_OK(server.Stop());
+    }
+  }
+
+  ConnectionOptions invalid_options;
+  invalid_options.read_buffer_size = 0;
+  unique_ptr<Service> service;
+  EXPECT_ERROR(Service::Connect("localhost", 21050, 0,
+      ProtocolVersion::HS2CLIENT_PROTOCOL_V7, invalid_options, &service));
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
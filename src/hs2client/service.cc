@@ -15,7 +15,7 @@
 #include "hs2client/service.h"
 
 #include <sstream>
-#include <thrift/protocol/TBinaryProtocol.h>
+#include <sys/socket.h>
 #include <thrift/transport/TSocket.h>
 #include <thrift/transport/TTransportUtils.h>
 
@@ -29,9 +29,9 @@
 namespace hs2 = apache::hive::service::cli::thrift;
 
 using apache::thrift::TException;
-using apache::thrift::protocol::TBinaryProtocol;
 using apache::thrift::protocol::TProtocol;
 using apache::thrift::transport::TBufferedTransport;
+using apache::thrift::transport::TFramedTransport;
 using apache::thrift::transport::TSocket;
 using apache::thrift::transport::TTransport;
 using std::string;
@@ -42,14 +42,35 @@ namespace hs2client {
 struct Service::ServiceImpl {
   hs2::TProtocolVersion::type protocol_version;
   // The use of boost here is required for Thrift compatibility.
+  WireProtocol wire_protocol;
   boost::shared_ptr<TSocket> socket;
+  // Wraps 'socket', and is wrapped by 'transport'.
+  boost::shared_ptr<CountingTransport> counting_transport;
   boost::shared_ptr<TTransport> transport;
   boost::shared_ptr<TProtocol> protocol;
+
+  // Non-null iff capturing. Wraps 'transport'.
+  boost::shared_ptr<CaptureTransport> capture_transport;
+
+  // Creates a new protocol and client over 'client_transport', which is either
+  // 'transport' or 'capture_transport'.
+  void ResetClient(const boost::shared_ptr<TTransport>& client_transport,
+      ThriftRPC* rpc) {
+    protocol = NewProtocol(wire_protocol, client_transport);
+    rpc->client.reset(new impala::ImpalaHiveServer2ServiceClient(protocol));
+  }
 };
 
 Status Service::Connect(const string& host, int port, int conn_timeout,
     ProtocolVersion protocol_version, unique_ptr<Service>* service) {
-  service->reset(new Service(host, port, conn_timeout, protocol_version));
+  return Connect(host, port, conn_timeout, protocol_version, ConnectionOptions(),
+      service);
+}
+
+Status Service::Connect(const string& host, int port, int conn_timeout,
+    ProtocolVersion protocol_version, const ConnectionOptions& options,
+    unique_ptr<Service>* service) {
+  service->reset(new Service(host, port, conn_timeout, protocol_version, options));
   return (*service)->Open();
 }
 
@@ -58,9 +79,14 @@ Service::~Service() {
 }
 
 Status Service::Close() {
-  if (!IsConnected()) return Status::OK();
+  // Anything queued by CloseAsync is sent before the connection is closed.
+  rpc_->StopReaper();
+  Status capture_status = StopCapture();
+  if (!IsConnected()) return capture_status;
+  std::lock_guard<std::mutex> l(rpc_->lock);
+  if (!rpc_->deferred_rpcs.empty()) FlushDeferredRpcs(rpc_.get());
   TRY_RPC_OR_RETURN(impl_->transport->close());
-  return Status::OK();
+  return capture_status;
 }
 
 bool Service::IsConnected() const {
@@ -81,11 +107,55 @@ Status Service::OpenSession(const string& user, const HS2ClientConfig& config,
   return (*session)->Open(config, user);
 }
 
+Status Service::Ping() const {
+  // GetInfo requires a session, so the server replies with an error status for the
+  // empty handle. Any reply shows that the connection works.
+  hs2::TGetInfoReq req;
+  req.__set_infoType(hs2::TGetInfoType::CLI_SERVER_NAME);
+  hs2::TGetInfoResp resp;
+  TRY_LOCKED_RPC_OR_RETURN(rpc_, RpcMethod::GET_INFO, NULL, NULL,
+      rpc_->client->GetInfo(resp, req), resp.status);
+  return Status::OK();
+}
+
+Status Service::StartCapture(const string& path) {
+  if (impl_->capture_transport) return Status::Error("Already capturing");
+  if (!impl_->transport) return Status::Error("Service is not open");
+  HS2CLIENT_RETURN_IF_ERROR(CaptureTransport::Create(impl_->transport,
+      impl_->wire_protocol, path, &impl_->capture_transport));
+  std::lock_guard<std::mutex> l(rpc_->lock);
+  impl_->ResetClient(impl_->capture_transport, rpc_.get());
+  return Status::OK();
+}
+
+void Service::SetTracer(const std::shared_ptr<Tracer>& tracer) {
+  std::lock_guard<std::mutex> l(rpc_->lock);
+  rpc_->tracer = tracer;
+}
+
+ServiceMetrics Service::GetMetrics() const {
+  ServiceMetrics metrics;
+  rpc_->metrics.Snapshot(&metrics);
+  return metrics;
+}
+
+Status Service::StopCapture() {
+  if (!impl_->capture_transport) return Status::OK();
+  {
+    std::lock_guard<std::mutex> l(rpc_->lock);
+    impl_->ResetClient(impl_->transport, rpc_.get());
+  }
+  Status status = impl_->capture_transport->Finish();
+  impl_->capture_transport.reset();
+  return status;
+}
+
 Service::Service(const string& host, int port, int conn_timeout,
-    ProtocolVersion protocol_version)
-  : host_(host), port_(port), conn_timeout_(conn_timeout), impl_(new ServiceImpl()),
-    rpc_(new ThriftRPC()) {
+    ProtocolVersion protocol_version, const ConnectionOptions& options)
+  : host_(host), port_(port), conn_timeout_(conn_timeout), options_(options),
+    impl_(new ServiceImpl()), rpc_(new ThriftRPC()) {
   impl_->protocol_version = ProtocolVersionToTProtocolVersion(protocol_version);
+  impl_->wire_protocol = options.protocol;
 }
 
 Status Service::Open() {
@@ -95,16 +165,37 @@ Status Service::Open() {
     return Status::Error(ss.str());
   }
 
+  if (options_.read_buffer_size <= 0 || options_.write_buffer_size <= 0) {
+    return Status::Error("Transport buffer sizes must be positive");
+  }
+
   impl_->socket.reset(new TSocket(host_, port_));
   impl_->socket->setConnTimeout(conn_timeout_);
-  impl_->transport.reset(new TBufferedTransport(impl_->socket));
-  impl_->protocol.reset(new TBinaryProtocol(impl_->transport));
-
-  rpc_->client.reset(new impala::ImpalaHiveServer2ServiceClient(impl_->protocol));
+  impl_->socket->setNoDelay(options_.tcp_nodelay);
+  impl_->counting_transport.reset(new CountingTransport(impl_->socket, &rpc_->metrics));
+  switch (options_.transport) {
+    case TransportType::FRAMED:
+      impl_->transport.reset(new TFramedTransport(impl_->counting_transport,
+          options_.write_buffer_size));
+      break;
+    case TransportType::BUFFERED:
+    default:
+      impl_->transport.reset(new TBufferedTransport(impl_->counting_transport,
+          options_.read_buffer_size, options_.write_buffer_size));
+      break;
+  }
+  impl_->ResetClient(impl_->transport, rpc_.get());
 
   TRY_RPC_OR_RETURN(impl_->transport->open());
 
-  return Status::OK();
+  // The socket is created by open(), so its buffer sizes can only be set afterwards.
+  int fd = impl_->socket->getSocketFD();
+  Status status = SetSocketBufferSize(fd, SO_RCVBUF, options_.socket_recv_buffer_size);
+  if (status.ok()) {
+    status = SetSocketBufferSize(fd, SO_SNDBUF, options_.socket_send_buffer_size);
+  }
+  if (!status.ok()) TRY_RPC_OR_RETURN(impl_->transport->close());
+  return status;
 }
 
 } // namespace hs2client
@@ -15,12 +15,15 @@
 #ifndef HS2CLIENT_SERVICE_H
 #define HS2CLIENT_SERVICE_H
 
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <string>
 
 #include "hs2client/macros.h"
+#include "hs2client/metrics.h"
 #include "hs2client/status.h"
+#include "hs2client/tracer.h"
 
 namespace hs2client {
 
@@ -59,13 +62,63 @@ enum class ProtocolVersion {
   HS2CLIENT_PROTOCOL_V7, // supported
 };
 
+// The Thrift transport that RPCs are sent over. Must match the server's configuration.
+enum class TransportType {
+  BUFFERED,
+  // Prefixes each message with its length. Required by servers using a non-blocking
+  // Thrift server.
+  FRAMED,
+};
+
+// The Thrift protocol that RPCs are serialized with. Must match the server's
+// configuration. The values are stored in capture files, see capture.h.
+enum class WireProtocol : uint8_t {
+  BINARY = 0,
+  // Smaller on the wire, especially for integer columns, but only supported by servers
+  // that have been configured for it.
+  COMPACT = 1,
+};
+
+// Options for the connection opened by Service::Connect. The defaults work with Impala
+// and HiveServer2.
+struct ConnectionOptions {
+  ConnectionOptions()
+    : transport(TransportType::BUFFERED), protocol(WireProtocol::BINARY),
+      read_buffer_size(64 * 1024), write_buffer_size(16 * 1024), tcp_nodelay(true),
+      socket_recv_buffer_size(0), socket_send_buffer_size(0) {}
+
+  TransportType transport;
+  WireProtocol protocol;
+
+  // The sizes in bytes of the transport's buffers. Reads from the socket are at most
+  // 'read_buffer_size', so large fetches benefit from a larger read buffer. For framed
+  // transports the read buffer grows to fit each frame and only 'write_buffer_size' is
+  // used, as the initial size of the frame buffer.
+  int read_buffer_size;
+  int write_buffer_size;
+
+  // Sets TCP_NODELAY on the socket, so that small requests aren't delayed by Nagle's
+  // algorithm.
+  bool tcp_nodelay;
+
+  // If positive, sets SO_RCVBUF and SO_SNDBUF on the socket. Otherwise the kernel's
+  // defaults, which are usually auto-tuned, are used. Set once the socket has connected,
+  // so they do not affect the TCP window scale negotiated by the handshake.
+  int socket_recv_buffer_size;
+  int socket_send_buffer_size;
+};
+
 // Manages a connection to a HiveServer2 server. Primarily used to create
 // new sessions via OpenSession.
 //
 // Service objects are created using Service::Connect(). They must
 // have Close called on them before they can be deleted.
 //
-// This class is not thread-safe.
+// The connection is shared by all of the Sessions and Operations created from this
+// service, which may be used concurrently from different threads: their RPCs are
+// serialized over the connection. Close, SetTracer, StartCapture and StopCapture must
+// not be called concurrently with other methods of this service, or with methods of
+// its sessions and operations.
 //
 // Example:
 // unique_ptr<Service> service;
@@ -87,6 +140,11 @@ class Service {
   static Status Connect(const std::string& host, int port, int conn_timeout,
       ProtocolVersion protocol_version, std::unique_ptr<Service>* service);
 
+  // As above, but with the transport, protocol and socket configured by 'options'.
+  static Status Connect(const std::string& host, int port, int conn_timeout,
+      ProtocolVersion protocol_version, const ConnectionOptions& options,
+      std::unique_ptr<Service>* service);
+
   ~Service();
 
   // Closes the connection. Must be called before the service is deleted. May be
@@ -108,6 +166,44 @@ class Service {
   Status OpenSession(const std::string& user, const HS2ClientConfig& config,
       std::unique_ptr<Session>* session) const;
 
+  // Checks that the connection is healthy with a cheap RPC. Returns an error iff the
+  // RPC fails.
+  Status Ping() const;
+
+  // Starts recording the raw bytes of every RPC sent and received through this service,
+  // including by its sessions and operations, to a capture file at 'path'. Any existing
+  // file is overwritten. The FetchResults replies in the file can be replayed offline
+  // with FetchReplay (see capture.h). Returns an error if already capturing.
+  Status StartCapture(const std::string& path);
+
+  // Returns a snapshot of the metrics of the RPCs issued through this service, including
+  // by its sessions and operations, since it connected. May be called concurrently with
+  // RPCs, eg. from a thread that exports the metrics periodically.
+  //
+  // Example:
+  // ServiceMetrics metrics = service->GetMetrics();
+  // const RpcMetrics& fetches = metrics.rpc(RpcMethod::FETCH_RESULTS);
+  // cout << fetches.count << " fetches, p99 " << fetches.latency.Percentile(99) << "us";
+  ServiceMetrics GetMetrics() const;
+
+  // Registers 'tracer' to be called for every RPC issued through this service,
+  // including by its sessions and operations, and for the milestones of its operations,
+  // see tracer.h. Replaces any previous tracer. A null tracer disables tracing, which
+  // is the default.
+  //
+  // Example:
+  // class SpanTracer : public Tracer {
+  //   void OnMilestone(OperationMilestone milestone, const TraceHandles& handles) {
+  //     // Start or end a span for handles.operation_id.
+  //   }
+  // };
+  // service->SetTracer(std::make_shared<SpanTracer>());
+  void SetTracer(const std::shared_ptr<Tracer>& tracer);
+
+  // Stops recording and closes the capture file. Returns an error if writing to the
+  // file failed. Does nothing if not capturing. Called by Close.
+  Status StopCapture();
+
  private:
   HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(Service);
 
@@ -115,7 +211,7 @@ class Service {
   struct ServiceImpl;
 
   Service(const std::string& host, int port, int conn_timeout,
-      ProtocolVersion protocol_version);
+      ProtocolVersion protocol_version, const ConnectionOptions& options);
 
   // Opens the connection to the server. Called by Connect before new service is returned
   // to the user. Must be called before OpenSession.
@@ -124,6 +220,7 @@ class Service {
   std::string host_;
   int port_;
   int conn_timeout_;
+  ConnectionOptions options_;
 
   std::unique_ptr<ServiceImpl> impl_;
   std::shared_ptr<ThriftRPC> rpc_;
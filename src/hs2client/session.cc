@@ -39,23 +39,38 @@ Session::~Session() {
 
 Status Session::Close() {
   if (!open_) return Status::OK();
+  // The session can't be closed through a broken connection, but closing the connection
+  // lets the server release it.
+  Status broken = rpc_->BrokenStatus();
+  if (!broken.ok()) {
+    open_ = false;
+    return broken;
+  }
 
   hs2::TCloseSessionReq req;
   req.__set_sessionHandle(impl_->handle);
   hs2::TCloseSessionResp resp;
-  TRY_RPC_OR_RETURN(rpc_->client->CloseSession(resp, req));
+  TRY_LOCKED_RPC_OR_RETURN(rpc_, RpcMethod::CLOSE_SESSION, &impl_->handle, NULL,
+      rpc_->client->CloseSession(resp, req), resp.status);
   RETURN_NOT_OK(resp.status);
 
   open_ = false;
   return TStatusToStatus(resp.status);
 }
 
+void Session::CloseAsync() {
+  if (!open_) return;
+  rpc_->Defer(DeferredRpc(RpcMethod::CLOSE_SESSION, impl_->handle, NULL), true);
+  open_ = false;
+}
+
 Status Session::Open(const HS2ClientConfig& config, const string& user) {
   hs2::TOpenSessionReq req;
   req.__set_configuration(config.GetConfig());
   req.__set_username(user);
   hs2::TOpenSessionResp resp;
-  TRY_RPC_OR_RETURN(rpc_->client->OpenSession(resp, req));
+  TRY_LOCKED_RPC_OR_RETURN(rpc_, RpcMethod::OPEN_SESSION, NULL, NULL,
+      rpc_->client->OpenSession(resp, req), resp.status);
   RETURN_NOT_OK(resp.status);
 
   impl_->handle = resp.sessionHandle;
@@ -63,6 +78,17 @@ Status Session::Open(const HS2ClientConfig& config, const string& user) {
   return TStatusToStatus(resp.status);
 }
 
+Status Session::Ping() const {
+  hs2::TGetInfoReq req;
+  req.__set_sessionHandle(impl_->handle);
+  req.__set_infoType(hs2::TGetInfoType::CLI_SERVER_NAME);
+  hs2::TGetInfoResp resp;
+  TRY_LOCKED_RPC_OR_RETURN(rpc_, RpcMethod::GET_INFO, &impl_->handle, NULL,
+      rpc_->client->GetInfo(resp, req), resp.status);
+  RETURN_NOT_OK(resp.status);
+  return TStatusToStatus(resp.status);
+}
+
 class ExecuteStatementOperation : public Operation {
  public:
   explicit ExecuteStatementOperation(const std::shared_ptr<ThriftRPC>& rpc)
@@ -75,14 +101,124 @@ class ExecuteStatementOperation : public Operation {
     req.__set_statement(statement);
     req.__set_confOverlay(config.GetConfig());
     hs2::TExecuteStatementResp resp;
-    TRY_RPC_OR_RETURN(rpc_->client->ExecuteStatement(resp, req));
+    TRY_LOCKED_RPC_OR_RETURN(rpc_, RpcMethod::EXECUTE_STATEMENT, &session_handle, NULL,
+        rpc_->client->ExecuteStatement(resp, req), resp.status);
     RETURN_NOT_OK(resp.status);
 
     impl_->handle = resp.operationHandle;
     impl_->session_handle = session_handle;
     open_ = true;
+    impl_->TraceMilestone(rpc_.get(), OperationMilestone::STATEMENT_SUBMITTED);
     return TStatusToStatus(resp.status);
   }
+
+  // Executes 'statement' and fetches its schema and first batch, with the requests
+  // pipelined, see Session::ExecuteAndFetch.
+  Status OpenAndFetch(const hs2::TSessionHandle& session_handle, const string& statement,
+      int max_rows, std::vector<ColumnDesc>* column_descs,
+      unique_ptr<ColumnarRowSet>* results, bool* has_more_rows) {
+    hs2::TExecuteStatementReq exec_req;
+    exec_req.__set_sessionHandle(session_handle);
+    exec_req.__set_statement(statement);
+    hs2::TExecuteStatementResp exec_resp;
+    hs2::TGetResultSetMetadataResp metadata_resp;
+    unique_ptr<ColumnarRowSet::ColumnarRowSetImpl> row_set_impl(
+        new ColumnarRowSet::ColumnarRowSetImpl());
+    {
+      std::lock_guard<std::mutex> l(rpc_->lock);
+      if (!rpc_->broken.ok()) return rpc_->broken;
+      // If any of the pipelined RPCs fail, the replies to those after it are left on the
+      // connection, so it is marked broken.
+      {
+        // Any deferred RPCs are sent ahead of ExecuteStatement, so that their replies
+        // arrive with its reply rather than costing a round trip of their own.
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        RpcScope scope(rpc_.get(), RpcMethod::EXECUTE_STATEMENT, &session_handle, NULL);
+        std::vector<DeferredRpc> deferred;
+        try {
+          SendDeferredRpcs(rpc_.get(), &deferred);
+          rpc_->client->send_ExecuteStatement(exec_req);
+          RecvDeferredRpcs(rpc_.get(), &deferred, start);
+          rpc_->client->recv_ExecuteStatement(exec_resp);
+        } catch (TException& tx) {
+          FailDeferredRpcs(rpc_.get(), deferred, start, Status::Error(tx.what()));
+          rpc_->MarkBroken(tx.what());
+          return scope.Failed(tx.what());
+        }
+        scope.Succeeded(exec_resp.status);
+      }
+      RETURN_NOT_OK(exec_resp.status);
+      impl_->handle = exec_resp.operationHandle;
+      impl_->session_handle = session_handle;
+      open_ = true;
+      impl_->TraceMilestone(rpc_.get(), OperationMilestone::STATEMENT_SUBMITTED);
+
+      if (impl_->handle.hasResultSet) {
+        hs2::TGetResultSetMetadataReq metadata_req;
+        metadata_req.__set_operationHandle(impl_->handle);
+        hs2::TFetchResultsReq fetch_req;
+        fetch_req.__set_operationHandle(impl_->handle);
+        fetch_req.__set_orientation(hs2::TFetchOrientation::FETCH_NEXT);
+        fetch_req.__set_maxRows(max_rows);
+
+        unique_ptr<RpcScope> metadata_scope(new RpcScope(rpc_.get(),
+            RpcMethod::GET_RESULT_SET_METADATA, &session_handle, &impl_->handle));
+        unique_ptr<RpcScope> fetch_scope;
+        try {
+          rpc_->client->send_GetResultSetMetadata(metadata_req);
+          fetch_scope.reset(new RpcScope(rpc_.get(), RpcMethod::FETCH_RESULTS,
+              &session_handle, &impl_->handle));
+          rpc_->client->send_FetchResults(fetch_req);
+          rpc_->client->recv_GetResultSetMetadata(metadata_resp);
+          metadata_scope->Succeeded(metadata_resp.status);
+          metadata_scope.reset();
+          RecvFetchResults(rpc_->client->getInputProtocol().get(), &row_set_impl->resp,
+              &row_set_impl->string_columns);
+          fetch_scope->Succeeded(row_set_impl->resp.status);
+        } catch (TException& tx) {
+          rpc_->MarkBroken(tx.what());
+          if (metadata_scope) metadata_scope->Failed(tx.what());
+          if (fetch_scope) return fetch_scope->Failed(tx.what());
+          return Status::Error(tx.what());
+        }
+      }
+    }
+
+    if (!impl_->handle.hasResultSet) {
+      column_descs->clear();
+      results->reset();
+      *has_more_rows = false;
+      return WaitForCompletion();
+    }
+
+    RETURN_NOT_OK(metadata_resp.status);
+    impl_->cached_schema.reset(new hs2::TTableSchema(metadata_resp.schema));
+    TTableSchemaToColumnDescs(metadata_resp.schema, column_descs);
+
+    RETURN_NOT_OK(row_set_impl->resp.status);
+    bool more_rows = row_set_impl->resp.hasMoreRows;
+    unique_ptr<ColumnarRowSet> batch(new ColumnarRowSet(row_set_impl.release()));
+    rpc_->metrics.AddRowsFetched(batch->num_rows());
+    // An empty batch with more rows to come only means the server's fetch timeout
+    // expired, not that the operation has finished.
+    if (batch->num_rows() > 0 || !more_rows) {
+      impl_->TraceMilestone(rpc_.get(), OperationMilestone::FINISHED);
+    }
+    impl_->TraceBatch(rpc_.get(), batch->num_rows(), more_rows);
+    *has_more_rows = more_rows;
+    *results = std::move(batch);
+    return Status::OK();
+  }
+
+  // Queues the CloseOperation RPC to be sent ahead of the next RPC, see
+  // ThriftRPC::Defer.
+  void CloseLazily() {
+    if (!open_) return;
+    rpc_->Defer(DeferredRpc(RpcMethod::CLOSE_OPERATION, impl_->session_handle,
+        &impl_->handle), false);
+    open_ = false;
+    impl_->TraceMilestone(rpc_.get(), OperationMilestone::CLOSED);
+  }
 };
 
 Status Session::ExecuteStatement(const string& statement,
@@ -97,4 +233,16 @@ Status Session::ExecuteStatement(const string& statement,
   return op->Open(impl_->handle, statement, conf_overlay);
 }
 
+Status Session::ExecuteAndFetch(const string& statement, int max_rows,
+    std::vector<ColumnDesc>* column_descs, unique_ptr<ColumnarRowSet>* results,
+    bool* has_more_rows, unique_ptr<Operation>* operation) const {
+  unique_ptr<ExecuteStatementOperation> op(new ExecuteStatementOperation(rpc_));
+  *has_more_rows = false;
+  Status status = op->OpenAndFetch(impl_->handle, statement, max_rows, column_descs,
+      results, has_more_rows);
+  if (operation == NULL || (status.ok() && !*has_more_rows)) op->CloseLazily();
+  if (operation != NULL) operation->reset(op.release());
+  return status;
+}
+
 } // namespace hs2client
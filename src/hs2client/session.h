@@ -16,6 +16,7 @@
 #define HS2CLIENT_SESSION_H
 
 #include <string>
+#include <vector>
 
 #include "hs2client/service.h"
 #include "hs2client/macros.h"
@@ -34,7 +35,9 @@ struct ThriftRPC;
 // Executing RPCs with an Operation corresponding to a particular Session after
 // that Session has been closed or deleted is undefined.
 //
-// This class is not thread-safe.
+// The const methods may be called concurrently with each other, and with methods of
+// other Sessions and Operations from the same Service. Close and CloseAsync must not be
+// called concurrently with any other method.
 class Session {
  public:
   ~Session();
@@ -44,11 +47,53 @@ class Session {
   // session is open but the close rpc fails.
   Status Close();
 
+  // Like Close, but returns immediately, after which the session may be deleted. The
+  // CloseSession RPC is sent by the Service's reaper thread, see Operation::CloseAsync.
+  void CloseAsync();
+
   Status ExecuteStatement(const std::string& statement,
       std::unique_ptr<Operation>* operation) const;
   Status ExecuteStatement(const std::string& statement,
       const HS2ClientConfig& conf_overlay, std::unique_ptr<Operation>* operation) const;
 
+  // Executes 'statement' and returns its schema and first batch of up to 'max_rows' rows
+  // together, in two round trips instead of the usual four or more. Intended for short,
+  // latency sensitive queries such as point lookups.
+  //
+  // After the ExecuteStatement reply, the GetResultSetMetadata and FetchResults
+  // requests are sent back to back before either reply is read. Like Fetch, this relies
+  // on the server blocking FetchResults until rows are ready, as Impala does, rather
+  // than polling GetState. The schema is cached, so GetResultSetMetadata on the
+  // returned operation doesn't issue an RPC.
+  //
+  // If the batch has all of the rows, ie. 'has_more_rows' is false, or 'operation' is
+  // NULL, the operation is closed lazily: its CloseOperation request is sent ahead of
+  // the next ExecuteAndFetch's request, or before any other RPC on the connection, so
+  // it doesn't cost a round trip of its own. Otherwise the open operation is returned in
+  // 'operation' to fetch the remaining rows, and must be closed as usual. If 'operation'
+  // is not NULL it's always set, and Close on a lazily closed operation does nothing.
+  //
+  // Statements without a result set, eg. DDL, are waited for with
+  // Operation::WaitForCompletion, and return no columns and a null 'results'.
+  //
+  // If any of the pipelined RPCs fails, the replies to those after it can't be matched
+  // up with their requests, so the Service's connection is closed. Every later RPC
+  // through it fails, and Close on its sessions and operations returns the error
+  // without an RPC.
+  //
+  // Example:
+  // vector<ColumnDesc> schema;
+  // unique_ptr<ColumnarRowSet> results;
+  // bool has_more_rows;
+  // HS2CLIENT_RETURN_IF_ERROR(session->ExecuteAndFetch("select * from t where id = 1",
+  //     100, &schema, &results, &has_more_rows, NULL));
+  Status ExecuteAndFetch(const std::string& statement, int max_rows,
+      std::vector<ColumnDesc>* column_descs, std::unique_ptr<ColumnarRowSet>* results,
+      bool* has_more_rows, std::unique_ptr<Operation>* operation) const;
+
+  // Checks that the session is still valid with a cheap GetInfo RPC.
+  Status Ping() const;
+
  private:
   HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(Session);
 
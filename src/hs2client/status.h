@@ -37,6 +37,10 @@ enum class StatusCode {
 
 class Status {
  public:
+  // Constructs an OK status. Allows a Status to be declared before it is assigned, eg.
+  // by Cython code that calls functions returning a Status without the GIL.
+  Status() : code_(StatusCode::Success) {}
+
   static Status OK(const std::string& msg = "");
   static Status StillExecuting();
   static Status Error(const std::string& msg);
@@ -0,0 +1,76 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/string-dictionary.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using namespace hs2client;
+using namespace std;
+
+TEST(StringDictionaryTest, TestGetOrInsert) {
+  StringDictionary dict;
+  EXPECT_EQ(dict.size(), 0);
+  EXPECT_EQ(dict.GetOrInsert(string("foo")), 0);
+  EXPECT_EQ(dict.GetOrInsert(string("bar")), 1);
+  EXPECT_EQ(dict.GetOrInsert(string("foo")), 0);
+  EXPECT_EQ(dict.GetOrInsert(string("")), 2);
+  EXPECT_EQ(dict.GetOrInsert(string("")), 2);
+  // Values that share a prefix, or differ only past the first 8 bytes.
+  EXPECT_EQ(dict.GetOrInsert(string("foobar")), 3);
+  EXPECT_EQ(dict.GetOrInsert(string("0123456789a")), 4);
+  EXPECT_EQ(dict.GetOrInsert(string("0123456789b")), 5);
+  EXPECT_EQ(dict.size(), 6);
+  EXPECT_EQ(dict.value(0).ToString(), "foo");
+  EXPECT_EQ(dict.value(2).ToString(), "");
+  EXPECT_EQ(dict.value(5).ToString(), "0123456789b");
+  EXPECT_EQ(dict.num_bytes(), 3 + 3 + 0 + 6 + 11 + 11);
+
+  dict.Clear();
+  EXPECT_EQ(dict.size(), 0);
+  EXPECT_EQ(dict.GetOrInsert(string("bar")), 0);
+}
+
+TEST(StringDictionaryTest, TestRehash) {
+  StringDictionary dict;
+  const int num_values = 10000;
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int i = 0; i < num_values; ++i) {
+      string value = "value" + to_string(i);
+      ASSERT_EQ(dict.GetOrInsert(value), i);
+    }
+  }
+  EXPECT_EQ(dict.size(), num_values);
+  for (int i = 0; i < num_values; ++i) {
+    EXPECT_EQ(dict.value(i).ToString(), "value" + to_string(i));
+  }
+}
+
+TEST(StringDictionaryTest, TestEmbeddedNulls) {
+  StringDictionary dict;
+  string a("a\0b", 3);
+  string b("a\0c", 3);
+  EXPECT_EQ(dict.GetOrInsert(a), 0);
+  EXPECT_EQ(dict.GetOrInsert(b), 1);
+  EXPECT_EQ(dict.GetOrInsert(string("a")), 2);
+  EXPECT_EQ(dict.value(1).ToString(), b);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
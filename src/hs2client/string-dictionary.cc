@@ -0,0 +1,92 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "hs2client/string-dictionary.h"
+
+#include <cstring>
+
+namespace hs2client {
+
+namespace {
+
+const size_t INITIAL_SLOTS = 64;
+const uint64_t HASH_MULTIPLIER = 0x9e3779b97f4a7c15ULL;
+
+inline uint64_t Mix(uint64_t h, uint64_t word) {
+  h = (h ^ word) * HASH_MULTIPLIER;
+  return h ^ (h >> 32);
+}
+
+} // namespace
+
+StringDictionary::StringDictionary() {
+  Clear();
+}
+
+uint64_t StringDictionary::Hash(const StringPiece& value) {
+  const char* data = value.data();
+  int32_t size = value.size();
+  uint64_t h = static_cast<uint64_t>(size) * HASH_MULTIPLIER;
+  int32_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    h = Mix(h, word);
+  }
+  if (i < size) {
+    uint64_t word = 0;
+    memcpy(&word, data + i, size - i);
+    h = Mix(h, word);
+  }
+  return h ^ (h >> 29);
+}
+
+int32_t StringDictionary::GetOrInsert(const StringPiece& value) {
+  uint64_t hash = Hash(value);
+  size_t mask = slots_.size() - 1;
+  size_t slot = hash & mask;
+  while (slots_[slot] != -1) {
+    int32_t code = slots_[slot];
+    if (hashes_[code] == hash && this->value(code) == value) return code;
+    slot = (slot + 1) & mask;
+  }
+
+  int32_t code = size();
+  bytes_.append(value.data(), value.size());
+  offsets_.push_back(bytes_.size());
+  hashes_.push_back(hash);
+  slots_[slot] = code;
+  if (hashes_.size() * 2 > slots_.size()) Rehash(slots_.size() * 2);
+  return code;
+}
+
+void StringDictionary::Clear() {
+  bytes_.clear();
+  offsets_.assign(1, 0);
+  hashes_.clear();
+  slots_.assign(INITIAL_SLOTS, -1);
+}
+
+void StringDictionary::Rehash(size_t num_slots) {
+  slots_.assign(num_slots, -1);
+  size_t mask = num_slots - 1;
+  for (int32_t code = 0; code < size(); ++code) {
+    size_t slot = hashes_[code] & mask;
+    while (slots_[slot] != -1) slot = (slot + 1) & mask;
+    slots_[slot] = code;
+  }
+}
+
+} // namespace hs2client
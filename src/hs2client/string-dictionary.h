@@ -0,0 +1,87 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef HS2CLIENT_STRING_DICTIONARY_H
+#define HS2CLIENT_STRING_DICTIONARY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "hs2client/columnar-row-set.h"
+#include "hs2client/macros.h"
+
+namespace hs2client {
+
+// Assigns each distinct string a dense code, 0, 1, 2, ..., in order of first appearance.
+// The dictionary keeps its own copy of each distinct value, so the columns that the
+// values came from may be freed while it is still in use.
+//
+// Used to dictionary encode StringViewColumns without creating an object per value,
+// eg. so that a converter only needs to create one Python string per distinct value.
+//
+// Example:
+// StringDictionary dict;
+// for (int i = 0; i < col->length(); ++i) {
+//   codes[i] = col->IsNull(i) ? -1 : dict.GetOrInsert(col->GetData(i));
+// }
+// for (int32_t code = 0; code < dict.size(); ++code) dict.value(code) ...
+//
+// This class is not thread-safe.
+class StringDictionary {
+ public:
+  StringDictionary();
+
+  // Returns the code of 'value', adding it to the dictionary if it isn't already there.
+  int32_t GetOrInsert(const StringPiece& value);
+
+  // The number of distinct values.
+  int32_t size() const { return static_cast<int32_t>(hashes_.size()); }
+
+  // The value with code 'code', which must be less than size(). Remains valid until the
+  // dictionary is modified.
+  StringPiece value(int32_t code) const {
+    return StringPiece(bytes_.data() + offsets_[code], offsets_[code + 1] - offsets_[code]);
+  }
+
+  // The total size of the distinct values.
+  int64_t num_bytes() const { return bytes_.size(); }
+
+  // Removes all values.
+  void Clear();
+
+ private:
+  HS2CLIENT_DISALLOW_COPY_AND_ASSIGN(StringDictionary);
+
+  static uint64_t Hash(const StringPiece& value);
+
+  // Rebuilds 'slots_' with 'num_slots' slots, which must be a power of 2.
+  void Rehash(size_t num_slots);
+
+  // The distinct values, back to back. Value i spans [offsets_[i], offsets_[i + 1]).
+  std::string bytes_;
+  std::vector<int64_t> offsets_;
+
+  // The hash of each value, so that rehashing doesn't need to hash the values again.
+  std::vector<uint64_t> hashes_;
+
+  // An open addressing hash table, probed linearly, of the codes of the values, or -1 for
+  // empty slots. Kept at most half full.
+  std::vector<int32_t> slots_;
+};
+
+} // namespace hs2client
+
+#endif // HS2CLIENT_STRING_DICTIONARY_H
@@ -20,6 +20,7 @@
 #include <string>
 #include <vector>
 
+#include "hs2client/mock-server.h"
 #include "hs2client/service.h"
 #include "hs2client/session.h"
 #include "hs2client/thrift-internal.h"
@@ -33,6 +34,11 @@ namespace hs2client {
     Status _hs2client_status = (stmt);                                     \
     EXPECT_TRUE(_hs2client_status.ok()) << _hs2client_status.GetMessage(); \
   } while(false)
+#define ASSERT_OK(stmt)                                                    \
+  do {                                                                     \
+    Status _hs2client_status = (stmt);                                     \
+    ASSERT_TRUE(_hs2client_status.ok()) << _hs2client_status.GetMessage(); \
+  } while(false)
 
 const static std::string& TEST_DB = "hs2client_test_db";
 
@@ -191,6 +197,50 @@ class HS2ClientTest : public ::testing::Test {
   std::unique_ptr<Session> session_;
 };
 
+// Runs a MockServer for each test, on a free port so that tests may run concurrently.
+// Subclasses set 'server_options_' and 'spec_' before starting it.
+class MockServerTestBase : public ::testing::Test {
+ protected:
+  virtual void TearDown() {
+    if (server_) EXPECT_OK(server_->Stop());
+  }
+
+  // Fails fatally if the server doesn't start, so call with ASSERT_NO_FATAL_FAILURE.
+  void StartServer() {
+    server_.reset(new MockServer(server_options_, spec_));
+    ASSERT_OK(server_->Start());
+  }
+
+  MockServerOptions server_options_;
+  MockResultSpec spec_;
+
+  std::unique_ptr<MockServer> server_;
+};
+
+// As above, and connects a service to the server and opens a session.
+class MockSessionTestBase : public MockServerTestBase {
+ protected:
+  virtual void TearDown() {
+    if (session_) EXPECT_OK(session_->Close());
+    if (service_) EXPECT_OK(service_->Close());
+    MockServerTestBase::TearDown();
+  }
+
+  // Fails fatally on any error, so call with ASSERT_NO_FATAL_FAILURE.
+  void StartAndConnect() {
+    ASSERT_NO_FATAL_FAILURE(StartServer());
+    ConnectionOptions options;
+    options.transport = server_options_.transport;
+    options.protocol = server_options_.protocol;
+    ASSERT_OK(Service::Connect("localhost", server_->port(), 0,
+        ProtocolVersion::HS2CLIENT_PROTOCOL_V7, options, &service_));
+    ASSERT_OK(service_->OpenSession("user", HS2ClientConfig(), &session_));
+  }
+
+  std::unique_ptr<Service> service_;
+  std::unique_ptr<Session> session_;
+};
+
 } // namespace impala
 
 #endif // HS2CLIENT_TEST_UTIL_H
@@ -14,7 +14,13 @@
 
 #include "hs2client/thrift-internal.h"
 
+#include <cerrno>
+#include <cstring>
 #include <sstream>
+#include <sys/socket.h>
+
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
 
 #include "hs2client/service.h"
 #include "hs2client/logging.h"
@@ -23,6 +29,11 @@
 
 namespace hs2 = apache::hive::service::cli::thrift;
 
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::transport::TTransport;
+
 namespace hs2client {
 
 namespace {
@@ -33,6 +44,19 @@ typename std::underlying_type<ENUM>::type EnumToInt(const ENUM& value) {
   return static_cast<typename std::underlying_type<ENUM>::type>(value);
 }
 
+// Returns the bytes of a handle's GUID as lowercase hex.
+std::string GuidToHex(const std::string& guid) {
+  static const char* HEX_DIGITS = "0123456789abcdef";
+  std::string hex;
+  hex.reserve(guid.size() * 2);
+  for (char c : guid) {
+    uint8_t byte = static_cast<uint8_t>(c);
+    hex.push_back(HEX_DIGITS[byte >> 4]);
+    hex.push_back(HEX_DIGITS[byte & 0xf]);
+  }
+  return hex;
+}
+
 } // namespace
 
 const std::string OperationStateToString(const Operation::State& state) {
@@ -136,6 +160,11 @@ Operation::State TOperationStateToOperationState(const hs2::TOperationState::typ
   }
 }
 
+bool IsServerError(const hs2::TStatus& tstatus) {
+  return tstatus.statusCode == hs2::TStatusCode::ERROR_STATUS ||
+      tstatus.statusCode == hs2::TStatusCode::INVALID_HANDLE_STATUS;
+}
+
 Status TStatusToStatus(const hs2::TStatus& tstatus) {
   switch (tstatus.statusCode) {
     case hs2::TStatusCode::SUCCESS_STATUS:
@@ -162,6 +191,223 @@ Status TStatusToStatus(const hs2::TStatus& tstatus) {
   }
 }
 
+TraceHandles ToTraceHandles(const hs2::TSessionHandle* session_handle,
+    const hs2::TOperationHandle* operation_handle) {
+  TraceHandles handles;
+  if (session_handle != NULL) {
+    handles.session_id = GuidToHex(session_handle->sessionId.guid);
+  }
+  if (operation_handle != NULL) {
+    handles.operation_id = GuidToHex(operation_handle->operationId.guid);
+  }
+  return handles;
+}
+
+namespace {
+
+// The handles passed to the tracer for a deferred RPC.
+TraceHandles DeferredRpcHandles(const DeferredRpc& rpc) {
+  return ToTraceHandles(&rpc.session_handle,
+      rpc.has_operation_handle ? &rpc.operation_handle : NULL);
+}
+
+} // namespace
+
+void ThriftRPC::Defer(const DeferredRpc& rpc, bool background) {
+  std::lock_guard<std::mutex> l(lock);
+  deferred_rpcs.push_back(rpc);
+  if (!background) return;
+  if (!reaper.joinable()) reaper = std::thread(&ThriftRPC::RunReaper, this);
+  reaper_cv.notify_one();
+}
+
+void ThriftRPC::StopReaper() {
+  {
+    std::lock_guard<std::mutex> l(lock);
+    if (!reaper.joinable()) return;
+    reaper_stopping = true;
+    reaper_cv.notify_one();
+  }
+  reaper.join();
+  std::lock_guard<std::mutex> l(lock);
+  reaper = std::thread();
+  reaper_stopping = false;
+}
+
+void ThriftRPC::MarkBroken(const std::string& msg) {
+  if (!broken.ok()) return;
+  HS2CLIENT_LOG(WARNING) << "Closing connection after pipelined RPCs failed: " << msg;
+  broken = Status::Error("Connection closed after pipelined RPCs failed: " + msg);
+  try {
+    client->getOutputProtocol()->getTransport()->close();
+  } catch (const apache::thrift::TException& e) {
+    HS2CLIENT_LOG(WARNING) << "Failed to close connection: " << e.what();
+  }
+}
+
+void ThriftRPC::RunReaper() {
+  std::unique_lock<std::mutex> l(lock);
+  while (true) {
+    reaper_cv.wait(l, [this]() { return reaper_stopping || !deferred_rpcs.empty(); });
+    if (deferred_rpcs.empty()) return;
+    // Everything queued while the last batch was in flight is sent together, so a burst
+    // of closes costs about one round trip.
+    FlushDeferredRpcs(this);
+  }
+}
+
+void SendDeferredRpcs(ThriftRPC* rpc, std::vector<DeferredRpc>* rpcs) {
+  DCHECK(rpcs->empty());
+  rpcs->swap(rpc->deferred_rpcs);
+  // All of the starts are reported up front, so that each RPC in 'rpcs' has been
+  // started if sending fails part way through.
+  if (rpc->tracer) {
+    for (const DeferredRpc& deferred : *rpcs) {
+      rpc->tracer->OnRpcStart(deferred.method, DeferredRpcHandles(deferred));
+    }
+  }
+  for (const DeferredRpc& deferred : *rpcs) {
+    switch (deferred.method) {
+      case RpcMethod::CANCEL_OPERATION: {
+        hs2::TCancelOperationReq req;
+        req.__set_operationHandle(deferred.operation_handle);
+        rpc->client->send_CancelOperation(req);
+        break;
+      }
+      case RpcMethod::CLOSE_OPERATION: {
+        hs2::TCloseOperationReq req;
+        req.__set_operationHandle(deferred.operation_handle);
+        rpc->client->send_CloseOperation(req);
+        break;
+      }
+      case RpcMethod::CLOSE_SESSION: {
+        hs2::TCloseSessionReq req;
+        req.__set_sessionHandle(deferred.session_handle);
+        rpc->client->send_CloseSession(req);
+        break;
+      }
+      default:
+        DCHECK(false) << "Unexpected deferred RPC " << RpcMethodToString(deferred.method);
+    }
+  }
+}
+
+void RecvDeferredRpcs(ThriftRPC* rpc, std::vector<DeferredRpc>* rpcs,
+    std::chrono::steady_clock::time_point start) {
+  size_t num_read = 0;
+  try {
+    for (; num_read < rpcs->size(); ++num_read) {
+      const DeferredRpc& deferred = (*rpcs)[num_read];
+      hs2::TStatus tstatus;
+      switch (deferred.method) {
+        case RpcMethod::CANCEL_OPERATION: {
+          hs2::TCancelOperationResp resp;
+          rpc->client->recv_CancelOperation(resp);
+          tstatus = resp.status;
+          break;
+        }
+        case RpcMethod::CLOSE_OPERATION: {
+          hs2::TCloseOperationResp resp;
+          rpc->client->recv_CloseOperation(resp);
+          tstatus = resp.status;
+          break;
+        }
+        case RpcMethod::CLOSE_SESSION: {
+          hs2::TCloseSessionResp resp;
+          rpc->client->recv_CloseSession(resp);
+          tstatus = resp.status;
+          break;
+        }
+        default:
+          break;
+      }
+      // The requests were pipelined, so each one's latency runs from when the first was
+      // sent.
+      int64_t latency_us = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start).count();
+      rpc->metrics.RecordRpc(deferred.method, latency_us, true);
+      Status status;
+      if (IsServerError(tstatus)) {
+        rpc->metrics.RecordServerError(deferred.method);
+        status = TStatusToStatus(tstatus);
+        HS2CLIENT_LOG(WARNING) << "Deferred " << RpcMethodToString(deferred.method)
+                               << " failed: " << status.GetMessage();
+      }
+      if (rpc->tracer) {
+        rpc->tracer->OnRpcEnd(deferred.method, DeferredRpcHandles(deferred), status);
+      }
+    }
+  } catch (const apache::thrift::TException& e) {
+    rpcs->erase(rpcs->begin(), rpcs->begin() + num_read);
+    throw;
+  }
+  rpcs->clear();
+}
+
+void FailDeferredRpcs(ThriftRPC* rpc, const std::vector<DeferredRpc>& rpcs,
+    std::chrono::steady_clock::time_point start, const Status& status) {
+  int64_t latency_us = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  for (const DeferredRpc& deferred : rpcs) {
+    rpc->metrics.RecordRpc(deferred.method, latency_us, false);
+    if (rpc->tracer) {
+      rpc->tracer->OnRpcEnd(deferred.method, DeferredRpcHandles(deferred), status);
+    }
+  }
+}
+
+void FlushDeferredRpcs(ThriftRPC* rpc) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<DeferredRpc> rpcs;
+  try {
+    SendDeferredRpcs(rpc, &rpcs);
+    RecvDeferredRpcs(rpc, &rpcs, start);
+  } catch (const apache::thrift::TException& e) {
+    HS2CLIENT_LOG(WARNING) << "Failed to send deferred RPCs: " << e.what();
+    FailDeferredRpcs(rpc, rpcs, start, Status::Error(e.what()));
+    // The replies to any RPCs after the one that failed may still arrive, and would be
+    // read as the replies to the RPCs that follow.
+    rpc->MarkBroken(e.what());
+  }
+}
+
+void Operation::OperationImpl::TraceMilestone(ThriftRPC* rpc,
+    OperationMilestone milestone) {
+  if (!rpc->tracer) return;
+  int bit = 1 << static_cast<int>(milestone);
+  if ((traced_milestones.fetch_or(bit) & bit) != 0) return;
+  rpc->tracer->OnMilestone(milestone, ToTraceHandles(&session_handle, &handle));
+}
+
+void Operation::OperationImpl::TraceBatch(ThriftRPC* rpc, int64_t num_rows,
+    bool has_more_rows) {
+  if (num_rows > 0 || !has_more_rows) {
+    TraceMilestone(rpc, OperationMilestone::FIRST_BATCH);
+  }
+  if (!has_more_rows) TraceMilestone(rpc, OperationMilestone::LAST_BATCH);
+}
+
+boost::shared_ptr<TProtocol> NewProtocol(WireProtocol protocol,
+    const boost::shared_ptr<TTransport>& transport) {
+  switch (protocol) {
+    case WireProtocol::COMPACT:
+      return boost::shared_ptr<TProtocol>(new TCompactProtocol(transport));
+    case WireProtocol::BINARY:
+    default:
+      return boost::shared_ptr<TProtocol>(new TBinaryProtocol(transport));
+  }
+}
+
+Status SetSocketBufferSize(int fd, int option, int size) {
+  if (size <= 0) return Status::OK();
+  if (setsockopt(fd, SOL_SOCKET, option, &size, sizeof(size)) != 0) {
+    std::stringstream ss;
+    ss << "Failed to set socket buffer size to " << size << ": " << strerror(errno);
+    return Status::Error(ss.str());
+  }
+  return Status::OK();
+}
+
 std::unique_ptr<ColumnType> TTypeDescToColumnType(const hs2::TTypeDesc& ttype_desc) {
   if (ttype_desc.types.size() != 1 || !ttype_desc.types[0].__isset.primitiveEntry) {
     HS2CLIENT_LOG(WARNING) << "TTypeDescToColumnType only supports primitive types.";
@@ -228,4 +474,15 @@ ColumnType::TypeId TTypeIdToTypeId(const hs2::TTypeId::type& type_id) {
   }
 }
 
+void TTableSchemaToColumnDescs(const hs2::TTableSchema& schema,
+    std::vector<ColumnDesc>* column_descs) {
+  column_descs->clear();
+  column_descs->reserve(schema.columns.size());
+  for (const hs2::TColumnDesc& tcolumn_desc: schema.columns) {
+    column_descs->emplace_back(tcolumn_desc.columnName,
+        TTypeDescToColumnType(tcolumn_desc.typeDesc), tcolumn_desc.position,
+        tcolumn_desc.comment);
+  }
+}
+
 } // namespace hs2client
@@ -15,9 +15,20 @@
 #ifndef HS2CLIENT_THRIFT_INTERNAL_H
 #define HS2CLIENT_THRIFT_INTERNAL_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include <thrift/transport/TVirtualTransport.h>
+
 #include "hs2client/columnar-row-set.h"
+#include "hs2client/metrics.h"
 #include "hs2client/operation.h"
 #include "hs2client/service.h"
+#include "hs2client/tracer.h"
 #include "hs2client/types.h"
 
 #include "gen-cpp/ImpalaHiveServer2Service.h"
@@ -25,18 +36,247 @@
 
 namespace hs2client {
 
+// The values and null bitmap of a STRING or BINARY column, deserialized into
+// contiguous storage by FetchResults rather than into a TColumn.
+struct StringColumnData {
+  std::string nulls;
+  // Has one more entry than there are values, see StringViewColumn.
+  std::vector<int32_t> offsets;
+  std::string data;
+
+  // Runs the copy of the values into the TColumn by MaterializeStrings once.
+  std::once_flag materialize_once;
+};
+
 // PIMPL structs.
 struct ColumnarRowSet::ColumnarRowSetImpl {
   apache::hive::service::cli::thrift::TFetchResultsResp resp;
+
+  // Indexed by column. Null for columns that are not STRING or BINARY.
+  std::vector<std::unique_ptr<StringColumnData>> string_columns;
+
+  // Copies the values of string column 'i' into resp as std::strings, for the
+  // StringColumn accessors. Does nothing if they have already been copied.
+  void MaterializeStrings(int i);
+
+  // Moves the first 'num_rows' rows, which must be fewer than there are, into a new
+  // batch that is returned, with hasMoreRows set. Must be called before any strings
+  // have been materialized.
+  std::unique_ptr<ColumnarRowSetImpl> SplitFront(int64_t num_rows);
 };
 
 struct Operation::OperationImpl {
+  OperationImpl() : pending_has_more_rows(false), traced_milestones(0) {}
+
+  // Moves up to 'max_rows' rows of the batch fetched by WaitForCompletion into the
+  // output parameters, if there is one, and returns true. Any rows beyond 'max_rows'
+  // are kept for the next call. Otherwise returns false.
+  bool TakePendingBatch(int max_rows, std::unique_ptr<ColumnarRowSet>* results,
+      bool* has_more_rows);
+
+  // Discards the batch fetched by WaitForCompletion, if there is one.
+  void ClearPendingBatch() {
+    std::lock_guard<std::mutex> l(pending_lock);
+    pending_batch.reset();
+  }
+
+  // Issues a FetchResults RPC through 'rpc' for Operation::Fetch, ignoring any pending
+  // batch. Doesn't report any milestones, so that the caller can order them.
+  Status FetchBatch(ThriftRPC* rpc, int max_rows, FetchOrientation orientation,
+      std::unique_ptr<ColumnarRowSet>* results, bool* has_more_rows);
+
+  // Reports 'milestone' to the tracer of 'rpc', if there is one, unless it has been
+  // reported for this operation before, eg. by a concurrent call.
+  void TraceMilestone(ThriftRPC* rpc, OperationMilestone milestone);
+
+  // Reports FIRST_BATCH and LAST_BATCH for a fetched batch of 'num_rows' rows. An empty
+  // batch with more rows to come only means the server's fetch timeout expired.
+  void TraceBatch(ThriftRPC* rpc, int64_t num_rows, bool has_more_rows);
+
   apache::hive::service::cli::thrift::TOperationHandle handle;
   apache::hive::service::cli::thrift::TSessionHandle session_handle;
+
+  // The result set schema, once fetched by Session::ExecuteAndFetch. Returned by
+  // GetResultSetMetadata instead of issuing the RPC again.
+  std::unique_ptr<apache::hive::service::cli::thrift::TTableSchema> cached_schema;
+
+  // The batch that WaitForCompletion fetched, to be returned by the next Fetch.
+  std::mutex pending_lock;
+  std::unique_ptr<ColumnarRowSet> pending_batch;
+  bool pending_has_more_rows;
+
+  // A bit per OperationMilestone that has been reported.
+  std::atomic<int> traced_milestones;
 };
 
+// A CancelOperation, CloseOperation or CloseSession RPC whose caller doesn't wait for
+// it, see ThriftRPC::Defer.
+struct DeferredRpc {
+  DeferredRpc(RpcMethod method,
+      const apache::hive::service::cli::thrift::TSessionHandle& session_handle,
+      const apache::hive::service::cli::thrift::TOperationHandle* operation_handle)
+    : method(method), session_handle(session_handle),
+      has_operation_handle(operation_handle != NULL) {
+    if (operation_handle != NULL) this->operation_handle = *operation_handle;
+  }
+
+  RpcMethod method;
+  apache::hive::service::cli::thrift::TSessionHandle session_handle;
+  // Only set for CancelOperation and CloseOperation.
+  apache::hive::service::cli::thrift::TOperationHandle operation_handle;
+  bool has_operation_handle;
+};
+
+// The client for a Service's connection, shared by the Service and all of the Sessions
+// and Operations created from it. The generated client is synchronous and keeps the
+// connection's framing state, so each RPC must send its request and receive its reply
+// while holding 'lock' - see TRY_LOCKED_RPC_OR_RETURN.
 struct ThriftRPC {
+  ThriftRPC() : reaper_stopping(false) {}
+
+  ~ThriftRPC() { StopReaper(); }
+
+  // Queues 'rpc' to be sent without the caller waiting for it. If 'background' is true
+  // the reaper thread, which is started if needed, sends it as soon as the connection
+  // is free. Otherwise it is sent ahead of the next RPC on the connection, or by the
+  // reaper if it's woken by another RPC first. 'lock' must not be held.
+  void Defer(const DeferredRpc& rpc, bool background);
+
+  // Waits for the reaper thread, if it's running, to send the RPCs that are queued for
+  // it and exit. 'lock' must not be held.
+  void StopReaper();
+
+  // Called when pipelined RPCs fail partway, leaving replies on the connection that no
+  // caller will read. Closes the connection, which also lets the server release the
+  // sessions and operations on it, and sets 'broken' so that every later RPC fails with
+  // an error built from 'msg' rather than reading another RPC's reply. 'lock' must be
+  // held.
+  void MarkBroken(const std::string& msg);
+
+  // Returns 'broken'. 'lock' must not be held.
+  Status BrokenStatus() {
+    std::lock_guard<std::mutex> l(lock);
+    return broken;
+  }
+
+  std::mutex lock;
   std::unique_ptr<impala::ImpalaHiveServer2ServiceClient> client;
+
+  // Updated by every RPC, see Service::GetMetrics.
+  MetricsRecorder metrics;
+
+  // May be null. Only set while no RPCs are in progress, see Service::SetTracer.
+  std::shared_ptr<Tracer> tracer;
+
+  // OK unless MarkBroken has been called. Protected by 'lock'.
+  Status broken;
+
+  // RPCs queued by Defer that haven't been sent yet, in the order they were queued. They
+  // are sent ahead of the next ExecuteAndFetch's request, by FlushDeferredRpcs before
+  // any other RPC, or by the reaper. Protected by 'lock'.
+  std::vector<DeferredRpc> deferred_rpcs;
+
+  // Sends 'deferred_rpcs' in the background. Started by the first Defer with
+  // 'background' true. Any RPCs queued while it's sending a batch are coalesced into the
+  // next one. 'reaper_cv' is signaled when it has RPCs to send or should stop, and
+  // 'reaper_stopping' is protected by 'lock'.
+  std::thread reaper;
+  std::condition_variable reaper_cv;
+  bool reaper_stopping;
+
+ private:
+  void RunReaper();
+};
+
+// Moves 'rpc->deferred_rpcs' into 'rpcs', which must be empty, and sends their requests
+// without reading the replies. The RPCs must then be passed to RecvDeferredRpcs before
+// any other reply is read. 'rpc->lock' must be held. Throws a TException if sending
+// fails.
+void SendDeferredRpcs(ThriftRPC* rpc, std::vector<DeferredRpc>* rpcs);
+
+// Reads the replies to the requests sent by SendDeferredRpcs, which are recorded in the
+// metrics and reported to the tracer, and removes each RPC from 'rpcs' once its reply
+// has been read. Errors in the replies are logged, since their callers have already
+// moved on. 'rpc->lock' must be held. Throws a TException if reading fails, in which
+// case 'rpcs' is left holding the RPCs whose replies weren't read.
+void RecvDeferredRpcs(ThriftRPC* rpc, std::vector<DeferredRpc>* rpcs,
+    std::chrono::steady_clock::time_point start);
+
+// Records 'rpcs', which were left by SendDeferredRpcs or RecvDeferredRpcs throwing, as
+// failed with 'status'. The caller must also call MarkBroken, since their replies may
+// still arrive.
+void FailDeferredRpcs(ThriftRPC* rpc, const std::vector<DeferredRpc>& rpcs,
+    std::chrono::steady_clock::time_point start, const Status& status);
+
+// Sends any deferred RPCs and reads their replies. Called by TRY_LOCKED_RPC_OR_RETURN
+// before other RPCs. Failures are logged rather than returned, and mark the connection
+// broken, which fails the RPC that follows. 'rpc->lock' must be held.
+void FlushDeferredRpcs(ThriftRPC* rpc);
+
+// Returns the TraceHandles for 'session_handle' and 'operation_handle', either of which
+// may be null.
+TraceHandles ToTraceHandles(
+    const apache::hive::service::cli::thrift::TSessionHandle* session_handle,
+    const apache::hive::service::cli::thrift::TOperationHandle* operation_handle);
+
+Status TStatusToStatus(const apache::hive::service::cli::thrift::TStatus& tstatus);
+
+// Returns true if 'tstatus' is an error returned by the server, ie. ERROR or
+// INVALID_HANDLE.
+bool IsServerError(const apache::hive::service::cli::thrift::TStatus& tstatus);
+
+// Covers a single RPC, see TRY_LOCKED_RPC_OR_RETURN. Reports the start of the RPC to the
+// tracer when created, and records its latency in the metrics and reports its end to the
+// tracer when it goes out of scope. The RPC is recorded as failed unless Succeeded is
+// called first, and as a server error, which is also reported to the tracer, if the
+// reply passed to Succeeded is one. The
+// handles are only converted to TraceHandles if there is a tracer.
+class RpcScope {
+ public:
+  RpcScope(ThriftRPC* rpc, RpcMethod method,
+      const apache::hive::service::cli::thrift::TSessionHandle* session_handle,
+      const apache::hive::service::cli::thrift::TOperationHandle* operation_handle)
+    : rpc_(rpc), method_(method), start_(std::chrono::steady_clock::now()),
+      ok_(false) {
+    if (rpc_->tracer) {
+      handles_ = ToTraceHandles(session_handle, operation_handle);
+      rpc_->tracer->OnRpcStart(method_, handles_);
+    }
+  }
+
+  ~RpcScope() {
+    int64_t latency_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start_).count();
+    rpc_->metrics.RecordRpc(method_, latency_us, ok_);
+    if (rpc_->tracer) {
+      if (!ok_ && error_.ok()) error_ = Status::Error("RPC did not complete");
+      rpc_->tracer->OnRpcEnd(method_, handles_, error_);
+    }
+  }
+
+  // Called once the reply has been read, with its status.
+  void Succeeded(const apache::hive::service::cli::thrift::TStatus& reply_status) {
+    ok_ = true;
+    if (IsServerError(reply_status)) {
+      rpc_->metrics.RecordServerError(method_);
+      error_ = TStatusToStatus(reply_status);
+    }
+  }
+
+  // Returns an error with 'msg', which is also reported to the tracer.
+  Status Failed(const char* msg) {
+    error_ = Status::Error(msg);
+    return error_;
+  }
+
+ private:
+  ThriftRPC* rpc_;
+  RpcMethod method_;
+  std::chrono::steady_clock::time_point start_;
+  bool ok_;
+  // OK unless Failed was called or the reply was a server error.
+  Status error_;
+  TraceHandles handles_;
 };
 
 const std::string OperationStateToString(const Operation::State& state);
@@ -53,7 +293,105 @@ apache::hive::service::cli::thrift::TProtocolVersion::type
 Operation::State TOperationStateToOperationState(
     const apache::hive::service::cli::thrift::TOperationState::type& tstate);
 
-Status TStatusToStatus(const apache::hive::service::cli::thrift::TStatus& tstatus);
+// Issues a FetchResults RPC and deserializes the response into 'out'. Unlike the
+// generated ImpalaHiveServer2ServiceClient::FetchResults, STRING and BINARY columns are
+// read into 'string_columns' instead of a std::string per value. Throws a TException
+// if the RPC fails.
+void FetchResults(impala::ImpalaHiveServer2ServiceClient* client,
+    const apache::hive::service::cli::thrift::TFetchResultsReq& req,
+    apache::hive::service::cli::thrift::TFetchResultsResp* resp,
+    std::vector<std::unique_ptr<StringColumnData>>* string_columns);
+
+// Deserializes a FetchResults reply from 'iprot' in the same way as FetchResults.
+// Throws a TException if the reply is an exception or can't be deserialized.
+void RecvFetchResults(apache::thrift::protocol::TProtocol* iprot,
+    apache::hive::service::cli::thrift::TFetchResultsResp* resp,
+    std::vector<std::unique_ptr<StringColumnData>>* string_columns);
+
+// Creates a TBinaryProtocol or TCompactProtocol over 'transport'.
+boost::shared_ptr<apache::thrift::protocol::TProtocol> NewProtocol(
+    WireProtocol protocol,
+    const boost::shared_ptr<apache::thrift::transport::TTransport>& transport);
+
+// Sets the socket option 'option', SO_RCVBUF or SO_SNDBUF, to 'size' if it's positive.
+Status SetSocketBufferSize(int fd, int option, int size);
+
+// Passes all calls through to an underlying transport, and records the bytes of each
+// message sent and received to a capture file, in the format described in capture.h.
+// Sent messages end at flush() and received messages at readEnd(), which the generated
+// clients call once per message. See Service::StartCapture.
+class CaptureTransport
+  : public apache::thrift::transport::TVirtualTransport<CaptureTransport> {
+ public:
+  // Creates the file at 'path', overwriting any existing file, and writes the header.
+  static Status Create(const boost::shared_ptr<apache::thrift::transport::TTransport>&
+      transport, WireProtocol protocol, const std::string& path,
+      boost::shared_ptr<CaptureTransport>* out);
+
+  bool isOpen() { return transport_->isOpen(); }
+  bool peek() { return transport_->peek(); }
+  void open() { transport_->open(); }
+  void close() { transport_->close(); }
+
+  uint32_t read(uint8_t* buf, uint32_t len);
+  uint32_t readEnd();
+  void write(const uint8_t* buf, uint32_t len);
+  uint32_t writeEnd() { return transport_->writeEnd(); }
+  void flush();
+
+  // Closes the capture file. Returns an error if any write to it failed. Failures to
+  // write to the file don't fail the RPCs being captured.
+  Status Finish();
+
+ private:
+  CaptureTransport(const boost::shared_ptr<apache::thrift::transport::TTransport>&
+      transport);
+
+  // Appends a record for 'message' to the file and clears it.
+  void WriteRecord(uint8_t direction, std::string* message);
+
+  boost::shared_ptr<apache::thrift::transport::TTransport> transport_;
+  std::ofstream file_;
+
+  // The bytes of the messages currently being sent and received.
+  std::string send_buf_;
+  std::string recv_buf_;
+};
+
+// Passes all calls through to an underlying transport, and counts the bytes read and
+// written in a MetricsRecorder. Wraps the socket, below any buffering, so that it is
+// called once per read from or write to the socket rather than once per value.
+class CountingTransport
+  : public apache::thrift::transport::TVirtualTransport<CountingTransport> {
+ public:
+  // 'metrics' must outlive the transport.
+  CountingTransport(const boost::shared_ptr<apache::thrift::transport::TTransport>&
+      transport, MetricsRecorder* metrics)
+    : transport_(transport), metrics_(metrics) {}
+
+  bool isOpen() { return transport_->isOpen(); }
+  bool peek() { return transport_->peek(); }
+  void open() { transport_->open(); }
+  void close() { transport_->close(); }
+
+  uint32_t read(uint8_t* buf, uint32_t len) {
+    uint32_t bytes_read = transport_->read(buf, len);
+    metrics_->AddBytesRead(bytes_read);
+    return bytes_read;
+  }
+  uint32_t readEnd() { return transport_->readEnd(); }
+
+  void write(const uint8_t* buf, uint32_t len) {
+    transport_->write(buf, len);
+    metrics_->AddBytesWritten(len);
+  }
+  uint32_t writeEnd() { return transport_->writeEnd(); }
+  void flush() { transport_->flush(); }
+
+ private:
+  boost::shared_ptr<apache::thrift::transport::TTransport> transport_;
+  MetricsRecorder* metrics_;
+};
 
 // Converts a TTypeDesc to a ColumnType. Currently only primitive types are supported.
 // The converted type is returned as a pointer to allow for polymorphism with ColumnType
@@ -64,6 +402,11 @@ std::unique_ptr<ColumnType> TTypeDescToColumnType(
 ColumnType::TypeId TTypeIdToTypeId(
     const apache::hive::service::cli::thrift::TTypeId::type& type_id);
 
+// Converts the columns of 'schema' into 'column_descs', replacing its contents.
+void TTableSchemaToColumnDescs(
+    const apache::hive::service::cli::thrift::TTableSchema& schema,
+    std::vector<ColumnDesc>* column_descs);
+
 } // namespace hs2client
 
 #define TRY_RPC_OR_RETURN(rpc)                 \
@@ -75,6 +418,30 @@ ColumnType::TypeId TTypeIdToTypeId(
     }                                          \
   } while (0)
 
+// Like TRY_RPC_OR_RETURN, but holds 'thrift_rpc->lock' for the duration of 'rpc', which
+// must use 'thrift_rpc->client', and records it as an RPC of RpcMethod 'method' with an
+// RpcScope. 'session_handle' and 'operation_handle' are the handles the RPC is for, or
+// NULL, and are passed to the tracer. 'reply_status' is the TStatus of the reply that
+// 'rpc' reads. Any deferred RPCs are flushed first. Returns the error that broke the
+// connection, without issuing the RPC, if it is broken, including by that flush.
+#define TRY_LOCKED_RPC_OR_RETURN(thrift_rpc, method, session_handle,                 \
+    operation_handle, rpc, reply_status)                                             \
+  do {                                                                               \
+    std::lock_guard<std::mutex> rpc_lock((thrift_rpc)->lock);                        \
+    if (!(thrift_rpc)->broken.ok()) return (thrift_rpc)->broken;                     \
+    if (!(thrift_rpc)->deferred_rpcs.empty()) {                                      \
+      FlushDeferredRpcs(&*(thrift_rpc));                                             \
+      if (!(thrift_rpc)->broken.ok()) return (thrift_rpc)->broken;                   \
+    }                                                                                \
+    RpcScope rpc_scope(&*(thrift_rpc), method, session_handle, operation_handle);    \
+    try {                                                                            \
+      (rpc);                                                                         \
+    } catch (apache::thrift::TException& tx) {                                       \
+      return rpc_scope.Failed(tx.what());                                            \
+    }                                                                                \
+    rpc_scope.Succeeded(reply_status);                                               \
+  } while (0)
+
 #define RETURN_NOT_OK(tstatus)                                              \
   do {                                                                      \
     if (tstatus.statusCode != hs2::TStatusCode::SUCCESS_STATUS &&           \
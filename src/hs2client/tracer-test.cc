@@ -0,0 +1,213 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hs2client/tracer.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "hs2client/mock-server.h"
+#include "hs2client/operation.h"
+#include "hs2client/service.h"
+#include "hs2client/session.h"
+#include "hs2client/test-util.h"
+
+using namespace hs2client;
+using namespace std;
+
+// Records each callback as a string, eg. "start FetchResults".
+class RecordingTracer : public Tracer {
+ public:
+  void OnRpcStart(RpcMethod method, const TraceHandles& handles) {
+    Record(string("start ") + RpcMethodToString(method), handles);
+  }
+
+  void OnRpcEnd(RpcMethod method, const TraceHandles& handles, const Status& status) {
+    Record(string(status.ok() ? "end " : "failed ") + RpcMethodToString(method),
+        handles);
+  }
+
+  void OnMilestone(OperationMilestone milestone, const TraceHandles& handles) {
+    Record(OperationMilestoneToString(milestone), handles);
+  }
+
+  vector<string> events() {
+    lock_guard<mutex> l(lock_);
+    return events_;
+  }
+
+  vector<TraceHandles> handles() {
+    lock_guard<mutex> l(lock_);
+    return handles_;
+  }
+
+  void Clear() {
+    lock_guard<mutex> l(lock_);
+    events_.clear();
+    handles_.clear();
+  }
+
+ private:
+  void Record(const string& event, const TraceHandles& handles) {
+    lock_guard<mutex> l(lock_);
+    events_.push_back(event);
+    handles_.push_back(handles);
+  }
+
+  mutex lock_;
+  vector<string> events_;
+  vector<TraceHandles> handles_;
+};
+
+// The tests open their own sessions, so that the tracer sees the OpenSession RPC.
+class TracerTest : public MockServerTestBase {
+ protected:
+  virtual void SetUp() {
+    spec_.num_rows = 2500;
+    spec_.columns.emplace_back(ColumnType::TypeId::INT);
+    ASSERT_NO_FATAL_FAILURE(StartServer());
+    ASSERT_OK(Service::Connect("localhost", server_->port(), 0,
+        ProtocolVersion::HS2CLIENT_PROTOCOL_V7, &service_));
+    tracer_.reset(new RecordingTracer());
+    service_->SetTracer(tracer_);
+  }
+
+  virtual void TearDown() {
+    if (service_) EXPECT_OK(service_->Close());
+    MockServerTestBase::TearDown();
+  }
+
+  unique_ptr<Service> service_;
+  shared_ptr<RecordingTracer> tracer_;
+};
+
+TEST_F(TracerTest, TestOperationLifecycle) {
+  unique_ptr<Session> session;
+  EXPECT_OK(service_->OpenSession("user", HS2ClientConfig(), &session));
+  unique_ptr<Operation> op;
+  EXPECT_OK(session->ExecuteStatement("select * from mock", &op));
+  Operation::State state;
+  EXPECT_OK(op->GetState(&state));
+  EXPECT_EQ(state, Operation::State::FINISHED);
+  EXPECT_OK(op->GetState(&state));
+  bool has_more_rows = true;
+  while (has_more_rows) {
+    unique_ptr<ColumnarRowSet> results;
+    EXPECT_OK(op->Fetch(1000, FetchOrientation::NEXT, &results, &has_more_rows));
+  }
+  EXPECT_OK(op->Close());
+  EXPECT_OK(session->Close());
+
+  // Milestones are only reported the first time they're reached.
+  vector<string> expected = {
+    "start OpenSession", "end OpenSession",
+    "start ExecuteStatement", "end ExecuteStatement", "StatementSubmitted",
+    "start GetOperationStatus", "end GetOperationStatus", "Finished",
+    "start GetOperationStatus", "end GetOperationStatus",
+    "start FetchResults", "end FetchResults", "FirstBatch",
+    "start FetchResults", "end FetchResults",
+    "start FetchResults", "end FetchResults", "LastBatch",
+    "start CloseOperation", "end CloseOperation", "Closed",
+    "start CloseSession", "end CloseSession",
+  };
+  EXPECT_EQ(tracer_->events(), expected);
+
+  // The session is unknown until OpenSession returns, and the operation until
+  // ExecuteStatement returns.
+  vector<TraceHandles> handles = tracer_->handles();
+  ASSERT_EQ(handles.size(), expected.size());
+  EXPECT_EQ(handles[1].session_id, "");
+  EXPECT_EQ(handles[3].operation_id, "");
+  const string& session_id = handles[2].session_id;
+  const string& operation_id = handles[4].operation_id;
+  EXPECT_EQ(session_id.size(), 32);
+  EXPECT_EQ(operation_id.size(), 32);
+  EXPECT_NE(session_id, operation_id);
+  for (size_t i = 4; i < handles.size() - 2; ++i) {
+    EXPECT_EQ(handles[i].session_id, session_id);
+    EXPECT_EQ(handles[i].operation_id, operation_id);
+  }
+  EXPECT_EQ(handles.back().session_id, session_id);
+  EXPECT_EQ(handles.back().operation_id, "");
+}
+
+TEST_F(TracerTest, TestSingleBatch) {
+  unique_ptr<Session> session;
+  EXPECT_OK(service_->OpenSession("user", HS2ClientConfig(), &session));
+  unique_ptr<Operation> op;
+  EXPECT_OK(session->ExecuteStatement("select * from mock", &op));
+  tracer_->Clear();
+
+  // The first batch can also be the last.
+  unique_ptr<ColumnarRowSet> results;
+  bool has_more_rows;
+  EXPECT_OK(op->Fetch(10000, FetchOrientation::NEXT, &results, &has_more_rows));
+  EXPECT_FALSE(has_more_rows);
+  vector<string> expected = {
+    "start FetchResults", "end FetchResults", "FirstBatch", "LastBatch",
+  };
+  EXPECT_EQ(tracer_->events(), expected);
+
+  EXPECT_OK(op->Close());
+  EXPECT_OK(session->Close());
+}
+
+TEST_F(TracerTest, TestWaitForCompletion) {
+  unique_ptr<Session> session;
+  EXPECT_OK(service_->OpenSession("user", HS2ClientConfig(), &session));
+  unique_ptr<Operation> op;
+  EXPECT_OK(session->ExecuteStatement("select * from mock", &op));
+  tracer_->Clear();
+
+  // The fetch that WaitForCompletion waits on finishes the operation before it returns
+  // the first batch.
+  EXPECT_OK(op->WaitForCompletion());
+  vector<string> expected = {
+    "start FetchResults", "end FetchResults", "Finished", "FirstBatch",
+  };
+  EXPECT_EQ(tracer_->events(), expected);
+
+  // Taking the batch reports nothing more.
+  unique_ptr<ColumnarRowSet> results;
+  bool has_more_rows;
+  EXPECT_OK(op->Fetch(&results, &has_more_rows));
+  EXPECT_TRUE(has_more_rows);
+  EXPECT_EQ(tracer_->events(), expected);
+
+  EXPECT_OK(op->Close());
+  EXPECT_OK(session->Close());
+}
+
+TEST_F(TracerTest, TestFailedRpc) {
+  EXPECT_OK(service_->Ping());
+  EXPECT_OK(service_->Close());
+  tracer_->Clear();
+
+  EXPECT_ERROR(service_->Ping());
+  vector<string> expected = {"start GetInfo", "failed GetInfo"};
+  EXPECT_EQ(tracer_->events(), expected);
+
+  // No more callbacks once the tracer is removed.
+  service_->SetTracer(shared_ptr<Tracer>());
+  EXPECT_ERROR(service_->Ping());
+  EXPECT_EQ(tracer_->events(), expected);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,30 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hs2client/tracer.h"
+
+namespace hs2client {
+
+const char* OperationMilestoneToString(OperationMilestone milestone) {
+  switch (milestone) {
+    case OperationMilestone::STATEMENT_SUBMITTED: return "StatementSubmitted";
+    case OperationMilestone::FINISHED: return "Finished";
+    case OperationMilestone::FIRST_BATCH: return "FirstBatch";
+    case OperationMilestone::LAST_BATCH: return "LastBatch";
+    case OperationMilestone::CLOSED: return "Closed";
+  }
+  return "Unknown";
+}
+
+} // namespace hs2client
@@ -0,0 +1,87 @@
+// Copyright 2016 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HS2CLIENT_TRACER_H
+#define HS2CLIENT_TRACER_H
+
+#include <string>
+
+#include "hs2client/metrics.h"
+#include "hs2client/status.h"
+
+namespace hs2client {
+
+// Points in the lifetime of an operation that are reported to a Tracer. Each is
+// reported at most once per operation.
+enum class OperationMilestone {
+  // ExecuteStatement returned a handle for the operation.
+  STATEMENT_SUBMITTED,
+  // GetState, or HasResultSet, first saw the operation in the FINISHED state, or
+  // WaitForCompletion or Session::ExecuteAndFetch first fetched results, in which case
+  // FIRST_BATCH is reported just after this.
+  FINISHED,
+  // The first Fetch that returned a batch of results, ie. with rows or with
+  // has_more_rows false.
+  FIRST_BATCH,
+  // The Fetch that returned the last batch of results, ie. with has_more_rows false.
+  // May be the same Fetch as FIRST_BATCH.
+  LAST_BATCH,
+  // Close closed the operation.
+  CLOSED,
+};
+
+// Returns the name of 'milestone', eg. "FirstBatch".
+const char* OperationMilestoneToString(OperationMilestone milestone);
+
+// Identifies the session and operation that a trace event belongs to, by the GUIDs of
+// their HiveServer2 handles as hex strings, which is how servers usually log them.
+// Either is empty if the event doesn't belong to one, eg. the session for a
+// Service::Ping, or the operation for an OpenSession or ExecuteStatement RPC, whose
+// reply creates the handle.
+struct TraceHandles {
+  std::string session_id;
+  std::string operation_id;
+};
+
+// Callbacks for the RPCs issued through a Service and for the milestones of its
+// operations, see Service::SetTracer. Used to export spans to a tracing system, eg. one
+// span per operation from STATEMENT_SUBMITTED to CLOSED, with the time from FINISHED to
+// FIRST_BATCH as the time to the first row and from FIRST_BATCH to LAST_BATCH as the
+// transfer time.
+//
+// The callbacks are made synchronously by the thread issuing the RPC, which may be the
+// background thread of Operation::StartPrefetch, so they may be called concurrently
+// and must be thread-safe. OnRpcStart and OnRpcEnd are called while the connection is
+// locked, so they should be cheap, and none of the callbacks may issue RPCs through the
+// same Service. The default implementations do nothing.
+class Tracer {
+ public:
+  virtual ~Tracer() {}
+
+  // Called before the request of an RPC is sent.
+  virtual void OnRpcStart(RpcMethod method, const TraceHandles& handles) {}
+
+  // Called once the reply of an RPC has been read, with an OK status or the error that
+  // the server returned in the reply, or once it failed, eg. because the connection was
+  // lost, with the error.
+  virtual void OnRpcEnd(RpcMethod method, const TraceHandles& handles,
+      const Status& status) {}
+
+  // Called once the operation in 'handles' has reached 'milestone'.
+  virtual void OnMilestone(OperationMilestone milestone, const TraceHandles& handles) {}
+};
+
+} // namespace hs2client
+
+#endif // HS2CLIENT_TRACER_H
@@ -19,6 +19,13 @@
 
 namespace hs2client {
 
+// The unscaled value of a DECIMAL, which has a precision of at most 38 digits. A
+// compiler extension, supported by GCC and Clang on 64-bit platforms.
+typedef __int128 int128_t;
+
+// The maximum precision of a DECIMAL.
+const int MAX_DECIMAL_PRECISION = 38;
+
 // Represents a column's type.
 //
 // For now only PrimitiveType is implemented, as thase are the only types Impala will